@@ -75,6 +75,36 @@ static music_handler_t *music_handlers = NULL;
 
 static snd_stream_t *bgmstream = NULL;
 
+/* BGM_UpdateStream may run on the mixer thread, which can't print or close
+ * the stream itself: it parks the stream and leaves the error for
+ * BGM_Update to report on the main thread. */
+typedef enum
+{
+	BGM_STREAM_OK,
+	BGM_STREAM_END,
+	BGM_STREAM_EOFLOOP,
+	BGM_STREAM_SEEKERROR,
+	BGM_STREAM_READERROR
+} bgmstreamerror_t;
+
+static SDL_atomic_t bgm_streamerror;
+static int	bgm_streamres;
+
+/*
+===============
+BGM_SetStream
+
+Publishes a newly opened stream to the mixer
+===============
+*/
+static void BGM_SetStream (snd_stream_t *stream)
+{
+	S_LockMixer ();
+	bgmstream = stream;
+	SDL_AtomicSet (&bgm_streamerror, BGM_STREAM_OK);
+	S_UnlockMixer ();
+}
+
 static void BGM_Play_f (void)
 {
 	if (Cmd_Argc() == 2) {
@@ -114,7 +144,9 @@ static void BGM_Loop_f (void)
 		else if (q_strcasecmp(Cmd_Argv(1),"toggle") == 0)
 			bgmloop = !bgmloop;
 
+		S_LockMixer ();
 		if (bgmstream) bgmstream->loop = bgmloop;
+		S_UnlockMixer ();
 	}
 
 	if (bgmloop)
@@ -134,7 +166,9 @@ static void BGM_Jump_f (void)
 		Con_Printf ("music_jump <ordernum>\n");
 	}
 	else if (bgmstream) {
+		S_LockMixer ();
 		S_CodecJumpToOrder(bgmstream, atoi(Cmd_Argv(1)));
+		S_UnlockMixer ();
 	}
 }
 
@@ -223,7 +257,7 @@ static void BGM_Play_noext (const char *filename, unsigned int allowed_types)
 		/* not supported in quake */
 			break;
 		case BGM_STREAMER:
-			bgmstream = S_CodecOpenStreamType(tmp, handler->type, bgmloop);
+			BGM_SetStream (S_CodecOpenStreamType(tmp, handler->type, bgmloop));
 			if (bgmstream)
 				return;		/* success */
 			break;
@@ -281,7 +315,7 @@ void BGM_Play (const char *filename)
 	/* not supported in quake */
 		break;
 	case BGM_STREAMER:
-		bgmstream = S_CodecOpenStreamType(tmp, handler->type, bgmloop);
+		BGM_SetStream (S_CodecOpenStreamType(tmp, handler->type, bgmloop));
 		if (bgmstream)
 			return;		/* success */
 		break;
@@ -357,7 +391,7 @@ void BGM_PlayCDtrack (byte track, qboolean looping)
 	{
 		q_snprintf(tmp, sizeof(tmp), "%s/track%02d.%s",
 				MUSIC_DIRNAME, (int)track, ext);
-		bgmstream = S_CodecOpenStreamType(tmp, type, bgmloop);
+		BGM_SetStream (S_CodecOpenStreamType(tmp, type, bgmloop));
 		if (! bgmstream)
 			Con_Printf("Couldn't handle music file %s\n", tmp);
 	}
@@ -367,10 +401,12 @@ void BGM_Stop (void)
 {
 	if (bgmstream)
 	{
+		S_LockMixer ();
 		bgmstream->status = STREAM_NONE;
 		S_CodecCloseStream(bgmstream);
 		bgmstream = NULL;
 		s_rawend = 0;
+		S_UnlockMixer ();
 	}
 }
 
@@ -378,11 +414,13 @@ void BGM_Pause (void)
 {
 	if (bgmstream)
 	{
+		S_LockMixer ();
 		if (bgmstream->status == STREAM_PLAY)
 		{
 			bgmstream->status = STREAM_PAUSE;
 			bgmstream->volume = 0.f;
 		}
+		S_UnlockMixer ();
 	}
 }
 
@@ -390,12 +428,36 @@ void BGM_Resume (void)
 {
 	if (bgmstream)
 	{
+		S_LockMixer ();
 		if (bgmstream->status == STREAM_PAUSE)
 			bgmstream->status = STREAM_PLAY;
+		S_UnlockMixer ();
 	}
 }
 
-static void BGM_UpdateStream (void)
+/*
+===============
+BGM_StreamError
+
+Stops decoding until the main thread gets to close the stream
+===============
+*/
+static void BGM_StreamError (bgmstreamerror_t error, int res)
+{
+	bgmstream->status = STREAM_PAUSE;
+	bgm_streamres = res;
+	SDL_AtomicSet (&bgm_streamerror, error);
+}
+
+/*
+===============
+BGM_UpdateStream
+
+Decodes music into the raw sample buffer. Called from the mixer thread
+when there is one, with the mixer locked.
+===============
+*/
+void BGM_UpdateStream (void)
 {
 	qboolean did_rewind = false;
 	int	res;	/* Number of bytes read. */
@@ -404,7 +466,10 @@ static void BGM_UpdateStream (void)
 	int	fileBytes;
 	byte	raw[16384];
 
-	if (bgmstream->status != STREAM_PLAY)
+	if (!bgmstream || bgmstream->status != STREAM_PLAY)
+		return;
+
+	if (SDL_AtomicGet (&bgm_streamerror) != BGM_STREAM_OK)
 		return;
 
 	/* don't bother playing anything if musicvolume is 0 */
@@ -462,30 +527,27 @@ static void BGM_UpdateStream (void)
 			{
 				if (did_rewind)
 				{
-					Con_Printf("Stream keeps returning EOF.\n");
-					BGM_Stop();
+					BGM_StreamError (BGM_STREAM_EOFLOOP, 0);
 					return;
 				}
 
 				res = S_CodecRewindStream(bgmstream);
 				if (res != 0)
 				{
-					Con_Printf("Stream seek error (%i), stopping.\n", res);
-					BGM_Stop();
+					BGM_StreamError (BGM_STREAM_SEEKERROR, res);
 					return;
 				}
 				did_rewind = true;
 			}
 			else
 			{
-				BGM_Stop();
+				BGM_StreamError (BGM_STREAM_END, 0);
 				return;
 			}
 		}
 		else	/* res < 0: some read error */
 		{
-			Con_Printf("Stream read error (%i), stopping.\n", res);
-			BGM_Stop();
+			BGM_StreamError (BGM_STREAM_READERROR, res);
 			return;
 		}
 	}
@@ -501,7 +563,25 @@ void BGM_Update (void)
 			Cvar_SetQuick (&bgmvolume, "1");
 		old_volume = bgmvolume.value;
 	}
-	if (bgmstream)
+	if (bgmstream && !S_MixerThreaded ())
 		BGM_UpdateStream ();
+
+	switch (SDL_AtomicSet (&bgm_streamerror, BGM_STREAM_OK))
+	{
+	case BGM_STREAM_OK:
+		return;
+	case BGM_STREAM_END:
+		break;
+	case BGM_STREAM_EOFLOOP:
+		Con_Printf("Stream keeps returning EOF.\n");
+		break;
+	case BGM_STREAM_SEEKERROR:
+		Con_Printf("Stream seek error (%i), stopping.\n", bgm_streamres);
+		break;
+	case BGM_STREAM_READERROR:
+		Con_Printf("Stream read error (%i), stopping.\n", bgm_streamres);
+		break;
+	}
+	BGM_Stop ();
 }
 
@@ -20,8 +20,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "quakedef.h"
+#include "miniz.h"
 
 static void CL_FinishTimeDemo (void);
+static void CL_FinishTimeDemoNoDraw (void);
+static void CL_DemoIndex_Shutdown (void);
+static void CL_DemoIndex_Start (const char *name);
+static void CL_DemoKeyframe_Capture (void);
 
 /*
 ==============================================================================
@@ -40,6 +45,62 @@ read from the demo file.
 static byte		*demo_head;
 static int		*demo_head_sizes;
 
+// Compressed demos
+//
+// A compressed demo holds the exact bytes of a regular demo (cd track line
+// included), split into chunks that are deflated independently:
+//
+//	header:		"IWDZ" version
+//	chunks:		rawsize compsize <compsize bytes of raw deflate data>
+//	table:		(rawsize compsize) for every chunk, numchunks "IWDT"
+//
+// The table lets readers locate any chunk without walking the file, but
+// it is only written when recording finishes; if it is missing (e.g. the
+// game crashed mid-recording) the chunk headers are walked instead.
+// Everything else reads demos through a demostream_t, which exposes
+// offsets into the uncompressed data, so that rewinding, seeking and
+// indexing work the same on both kinds of demos.
+
+#define DEMOZ_MAGIC			(('I'<<0)|('W'<<8)|('D'<<16)|('Z'<<24))
+#define DEMOZ_TABLEMAGIC	(('I'<<0)|('W'<<8)|('D'<<16)|('T'<<24))
+#define DEMOZ_VERSION		1
+#define DEMOZ_CHUNKSIZE		(128 * 1024)	// uncompressed bytes per chunk when recording
+#define DEMOZ_MAXCHUNKSIZE	(4 * 1024 * 1024)
+
+typedef struct
+{
+	qfileofs_t		rawofs;			// offset in the uncompressed data
+	qfileofs_t		fileofs;		// offset of the compressed data, relative to the container
+	int				rawsize;
+	int				compsize;
+} demochunk_t;
+
+typedef struct
+{
+	FILE				*file;
+	qfileofs_t			base;		// file offset of the demo (for demos in pak files)
+	qfileofs_t			size;		// uncompressed size
+	qfileofs_t			pos;		// uncompressed read position (compressed demos only)
+	demochunk_t			*chunks;	// NULL for regular demos
+	int					curchunk;	// chunk currently held in raw, -1 if none
+	byte				*raw;
+	byte				*comp;
+	tinfl_decompressor	inflator;
+} demostream_t;
+
+typedef struct
+{
+	FILE			*file;
+	byte			*raw;			// pending chunk data, NULL when not compressing
+	int				rawsize;
+	int				*table;			// rawsize/compsize pairs of the chunks written so far
+} demowriter_t;
+
+cvar_t cl_democompress = {"cl_democompress", "0", CVAR_ARCHIVE};
+
+static demostream_t	demo_stream;	// demo being played back
+static demowriter_t	demo_writer;	// demo being recorded
+
 // Demo rewinding
 typedef struct
 {
@@ -80,6 +141,518 @@ static struct
 	}				prev;
 }					demo_rewind;
 
+// Demo seeking
+//
+// When playback starts a background thread scans the whole file (or loads
+// a cached copy of the result from a sidecar file) and records the offset
+// and time of every message. Map changes split the demo into segments.
+// As the demo is played back (or fast-forwarded by demoseek) we also take
+// periodic snapshots of the client state, so that later seeks only have to
+// parse the messages between the closest keyframe and the target time.
+
+#define DEMOINDEX_MAGIC		(('I'<<0)|('W'<<8)|('D'<<16)|('X'<<24))
+#define DEMOINDEX_VERSION	1
+#define DEMOINDEX_CRCSIZE	(64 * 1024)
+
+typedef struct
+{
+	unsigned int	fileofs;		// relative to cls.demofilestart
+	float			time;			// demo time, accumulated across map changes
+} demoindexframe_t;
+
+typedef struct
+{
+	unsigned int	firstframe;		// first message of the map (serverinfo)
+	float			starttime;		// demo time at the start of the map
+	float			servertime;		// server time of the first svc_time in the map
+} demoindexsegment_t;
+
+typedef struct
+{
+	char			name[MAX_SCOREBOARDNAME];
+	float			entertime;
+	int				frags;
+	int				colors;
+} demoscore_t;
+
+typedef struct
+{
+	unsigned int	fileofs;		// offset of the message following the keyframe
+	int				segment;
+	float			time;
+
+	int				stats[MAX_CL_STATS];
+	float			statsf[MAX_CL_STATS];
+	int				items;
+	float			item_gettime[32];
+	float			faceanimtime;
+	cshift_t		cshifts[NUM_CSHIFTS];
+	vec3_t			mviewangles[2];
+	vec3_t			mvelocity[2];
+	vec3_t			punchangle;
+	float			idealpitch;
+	float			viewheight;
+	qboolean		paused;
+	qboolean		onground;
+	qboolean		inwater;
+	int				intermission;
+	int				completed_time;
+	double			mtime[2];
+	int				viewentity;
+	int				cdtrack, looptrack;
+	qboolean		forceunderwater;
+
+	cshift_t		cshift_empty;
+	float			fog[4];			// density, red, green, blue
+	lightstyle_t	lightstyles[MAX_LIGHTSTYLES];
+
+	int				num_entities;
+	entity_t		*entities;		// [num_entities]
+	demoscore_t		*scores;		// [cl.maxclients]
+} demokeyframe_t;
+
+cvar_t cl_demokeyframes = {"cl_demokeyframes", "30", CVAR_ARCHIVE}; // seconds between keyframes (0 = off)
+
+static struct
+{
+	SDL_Thread			*thread;
+	SDL_atomic_t		done;
+	SDL_atomic_t		cancel;
+	qboolean			ready;
+	qboolean			fromcache;
+
+	// written by the indexing thread, owned by the main thread once it's done
+	demostream_t		stream;
+	qfileofs_t			start;
+	qfileofs_t			end;
+	unsigned short		crc;
+	demoindexframe_t	*frames;
+	demoindexsegment_t	*segments;
+
+	char				cachepath[MAX_OSPATH];
+	demokeyframe_t		*keyframes;
+}					demo_index;
+
+/*
+==============================================================================
+
+DEMO STREAMS
+
+==============================================================================
+*/
+
+/*
+====================
+CL_DemoStream_AddChunk
+====================
+*/
+static qboolean CL_DemoStream_AddChunk (demostream_t *s, qfileofs_t fileofs, int rawsize, int compsize)
+{
+	demochunk_t	chunk;
+
+	if (rawsize <= 0 || rawsize > DEMOZ_MAXCHUNKSIZE || compsize <= 0 || compsize > DEMOZ_MAXCHUNKSIZE)
+		return false;
+
+	chunk.rawofs = s->size;
+	chunk.fileofs = fileofs;
+	chunk.rawsize = rawsize;
+	chunk.compsize = compsize;
+	VEC_PUSH (s->chunks, chunk);
+	s->size += rawsize;
+
+	return true;
+}
+
+/*
+====================
+CL_DemoStream_ReadTable
+
+Builds the chunk list from the table at the end of the file
+====================
+*/
+static qboolean CL_DemoStream_ReadTable (demostream_t *s, qfileofs_t filesize)
+{
+	int			trailer[2];
+	int			*table;
+	int			i, numchunks;
+	qfileofs_t	ofs, tableofs;
+	qboolean	ok;
+
+	if (filesize < 16 ||
+		Sys_fseek (s->file, s->base + filesize - sizeof (trailer), SEEK_SET) != 0 ||
+		fread (trailer, sizeof (trailer), 1, s->file) != 1)
+		return false;
+
+	numchunks = LittleLong (trailer[0]);
+	if (LittleLong (trailer[1]) != DEMOZ_TABLEMAGIC || numchunks <= 0 || numchunks > filesize / 16)
+		return false;
+
+	tableofs = filesize - sizeof (trailer) - (qfileofs_t) numchunks * 8;
+	if (tableofs < 8)
+		return false;
+
+	table = (int *) malloc (numchunks * 8);
+	if (!table)
+		return false;
+
+	ok = Sys_fseek (s->file, s->base + tableofs, SEEK_SET) == 0 && fread (table, 8, numchunks, s->file) == (size_t) numchunks;
+	for (i = 0, ofs = 8; ok && i < numchunks; i++)
+	{
+		ok = CL_DemoStream_AddChunk (s, ofs + 8, LittleLong (table[i*2]), LittleLong (table[i*2+1]));
+		ofs += 8 + LittleLong (table[i*2+1]);
+	}
+	free (table);
+
+	if (!ok || ofs != tableofs)
+	{
+		VEC_FREE (s->chunks);
+		s->size = 0;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+====================
+CL_DemoStream_WalkChunks
+
+Builds the chunk list from the chunk headers, for files without a table
+====================
+*/
+static void CL_DemoStream_WalkChunks (demostream_t *s, qfileofs_t filesize)
+{
+	int			header[2];
+	int			compsize;
+	qfileofs_t	ofs;
+
+	for (ofs = 8; ofs + 8 <= filesize; ofs += 8 + compsize)
+	{
+		if (Sys_fseek (s->file, s->base + ofs, SEEK_SET) != 0 || fread (header, sizeof (header), 1, s->file) != 1)
+			break;
+		compsize = LittleLong (header[1]);
+		// stop at a partially written chunk
+		if (ofs + 8 + compsize > filesize || !CL_DemoStream_AddChunk (s, ofs + 8, LittleLong (header[0]), compsize))
+			break;
+	}
+}
+
+/*
+====================
+CL_DemoStream_Open
+
+Takes ownership of f, positioned at the start of the demo.
+Regular demos are read straight from the file.
+====================
+*/
+static qboolean CL_DemoStream_Open (demostream_t *s, FILE *f, qfileofs_t filesize)
+{
+	int		header[2];
+	int		i, count, maxraw, maxcomp;
+
+	memset (s, 0, sizeof (*s));
+	s->file = f;
+	s->base = Sys_ftell (f);
+	s->size = filesize;
+	s->curchunk = -1;
+
+	if (filesize < 8 || fread (header, sizeof (header), 1, f) != 1 || LittleLong (header[0]) != DEMOZ_MAGIC)
+		return Sys_fseek (f, s->base, SEEK_SET) == 0;
+
+	if (LittleLong (header[1]) != DEMOZ_VERSION)
+		return false;
+
+	s->size = 0;
+	if (!CL_DemoStream_ReadTable (s, filesize))
+		CL_DemoStream_WalkChunks (s, filesize);
+	if (!s->chunks)
+		return false;
+
+	maxraw = maxcomp = 0;
+	for (i = 0, count = VEC_SIZE (s->chunks); i < count; i++)
+	{
+		maxraw = q_max (maxraw, s->chunks[i].rawsize);
+		maxcomp = q_max (maxcomp, s->chunks[i].compsize);
+	}
+	s->raw = (byte *) malloc (maxraw);
+	s->comp = (byte *) malloc (maxcomp);
+
+	return s->raw && s->comp;
+}
+
+/*
+====================
+CL_DemoStream_Close
+====================
+*/
+static void CL_DemoStream_Close (demostream_t *s)
+{
+	if (s->file)
+		fclose (s->file);
+	VEC_FREE (s->chunks);
+	free (s->raw);
+	free (s->comp);
+	s->file = NULL;
+	s->raw = s->comp = NULL;
+	s->curchunk = -1;
+	s->size = s->pos = 0;
+}
+
+/*
+====================
+CL_DemoStream_LoadChunk
+
+Decompresses the chunk containing the current read position
+====================
+*/
+static demochunk_t *CL_DemoStream_LoadChunk (demostream_t *s)
+{
+	demochunk_t	*c;
+	int			lo, hi, mid;
+	size_t		insize, outsize;
+
+	if (s->curchunk >= 0)
+	{
+		c = &s->chunks[s->curchunk];
+		if (s->pos >= c->rawofs && s->pos < c->rawofs + c->rawsize)
+			return c;
+	}
+
+	lo = 0;
+	hi = VEC_SIZE (s->chunks) - 1;
+	while (lo < hi)
+	{
+		mid = (lo + hi + 1) / 2;
+		if (s->chunks[mid].rawofs <= s->pos)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	c = &s->chunks[lo];
+
+	s->curchunk = -1;
+	if (Sys_fseek (s->file, s->base + c->fileofs, SEEK_SET) != 0 || fread (s->comp, c->compsize, 1, s->file) != 1)
+		return NULL;
+
+	tinfl_init (&s->inflator);
+	insize = c->compsize;
+	outsize = c->rawsize;
+	if (tinfl_decompress (&s->inflator, s->comp, &insize, s->raw, s->raw, &outsize,
+			TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF) != TINFL_STATUS_DONE || outsize != (size_t) c->rawsize)
+		return NULL;
+
+	s->curchunk = lo;
+	return c;
+}
+
+/*
+====================
+CL_DemoStream_Read
+
+Returns the number of bytes read
+====================
+*/
+static size_t CL_DemoStream_Read (demostream_t *s, void *buf, size_t size)
+{
+	demochunk_t	*c;
+	size_t		done, ofs, n;
+
+	if (!s->chunks)
+		return fread (buf, 1, size, s->file);
+
+	for (done = 0; done < size && s->pos < s->size; done += n)
+	{
+		c = CL_DemoStream_LoadChunk (s);
+		if (!c)
+			break;
+		ofs = (size_t) (s->pos - c->rawofs);
+		n = q_min (size - done, c->rawsize - ofs);
+		memcpy ((byte *) buf + done, s->raw + ofs, n);
+		s->pos += n;
+	}
+
+	return done;
+}
+
+/*
+====================
+CL_DemoStream_Tell
+
+Offsets of compressed demos are into the uncompressed data,
+but still relative to the start of the file like Sys_ftell
+====================
+*/
+static qfileofs_t CL_DemoStream_Tell (demostream_t *s)
+{
+	if (!s->chunks)
+		return Sys_ftell (s->file);
+	return s->base + s->pos;
+}
+
+/*
+====================
+CL_DemoStream_Seek
+====================
+*/
+static int CL_DemoStream_Seek (demostream_t *s, qfileofs_t ofs)
+{
+	if (!s->chunks)
+		return Sys_fseek (s->file, ofs, SEEK_SET);
+	if (ofs < s->base || ofs > s->base + s->size)
+		return -1;
+	s->pos = ofs - s->base;
+	return 0;
+}
+
+/*
+====================
+CL_DemoStream_ReadTrack
+
+Reads the cd track line at the start of the demo
+====================
+*/
+static qboolean CL_DemoStream_ReadTrack (demostream_t *s, int *track)
+{
+	char	line[32];
+	size_t	i;
+
+	for (i = 0; i < sizeof (line) - 1; i++)
+	{
+		if (CL_DemoStream_Read (s, &line[i], 1) != 1)
+			return false;
+		if (line[i] == '\n')
+		{
+			line[i] = '\0';
+			return sscanf (line, "%i", track) == 1;
+		}
+	}
+
+	return false;
+}
+
+/*
+====================
+CL_DemoWriter_Begin
+
+Takes ownership of f
+====================
+*/
+static void CL_DemoWriter_Begin (demowriter_t *w, FILE *f, qboolean compress)
+{
+	int		header[2];
+
+	memset (w, 0, sizeof (*w));
+	w->file = f;
+	if (!compress)
+		return;
+
+	w->raw = (byte *) malloc (DEMOZ_CHUNKSIZE);
+	if (!w->raw)
+		return;	// fall back to a regular demo
+
+	header[0] = LittleLong (DEMOZ_MAGIC);
+	header[1] = LittleLong (DEMOZ_VERSION);
+	fwrite (header, sizeof (header), 1, f);
+}
+
+/*
+====================
+CL_DemoWriter_FlushChunk
+====================
+*/
+static qboolean CL_DemoWriter_FlushChunk (demowriter_t *w)
+{
+	byte		*comp;
+	size_t		compsize;
+	int			header[2];
+	qboolean	ok;
+
+	if (!w->raw || !w->rawsize)
+		return true;
+
+	comp = Image_Deflate (w->raw, w->rawsize, &compsize);
+	if (!comp)
+	{
+		w->rawsize = 0;	// drop the chunk so the writer never gets stuck on a full buffer
+		return false;
+	}
+
+	header[0] = LittleLong (w->rawsize);
+	header[1] = LittleLong ((int) compsize);
+	ok = fwrite (header, sizeof (header), 1, w->file) == 1 && fwrite (comp, compsize, 1, w->file) == 1;
+	free (comp);
+	fflush (w->file);
+
+	VEC_PUSH (w->table, w->rawsize);
+	VEC_PUSH (w->table, (int) compsize);
+	w->rawsize = 0;
+
+	return ok;
+}
+
+/*
+====================
+CL_DemoWriter_Write
+====================
+*/
+static qboolean CL_DemoWriter_Write (demowriter_t *w, const void *data, size_t size)
+{
+	const byte	*p = (const byte *) data;
+	size_t		n;
+
+	if (!w->raw)
+		return fwrite (data, size, 1, w->file) == 1;
+
+	while (size > 0)
+	{
+		n = q_min (size, (size_t) (DEMOZ_CHUNKSIZE - w->rawsize));
+		memcpy (w->raw + w->rawsize, p, n);
+		w->rawsize += n;
+		p += n;
+		size -= n;
+		if (w->rawsize == DEMOZ_CHUNKSIZE && !CL_DemoWriter_FlushChunk (w))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+====================
+CL_DemoWriter_End
+
+Flushes the last chunk, writes the chunk table and closes the file
+====================
+*/
+static qboolean CL_DemoWriter_End (demowriter_t *w)
+{
+	int			trailer[2];
+	size_t		i, count;
+	qboolean	ok = true;
+
+	if (w->raw)
+	{
+		ok = CL_DemoWriter_FlushChunk (w);
+		count = VEC_SIZE (w->table);
+		for (i = 0; i < count; i++)
+			w->table[i] = LittleLong (w->table[i]);
+		if (count && fwrite (w->table, sizeof (w->table[0]), count, w->file) != count)
+			ok = false;
+		trailer[0] = LittleLong ((int) (count / 2));
+		trailer[1] = LittleLong (DEMOZ_TABLEMAGIC);
+		if (fwrite (trailer, sizeof (trailer), 1, w->file) != 1)
+			ok = false;
+	}
+
+	if (fclose (w->file) != 0)
+		ok = false;
+	free (w->raw);
+	VEC_FREE (w->table);
+	memset (w, 0, sizeof (*w));
+
+	return ok;
+}
+
 /*
 ==============
 CL_ClearSignons
@@ -104,8 +677,11 @@ void CL_StopPlayback (void)
 	if (!cls.demoplayback)
 		return;
 
-	fclose (cls.demofile);
+	CL_DemoIndex_Shutdown ();
+
+	CL_DemoStream_Close (&demo_stream);
 	cls.demoplayback = false;
+	cls.demoseeking = false;
 	cls.demopaused = false;
 	cls.demospeed = 1.f;
 	cls.demofile = NULL;
@@ -121,6 +697,8 @@ void CL_StopPlayback (void)
 
 	if (cls.timedemo)
 		CL_FinishTimeDemo ();
+	if (cls.timedemo_nodraw)
+		CL_FinishTimeDemoNoDraw ();
 }
 
 /*
@@ -132,19 +710,34 @@ Dumps the current net message, prefixed by the length and view angles
 */
 static void CL_WriteDemoMessage (void)
 {
-	int	len;
-	int	i;
-	float	f;
+	int			len;
+	int			i;
+	float		f;
+	qboolean	ok;
+
+	if (!cls.demorecording)
+		return;
 
 	len = LittleLong (net_message.cursize);
-	fwrite (&len, 4, 1, cls.demofile);
-	for (i = 0; i < 3; i++)
+	ok = CL_DemoWriter_Write (&demo_writer, &len, 4);
+	for (i = 0; i < 3 && ok; i++)
 	{
 		f = LittleFloat (cl.viewangles[i]);
-		fwrite (&f, 4, 1, cls.demofile);
+		ok = CL_DemoWriter_Write (&demo_writer, &f, 4);
+	}
+	if (ok)
+		ok = CL_DemoWriter_Write (&demo_writer, net_message.data, net_message.cursize);
+	if (ok && !demo_writer.raw)	// compressed demos are flushed a chunk at a time
+		ok = fflush (cls.demofile) == 0;
+
+	if (!ok)
+	{
+		Con_Printf ("ERROR: couldn't write to %s, recording stopped\n", COM_SkipPath (cls.demofilename));
+		CL_DemoWriter_End (&demo_writer);
+		cls.demofile = NULL;
+		cls.demorecording = false;
+		DemoList_Rebuild ();
 	}
-	fwrite (net_message.data, net_message.cursize, 1, cls.demofile);
-	fflush (cls.demofile);
 }
 
 /*
@@ -257,7 +850,7 @@ static qboolean CL_NextDemoFrame (void)
 			demoframe_t newframe;
 
 			memset (&newframe, 0, sizeof (newframe));
-			newframe.fileofs = Sys_ftell (cls.demofile);
+			newframe.fileofs = CL_DemoStream_Tell (&demo_stream);
 			newframe.intermission = cl.intermission;
 			newframe.forceunderwater = cl.forceunderwater;
 			VEC_PUSH (demo_rewind.frames, newframe);
@@ -276,7 +869,7 @@ static qboolean CL_NextDemoFrame (void)
 		return false;
 
 	lastframe = &demo_rewind.frames[framecount - 1];
-	Sys_fseek (cls.demofile, lastframe->fileofs, SEEK_SET);
+	CL_DemoStream_Seek (&demo_stream, lastframe->fileofs);
 
 	if (framecount == 1)
 		demo_rewind.backstop = true;
@@ -294,13 +887,20 @@ void CL_FinishDemoFrame (void)
 	size_t		i, len, numframes;
 	demoframe_t	*lastframe;
 
-	if (!cls.demoplayback || !cls.demospeed)
+	if (!cls.demoplayback || (!cls.demospeed && !cls.demoseeking))
 		return;
 
 	// Flush any pending stuffcmds (such as v_chifts)
 	// so that they take effect this frame, not the next
 	Cbuf_Execute ();
 
+	if (cls.demoseeking || cls.demospeed > 0.f)
+		CL_DemoKeyframe_Capture ();
+
+	// demoseek clears the rewind history once it's done
+	if (cls.demoseeking)
+		return;
+
 	// We're not going to rewind before the first frame,
 	// so we only track state changes from the second one onwards
 	numframes = VEC_SIZE (demo_rewind.frames);
@@ -375,142 +975,888 @@ void CL_FinishDemoFrame (void)
 					}
 					break;
 
-				case DFE_CSHIFT:
-					{
-						memcpy (&cshift_empty, data, sizeof (cshift_empty));
-						begin += sizeof (cshift_empty);
-					}
-					break;
+				case DFE_CSHIFT:
+					{
+						memcpy (&cshift_empty, data, sizeof (cshift_empty));
+						begin += sizeof (cshift_empty);
+					}
+					break;
+
+				case DFE_SOUND:
+					{
+						soundevent_t snd;
+
+						memcpy (&snd, data, sizeof (snd));
+						if (snd.sfx)
+							S_StartSound (snd.ent, snd.channel, snd.sfx, snd.pos, snd.volume/255.0, snd.attenuation / 64.f);
+						else
+							S_StopSound (snd.ent, snd.channel);
+
+						begin += sizeof (snd);
+					}
+					break;
+
+				default:
+					Sys_Error ("CL_NextDemoFrame: bad event type %d", datatype);
+					break;
+				}
+			}
+
+			SDL_assert (begin == end);
+
+			VEC_POP_N (demo_rewind.frame_events, lastframe->datasize);
+			lastframe->datasize = 0;
+		}
+
+		if (cl.intermission != lastframe->intermission && !lastframe->intermission)
+			cl.completed_time = 0;
+		cl.intermission = lastframe->intermission;
+		cl.forceunderwater = lastframe->forceunderwater;
+
+		VEC_POP (demo_rewind.frames);
+	}
+}
+
+/*
+====================
+CL_ReadDemoMessage
+
+Reads the next message from the demo file into net_message
+====================
+*/
+static qboolean CL_ReadDemoMessage (void)
+{
+	int		i;
+	float	f;
+
+	if (CL_DemoStream_Read (&demo_stream, &net_message.cursize, 4) != 4)
+		goto readerror;
+	VectorCopy (cl.mviewangles[0], cl.mviewangles[1]);
+	for (i = 0 ; i < 3 ; i++)
+	{
+		if (CL_DemoStream_Read (&demo_stream, &f, 4) != 4)
+			goto readerror;
+		cl.mviewangles[0][i] = LittleFloat (f);
+	}
+
+	net_message.cursize = LittleLong (net_message.cursize);
+	if (net_message.cursize > MAX_MSGLEN)
+		Sys_Error ("Demo message > MAX_MSGLEN");
+	if (CL_DemoStream_Read (&demo_stream, net_message.data, net_message.cursize) != (size_t) net_message.cursize)
+		goto readerror;
+
+	return true;
+
+readerror:
+	CL_StopPlayback ();
+	return false;
+}
+
+static int CL_GetDemoMessage (void)
+{
+	if (!cls.demospeed || demo_rewind.backstop)
+		return 0;
+
+	// decide if it is time to grab the next message
+	if (cls.signon == SIGNONS)	// always grab until fully connected
+	{
+		if (cls.timedemo)
+		{
+			if (host_framecount == cls.td_lastframe)
+				return 0;	// already read this frame's message
+			cls.td_lastframe = host_framecount;
+		// if this is the second frame, grab the real td_starttime
+		// so the bogus time on the first frame doesn't count
+			if (host_framecount == cls.td_startframe + 1)
+				cls.td_starttime = realtime;
+		}
+		else if (/* cl.time > 0 && */ cls.demospeed > 0.f ? cl.time <= cl.mtime[0] : cl.time >= cl.mtime[0])
+		{
+			return 0;	// don't need another message yet
+		}
+	}
+
+// get the next message
+	if (!CL_NextDemoFrame ())
+		return 0;
+
+	return CL_ReadDemoMessage ();
+}
+
+/*
+====================
+CL_GetMessage
+
+Handles recording and playback of demos, on top of NET_ code
+====================
+*/
+int CL_GetMessage (void)
+{
+	int	r;
+
+	if (cls.demoplayback)
+		return CL_GetDemoMessage ();
+
+	while (1)
+	{
+		r = NET_GetMessage (cls.netcon);
+
+		if (r != 1 && r != 2)
+			return r;
+
+	// discard nop keepalive message
+		if (net_message.cursize == 1 && net_message.data[0] == svc_nop)
+			Con_Printf ("<-- server to client keepalive\n");
+		else
+			break;
+	}
+
+	if (cls.demorecording)
+		CL_WriteDemoMessage ();
+
+	if (cls.signon < 2)
+	{
+	// record messages before full connection, so that a
+	// demo record can happen after connection is done
+		Vec_Append ((void**)&demo_head, 1, net_message.data, net_message.cursize);
+		VEC_PUSH (demo_head_sizes, net_message.cursize);
+	}
+
+	return r;
+}
+
+/*
+==============================================================================
+
+DEMO SEEKING
+
+==============================================================================
+*/
+
+/*
+====================
+CL_DemoIndex_CRC
+
+Checksum of the beginning of the demo, to validate cached indices
+====================
+*/
+static qboolean CL_DemoIndex_CRC (demostream_t *s, qfileofs_t start, qfileofs_t end, unsigned short *crc)
+{
+	byte	*buf;
+	size_t	size;
+	qboolean ok;
+
+	size = (size_t) q_min (end - start, (qfileofs_t) DEMOINDEX_CRCSIZE);
+	buf = (byte *) malloc (size);
+	if (!buf)
+		return false;
+
+	ok = CL_DemoStream_Seek (s, start) == 0 && CL_DemoStream_Read (s, buf, size) == size;
+	if (ok)
+		*crc = CRC_Block (buf, (int) size);
+	free (buf);
+
+	return ok;
+}
+
+/*
+====================
+CL_DemoIndex_LoadCache
+====================
+*/
+static qboolean CL_DemoIndex_LoadCache (void)
+{
+	FILE				*f;
+	int					header[6];
+	int					i, numframes, numsegments;
+	demoindexframe_t	frame;
+	demoindexsegment_t	seg;
+
+	f = Sys_fopen (demo_index.cachepath, "rb");
+	if (!f)
+		return false;
+
+	if (fread (header, sizeof (header), 1, f) != 1)
+		goto fail;
+	for (i = 0; i < countof (header); i++)
+		header[i] = LittleLong (header[i]);
+	if (header[0] != DEMOINDEX_MAGIC || header[1] != DEMOINDEX_VERSION ||
+		(unsigned int) header[2] != (unsigned int) (demo_index.end - demo_index.start) ||
+		header[3] != demo_index.crc)
+		goto fail;
+
+	numframes = header[4];
+	numsegments = header[5];
+	if (numframes <= 0 || numsegments <= 0)
+		goto fail;
+
+	for (i = 0; i < numframes; i++)
+	{
+		if (fread (&frame, sizeof (frame), 1, f) != 1)
+			goto fail;
+		frame.fileofs = LittleLong (frame.fileofs);
+		frame.time = LittleFloat (frame.time);
+		VEC_PUSH (demo_index.frames, frame);
+	}
+
+	for (i = 0; i < numsegments; i++)
+	{
+		if (fread (&seg, sizeof (seg), 1, f) != 1)
+			goto fail;
+		seg.firstframe = LittleLong (seg.firstframe);
+		seg.starttime = LittleFloat (seg.starttime);
+		seg.servertime = LittleFloat (seg.servertime);
+		if (seg.firstframe >= (unsigned int) numframes)
+			goto fail;
+		VEC_PUSH (demo_index.segments, seg);
+	}
+
+	fclose (f);
+	return true;
+
+fail:
+	fclose (f);
+	VEC_CLEAR (demo_index.frames);
+	VEC_CLEAR (demo_index.segments);
+	return false;
+}
+
+/*
+====================
+CL_DemoIndex_SaveCache
+====================
+*/
+static void CL_DemoIndex_SaveCache (void)
+{
+	FILE				*f;
+	int					header[6];
+	size_t				i, count;
+	demoindexframe_t	frame;
+	demoindexsegment_t	seg;
+
+	COM_CreatePath (demo_index.cachepath);
+	f = Sys_fopen (demo_index.cachepath, "wb");
+	if (!f)
+	{
+		Con_DPrintf ("Couldn't write demo index %s\n", demo_index.cachepath);
+		return;
+	}
+
+	header[0] = LittleLong (DEMOINDEX_MAGIC);
+	header[1] = LittleLong (DEMOINDEX_VERSION);
+	header[2] = LittleLong ((int) (demo_index.end - demo_index.start));
+	header[3] = LittleLong (demo_index.crc);
+	header[4] = LittleLong ((int) VEC_SIZE (demo_index.frames));
+	header[5] = LittleLong ((int) VEC_SIZE (demo_index.segments));
+	fwrite (header, sizeof (header), 1, f);
+
+	for (i = 0, count = VEC_SIZE (demo_index.frames); i < count; i++)
+	{
+		frame.fileofs = LittleLong (demo_index.frames[i].fileofs);
+		frame.time = LittleFloat (demo_index.frames[i].time);
+		fwrite (&frame, sizeof (frame), 1, f);
+	}
+
+	for (i = 0, count = VEC_SIZE (demo_index.segments); i < count; i++)
+	{
+		seg.firstframe = LittleLong (demo_index.segments[i].firstframe);
+		seg.starttime = LittleFloat (demo_index.segments[i].starttime);
+		seg.servertime = LittleFloat (demo_index.segments[i].servertime);
+		fwrite (&seg, sizeof (seg), 1, f);
+	}
+
+	fclose (f);
+}
+
+/*
+====================
+CL_DemoIndex_Scan
+
+Records the offset and time of every message in the demo
+====================
+*/
+static qboolean CL_DemoIndex_Scan (void)
+{
+	demostream_t		*s = &demo_index.stream;
+	byte				*data;
+	int					len;
+	unsigned int		numframes, lasttimed;
+	float				servertime, lastservertime, demotime;
+	qfileofs_t			pos;
+	demoindexframe_t	frame;
+	demoindexsegment_t	seg;
+	qboolean			ok = false;
+
+	data = (byte *) malloc (MAX_MSGLEN);
+	if (!data)
+		return false;
+
+	memset (&seg, 0, sizeof (seg));
+	seg.servertime = -1.f;
+	VEC_PUSH (demo_index.segments, seg);
+
+	numframes = lasttimed = 0;
+	lastservertime = demotime = 0.f;
+	pos = demo_index.start;
+	if (CL_DemoStream_Seek (s, pos) != 0)
+		goto done;
+
+	while (pos + 16 <= demo_index.end)
+	{
+		if (SDL_AtomicGet (&demo_index.cancel))
+			goto done;
+
+		// message length + view angles
+		if (CL_DemoStream_Read (s, data, 16) != 16)
+			break;
+		memcpy (&len, data, 4);
+		len = LittleLong (len);
+		if (len < 0 || len > MAX_MSGLEN || pos + 16 + len > demo_index.end)
+			break;
+		if (len && CL_DemoStream_Read (s, data, len) != (size_t) len)
+			break;
+
+		// server datagrams start with the current time
+		if (len >= 5 && data[0] == svc_time)
+		{
+			memcpy (&servertime, data + 1, 4);
+			servertime = LittleFloat (servertime);
+
+			seg = VEC_LAST (demo_index.segments);
+			if (seg.servertime < 0.f)
+			{
+				VEC_LAST (demo_index.segments).servertime = servertime;
+			}
+			else if (servertime < lastservertime)
+			{
+				// server time went back, this is a new map: it begins
+				// right after the last timed message of the previous one
+				seg.firstframe = lasttimed + 1;
+				seg.starttime = demotime;
+				seg.servertime = servertime;
+				VEC_PUSH (demo_index.segments, seg);
+			}
+
+			seg = VEC_LAST (demo_index.segments);
+			demotime = seg.starttime + q_max (servertime - seg.servertime, 0.f);
+			lastservertime = servertime;
+			lasttimed = numframes;
+		}
+
+		frame.fileofs = (unsigned int) (pos - demo_index.start);
+		frame.time = demotime;
+		VEC_PUSH (demo_index.frames, frame);
+		numframes++;
+
+		pos += 16 + len;
+	}
+
+	ok = numframes > 0;
+
+done:
+	free (data);
+	if (!ok)
+	{
+		VEC_CLEAR (demo_index.frames);
+		VEC_CLEAR (demo_index.segments);
+	}
+	return ok;
+}
+
+/*
+====================
+CL_DemoIndex_Thread
+====================
+*/
+static int CL_DemoIndex_Thread (void *param)
+{
+	demo_index.fromcache = false;
+	if (CL_DemoIndex_CRC (&demo_index.stream, demo_index.start, demo_index.end, &demo_index.crc))
+	{
+		demo_index.fromcache = CL_DemoIndex_LoadCache ();
+		if (!demo_index.fromcache)
+			CL_DemoIndex_Scan ();
+	}
+
+	CL_DemoStream_Close (&demo_index.stream);
+
+	SDL_AtomicSet (&demo_index.done, 1);
+
+	return 0;
+}
+
+/*
+====================
+CL_DemoIndex_Start
+
+Starts indexing the demo currently being played back in the background
+====================
+*/
+static void CL_DemoIndex_Start (const char *name)
+{
+	FILE		*f;
+
+	if (COM_FOpenFile (name, &f, NULL) == -1 || !f)
+		return;
+	if (!CL_DemoStream_Open (&demo_index.stream, f, com_filesize))
+	{
+		CL_DemoStream_Close (&demo_index.stream);
+		return;
+	}
+
+	demo_index.start = cls.demofilestart;
+	demo_index.end = demo_index.stream.base + cls.demofilesize;
+	q_snprintf (demo_index.cachepath, sizeof (demo_index.cachepath), "%s/%s.idx", com_gamedir, name);
+	demo_index.ready = false;
+	SDL_AtomicSet (&demo_index.done, 0);
+	SDL_AtomicSet (&demo_index.cancel, 0);
+
+	demo_index.thread = SDL_CreateThread (CL_DemoIndex_Thread, "Demo indexer", NULL);
+	if (!demo_index.thread)
+		CL_DemoStream_Close (&demo_index.stream);
+}
+
+/*
+====================
+CL_DemoIndex_Finish
+
+Waits for the indexing thread if needed, returns true if the index is usable
+====================
+*/
+static qboolean CL_DemoIndex_Finish (qboolean wait)
+{
+	if (demo_index.ready)
+		return true;
+	if (!demo_index.thread)
+		return false;
+	if (!wait && !SDL_AtomicGet (&demo_index.done))
+		return false;
+
+	SDL_WaitThread (demo_index.thread, NULL);
+	demo_index.thread = NULL;
+	demo_index.ready = VEC_SIZE (demo_index.frames) > 0;
+
+	if (demo_index.ready && !demo_index.fromcache)
+		CL_DemoIndex_SaveCache ();
+
+	return demo_index.ready;
+}
+
+/*
+====================
+CL_DemoKeyframe_Free
+====================
+*/
+static void CL_DemoKeyframe_Free (void)
+{
+	size_t i, count;
+
+	for (i = 0, count = VEC_SIZE (demo_index.keyframes); i < count; i++)
+	{
+		free (demo_index.keyframes[i].entities);
+		free (demo_index.keyframes[i].scores);
+	}
+	VEC_FREE (demo_index.keyframes);
+}
+
+/*
+====================
+CL_DemoIndex_Shutdown
+====================
+*/
+static void CL_DemoIndex_Shutdown (void)
+{
+	if (demo_index.thread)
+	{
+		SDL_AtomicSet (&demo_index.cancel, 1);
+		SDL_WaitThread (demo_index.thread, NULL);
+		demo_index.thread = NULL;
+	}
+	demo_index.ready = false;
+	VEC_FREE (demo_index.frames);
+	VEC_FREE (demo_index.segments);
+	CL_DemoKeyframe_Free ();
+}
+
+/*
+====================
+CL_DemoIndex_FindFrame
+
+Returns the index of the last message starting before the given offset
+====================
+*/
+static int CL_DemoIndex_FindFrame (qfileofs_t ofs)
+{
+	int lo = 0, hi = (int) VEC_SIZE (demo_index.frames) - 1, mid;
+
+	if (hi < 0 || ofs <= demo_index.frames[0].fileofs)
+		return 0;
+
+	while (lo < hi)
+	{
+		mid = (lo + hi + 1) / 2;
+		if (demo_index.frames[mid].fileofs < ofs)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}
+
+/*
+====================
+CL_DemoIndex_FindTime
+
+Returns the index of the first message at or after the given demo time
+====================
+*/
+static int CL_DemoIndex_FindTime (float time)
+{
+	int lo = 0, hi = (int) VEC_SIZE (demo_index.frames) - 1, mid;
+
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if (demo_index.frames[mid].time < time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+====================
+CL_DemoIndex_FindSegment
+====================
+*/
+static int CL_DemoIndex_FindSegment (int frame)
+{
+	int i;
+
+	for (i = (int) VEC_SIZE (demo_index.segments) - 1; i > 0; i--)
+		if (demo_index.segments[i].firstframe <= (unsigned int) frame)
+			break;
+
+	return i;
+}
+
+/*
+====================
+CL_DemoTell
+
+Current offset relative to the start of the demo messages
+====================
+*/
+qfileofs_t CL_DemoTell (void)
+{
+	return CL_DemoStream_Tell (&demo_stream) - cls.demofilestart;
+}
 
-				case DFE_SOUND:
-					{
-						soundevent_t snd;
+/*
+====================
+CL_DemoKeyframe_Capture
 
-						memcpy (&snd, data, sizeof (snd));
-						if (snd.sfx)
-							S_StartSound (snd.ent, snd.channel, snd.sfx, snd.pos, snd.volume/255.0, snd.attenuation / 64.f);
-						else
-							S_StopSound (snd.ent, snd.channel);
+Takes a snapshot of the client state after the current message,
+if there isn't one for this part of the demo yet
+====================
+*/
+static void CL_DemoKeyframe_Capture (void)
+{
+	demokeyframe_t	kf;
+	qfileofs_t		ofs;
+	int				i, frame, segment, slot;
+	float			interval;
+	size_t			count;
+
+	interval = cl_demokeyframes.value;
+	if (interval <= 0.f || cls.signon != SIGNONS || !CL_DemoIndex_Finish (false))
+		return;
 
-						begin += sizeof (snd);
-					}
-					break;
+	ofs = CL_DemoTell ();
+	frame = CL_DemoIndex_FindFrame (ofs);
+	segment = CL_DemoIndex_FindSegment (frame);
+	slot = (int) ((demo_index.frames[frame].time - demo_index.segments[segment].starttime) / interval);
 
-				default:
-					Sys_Error ("CL_NextDemoFrame: bad event type %d", datatype);
-					break;
-				}
-			}
+	for (i = 0, count = VEC_SIZE (demo_index.keyframes); i < (int) count; i++)
+	{
+		demokeyframe_t *other = &demo_index.keyframes[i];
+		if (other->segment == segment &&
+			(int) ((other->time - demo_index.segments[segment].starttime) / interval) == slot)
+			return;
+	}
 
-			SDL_assert (begin == end);
+	memset (&kf, 0, sizeof (kf));
+	kf.fileofs			= (unsigned int) ofs;
+	kf.segment			= segment;
+	kf.time				= demo_index.frames[frame].time;
+
+	memcpy (kf.stats, cl.stats, sizeof (kf.stats));
+	memcpy (kf.statsf, cl.statsf, sizeof (kf.statsf));
+	kf.items			= cl.items;
+	memcpy (kf.item_gettime, cl.item_gettime, sizeof (kf.item_gettime));
+	kf.faceanimtime		= cl.faceanimtime;
+	memcpy (kf.cshifts, cl.cshifts, sizeof (kf.cshifts));
+	memcpy (kf.mviewangles, cl.mviewangles, sizeof (kf.mviewangles));
+	memcpy (kf.mvelocity, cl.mvelocity, sizeof (kf.mvelocity));
+	VectorCopy (cl.punchangle, kf.punchangle);
+	kf.idealpitch		= cl.idealpitch;
+	kf.viewheight		= cl.viewheight;
+	kf.paused			= cl.paused;
+	kf.onground			= cl.onground;
+	kf.inwater			= cl.inwater;
+	kf.intermission		= cl.intermission;
+	kf.completed_time	= cl.completed_time;
+	kf.mtime[0]			= cl.mtime[0];
+	kf.mtime[1]			= cl.mtime[1];
+	kf.viewentity		= cl.viewentity;
+	kf.cdtrack			= cl.cdtrack;
+	kf.looptrack		= cl.looptrack;
+	kf.forceunderwater	= cl.forceunderwater;
+
+	kf.cshift_empty		= cshift_empty;
+	kf.fog[0]			= Fog_GetDensity ();
+	memcpy (kf.fog + 1, Fog_GetColor (), 3 * sizeof (float));
+	memcpy (kf.lightstyles, cl_lightstyle, sizeof (kf.lightstyles));
+
+	kf.num_entities		= cl.num_entities;
+	kf.entities			= (entity_t *) malloc (cl.num_entities * sizeof (entity_t));
+	kf.scores			= (demoscore_t *) malloc (cl.maxclients * sizeof (demoscore_t));
+	if (!kf.entities || !kf.scores)
+	{
+		free (kf.entities);
+		free (kf.scores);
+		return;
+	}
+	memcpy (kf.entities, cl_entities, cl.num_entities * sizeof (entity_t));
+	for (i = 0; i < cl.maxclients; i++)
+	{
+		q_strlcpy (kf.scores[i].name, cl.scores[i].name, sizeof (kf.scores[i].name));
+		kf.scores[i].entertime	= cl.scores[i].entertime;
+		kf.scores[i].frags		= cl.scores[i].frags;
+		kf.scores[i].colors		= cl.scores[i].colors;
+	}
 
-			VEC_POP_N (demo_rewind.frame_events, lastframe->datasize);
-			lastframe->datasize = 0;
-		}
+	VEC_PUSH (demo_index.keyframes, kf);
+}
 
-		if (cl.intermission != lastframe->intermission && !lastframe->intermission)
-			cl.completed_time = 0;
-		cl.intermission = lastframe->intermission;
-		cl.forceunderwater = lastframe->forceunderwater;
+/*
+====================
+CL_DemoKeyframe_Restore
+====================
+*/
+static void CL_DemoKeyframe_Restore (const demokeyframe_t *kf)
+{
+	int			i;
+	entity_t	*ent;
+
+	CL_DemoStream_Seek (&demo_stream, cls.demofilestart + kf->fileofs);
+
+	memcpy (cl.stats, kf->stats, sizeof (cl.stats));
+	memcpy (cl.statsf, kf->statsf, sizeof (cl.statsf));
+	cl.items			= kf->items;
+	memcpy (cl.item_gettime, kf->item_gettime, sizeof (cl.item_gettime));
+	cl.faceanimtime		= kf->faceanimtime;
+	memcpy (cl.cshifts, kf->cshifts, sizeof (cl.cshifts));
+	memcpy (cl.mviewangles, kf->mviewangles, sizeof (cl.mviewangles));
+	memcpy (cl.mvelocity, kf->mvelocity, sizeof (cl.mvelocity));
+	VectorCopy (kf->punchangle, cl.punchangle);
+	cl.idealpitch		= kf->idealpitch;
+	cl.viewheight		= kf->viewheight;
+	cl.paused			= kf->paused;
+	cl.onground			= kf->onground;
+	cl.inwater			= kf->inwater;
+	cl.intermission		= kf->intermission;
+	cl.completed_time	= kf->completed_time;
+	cl.mtime[0]			= kf->mtime[0];
+	cl.mtime[1]			= kf->mtime[1];
+	cl.time				= cl.mtime[0];
+	cl.oldtime			= cl.mtime[0];
+	cl.fixangle			= false;
+	cl.viewentity		= kf->viewentity;
+	cl.cdtrack			= kf->cdtrack;
+	cl.looptrack		= kf->looptrack;
+	cl.forceunderwater	= kf->forceunderwater;
+
+	cshift_empty		= kf->cshift_empty;
+	Fog_Update (kf->fog[0], kf->fog[1], kf->fog[2], kf->fog[3], 0.f);
+	memcpy (cl_lightstyle, kf->lightstyles, sizeof (cl_lightstyle));
+
+	for (i = 0; i < cl.maxclients; i++)
+	{
+		q_strlcpy (cl.scores[i].name, kf->scores[i].name, sizeof (cl.scores[i].name));
+		cl.scores[i].entertime	= kf->scores[i].entertime;
+		cl.scores[i].frags		= kf->scores[i].frags;
+		cl.scores[i].colors		= kf->scores[i].colors;
+		CL_NewTranslation (i);
+	}
 
-		VEC_POP (demo_rewind.frames);
+	// entities that didn't exist yet will be set up again by CL_EntityNum
+	if (cl.num_entities > kf->num_entities)
+		memset (cl_entities + kf->num_entities, 0, (cl.num_entities - kf->num_entities) * sizeof (entity_t));
+	cl.num_entities = kf->num_entities;
+	memcpy (cl_entities, kf->entities, kf->num_entities * sizeof (entity_t));
+	for (i = 0, ent = cl_entities; i < cl.num_entities; i++, ent++)
+	{
+		// player colormaps point to the (reallocated) scoreboard
+		if (ent->colormap != vid.colormap)
+			ent->colormap = (i >= 1 && i <= cl.maxclients) ? cl.scores[i - 1].translations : vid.colormap;
+		ent->lerpflags |= LERP_RESETMOVE|LERP_RESETANIM;
 	}
+	cl_entities[0].model = cl.worldmodel;
 }
 
-static int CL_GetDemoMessage (void)
+/*
+====================
+CL_DemoSeek
+
+Jumps to the first message at or after the given demo time
+====================
+*/
+static void CL_DemoSeek (float time)
 {
-	int		i;
-	float	f;
+	int				i, target, segment, current, cursegment;
+	unsigned int	targetofs;
+	qfileofs_t		pos;
+	demokeyframe_t	*kf;
 
-	if (!cls.demospeed || demo_rewind.backstop)
-		return 0;
+	target = CL_DemoIndex_FindTime (time);
+	targetofs = demo_index.frames[target].fileofs;
+	segment = CL_DemoIndex_FindSegment (target);
 
-	// decide if it is time to grab the next message
-	if (cls.signon == SIGNONS)	// always grab until fully connected
+	pos = CL_DemoTell ();
+	current = CL_DemoIndex_FindFrame (pos);
+	cursegment = CL_DemoIndex_FindSegment (current);
+
+	// find the closest keyframe before the target
+	for (i = 0, kf = NULL; i < (int) VEC_SIZE (demo_index.keyframes); i++)
 	{
-		if (cls.timedemo)
-		{
-			if (host_framecount == cls.td_lastframe)
-				return 0;	// already read this frame's message
-			cls.td_lastframe = host_framecount;
-		// if this is the second frame, grab the real td_starttime
-		// so the bogus time on the first frame doesn't count
-			if (host_framecount == cls.td_startframe + 1)
-				cls.td_starttime = realtime;
-		}
-		else if (/* cl.time > 0 && */ cls.demospeed > 0.f ? cl.time <= cl.mtime[0] : cl.time >= cl.mtime[0])
-		{
-			return 0;	// don't need another message yet
-		}
+		demokeyframe_t *other = &demo_index.keyframes[i];
+		if (other->segment == segment && other->fileofs <= targetofs && (!kf || other->fileofs > kf->fileofs))
+			kf = other;
 	}
 
-// get the next message
-	if (!CL_NextDemoFrame ())
-		return 0;
+	cls.demoseeking = true;
 
-	if (fread (&net_message.cursize, 4, 1, cls.demofile) != 1)
-		goto readerror;
-	VectorCopy (cl.mviewangles[0], cl.mviewangles[1]);
-	for (i = 0 ; i < 3 ; i++)
+	// we can't go back without a keyframe, and keyframes
+	// can only be restored on top of the right map
+	if (cursegment != segment || cls.signon != SIGNONS || (pos > targetofs && !kf))
 	{
-		if (fread (&f, 4, 1, cls.demofile) != 1)
-			goto readerror;
-		cl.mviewangles[0][i] = LittleFloat (f);
+		// go back to the start of the map and parse the signon messages again
+		CL_DemoStream_Seek (&demo_stream, cls.demofilestart + demo_index.frames[demo_index.segments[segment].firstframe].fileofs);
+		CL_ClearSignons ();
+		while (cls.demoplayback && cls.signon < SIGNONS && CL_ReadDemoMessage ())
+			CL_ParseServerMessage ();
+		if (!cls.demoplayback)
+			return;
+		pos = CL_DemoTell ();
 	}
 
-	net_message.cursize = LittleLong (net_message.cursize);
-	if (net_message.cursize > MAX_MSGLEN)
-		Sys_Error ("Demo message > MAX_MSGLEN");
-	if (fread (net_message.data, net_message.cursize, 1, cls.demofile) != 1)
+	if (kf && (kf->fileofs > pos || pos > targetofs))
+		CL_DemoKeyframe_Restore (kf);
+
+	// parse everything up to (and including) the target message
+	while (cls.demoplayback && CL_DemoTell () <= targetofs)
 	{
-	readerror:
-		CL_StopPlayback ();
-		return 0;
+		if (!CL_ReadDemoMessage ())
+			break;
+		CL_ParseServerMessage ();
+		cl.time = cl.mtime[0];
 	}
 
-	return 1;
+	cls.demoseeking = false;
+
+	if (!cls.demoplayback)
+		return;
+
+	cl.time = cl.oldtime = cl.mtime[0];
+
+	// rewind history is only valid from here on
+	VEC_CLEAR (demo_rewind.frames);
+	VEC_CLEAR (demo_rewind.frame_events);
+	VEC_CLEAR (demo_rewind.pending_sounds);
+	demo_rewind.backstop = false;
+
+	// drop transient effects from the previous position
+	R_ClearParticles ();
+	memset (cl_dlights, 0, sizeof (cl_dlights));
+	memset (cl_beams, 0, sizeof (cl_beams));
 }
 
 /*
 ====================
-CL_GetMessage
+CL_FormatDemoTime
+====================
+*/
+static const char *CL_FormatDemoTime (float time)
+{
+	int sec = (int) time;
 
-Handles recording and playback of demos, on top of NET_ code
+	if (sec >= 3600)
+		return va ("%d:%02d:%02d", sec / 3600, (sec / 60) % 60, sec % 60);
+	return va ("%d:%02d", sec / 60, sec % 60);
+}
+
+/*
+====================
+CL_DemoSeek_f
+
+demoseek [+|-]<[[hh:]mm:]ss>
 ====================
 */
-int CL_GetMessage (void)
+void CL_DemoSeek_f (void)
 {
-	int	r;
+	const char	*arg;
+	float		time, current, length;
+	int			sign;
 
-	if (cls.demoplayback)
-		return CL_GetDemoMessage ();
+	if (cmd_source != src_command)
+		return;
 
-	while (1)
+	if (!cls.demoplayback)
 	{
-		r = NET_GetMessage (cls.netcon);
+		Con_Printf ("Not playing a demo.\n");
+		return;
+	}
 
-		if (r != 1 && r != 2)
-			return r;
+	if (!CL_DemoIndex_Finish (true))
+	{
+		Con_Printf ("Demo index not available.\n");
+		return;
+	}
 
-	// discard nop keepalive message
-		if (net_message.cursize == 1 && net_message.data[0] == svc_nop)
-			Con_Printf ("<-- server to client keepalive\n");
-		else
-			break;
+	length = VEC_LAST (demo_index.frames).time;
+	current = demo_index.frames[CL_DemoIndex_FindFrame (CL_DemoTell ())].time;
+
+	if (Cmd_Argc () != 2)
+	{
+		Con_Printf ("demoseek [+|-]<[[hh:]mm:]ss> : jump to demo time\n");
+		Con_Printf ("position %s", CL_FormatDemoTime (current));
+		Con_Printf (" / %s (%d keyframes)\n", CL_FormatDemoTime (length), (int) VEC_SIZE (demo_index.keyframes));
+		return;
 	}
 
-	if (cls.demorecording)
-		CL_WriteDemoMessage ();
+	arg = Cmd_Argv (1);
+	sign = 0;
+	if (*arg == '+' || *arg == '-')
+		sign = *arg++ == '+' ? 1 : -1;
 
-	if (cls.signon < 2)
+	for (time = 0.f; *arg; )
 	{
-	// record messages before full connection, so that a
-	// demo record can happen after connection is done
-		Vec_Append ((void**)&demo_head, 1, net_message.data, net_message.cursize);
-		VEC_PUSH (demo_head_sizes, net_message.cursize);
+		time = time * 60.f + Q_atof (arg);
+		while (*arg && *arg != ':')
+			arg++;
+		if (*arg == ':')
+			arg++;
 	}
 
-	return r;
+	if (sign)
+		time = current + sign * time;
+	time = CLAMP (0.f, time, length);
+
+	CL_DemoSeek (time);
 }
 
 
@@ -536,12 +1882,16 @@ void CL_Stop_f (void)
 	SZ_Clear (&net_message);
 	MSG_WriteByte (&net_message, svc_disconnect);
 	CL_WriteDemoMessage ();
+	if (!cls.demorecording)
+		return;	// the write failed and already stopped the recording
 
 // finish up
-	fclose (cls.demofile);
+	if (CL_DemoWriter_End (&demo_writer))
+		Con_Printf ("Completed demo\n");
+	else
+		Con_Printf ("ERROR: couldn't write to %s\n", COM_SkipPath (cls.demofilename));
 	cls.demofile = NULL;
 	cls.demorecording = false;
-	Con_Printf ("Completed demo\n");
 	
 // ericw -- update demo tab-completion list
 	DemoList_Rebuild ();
@@ -559,6 +1909,7 @@ void CL_Record_f (void)
 	int		c;
 	char	relname[MAX_OSPATH];
 	char	name[MAX_OSPATH];
+	char	trackline[16];
 	int		track;
 
 	if (cmd_source != src_command)
@@ -636,8 +1987,11 @@ void CL_Record_f (void)
 		return;
 	}
 
+	CL_DemoWriter_Begin (&demo_writer, cls.demofile, cl_democompress.value != 0.f);
+
 	cls.forcetrack = track;
-	fprintf (cls.demofile, "%i\n", cls.forcetrack);
+	q_snprintf (trackline, sizeof (trackline), "%i\n", cls.forcetrack);
+	CL_DemoWriter_Write (&demo_writer, trackline, strlen (trackline));
 	q_strlcpy (cls.demofilename, name, sizeof (cls.demofilename));
 
 	cls.demorecording = true;
@@ -750,6 +2104,118 @@ void CL_Record_f (void)
 }
 
 
+/*
+====================
+CL_DemoCompress_f
+
+democompress <demoname> [<output>]
+====================
+*/
+void CL_DemoCompress_f (void)
+{
+	static demostream_t	in;
+	demowriter_t		out;
+	char				name[MAX_OSPATH];
+	char				relname[MAX_OSPATH];
+	char				outname[MAX_OSPATH];
+	char				tmpname[MAX_OSPATH];
+	FILE				*f;
+	byte				*buf;
+	size_t				n;
+	qfileofs_t			left, insize, outsize;
+	int					handle;
+	qboolean			ok;
+
+	if (cmd_source != src_command)
+		return;
+
+	if (Cmd_Argc () != 2 && Cmd_Argc () != 3)
+	{
+		Con_Printf ("democompress <demoname> [<output>] : converts a demo to the compressed format\n");
+		return;
+	}
+
+	q_strlcpy (name, Cmd_Argv (1), sizeof (name));
+	COM_AddExtension (name, ".dem", sizeof (name));
+	q_strlcpy (relname, Cmd_Argc () == 3 ? Cmd_Argv (2) : name, sizeof (relname));
+	COM_AddExtension (relname, ".dem", sizeof (relname));
+	if (strstr (relname, ".."))
+	{
+		Con_Printf ("Relative pathnames are not allowed.\n");
+		return;
+	}
+	if ((cls.demoplayback || cls.demorecording) && !q_strcasecmp (COM_SkipPath (cls.demofilename), COM_SkipPath (relname)))
+	{
+		Con_Printf ("Can't compress a demo that is in use\n");
+		return;
+	}
+
+	if (COM_FOpenFile (name, &f, NULL) == -1 || !f)
+	{
+		Con_Printf ("ERROR: couldn't open %s\n", name);
+		return;
+	}
+	if (!CL_DemoStream_Open (&in, f, com_filesize))
+	{
+		CL_DemoStream_Close (&in);
+		Con_Printf ("ERROR: demo \"%s\" is invalid\n", name);
+		return;
+	}
+	if (in.chunks)
+	{
+		CL_DemoStream_Close (&in);
+		Con_Printf ("%s is already compressed\n", name);
+		return;
+	}
+
+	q_snprintf (outname, sizeof (outname), "%s/%s", com_gamedir, relname);
+	q_snprintf (tmpname, sizeof (tmpname), "%s.tmp", outname);
+	COM_CreatePath (tmpname);
+	f = Sys_fopen (tmpname, "wb");
+	if (!f)
+	{
+		CL_DemoStream_Close (&in);
+		Con_Printf ("ERROR: couldn't create %s\n", relname);
+		return;
+	}
+
+	insize = in.size;
+	CL_DemoWriter_Begin (&out, f, true);
+	buf = (byte *) malloc (DEMOZ_CHUNKSIZE);
+	ok = buf && out.raw;
+	// stop at the end of the demo, not of the pak file it lives in
+	for (left = insize; ok && left > 0; left -= n)
+	{
+		n = CL_DemoStream_Read (&in, buf, (size_t) q_min (left, (qfileofs_t) DEMOZ_CHUNKSIZE));
+		ok = n > 0 && CL_DemoWriter_Write (&out, buf, n);
+	}
+	if (!CL_DemoWriter_End (&out))
+		ok = false;
+	CL_DemoStream_Close (&in);
+	free (buf);
+
+	if (ok)
+	{
+		Sys_remove (outname);
+		ok = Sys_rename (tmpname, outname) == 0;
+	}
+	if (!ok)
+	{
+		Sys_remove (tmpname);
+		Con_Printf ("ERROR: couldn't write %s\n", relname);
+		return;
+	}
+
+	outsize = Sys_FileOpenRead (outname, &handle);
+	if (handle != -1)
+		Sys_FileClose (handle);
+	Con_Printf ("%s: %.1f KB -> %.1f KB (%.1f%%)\n", relname,
+		insize / 1024.0, outsize / 1024.0, insize ? 100.0 * outsize / insize : 0.0);
+
+	// ericw -- update demo tab-completion list
+	DemoList_Rebuild ();
+}
+
 /*
 ====================
 CL_PlayDemo_f
@@ -787,13 +2253,10 @@ void CL_PlayDemo_f (void)
 		return;
 	}
 
-// ZOID, fscanf is evil
-// O.S.: if a space character e.g. 0x20 (' ') follows '\n',
-// fscanf skips that byte too and screws up further reads.
-//	fscanf (cls.demofile, "%i\n", &cls.forcetrack);
-	if (fscanf (cls.demofile, "%i", &cls.forcetrack) != 1 || fgetc (cls.demofile) != '\n')
+	if (!CL_DemoStream_Open (&demo_stream, cls.demofile, com_filesize) ||
+		!CL_DemoStream_ReadTrack (&demo_stream, &cls.forcetrack))
 	{
-		fclose (cls.demofile);
+		CL_DemoStream_Close (&demo_stream);
 		cls.demofile = NULL;
 		cls.demonum = -1;	// stop demo loop
 		Con_Printf ("ERROR: demo \"%s\" is invalid\n", name);
@@ -810,8 +2273,12 @@ void CL_PlayDemo_f (void)
 	q_strlcpy (cls.demofilename, name, sizeof (cls.demofilename));
 	cls.state = ca_connected;
 	cls.demoloop = Cmd_Argc () >= 3 ? Q_atoi (Cmd_Argv (2)) != 0 : false;
-	cls.demofilestart = Sys_ftell (cls.demofile);
-	cls.demofilesize = com_filesize;
+	cls.demofilestart = CL_DemoStream_Tell (&demo_stream);
+	cls.demofilesize = demo_stream.size;
+
+	// only index demos the player asked for, not the startup demo loop
+	if (cls.demonum == -1)
+		CL_DemoIndex_Start (name);
 
 // if this is a player-initiated demo, get rid of the console
 	if (cls.demonum == -1 && key_dest == key_console)
@@ -869,3 +2336,111 @@ void CL_TimeDemo_f (void)
 	cls.td_lastframe = -1;	// get a new message this frame
 }
 
+/*
+==============================================================================
+
+HEADLESS TIMEDEMO
+
+timedemo_nodraw decodes a whole demo inside a single command, with no
+rendering, sound or frame pacing, so that the cost of the client side of
+the network code can be measured on its own.  Playback normally ends with
+a svc_disconnect, which longjmps out of the loop, so the results are
+printed from CL_StopPlayback like a regular timedemo.
+==============================================================================
+*/
+
+static struct
+{
+	double		starttime;
+	double		parsetime;
+	double		relinktime;
+	double		particletime;
+	double		bytes;
+	int			messages;
+	int			frames;
+} td_nodraw;
+
+/*
+====================
+CL_FinishTimeDemoNoDraw
+====================
+*/
+static void CL_FinishTimeDemoNoDraw (void)
+{
+	double	time;
+
+	cls.timedemo_nodraw = false;
+
+	time = Sys_DoubleTime () - td_nodraw.starttime;
+	if (time <= 0.0)
+		time = 1.0;
+
+	Con_Printf ("%i messages %5.2f seconds %.0f msgs/sec %.1f MB/s\n",
+		td_nodraw.messages, time, td_nodraw.messages / time, td_nodraw.bytes / time / (1024.0 * 1024.0));
+	Con_Printf ("parse %.1f ms, relink %.1f ms, particles %.1f ms over %i frames\n",
+		td_nodraw.parsetime * 1000.0, td_nodraw.relinktime * 1000.0,
+		td_nodraw.particletime * 1000.0, td_nodraw.frames);
+	CL_PrintSvcProfile (td_nodraw.parsetime);
+}
+
+/*
+====================
+CL_TimeDemoNoDraw_f
+
+timedemo_nodraw [demoname]
+====================
+*/
+void CL_TimeDemoNoDraw_f (void)
+{
+	double	t0, t1, t2;
+	float	lastmtime;
+
+	if (cmd_source != src_command)
+		return;
+
+	if (Cmd_Argc() != 2)
+	{
+		Con_Printf ("timedemo_nodraw <demoname> : gets demo decode speeds without rendering\n");
+		return;
+	}
+
+	CL_PlayDemo_f ();
+	if (!cls.demofile)
+		return;
+
+	// don't let the background indexer compete for the disk
+	CL_DemoIndex_Shutdown ();
+
+	memset (&td_nodraw, 0, sizeof (td_nodraw));
+	CL_ResetSvcProfile ();
+	cls.timedemo_nodraw = true;
+	td_nodraw.starttime = Sys_DoubleTime ();
+
+	while (cls.demoplayback)
+	{
+		if (!CL_ReadDemoMessage ())
+			break;
+		td_nodraw.messages++;
+		td_nodraw.bytes += net_message.cursize;
+
+		lastmtime = cl.mtime[0];
+		t0 = Sys_DoubleTime ();
+		CL_ParseServerMessage ();
+		t1 = Sys_DoubleTime ();
+		td_nodraw.parsetime += t1 - t0;
+
+	// advance the client once per server frame, as a rendered frame would
+		if (cls.signon != SIGNONS || cl.mtime[0] == lastmtime)
+			continue;
+		cl.oldtime = cl.time;
+		cl.time = cl.mtime[0];
+
+		CL_RelinkEntities ();
+		t2 = Sys_DoubleTime ();
+		td_nodraw.relinktime += t2 - t1;
+
+		CL_RunParticles ();
+		td_nodraw.particletime += Sys_DoubleTime () - t2;
+		td_nodraw.frames++;
+	}
+}
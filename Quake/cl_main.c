@@ -33,6 +33,8 @@ cvar_t	cl_color = {"_cl_color", "0", CVAR_ARCHIVE};
 
 cvar_t	cl_shownet = {"cl_shownet","0",CVAR_NONE};	// can be 0, 1, or 2
 cvar_t	cl_nolerp = {"cl_nolerp","0",CVAR_NONE};
+cvar_t	cl_interp = {"cl_interp","0",CVAR_ARCHIVE};			// buffer entity positions on remote servers
+cvar_t	cl_interp_delay = {"cl_interp_delay","0",CVAR_ARCHIVE};	// playout delay in ms, 0 = adaptive
 
 cvar_t	cfg_unbindall = {"cfg_unbindall", "1", CVAR_ARCHIVE};
 
@@ -57,12 +59,14 @@ cvar_t	cl_confirmquit = {"cl_confirmquit", "0", CVAR_ARCHIVE};
 client_static_t	cls;
 client_state_t	cl;
 // FIXME: put these on hunk?
-entity_t		cl_static_entities[MAX_STATIC_ENTITIES];
+entity_t		*cl_static_entities;
 lightstyle_t	cl_lightstyle[MAX_LIGHTSTYLES];
 dlight_t		cl_dlights[MAX_DLIGHTS];
+int				cl_numdlights;	// slots handed out since the last clear, none above are in use
 
 entity_t		*cl_entities; //johnfitz -- was a static array, now on hunk
 int				cl_max_edicts; //johnfitz -- only changes when new map loads
+entinterp_t		*cl_entinterp;
 
 int				cl_numvisedicts;
 entity_t		*cl_visedicts[MAX_VISEDICTS];
@@ -107,14 +111,17 @@ void CL_ClearState (void)
 
 // clear other arrays
 	memset (cl_dlights, 0, sizeof(cl_dlights));
+	cl_numdlights = 0;
 	memset (cl_lightstyle, 0, sizeof(cl_lightstyle));
 	memset (cl_temp_entities, 0, sizeof(cl_temp_entities));
 	memset (cl_beams, 0, sizeof(cl_beams));
+	VEC_CLEAR (cl_static_entities);
 
 	//johnfitz -- cl_entities is now dynamically allocated
 	cl_max_edicts = CLAMP (MIN_EDICTS,(int)max_edicts.value,MAX_EDICTS);
 	cl_entities = (entity_t *) Hunk_AllocName (cl_max_edicts*sizeof(entity_t), "cl_entities");
 	//johnfitz
+	cl_entinterp = (entinterp_t *) Hunk_AllocName (cl_max_edicts*sizeof(entinterp_t), "cl_entinterp");
 
 	memset (v_punchangles, 0, sizeof (v_punchangles));
 }
@@ -156,7 +163,7 @@ void CL_Disconnect (void)
 			Host_ShutdownServer(false);
 	}
 
-	cls.demoplayback = cls.timedemo = false;
+	cls.demoplayback = cls.timedemo = cls.timedemo_nodraw = false;
 	cls.demopaused = false;
 	cl.intermission = 0;
 	cl.sendprespawn = false;
@@ -359,7 +366,7 @@ dlight_t *CL_AllocDlight (int key)
 	if (key)
 	{
 		dl = cl_dlights;
-		for (i=0 ; i<MAX_DLIGHTS ; i++, dl++)
+		for (i=0 ; i<cl_numdlights ; i++, dl++)
 		{
 			if (dl->key == key)
 			{
@@ -374,7 +381,7 @@ dlight_t *CL_AllocDlight (int key)
 
 // then look for anything else
 	dl = cl_dlights;
-	for (i=0 ; i<MAX_DLIGHTS ; i++, dl++)
+	for (i=0 ; i<cl_numdlights ; i++, dl++)
 	{
 		if (dl->die < cl.time || dl->spawn > cl.time)
 		{
@@ -386,7 +393,10 @@ dlight_t *CL_AllocDlight (int key)
 		}
 	}
 
-	dl = &cl_dlights[0];
+	if (cl_numdlights < MAX_DLIGHTS)
+		dl = &cl_dlights[cl_numdlights++];
+	else
+		dl = &cl_dlights[0];
 	memset (dl, 0, sizeof(*dl));
 	dl->key = key;
 	dl->color[0] = dl->color[1] = dl->color[2] = 1; //johnfitz -- lit support via lordhavoc
@@ -410,7 +420,7 @@ void CL_DecayLights (void)
 	time = cl.time - cl.oldtime;
 
 	dl = cl_dlights;
-	for (i=0 ; i<MAX_DLIGHTS ; i++, dl++)
+	for (i=0 ; i<cl_numdlights ; i++, dl++)
 	{
 		if (dl->die < cl.time || dl->spawn > cl.time || !dl->radius)
 			continue;
@@ -471,6 +481,172 @@ float	CL_LerpPoint (void)
 	return frac;
 }
 
+/*
+==============================================================================
+
+BUFFERED INTERPOLATION
+
+With cl_interp 1, entities on remote servers are drawn a little in the
+past, interpolating between the buffered snapshots that surround that
+time instead of between the last two messages only. The playout delay
+follows the measured server frame interval, jitter and loss, so a late
+or dropped packet no longer makes everything snap or stall.
+==============================================================================
+*/
+
+#define INTERP_MAXDELAY		0.25	// seconds
+
+/*
+===============
+CL_InterpArrival
+
+Called for every svc_time, measures packet timing
+===============
+*/
+void CL_InterpArrival (void)
+{
+	float	interval, arrival;
+
+	interval = cl.mtime[0] - cl.interp_lastmtime;
+	if (cl.interp_lastrecv > 0.0 && interval > 0.f && interval < 0.5f)
+	{
+		if (!cl.interp_interval)
+			cl.interp_interval = interval;
+
+		// a gap much longer than usual means server frames went missing
+		cl.interp_loss += ((interval > cl.interp_interval * 1.5f ? 1.f : 0.f) - cl.interp_loss) * 0.0625f;
+		if (interval <= cl.interp_interval * 1.5f)
+			cl.interp_interval += (interval - cl.interp_interval) * 0.0625f;
+
+		arrival = realtime - cl.interp_lastrecv;
+		cl.interp_jitter += (fabs (arrival - interval) - cl.interp_jitter) * 0.0625f;
+	}
+
+	cl.interp_lastrecv = realtime;
+	cl.interp_lastmtime = cl.mtime[0];
+}
+
+/*
+===============
+CL_AddEntitySnapshot
+
+Called after every entity update
+===============
+*/
+void CL_AddEntitySnapshot (int num, qboolean reset)
+{
+	entity_t		*ent = &cl_entities[num];
+	entinterp_t		*interp = &cl_entinterp[num];
+	entsnapshot_t	*snap;
+
+	if (reset || (interp->count && cl.mtime[0] < interp->snapshots[interp->head].time))
+		interp->count = 0;
+
+	// a second update for the same server frame replaces the first one
+	if (!interp->count || cl.mtime[0] > interp->snapshots[interp->head].time)
+	{
+		interp->head = (interp->head + 1) & (MAX_INTERP_SNAPSHOTS - 1);
+		interp->count = q_min (interp->count + 1, MAX_INTERP_SNAPSHOTS);
+	}
+
+	snap = &interp->snapshots[interp->head];
+	snap->time = cl.mtime[0];
+	VectorCopy (ent->msg_origins[0], snap->origin);
+	VectorCopy (ent->msg_angles[0], snap->angles);
+}
+
+/*
+===============
+CL_UpdateInterpTime
+
+Advances the interpolation clock, steering it towards the estimated
+server time minus the playout delay
+===============
+*/
+static void CL_UpdateInterpTime (void)
+{
+	float	target;
+	double	now;
+
+	if (cl_interp_delay.value > 0.f)
+		target = cl_interp_delay.value / 1000.f;
+	else
+		target = cl.interp_interval * (1.f + q_min (cl.interp_loss * 10.f, 1.f)) + 2.5f * cl.interp_jitter;
+	target = CLAMP (0.f, target, INTERP_MAXDELAY);
+	cl.interp_delay += (target - cl.interp_delay) * q_min (host_frametime * 2.0, 1.0);
+
+	now = cl.mtime[0] + (realtime - cl.interp_lastrecv) - cl.interp_delay;
+	cl.interp_time += host_frametime;
+	if (fabs (now - cl.interp_time) > INTERP_MAXDELAY)
+		cl.interp_time = now;	// too far off to steer smoothly (e.g. first frame)
+	else
+		cl.interp_time += (now - cl.interp_time) * q_min (host_frametime * 4.0, 1.0);
+}
+
+/*
+===============
+CL_InterpEntity
+
+Positions the entity at cl.interp_time, returns false if there aren't
+enough snapshots yet
+===============
+*/
+static qboolean CL_InterpEntity (int num, entity_t *ent)
+{
+	entinterp_t		*interp = &cl_entinterp[num];
+	entsnapshot_t	*from, *to;
+	int				i, j;
+	float			f, d;
+
+	if (interp->count < 2)
+		return false;
+
+	// find the two snapshots around interp_time, holding the
+	// newest/oldest one rather than extrapolating past the ends
+	to = &interp->snapshots[interp->head];
+	from = to;
+	for (i = 1; i < interp->count && from->time > cl.interp_time; i++)
+	{
+		to = from;
+		from = &interp->snapshots[(interp->head - i) & (MAX_INTERP_SNAPSHOTS - 1)];
+	}
+
+	if (from == to || cl.interp_time <= from->time)
+		f = 0.f;
+	else
+		f = q_min ((cl.interp_time - from->time) / (to->time - from->time), 1.0);
+
+	for (j = 0; j < 3; j++)
+	{
+		if (fabs (to->origin[j] - from->origin[j]) > 100)
+		{
+			f = cl.interp_time >= to->time ? 1.f : 0.f;	// teleport, don't lerp
+			ent->lerpflags |= LERP_RESETMOVE;
+			break;
+		}
+	}
+
+	//don't cl_lerp entities that will be r_lerped
+	if (r_lerpmove.value && (ent->lerpflags & LERP_MOVESTEP))
+		f = f < 1.f ? 0.f : 1.f;
+	if (cl_nolerp.value)
+		f = 1.f;
+
+	for (j = 0; j < 3; j++)
+	{
+		ent->origin[j] = from->origin[j] + f * (to->origin[j] - from->origin[j]);
+
+		d = to->angles[j] - from->angles[j];
+		if (d > 180)
+			d -= 360;
+		else if (d < -180)
+			d += 360;
+		ent->angles[j] = from->angles[j] + f * d;
+	}
+
+	return true;
+}
+
 /*
 ===============
 CL_ResetTrail
@@ -498,6 +674,92 @@ static void CL_RocketTrail (entity_t *ent, int type)
 	CL_ResetTrail (ent);
 }
 
+typedef struct lerpjob_s
+{
+	float		frac;
+	float		bobjrotate;
+	qboolean	buffered;
+} lerpjob_t;
+
+/*
+===============
+CL_LerpEntityTask
+
+Moves a single entity to its interpolated position, only touching
+that entity so it can run on any thread
+===============
+*/
+static void CL_LerpEntityTask (int index, void *param)
+{
+	lerpjob_t	*job = (lerpjob_t *) param;
+	int			i = index + 1; // start on the entity after the world
+	entity_t	*ent = &cl_entities[i];
+	int			j;
+	float		f, d;
+	vec3_t		delta;
+
+	if (!ent->model)
+	{	// empty slot
+
+		// ericw -- efrags are only used for static entities in GLQuake
+		// ent can't be static, so this is a no-op.
+		//if (ent->forcelink)
+		//	R_RemoveEfrags (ent);	// just became empty
+		return;
+	}
+
+// if the object wasn't included in the last packet, remove it
+	if (ent->msgtime != cl.mtime[0])
+	{
+		ent->model = NULL;
+		ent->lerpflags |= LERP_RESETMOVE|LERP_RESETANIM; //johnfitz -- next time this entity slot is reused, the lerp will need to be reset
+		return;
+	}
+
+	if (ent->forcelink)
+	{	// the entity was not updated in the last message
+		// so move to the final spot
+		VectorCopy (ent->msg_origins[0], ent->origin);
+		VectorCopy (ent->msg_angles[0], ent->angles);
+	}
+	// the player's own entity isn't buffered, to keep the view responsive
+	else if (!job->buffered || i == cl.viewentity || !CL_InterpEntity (i, ent))
+	{	// if the delta is large, assume a teleport and don't lerp
+		f = job->frac;
+		for (j=0 ; j<3 ; j++)
+		{
+			delta[j] = ent->msg_origins[0][j] - ent->msg_origins[1][j];
+			if (delta[j] > 100 || delta[j] < -100)
+			{
+				f = 1;		// assume a teleportation, not a motion
+				ent->lerpflags |= LERP_RESETMOVE; //johnfitz -- don't lerp teleports
+			}
+		}
+
+		//johnfitz -- don't cl_lerp entities that will be r_lerped
+		if (r_lerpmove.value && (ent->lerpflags & LERP_MOVESTEP))
+			f = 1;
+		//johnfitz
+
+	// interpolate the origin and angles
+		for (j=0 ; j<3 ; j++)
+		{
+			ent->origin[j] = ent->msg_origins[1][j] + f*delta[j];
+
+			d = ent->msg_angles[0][j] - ent->msg_angles[1][j];
+			if (d > 180)
+				d -= 360;
+			else if (d < -180)
+				d += 360;
+			ent->angles[j] = ent->msg_angles[1][j] + f*d;
+		}
+	}
+
+// rotate binary objects locally
+	if (ent->model->flags & EF_ROTATE)
+		ent->angles[1] = job->bobjrotate;
+}
+
 /*
 ===============
 CL_RelinkEntities
@@ -507,14 +769,20 @@ void CL_RelinkEntities (void)
 {
 	entity_t	*ent;
 	int			i, j;
-	float		frac, f, d;
-	vec3_t		delta;
+	float		frac, d;
 	float		bobjrotate;
 	dlight_t	*dl;
+	qboolean	buffered;
+	lerpjob_t	job;
 
 // determine partial update time
 	frac = CL_LerpPoint ();
 
+// local games and demos have no jitter to hide
+	buffered = cl_interp.value && !sv.active && !cls.demoplayback;
+	if (buffered)
+		CL_UpdateInterpTime ();
+
 	cl_numvisedicts = 0;
 
 //
@@ -542,72 +810,22 @@ void CL_RelinkEntities (void)
 
 	bobjrotate = anglemod(100*cl.time);
 
+// move the entities on the worker pool, the effects below spawn
+// particles and dlights and stay on the main thread
+	job.frac = frac;
+	job.buffered = buffered;
+	job.bobjrotate = bobjrotate;
+	Tasks_ParallelFor (cl.num_entities - 1, CL_LerpEntityTask, &job);
+
 // start on the entity after the world
 	for (i=1,ent=cl_entities+1 ; i<cl.num_entities ; i++,ent++)
 	{
 		if (!ent->model)
-		{	// empty slot
-			
-			// ericw -- efrags are only used for static entities in GLQuake
-			// ent can't be static, so this is a no-op.
-			//if (ent->forcelink)
-			//	R_RemoveEfrags (ent);	// just became empty
-			continue;
-		}
-
-// if the object wasn't included in the last packet, remove it
-		if (ent->msgtime != cl.mtime[0])
-		{
-			ent->model = NULL;
-			ent->lerpflags |= LERP_RESETMOVE|LERP_RESETANIM; //johnfitz -- next time this entity slot is reused, the lerp will need to be reset
-			continue;
-		}
-
-		if (ent->forcelink)
-		{	// the entity was not updated in the last message
-			// so move to the final spot
-			VectorCopy (ent->msg_origins[0], ent->origin);
-			VectorCopy (ent->msg_angles[0], ent->angles);
-		}
-		else
-		{	// if the delta is large, assume a teleport and don't lerp
-			f = frac;
-			for (j=0 ; j<3 ; j++)
-			{
-				delta[j] = ent->msg_origins[0][j] - ent->msg_origins[1][j];
-				if (delta[j] > 100 || delta[j] < -100)
-				{
-					f = 1;		// assume a teleportation, not a motion
-					ent->lerpflags |= LERP_RESETMOVE; //johnfitz -- don't lerp teleports
-				}
-			}
-
-			//johnfitz -- don't cl_lerp entities that will be r_lerped
-			if (r_lerpmove.value && (ent->lerpflags & LERP_MOVESTEP))
-				f = 1;
-			//johnfitz
-
-		// interpolate the origin and angles
-			for (j=0 ; j<3 ; j++)
-			{
-				ent->origin[j] = ent->msg_origins[1][j] + f*delta[j];
-
-				d = ent->msg_angles[0][j] - ent->msg_angles[1][j];
-				if (d > 180)
-					d -= 360;
-				else if (d < -180)
-					d += 360;
-				ent->angles[j] = ent->msg_angles[1][j] + f*d;
-			}
-		}
+			continue;	// empty slot, or just removed
 
 		if (ent->forcelink || ent->lerpflags & LERP_RESETMOVE)
 			CL_ResetTrail (ent);
 
-// rotate binary objects locally
-		if (ent->model->flags & EF_ROTATE)
-			ent->angles[1] = bobjrotate;
-
 		if (ent->effects & EF_BRIGHTFIELD)
 			R_EntityParticles (ent);
 
@@ -769,7 +987,7 @@ int CL_ReadFromServer (void)
 	dev_peakstats.beams = q_max(num_beams, dev_peakstats.beams);
 
 	//dlights
-	for (i=0, l=cl_dlights ; i<MAX_DLIGHTS ; i++, l++)
+	for (i=0, l=cl_dlights ; i<cl_numdlights ; i++, l++)
 		if (l->die >= cl.time && l->spawn <= cl.time && l->radius)
 			num_dlights++;
 	if (num_dlights > 32 && dev_peakstats.dlights <= 32)
@@ -1017,6 +1235,8 @@ void CL_Init (void)
 	Cvar_RegisterVariable (&cl_anglespeedkey);
 	Cvar_RegisterVariable (&cl_shownet);
 	Cvar_RegisterVariable (&cl_nolerp);
+	Cvar_RegisterVariable (&cl_interp);
+	Cvar_RegisterVariable (&cl_interp_delay);
 	Cvar_RegisterVariable (&freelook);
 	Cvar_RegisterVariable (&lookspring);
 	Cvar_RegisterVariable (&lookstrafe);
@@ -1038,6 +1258,8 @@ void CL_Init (void)
 
 	Cvar_RegisterVariable (&cl_startdemos);
 	Cvar_RegisterVariable (&cl_confirmquit);
+	Cvar_RegisterVariable (&cl_demokeyframes);
+	Cvar_RegisterVariable (&cl_democompress);
 
 	Cmd_AddCommand ("entities", CL_PrintEntities_f);
 	Cmd_AddCommand ("disconnect", CL_Disconnect_f);
@@ -1045,6 +1267,9 @@ void CL_Init (void)
 	Cmd_AddCommand ("stop", CL_Stop_f);
 	Cmd_AddCommand ("playdemo", CL_PlayDemo_f);
 	Cmd_AddCommand ("timedemo", CL_TimeDemo_f);
+	Cmd_AddCommand ("timedemo_nodraw", CL_TimeDemoNoDraw_f);
+	Cmd_AddCommand ("democompress", CL_DemoCompress_f);
+	Cmd_AddCommand ("demoseek", CL_DemoSeek_f);
 
 	Cmd_AddCommand ("tracepos", CL_Tracepos_f); //johnfitz
 	cmd = Cmd_AddCommand ("viewpos", CL_Viewpos_f); //johnfitz
@@ -100,6 +100,16 @@ const char *svc_strings[] =
 };
 #define NUM_SVC_STRINGS Q_COUNTOF(svc_strings)
 
+// per-command decode cost, gathered by timedemo_nodraw
+typedef struct
+{
+	double		time;
+	int			count;
+	int			bytes;
+} svcprofile_t;
+
+static svcprofile_t	svc_profile[NUM_SVC_STRINGS + 1];	// last slot is fast entity updates
+
 qboolean warn_about_nehahra_protocol; //johnfitz
 
 extern vec3_t	v_punchangles[2]; //johnfitz
@@ -460,6 +470,7 @@ void CL_ParseUpdate (int bits)
 	int		num;
 	int		skin;
 	int		prevframe;
+	qboolean	newent;
 
 	if (cls.signon == SIGNONS - 1)
 	{	// first update is the final signon stage
@@ -495,6 +506,9 @@ void CL_ParseUpdate (int bits)
 	else
 		forcelink = false;
 
+	// the interpolation buffer survives a few dropped packets, but not slot reuse
+	newent = !ent->model || ent->msgtime + 0.5 < cl.mtime[0];
+
 	//johnfitz -- lerping
 	if (ent->msgtime + 0.2 < cl.mtime[0]) //more than 0.2 seconds since the last message (most entities think every 0.1 sec)
 		ent->lerpflags |= LERP_RESETANIM; //if we missed a think, we'd be lerping from the wrong frame
@@ -668,6 +682,8 @@ void CL_ParseUpdate (int bits)
 		VectorCopy (ent->msg_angles[0], ent->angles);
 		ent->forcelink = true;
 	}
+
+	CL_AddEntitySnapshot (num, newent || !ent->model);
 }
 
 /*
@@ -933,13 +949,11 @@ CL_ParseStatic
 void CL_ParseStatic (int version) //johnfitz -- added a parameter
 {
 	entity_t *ent;
-	int		i;
-
-	i = cl.num_statics;
-	if (i >= MAX_STATIC_ENTITIES)
-		Host_Error ("Too many static entities");
 
-	ent = &cl_static_entities[i];
+	// the array may move, so nothing should keep pointers to statics across frames
+	Vec_Grow ((void **) &cl_static_entities, sizeof (cl_static_entities[0]), 1);
+	ent = &cl_static_entities[VEC_HEADER (cl_static_entities).size++];
+	memset (ent, 0, sizeof (*ent));
 	cl.num_statics++;
 	CL_ParseBaseline (ent, version); //johnfitz -- added second parameter
 
@@ -1072,6 +1086,9 @@ void CL_ParseServerMessage (void)
 	int			i;
 	const char		*str; //johnfitz
 	int			lastcmd; //johnfitz
+	qboolean	profile;
+	int			profslot, profofs;
+	double		proftime, now;
 
 //
 // if recording demos, copy the message out
@@ -1089,12 +1106,34 @@ void CL_ParseServerMessage (void)
 	MSG_BeginReading ();
 
 	lastcmd = 0;
+	profile = cls.timedemo_nodraw;
+	profslot = -1;
+	profofs = 0;
+	proftime = profile ? Sys_DoubleTime () : 0.0;
 	while (1)
 	{
+	// charge the time and bytes since the last command to it
+		if (profile)
+		{
+			now = Sys_DoubleTime ();
+			if (profslot >= 0)
+			{
+				svc_profile[profslot].time += now - proftime;
+				svc_profile[profslot].bytes += msg_readcount - profofs;
+				svc_profile[profslot].count++;
+			}
+			proftime = now;
+			profofs = msg_readcount;
+		}
+
 		if (msg_badread)
 			Host_Error ("CL_ParseServerMessage: Bad server message");
 
 		cmd = MSG_ReadByte ();
+		if (cmd & U_SIGNAL)
+			profslot = NUM_SVC_STRINGS;
+		else
+			profslot = cmd < (int)NUM_SVC_STRINGS ? cmd : -1;
 
 		if (cmd == -1)
 		{
@@ -1135,6 +1174,7 @@ void CL_ParseServerMessage (void)
 			cl.mtime[1] = cl.mtime[0];
 			cl.mtime[0] = MSG_ReadFloat ();
 			cl.fixangle = false;
+			CL_InterpArrival ();
 			break;
 
 		case svc_clientdata:
@@ -1270,7 +1310,7 @@ void CL_ParseServerMessage (void)
 			if (i == 2)
 			{
 				if (cl.num_statics > 128)
-					Con_DWarning ("%i static entities exceeds standard limit of 128 (max = %d).\n", cl.num_statics, MAX_STATIC_ENTITIES);
+					Con_DWarning ("%i static entities exceeds standard limit of 128.\n", cl.num_statics);
 				R_CheckEfrags ();
 			}
 			//johnfitz
@@ -1388,3 +1428,53 @@ void CL_ParseServerMessage (void)
 	}
 }
 
+/*
+=====================
+CL_ResetSvcProfile
+=====================
+*/
+void CL_ResetSvcProfile (void)
+{
+	memset (svc_profile, 0, sizeof (svc_profile));
+}
+
+static int CL_CmpSvcProfile (const void *a, const void *b)
+{
+	double ta = svc_profile[*(const int *)a].time;
+	double tb = svc_profile[*(const int *)b].time;
+	return (ta < tb) - (ta > tb);
+}
+
+/*
+=====================
+CL_PrintSvcProfile
+
+Prints per-command decode cost, most expensive first
+=====================
+*/
+void CL_PrintSvcProfile (double totaltime)
+{
+	int		order[NUM_SVC_STRINGS + 1];
+	int		i, count;
+	const svcprofile_t *p;
+
+	for (i = count = 0; i < (int)countof (order); i++)
+		if (svc_profile[i].count)
+			order[count++] = i;
+	if (!count)
+		return;
+	qsort (order, count, sizeof (order[0]), CL_CmpSvcProfile);
+
+	if (totaltime <= 0.0)
+		totaltime = 1.0;
+
+	Con_Printf ("command               count      bytes       ms  us/cmd     %%\n");
+	for (i = 0; i < count; i++)
+	{
+		p = &svc_profile[order[i]];
+		Con_Printf ("%-18s %8i %10i %8.2f %7.2f %5.1f\n",
+			order[i] == NUM_SVC_STRINGS ? "fast update" : svc_strings[order[i]],
+			p->count, p->bytes, p->time * 1000.0, p->time * 1e6 / p->count,
+			100.0 * p->time / totaltime);
+	}
+}
@@ -65,7 +65,7 @@ extern cshift_t		cshift_empty;
 
 #define	SIGNONS		4			// signon messages to receive before connected
 
-#define	MAX_DLIGHTS		64 //johnfitz -- was 32
+#define	MAX_DLIGHTS		4096 //johnfitz -- was 32
 typedef struct
 {
 	vec3_t	origin;
@@ -131,7 +131,10 @@ typedef struct
 // (we want to be able to set playback speed to 1/2x, pause, and then resume playback at 1/2x not 1x)
 	float		basedemospeed;
 
+	qboolean	demoseeking;	// fast-forwarding to a demoseek target, no sounds
+
 	qboolean	timedemo;
+	qboolean	timedemo_nodraw;	// decoding a demo without rendering, sounds or frame pacing
 	int		forcetrack;		// -1 = use normal cd track
 	char		demofilename[MAX_OSPATH];
 	FILE		*demofile;
@@ -217,6 +220,15 @@ typedef struct
 	double		oldtime;		// previous cl.time, time-oldtime is used
 								// to decay light values and smooth step ups
 
+// buffered entity interpolation (cl_interp)
+	double		interp_time;		// server time entities are drawn at
+	double		interp_lastrecv;	// realtime of the last svc_time
+	double		interp_lastmtime;	// server time of the last svc_time
+	float		interp_interval;	// smoothed server frame interval
+	float		interp_jitter;		// smoothed interarrival jitter
+	float		interp_loss;		// smoothed fraction of missing server frames
+	float		interp_delay;		// current playout delay
+
 
 	float		last_received_message;	// (realtime) for net trouble icon
 	float		spawntime;		// time when signon 4 was received
@@ -285,6 +297,8 @@ extern	cvar_t	cl_autofire;
 
 extern	cvar_t	cl_shownet;
 extern	cvar_t	cl_nolerp;
+extern	cvar_t	cl_interp;
+extern	cvar_t	cl_interp_delay;
 
 extern	cvar_t	cfg_unbindall;
 
@@ -304,15 +318,14 @@ extern	cvar_t	cl_confirmquit;
 
 
 #define	MAX_TEMP_ENTITIES	256		//johnfitz -- was 64
-#define	MAX_STATIC_ENTITIES	4096	//ericw -- was 512	//johnfitz -- was 128
 #define	MAX_VISEDICTS		16384	// larger, now we support BSP2
 
 extern	client_state_t	cl;
 
-// FIXME, allocate dynamically
-extern	entity_t		cl_static_entities[MAX_STATIC_ENTITIES];
+extern	entity_t		*cl_static_entities; // dynamic array, cl.num_statics entries
 extern	lightstyle_t	cl_lightstyle[MAX_LIGHTSTYLES];
 extern	dlight_t		cl_dlights[MAX_DLIGHTS];
+extern	int				cl_numdlights;	// dlight slots in use, see CL_AllocDlight
 extern	entity_t		cl_temp_entities[MAX_TEMP_ENTITIES];
 extern	beam_t			cl_beams[MAX_BEAMS];
 extern	entity_t		*cl_visedicts[MAX_VISEDICTS];
@@ -321,6 +334,25 @@ extern	int				cl_numvisedicts;
 extern	entity_t		*cl_entities; //johnfitz -- was a static array, now on hunk
 extern	int				cl_max_edicts; //johnfitz -- only changes when new map loads
 
+// recent positions of every entity, for buffered interpolation
+#define	MAX_INTERP_SNAPSHOTS	8	// must be a power of two
+
+typedef struct
+{
+	double			time;		// server time of the message
+	vec3_t			origin;
+	vec3_t			angles;
+} entsnapshot_t;
+
+typedef struct
+{
+	entsnapshot_t	snapshots[MAX_INTERP_SNAPSHOTS];
+	int				head;		// newest snapshot
+	int				count;
+} entinterp_t;
+
+extern	entinterp_t		*cl_entinterp;	// [cl_max_edicts], on hunk
+
 //=============================================================================
 
 //
@@ -337,6 +369,9 @@ void CL_EstablishConnection (const char *host);
 void CL_Disconnect (void);
 void CL_Disconnect_f (void);
 void CL_NextDemo (void);
+void CL_RelinkEntities (void);
+void CL_InterpArrival (void);
+void CL_AddEntitySnapshot (int num, qboolean reset);
 
 //
 // cl_input
@@ -382,12 +417,21 @@ void CL_Stop_f (void);
 void CL_Record_f (void);
 void CL_PlayDemo_f (void);
 void CL_TimeDemo_f (void);
+void CL_TimeDemoNoDraw_f (void);
+void CL_DemoSeek_f (void);
+void CL_DemoCompress_f (void);
+qfileofs_t CL_DemoTell (void);
+
+extern cvar_t cl_demokeyframes;
+extern cvar_t cl_democompress;
 
 //
 // cl_parse.c
 //
 void CL_ParseServerMessage (void);
 void CL_NewTranslation (int slot);
+void CL_ResetSvcProfile (void);
+void CL_PrintSvcProfile (double totaltime);
 
 //
 // view
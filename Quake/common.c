@@ -1612,10 +1612,10 @@ void COM_Init (void)
 ============
 va
 
-does a varargs printf into a temp buffer. cycles between
-4 different static buffers. the number of buffers cycled
-is defined in VA_NUM_BUFFS.
-FIXME: make this buffer size safe someday
+does a varargs printf into a temp buffer. on the main thread the buffer
+comes from the frame arena, has no length limit and stays valid until the
+end of the frame. other threads cycle between VA_NUM_BUFFS buffers of their
+own.
 ============
 */
 #define	VA_NUM_BUFFS	4
@@ -1623,8 +1623,8 @@ FIXME: make this buffer size safe someday
 
 static char *get_va_buffer(void)
 {
-	static char va_buffers[VA_NUM_BUFFS][VA_BUFFERLEN];
-	static int buffer_idx = 0;
+	static THREAD_LOCAL char va_buffers[VA_NUM_BUFFS][VA_BUFFERLEN];
+	static THREAD_LOCAL int buffer_idx = 0;
 	buffer_idx = (buffer_idx + 1) & (VA_NUM_BUFFS - 1);
 	return va_buffers[buffer_idx];
 }
@@ -1633,13 +1633,33 @@ char *va (const char *format, ...)
 {
 	va_list		argptr;
 	char		*va_buf;
+	size_t		size;
+	int			len;
 
-	va_buf = get_va_buffer ();
-	va_start (argptr, format);
-	q_vsnprintf (va_buf, VA_BUFFERLEN, format, argptr);
-	va_end (argptr);
+	if (!Frame_Available ())
+	{
+		va_buf = get_va_buffer ();
+		va_start (argptr, format);
+		q_vsnprintf (va_buf, VA_BUFFERLEN, format, argptr);
+		va_end (argptr);
+
+		return va_buf;
+	}
 
-	return va_buf;
+	for (size = VA_BUFFERLEN; ; size = q_max ((size_t) len + 1, size * 2))
+	{
+		va_buf = (char *) Frame_Alloc (size);
+		va_start (argptr, format);
+		len = q_vsnprintf (va_buf, size, format, argptr);
+		va_end (argptr);
+
+		if (len >= 0 && (size_t) len < size)
+		{
+			Frame_Shrink (va_buf, len + 1);
+			return va_buf;
+		}
+		Frame_Shrink (va_buf, 0);
+	}
 }
 
 /*
@@ -2564,6 +2584,7 @@ void COM_SwitchGame (const char *paths)
 		Draw_NewGame ();
 		R_NewGame ();
 		BGM_Stop ();
+		S_FlushSounds ();
 	}
 	ExtraMaps_Init ();
 	Host_Resetdemos ();
@@ -829,16 +829,13 @@ qboolean Con_CopySelectionToClipboard (void)
 
 	// Convert to UTF-8
 	maxsize = UTF8_FromQuake (NULL, 0, qtext);
-	utf8 = (char *) malloc (maxsize);
-	if (!utf8)
-		Sys_Error ("Con_CopySelectionToClipboard: out of memory on %" SDL_PRIu64 " bytes", (uint64_t)maxsize);
+	utf8 = (char *) Frame_Alloc (maxsize);
 	UTF8_FromQuake (utf8, maxsize, qtext);
 
 	// Copy the UTF-8 text to clipboard
 	SDL_SetClipboardText (utf8);
 
 	// Clean up temporary buffers
-	free (utf8);
 	VEC_FREE (qtext);
 
 	Con_ClearSelection ();
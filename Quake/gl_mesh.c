@@ -352,10 +352,10 @@ void GLMesh_DeleteVertexBuffers (void)
 		if (!(m = cl.model_precache[j])) break;
 		if (m->type != mod_alias) continue;
 		
-		GL_DeleteBuffersFunc (1, &m->meshvbo);
+		GL_DeleteBuffer (m->meshvbo);
 		m->meshvbo = 0;
 
-		GL_DeleteBuffersFunc (1, &m->meshindexesvbo);
+		GL_DeleteBuffer (m->meshindexesvbo);
 		m->meshindexesvbo = 0;
 	}
 	
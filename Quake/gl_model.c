@@ -530,6 +530,8 @@ void Mod_ClearAll (void)
 			TexMgr_FreeTexturesForOwner (mod); //johnfitz
 		}
 	}
+
+	MemStats_Set (MEM_BSP, 0); // the hunk is about to be freed
 }
 
 void Mod_ResetAll (void)
@@ -547,6 +549,8 @@ void Mod_ResetAll (void)
 		memset(mod, 0, sizeof(qmodel_t));
 	}
 	mod_numknown = 0;
+
+	MemStats_Set (MEM_BSP, 0);
 }
 
 /*
@@ -614,6 +618,7 @@ static qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash)
 {
 	byte	*buf;
 	int		mod_type;
+	int		mark;
 
 	if (!mod->needload)
 	{
@@ -671,7 +676,9 @@ static qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash)
 		break;
 
 	default:
+		mark = Hunk_LowMark ();
 		Mod_LoadBrushModel (mod, buf);
+		MemStats_Add (MEM_BSP, Hunk_LowMark () - mark);
 		break;
 	}
 
@@ -3618,7 +3625,7 @@ static void Mod_LoadAliasModel (qmodel_t *mod, void *buffer)
 	end = Hunk_LowMark ();
 	total = end - start;
 
-	Cache_Alloc (&mod->cache, total, loadname);
+	Cache_Alloc (&mod->cache, CACHE_ALIAS, total, loadname);
 	if (!mod->cache.data)
 		return;
 	memcpy (mod->cache.data, pheader, total);
@@ -4586,7 +4593,7 @@ static void Mod_LoadMD5MeshModel (qmodel_t *mod, const char *buffer)
 	end = Hunk_LowMark ();
 	total = end - start;
 
-	Cache_Alloc (&mod->cache, total, loadname);
+	Cache_Alloc (&mod->cache, CACHE_MD5, total, loadname);
 	if (!mod->cache.data)
 		return;
 	memcpy (mod->cache.data, outhdr, total);
@@ -102,16 +102,6 @@ void R_CheckEfrags (void)
 	dev_peakstats.efrags = q_max(cl.num_efrags, dev_peakstats.efrags);
 }
 
-/*
-===========
-R_ClearEfrags
-===========
-*/
-void R_ClearEfrags (void)
-{
-	VEC_CLEAR (cl_efrags);
-}
-
 /*
 ===========
 R_AddEfrags
@@ -149,34 +139,317 @@ void R_AddEfrags (entity_t *ent)
 	R_CheckEfrags (); //johnfitz
 }
 
+/*
+===============================================================================
+
+					STATIC ENTITY BVH
+
+Static entities never move, so a bounding volume hierarchy is built over them
+once (and again only if more statics are spawned later). Each node also stores
+a coarse mask of the leaves its entities touch: leaf indices are split into
+STATIC_LEAFMASK_BITS buckets, and a node is skipped when none of its buckets
+has a leaf in the current pvs. Only the entities in the nodes that pass the
+frustum and mask tests have their efrag leaves checked against the pvs.
+
+===============================================================================
+*/
+
+#define STATIC_BVH_LEAF_SIZE	4
+#define STATIC_LEAFMASK_WORDS	4
+#define STATIC_LEAFMASK_BITS	(STATIC_LEAFMASK_WORDS * 64)
+
+typedef struct staticbvhnode_s {
+	vec3_t		mins;
+	vec3_t		maxs;
+	uint64_t	leafmask[STATIC_LEAFMASK_WORDS];
+	int			first;		// leaf: first entry in r_staticbvh.ents; inner node: first of the two child nodes
+	int			count;		// leaf: number of entities; inner node: 0
+} staticbvhnode_t;
+
+typedef struct staticbvhent_s {
+	vec3_t		mins;
+	vec3_t		maxs;
+	uint64_t	leafmask[STATIC_LEAFMASK_WORDS];
+	int			efragofs;	// offset of the leaf count in cl_efrags
+	int			index;		// in cl_static_entities
+} staticbvhent_t;
+
+typedef struct staticvisent_s {
+	int			index;
+	int			visleaf;	// first leaf in the pvs + 1
+} staticvisent_t;
+
+static struct {
+	int					numstatics;	// number of statics the tree was built for
+	staticbvhnode_t		*nodes;
+	staticbvhent_t		*ents;
+} r_staticbvh;
+
+static int				r_staticbvh_axis; // for R_CompareStaticEnts
+
 /*
 ===============
-R_AddStaticModels
+R_ClearStaticBVH
 ===============
 */
-void R_AddStaticModels (const byte *vis)
+static void R_ClearStaticBVH (void)
+{
+	VEC_CLEAR (r_staticbvh.nodes);
+	VEC_CLEAR (r_staticbvh.ents);
+	r_staticbvh.numstatics = 0;
+}
+
+/*
+===========
+R_ClearEfrags
+===========
+*/
+void R_ClearEfrags (void)
 {
-	int			i, j, start, leafidx, maxleaf, numleafs, *efrags;
-	entity_t	*ent;
+	VEC_CLEAR (cl_efrags);
+	R_ClearStaticBVH ();
+}
+
+/*
+===============
+R_CompareStaticEnts
+===============
+*/
+static int R_CompareStaticEnts (const void *pa, const void *pb)
+{
+	const staticbvhent_t *a = (const staticbvhent_t *) pa;
+	const staticbvhent_t *b = (const staticbvhent_t *) pb;
+	float ca = a->mins[r_staticbvh_axis] + a->maxs[r_staticbvh_axis];
+	float cb = b->mins[r_staticbvh_axis] + b->maxs[r_staticbvh_axis];
+	return (ca > cb) - (ca < cb);
+}
+
+/*
+===============
+R_BuildStaticBVHNode
+
+Top-down median split along the axis with the largest spread of centers
+===============
+*/
+static void R_BuildStaticBVHNode (int nodeidx, int first, int count)
+{
+	staticbvhnode_t	*node = &r_staticbvh.nodes[nodeidx];
+	staticbvhent_t	*ents = r_staticbvh.ents + first;
+	vec3_t			cmins, cmaxs;
+	int				i, j, child;
+
+	VectorCopy (ents[0].mins, node->mins);
+	VectorCopy (ents[0].maxs, node->maxs);
+	VectorAdd (ents[0].mins, ents[0].maxs, cmins);
+	VectorCopy (cmins, cmaxs);
+	memset (node->leafmask, 0, sizeof (node->leafmask));
+	for (i = 0; i < count; i++)
+	{
+		for (j = 0; j < 3; j++)
+		{
+			float center = ents[i].mins[j] + ents[i].maxs[j];
+			node->mins[j] = q_min (node->mins[j], ents[i].mins[j]);
+			node->maxs[j] = q_max (node->maxs[j], ents[i].maxs[j]);
+			cmins[j] = q_min (cmins[j], center);
+			cmaxs[j] = q_max (cmaxs[j], center);
+		}
+		for (j = 0; j < STATIC_LEAFMASK_WORDS; j++)
+			node->leafmask[j] |= ents[i].leafmask[j];
+	}
+
+	if (count <= STATIC_BVH_LEAF_SIZE)
+	{
+		node->first = first;
+		node->count = count;
+		return;
+	}
+
+	r_staticbvh_axis = 0;
+	for (i = 1; i < 3; i++)
+		if (cmaxs[i] - cmins[i] > cmaxs[r_staticbvh_axis] - cmins[r_staticbvh_axis])
+			r_staticbvh_axis = i;
+	qsort (ents, count, sizeof (ents[0]), R_CompareStaticEnts);
+
+	// the node pointer is invalidated when the vector grows
+	child = VEC_SIZE (r_staticbvh.nodes);
+	Vec_Grow ((void **) &r_staticbvh.nodes, sizeof (r_staticbvh.nodes[0]), 2);
+	VEC_HEADER (r_staticbvh.nodes).size += 2;
+	r_staticbvh.nodes[nodeidx].first = child;
+	r_staticbvh.nodes[nodeidx].count = 0;
+
+	R_BuildStaticBVHNode (child + 0, first, count / 2);
+	R_BuildStaticBVHNode (child + 1, first + count / 2, count - count / 2);
+}
+
+/*
+===============
+R_BuildStaticBVH
+===============
+*/
+static void R_BuildStaticBVH (void)
+{
+	staticbvhent_t	bvhent;
+	entity_t		*ent;
+	const int		*efrags;
+	int				i, j, ofs, numleafs, bucket;
+
+	R_ClearStaticBVH ();
+	r_staticbvh.numstatics = cl.num_statics;
 
-	for (i = maxleaf = 0, start = cl_numvisedicts, ent = cl_static_entities, efrags = cl_efrags; i < cl.num_statics; i++, ent++)
+	// only statics with a model have efrags
+	for (i = ofs = 0, ent = cl_static_entities; i < cl.num_statics; i++, ent++)
 	{
 		if (!ent->model)
 			continue;
+
+		memset (&bvhent, 0, sizeof (bvhent));
+		R_GetEntityBounds (ent, bvhent.mins, bvhent.maxs);
+		bvhent.efragofs = ofs;
+		bvhent.index = i;
+
+		efrags = cl_efrags + ofs;
 		for (j = 0, numleafs = *efrags++; j < numleafs; j++)
 		{
-			leafidx = efrags[j];
-			if ((vis[leafidx >> 3] & (1 << (leafidx & 7))))
+			bucket = (int)((int64_t) efrags[j] * STATIC_LEAFMASK_BITS / cl.worldmodel->numleafs);
+			bvhent.leafmask[bucket >> 6] |= 1ull << (bucket & 63);
+		}
+		ofs += numleafs + 1;
+
+		// statics that aren't in any leaf can never be seen
+		if (numleafs)
+			VEC_PUSH (r_staticbvh.ents, bvhent);
+	}
+
+	if (!VEC_SIZE (r_staticbvh.ents))
+		return;
+
+	Vec_Grow ((void **) &r_staticbvh.nodes, sizeof (r_staticbvh.nodes[0]), 1);
+	VEC_HEADER (r_staticbvh.nodes).size++;
+	R_BuildStaticBVHNode (0, 0, VEC_SIZE (r_staticbvh.ents));
+}
+
+/*
+===============
+R_StaticVisLeaf
+
+Returns the first leaf of the entity that is in the pvs + 1, or 0 if there's none
+===============
+*/
+static int R_StaticVisLeaf (const staticbvhent_t *bvhent, const byte *vis)
+{
+	const int	*efrags = cl_efrags + bvhent->efragofs;
+	int			j, numleafs, leafidx;
+
+	for (j = 0, numleafs = *efrags++; j < numleafs; j++)
+	{
+		leafidx = efrags[j];
+		if (vis[leafidx >> 3] & (1 << (leafidx & 7)))
+			return leafidx + 1;
+	}
+
+	return 0;
+}
+
+/*
+===============
+R_CompareStaticVisEnts
+===============
+*/
+static int R_CompareStaticVisEnts (const void *pa, const void *pb)
+{
+	return ((const staticvisent_t *) pa)->index - ((const staticvisent_t *) pb)->index;
+}
+
+/*
+===============
+R_AddStaticModels
+
+The visible statics are found by walking the bvh, then added in their original order
+===============
+*/
+void R_AddStaticModels (const byte *vis)
+{
+	uint64_t		leafmask[STATIC_LEAFMASK_WORDS];
+	int				stack[64];
+	int				i, j, sp, start, maxleaf, numleafs, numvisible;
+	staticvisent_t	*visible;
+	entity_t		*ent;
+
+	if (!cl.num_statics)
+		return;
+
+	if (r_staticbvh.numstatics != cl.num_statics)
+		R_BuildStaticBVH ();
+	if (!VEC_SIZE (r_staticbvh.nodes))
+		return;
+
+	// mask of the leaf buckets with at least one leaf in the pvs
+	memset (leafmask, 0, sizeof (leafmask));
+	numleafs = cl.worldmodel->numleafs;
+	for (i = 0; i < (numleafs + 7) >> 3; i++)
+	{
+		if (!vis[i])
+			continue;
+		for (j = 0; j < 8; j++)
+		{
+			int leafidx = (i << 3) + j;
+			if (leafidx < numleafs && (vis[i] & (1 << j)))
 			{
-				if (cl_numvisedicts >= MAX_VISEDICTS)
-					return;
-				cl_visedicts[cl_numvisedicts++] = ent;
-				ent->firstleaf = leafidx + 1;
-				maxleaf = q_max (maxleaf, leafidx + 1);
+				int bucket = (int)((int64_t) leafidx * STATIC_LEAFMASK_BITS / numleafs);
+				leafmask[bucket >> 6] |= 1ull << (bucket & 63);
+			}
+		}
+	}
+
+	visible = (staticvisent_t *) Frame_Alloc (VEC_SIZE (r_staticbvh.ents) * sizeof (staticvisent_t));
+	numvisible = 0;
+
+	stack[0] = 0;
+	sp = 1;
+	while (sp > 0)
+	{
+		staticbvhnode_t *node = &r_staticbvh.nodes[stack[--sp]];
+
+		for (j = 0; j < STATIC_LEAFMASK_WORDS; j++)
+			if (node->leafmask[j] & leafmask[j])
 				break;
+		if (j == STATIC_LEAFMASK_WORDS || R_CullBox (node->mins, node->maxs))
+			continue;
+
+		if (node->count)
+		{
+			for (i = 0; i < node->count; i++)
+			{
+				staticbvhent_t *bvhent = &r_staticbvh.ents[node->first + i];
+				int visleaf;
+				if (node->count > 1 && R_CullBox (bvhent->mins, bvhent->maxs))
+					continue;
+				visleaf = R_StaticVisLeaf (bvhent, vis);
+				if (!visleaf)
+					continue;
+				visible[numvisible].index = bvhent->index;
+				visible[numvisible].visleaf = visleaf;
+				numvisible++;
 			}
 		}
-		efrags += numleafs;
+		else
+		{
+			SDL_assert (sp + 2 <= (int) countof (stack));
+			stack[sp++] = node->first + 1;
+			stack[sp++] = node->first;
+		}
+	}
+
+	qsort (visible, numvisible, sizeof (visible[0]), R_CompareStaticVisEnts);
+
+	for (i = maxleaf = 0, start = cl_numvisedicts; i < numvisible; i++)
+	{
+		if (cl_numvisedicts >= MAX_VISEDICTS)
+			return;
+		ent = &cl_static_entities[visible[i].index];
+		cl_visedicts[cl_numvisedicts++] = ent;
+		ent->firstleaf = visible[i].visleaf;
+		maxleaf = q_max (maxleaf, visible[i].visleaf);
 	}
 
 	// reverse order to match QS, if needed
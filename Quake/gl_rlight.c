@@ -29,6 +29,16 @@ extern cvar_t r_dynamic;
 
 gpulightbuffer_t r_lightbuffer;
 
+typedef struct dlightlink_s {
+	int			light;		// index in r_lightbuffer.lights
+	int			next;		// next link in the same leaf, -1 = end
+} dlightlink_t;
+
+static struct {
+	int				*leafhead;	// first link of each leaf, -1 = none
+	dlightlink_t	*links;
+} r_dlightbins;
+
 /*
 ==================
 R_AnimateLight
@@ -92,6 +102,7 @@ DYNAMIC LIGHTS
 */
 
 static GLuint gl_lightclustertexture;
+static GLuint gl_lightindextexture;
 
 typedef struct gpu_cluster_inputs_s {
 	float		transposed_proj[16];
@@ -108,7 +119,17 @@ void GLLight_CreateResources (void)
 	glGenTextures (1, &gl_lightclustertexture);
 	GL_BindNative (GL_TEXTURE0, GL_TEXTURE_3D, gl_lightclustertexture);
 	GL_ObjectLabelFunc (GL_TEXTURE, gl_lightclustertexture, -1, "light clusters");
-	GL_TexImage3DFunc (GL_TEXTURE_3D, 0, GL_RG32UI, LIGHT_TILES_X, LIGHT_TILES_Y, LIGHT_TILES_Z, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, NULL);
+	GL_TexImage3DFunc (GL_TEXTURE_3D, 0, GL_R32UI, LIGHT_TILES_X, LIGHT_TILES_Y, LIGHT_TILES_Z, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+	glTexParameteri (GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri (GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri (GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri (GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+	// MAX_CLUSTER_LIGHTS light indices for each cluster, stored side by side along x
+	glGenTextures (1, &gl_lightindextexture);
+	GL_BindNative (GL_TEXTURE0, GL_TEXTURE_3D, gl_lightindextexture);
+	GL_ObjectLabelFunc (GL_TEXTURE, gl_lightindextexture, -1, "light cluster indices");
+	GL_TexImage3DFunc (GL_TEXTURE_3D, 0, GL_R16UI, LIGHT_TILES_X * MAX_CLUSTER_LIGHTS, LIGHT_TILES_Y, LIGHT_TILES_Z, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, NULL);
 	glTexParameteri (GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, 0);
 	glTexParameteri (GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
 	glTexParameteri (GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -124,62 +145,226 @@ void GLLight_DeleteResources (void)
 {
 	glDeleteTextures (1, &gl_lightclustertexture);
 	gl_lightclustertexture = 0;
+	glDeleteTextures (1, &gl_lightindextexture);
+	gl_lightindextexture = 0;
 }
 
 /*
 =============
-R_PushDlights
+R_DlightTouchesVisibleLeaf
+
+Walks the world bsp with the light's bounding sphere,
+stopping at the first non-solid leaf that is in the pvs
 =============
 */
-void R_PushDlights (void)
+static qboolean R_DlightTouchesVisibleLeaf (mnode_t *node, const vec3_t origin, float radius, const byte *vis)
 {
-	int				i, j;
-	GLuint			buf;
-	GLbyte			*ofs;
-	gpu_cluster_inputs_t cluster_inputs;
+	mplane_t	*plane;
+	float		dist;
+	int			leafidx;
+
+	while (node->contents >= 0)
+	{
+		plane = node->plane;
+		if (plane->type < 3)
+			dist = origin[plane->type] - plane->dist;
+		else
+			dist = DotProduct (origin, plane->normal) - plane->dist;
+		if (dist > radius)
+			node = node->children[0];
+		else if (dist < -radius)
+			node = node->children[1];
+		else
+		{
+			if (R_DlightTouchesVisibleLeaf (node->children[0], origin, radius, vis))
+				return true;
+			node = node->children[1];
+		}
+	}
+
+	if (node->contents == CONTENTS_SOLID)
+		return false;
+
+	leafidx = (mleaf_t *)node - cl.worldmodel->leafs - 1;
+	return leafidx >= 0 && (vis[leafidx >> 3] & (1 << (leafidx & 7)));
+}
+
+/*
+=============
+R_BinDlight
+
+Links the light to every non-solid leaf its bounding sphere reaches
+=============
+*/
+static void R_BinDlight (mnode_t *node, const vec3_t origin, float radius, int light)
+{
+	mplane_t	*plane;
+	float		dist;
+	int			leafidx;
+	dlightlink_t link;
+
+	while (node->contents >= 0)
+	{
+		plane = node->plane;
+		if (plane->type < 3)
+			dist = origin[plane->type] - plane->dist;
+		else
+			dist = DotProduct (origin, plane->normal) - plane->dist;
+		if (dist > radius)
+			node = node->children[0];
+		else if (dist < -radius)
+			node = node->children[1];
+		else
+		{
+			R_BinDlight (node->children[0], origin, radius, light);
+			node = node->children[1];
+		}
+	}
+
+	if (node->contents == CONTENTS_SOLID)
+		return;
+
+	leafidx = (mleaf_t *)node - cl.worldmodel->leafs;
+	link.light = light;
+	link.next = r_dlightbins.leafhead[leafidx];
+	r_dlightbins.leafhead[leafidx] = VEC_SIZE (r_dlightbins.links);
+	VEC_PUSH (r_dlightbins.links, link);
+}
+
+/*
+=============
+R_AddDlightsAtPoint
+
+Adds the light of the culled dlights reaching p, only looking at the ones
+binned to the leaf that contains it
+=============
+*/
+void R_AddDlightsAtPoint (const vec3_t p, vec3_t color)
+{
+	const gpulight_t	*l;
+	mleaf_t				*leaf;
+	vec3_t				dist;
+	float				add;
+	int					i;
+
+	if (!r_framedata.numlights)
+		return;
+
+	leaf = Mod_PointInLeaf ((float *) p, cl.worldmodel);
+	if (leaf->contents == CONTENTS_SOLID)
+	{
+		// origin inside a wall, no bins to go by
+		for (i = 0; i < r_framedata.numlights; i++)
+		{
+			l = &r_lightbuffer.lights[i];
+			VectorSubtract (p, l->pos, dist);
+			add = DotProduct (dist, dist);
+			if (l->radius * l->radius > add)
+				VectorMA (color, l->radius - sqrtf (add), l->color, color);
+		}
+		return;
+	}
+
+	for (i = r_dlightbins.leafhead[leaf - cl.worldmodel->leafs]; i >= 0; i = r_dlightbins.links[i].next)
+	{
+		l = &r_lightbuffer.lights[r_dlightbins.links[i].light];
+		VectorSubtract (p, l->pos, dist);
+		add = DotProduct (dist, dist);
+		if (l->radius * l->radius > add)
+			VectorMA (color, l->radius - sqrtf (add), l->color, color);
+	}
+}
+
+/*
+=============
+R_CullDlights
+
+Coarse cpu binning before the lights are uploaded: only the lights inside the
+view frustum that reach at least one leaf in the pvs are sent to the gpu,
+and binned to the leaves they touch for the per-entity lookups
+=============
+*/
+void R_CullDlights (const byte *vis)
+{
+	int			i, j;
+	dlight_t	*l;
+	gpulight_t	*out;
+
+	COMPILE_TIME_ASSERT (light_indices_must_fit_in_16_bits, MAX_DLIGHTS <= 65536);
 
 	r_framedata.numlights = 0;
+	rs_dlights = rs_culleddlights = rs_hiddendlights = 0;
 
-	if (r_dynamic.value)
+	if (!r_dynamic.value)
+		return;
+
+	if (VEC_SIZE (r_dlightbins.leafhead) != (size_t) cl.worldmodel->numleafs + 1)
 	{
-		dlight_t *l;
-		for (i = 0, l = cl_dlights; i < MAX_DLIGHTS; i++, l++)
+		VEC_CLEAR (r_dlightbins.leafhead);
+		Vec_Grow ((void **) &r_dlightbins.leafhead, sizeof (r_dlightbins.leafhead[0]), cl.worldmodel->numleafs + 1);
+		VEC_HEADER (r_dlightbins.leafhead).size = cl.worldmodel->numleafs + 1;
+	}
+	memset (r_dlightbins.leafhead, 0xff, VEC_SIZE (r_dlightbins.leafhead) * sizeof (r_dlightbins.leafhead[0]));
+	VEC_CLEAR (r_dlightbins.links);
+
+	for (i = 0, l = cl_dlights; i < cl_numdlights; i++, l++)
+	{
+		if (l->spawn > cl.time)
 		{
-			gpulight_t *out;
-			qboolean cull = false;
+			l->die = 0.f;
+			continue;
+		}
 
-			if (l->spawn > cl.time)
-			{
-				l->die = 0.f;
-				continue;
-			}
+		if (l->die < cl.time || !l->radius)
+			continue;
 
-			if (l->die < cl.time || !l->radius)
-				continue;
+		rs_dlights++;
 
-			for (j = 0; j < 4; j++)
-			{
-				mplane_t *p = &frustum[j];
-				if (DotProduct (p->normal, l->origin) - p->dist + l->radius < 0.f)
-				{
-					cull = true;
-					break;
-				}
-			}
-			if (cull)
-				continue;
+		for (j = 0; j < 4; j++)
+		{
+			mplane_t *p = &frustum[j];
+			if (DotProduct (p->normal, l->origin) - p->dist + l->radius < 0.f)
+				break;
+		}
+		if (j < 4)
+		{
+			rs_culleddlights++;
+			continue;
+		}
 
-			out = &r_lightbuffer.lights[r_framedata.numlights++];
-			out->pos[0]   = l->origin[0];
-			out->pos[1]   = l->origin[1];
-			out->pos[2]   = l->origin[2];
-			out->radius   = l->radius;
-			out->color[0] = l->color[0];
-			out->color[1] = l->color[1];
-			out->color[2] = l->color[2];
-			out->minlight = l->minlight;
+		if (!R_DlightTouchesVisibleLeaf (cl.worldmodel->nodes, l->origin, l->radius, vis))
+		{
+			rs_hiddendlights++;
+			continue;
 		}
+
+		R_BinDlight (cl.worldmodel->nodes, l->origin, l->radius, r_framedata.numlights);
+
+		out = &r_lightbuffer.lights[r_framedata.numlights++];
+		out->pos[0]   = l->origin[0];
+		out->pos[1]   = l->origin[1];
+		out->pos[2]   = l->origin[2];
+		out->radius   = l->radius;
+		out->color[0] = l->color[0];
+		out->color[1] = l->color[1];
+		out->color[2] = l->color[2];
+		out->minlight = l->minlight;
 	}
+}
+
+/*
+=============
+R_PushDlights
+
+Uploads the lights kept by R_CullDlights and assigns them to clusters
+=============
+*/
+void R_PushDlights (void)
+{
+	int				i;
+	GLuint			buf;
+	GLbyte			*ofs;
+	gpu_cluster_inputs_t cluster_inputs;
 
 	GL_BeginGroup ("Light clustering");
 
@@ -192,11 +377,13 @@ void R_PushDlights (void)
 	GL_UseProgram (glprogs.cluster_lights);
 	GL_Upload (GL_UNIFORM_BUFFER, &cluster_inputs, sizeof (cluster_inputs), &buf, &ofs);
 	GL_BindBufferRange (GL_UNIFORM_BUFFER, 1, buf, (GLintptr) ofs, sizeof (cluster_inputs));
-	GL_BindImageTextureFunc (0, gl_lightclustertexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RG32UI);
+	GL_BindImageTextureFunc (0, gl_lightclustertexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32UI);
+	GL_BindImageTextureFunc (1, gl_lightindextexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R16UI);
 	GL_DispatchComputeFunc ((LIGHT_TILES_X+7)/8, (LIGHT_TILES_Y+7)/8, LIGHT_TILES_Z);
 	GL_MemoryBarrierFunc (GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 
-	GL_BindImageTextureFunc (0, gl_lightclustertexture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RG32UI);
+	GL_BindImageTextureFunc (0, gl_lightclustertexture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R32UI);
+	GL_BindImageTextureFunc (1, gl_lightindextexture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R16UI);
 
 	GL_EndGroup ();
 }
@@ -210,8 +397,6 @@ LIGHT SAMPLING
 =============================================================================
 */
 
-vec3_t lightcolor; //johnfitz -- lit support via lordhavoc
-
 static void InterpolateLightmap (vec3_t color, msurface_t *surf, int ds, int dt)
 {
 	byte *lightmap;
@@ -356,9 +541,11 @@ loc0:
 /*
 =============
 R_LightPoint -- johnfitz -- replaced entire function for lit support via lordhavoc
+
+Safe to call from worker threads, as long as each uses its own cache
 =============
 */
-int R_LightPoint (vec3_t p, float ofs, lightcache_t *cache)
+int R_LightPoint (vec3_t p, float ofs, lightcache_t *cache, vec3_t lightcolor)
 {
 	vec3_t		start, end;
 	float		maxdist = 8192.f; //johnfitz -- was 2048
@@ -394,3 +581,348 @@ int R_LightPoint (vec3_t p, float ofs, lightcache_t *cache)
 
 	return ((lightcolor[0] + lightcolor[1] + lightcolor[2]) * (1.0f / 3.0f));
 }
+
+/*
+=============================================================================
+
+LIGHT GRID
+
+A sparse grid of light probes, baked from the lightmaps at map load.
+The grid is split into bricks of LIGHTGRID_BRICK^3 probes, and bricks that
+are entirely in solid space aren't stored. Each probe keeps the light of up
+to MAXLIGHTMAPS styles so animated lightstyles still work, and a brick only
+stores as many styles per probe as its busiest probe uses. Lookups blend the
+8 nearest probes, skipping the ones inside walls, both here and in the alias
+vertex shader.
+
+=============================================================================
+*/
+
+#define LIGHTGRID_SPACING		32.f
+#define LIGHTGRID_BRICK			4
+#define LIGHTGRID_BRICKPROBES	(LIGHTGRID_BRICK * LIGHTGRID_BRICK * LIGHTGRID_BRICK)
+#define LIGHTGRID_PROBEWORDS	(1 + MAXLIGHTMAPS)	// packed styles, then one rgb color per style
+#define LIGHTGRID_MAXBRICKS		(1 << 18)
+#define LIGHTGRID_MAXFILLED		8192				// at most 10 MB of probes, and 512k traces to bake them
+#define LIGHTGRID_VALID			(1u << 24)			// set in the first color of probes outside solid space
+
+typedef struct lightgridheader_s {
+	vec3_t		origin;
+	float		scale;			// 1 / spacing
+	int			bricks[3];		// the probes follow right after, no padding
+} lightgridheader_t;
+
+static struct {
+	lightgridheader_t	header;
+	uint32_t			*data;		// brick entries (0 = empty, else probe offset << 3 | styles), followed by the probes
+	int					*filled;	// index of each stored brick
+	uint32_t			*baked;		// LIGHTGRID_PROBEWORDS per probe while baking
+	int					*numstyles;	// styles stored per probe of each filled brick
+	int					numbricks;
+	float				spacing;
+	GLuint				buffer;
+	size_t				buffersize;
+} lightgrid;
+
+/*
+=============
+R_LightGridProbeOrigin
+=============
+*/
+static void R_LightGridProbeOrigin (int brick, int probe, vec3_t pos)
+{
+	const int *bricks = lightgrid.header.bricks;
+	int x = (brick % bricks[0]) * LIGHTGRID_BRICK + probe % LIGHTGRID_BRICK;
+	int y = (brick / bricks[0] % bricks[1]) * LIGHTGRID_BRICK + probe / LIGHTGRID_BRICK % LIGHTGRID_BRICK;
+	int z = (brick / (bricks[0] * bricks[1])) * LIGHTGRID_BRICK + probe / (LIGHTGRID_BRICK * LIGHTGRID_BRICK);
+
+	pos[0] = lightgrid.header.origin[0] + x * lightgrid.spacing;
+	pos[1] = lightgrid.header.origin[1] + y * lightgrid.spacing;
+	pos[2] = lightgrid.header.origin[2] + z * lightgrid.spacing;
+}
+
+/*
+=============
+R_FindLightGridBricksTask
+
+Flags the bricks that have at least one probe outside solid space
+=============
+*/
+static void R_FindLightGridBricksTask (int index, void *param)
+{
+	vec3_t	pos;
+	int		i;
+
+	lightgrid.data[index] = 0;
+	for (i = 0; i < LIGHTGRID_BRICKPROBES; i++)
+	{
+		R_LightGridProbeOrigin (index, i, pos);
+		if (Mod_PointInLeaf (pos, cl.worldmodel)->contents != CONTENTS_SOLID)
+		{
+			lightgrid.data[index] = 1;
+			return;
+		}
+	}
+}
+
+/*
+=============
+R_SampleLightmapStyles
+
+Like InterpolateLightmap, but keeps each style separate
+=============
+*/
+static void R_SampleLightmapStyles (uint32_t *probe, msurface_t *surf, int ds, int dt)
+{
+	byte *lightmap;
+	int maps, c, line3, dsfrac = ds & 15, dtfrac = dt & 15, top, bottom;
+	line3 = ((surf->extents[0]>>4)+1)*3;
+
+	lightmap = surf->samples + ((dt>>4) * ((surf->extents[0]>>4)+1) + (ds>>4))*3;
+
+	for (maps = 0;maps < MAXLIGHTMAPS && surf->styles[maps] != 255;maps++)
+	{
+		probe[0] &= ~(255u << (maps * 8));
+		probe[0] |= (uint32_t) surf->styles[maps] << (maps * 8);
+		for (c = 0; c < 3; c++)
+		{
+			top = lightmap[c] + (((lightmap[c+3] - lightmap[c]) * dsfrac) >> 4);
+			bottom = lightmap[line3+c] + (((lightmap[line3+c+3] - lightmap[line3+c]) * dsfrac) >> 4);
+			probe[1 + maps] |= (uint32_t) (top + (((bottom - top) * dtfrac) >> 4)) << (c * 8);
+		}
+		lightmap += ((surf->extents[0]>>4)+1) * ((surf->extents[1]>>4)+1)*3;
+	}
+}
+
+/*
+=============
+R_BakeLightGridBrickTask
+
+Traces down from each probe of a brick like R_LightPoint does
+=============
+*/
+static void R_BakeLightGridBrickTask (int index, void *param)
+{
+	int			brick = lightgrid.filled[index];
+	uint32_t	*probe = lightgrid.baked + index * LIGHTGRID_BRICKPROBES * LIGHTGRID_PROBEWORDS;
+	lightcache_t cache;
+	vec3_t		start, end;
+	float		maxdist;
+	int			i, styles, numstyles = 1;
+
+	for (i = 0; i < LIGHTGRID_BRICKPROBES; i++, probe += LIGHTGRID_PROBEWORDS)
+	{
+		memset (probe, 0, LIGHTGRID_PROBEWORDS * sizeof (probe[0]));
+		probe[0] = 0xffffffffu; // no styles
+
+		R_LightGridProbeOrigin (brick, i, start);
+		if (Mod_PointInLeaf (start, cl.worldmodel)->contents == CONTENTS_SOLID)
+			continue;
+		probe[1] = LIGHTGRID_VALID;
+
+		VectorCopy (start, end);
+		end[2] -= 8192.f;
+		maxdist = 8192.f;
+		memset (&cache, 0, sizeof (cache));
+		RecursiveLightPoint (&cache, cl.worldmodel->nodes, start, start, end, &maxdist);
+		if (cache.surfidx > 0)
+			R_SampleLightmapStyles (probe, cl.worldmodel->surfaces + cache.surfidx - 1, cache.ds, cache.dt);
+
+		for (styles = 0; styles < MAXLIGHTMAPS && ((probe[0] >> (styles * 8)) & 255) != 255; styles++)
+			;
+		numstyles = q_max (numstyles, styles);
+	}
+
+	lightgrid.numstyles[index] = numstyles;
+}
+
+/*
+=============
+R_BuildLightGrid
+=============
+*/
+void R_BuildLightGrid (void)
+{
+	lightgridheader_t	*header = &lightgrid.header;
+	double				time = Sys_DoubleTime ();
+	const uint32_t		*src;
+	uint32_t			*dst;
+	int					i, j, numfilled, numwords, stride;
+
+	VEC_CLEAR (lightgrid.data);
+	VEC_CLEAR (lightgrid.filled);
+	lightgrid.numbricks = 0;
+
+	if (!cl.worldmodel->lightdata)
+		return;
+
+	VectorCopy (cl.worldmodel->mins, header->origin);
+
+	// coarser grids for very large or very open maps
+	lightgrid.spacing = LIGHTGRID_SPACING;
+	do
+	{
+		for (i = 0; i < 3; i++)
+		{
+			int numprobes = (int) ceil ((cl.worldmodel->maxs[i] - cl.worldmodel->mins[i]) / lightgrid.spacing) + 1;
+			header->bricks[i] = (numprobes + LIGHTGRID_BRICK - 1) / LIGHTGRID_BRICK;
+		}
+		lightgrid.numbricks = header->bricks[0] * header->bricks[1] * header->bricks[2];
+		if (lightgrid.numbricks > LIGHTGRID_MAXBRICKS)
+		{
+			lightgrid.spacing *= 2.f;
+			continue;
+		}
+
+		VEC_CLEAR (lightgrid.data);
+		Vec_Grow ((void **) &lightgrid.data, sizeof (lightgrid.data[0]), lightgrid.numbricks);
+		VEC_HEADER (lightgrid.data).size = lightgrid.numbricks;
+		Tasks_ParallelFor (lightgrid.numbricks, R_FindLightGridBricksTask, NULL);
+
+		for (i = numfilled = 0; i < lightgrid.numbricks; i++)
+			numfilled += lightgrid.data[i];
+		if (numfilled <= LIGHTGRID_MAXFILLED)
+			break;
+		lightgrid.spacing *= 2.f;
+	} while (1);
+
+	header->scale = 1.f / lightgrid.spacing;
+
+	for (i = 0; i < lightgrid.numbricks; i++)
+		if (lightgrid.data[i])
+			VEC_PUSH (lightgrid.filled, i);
+
+	// bake at the full probe size, then keep only the styles each brick uses
+	Vec_Grow ((void **) &lightgrid.baked, sizeof (lightgrid.baked[0]), numfilled * LIGHTGRID_BRICKPROBES * LIGHTGRID_PROBEWORDS);
+	Vec_Grow ((void **) &lightgrid.numstyles, sizeof (lightgrid.numstyles[0]), numfilled);
+	Tasks_ParallelFor (numfilled, R_BakeLightGridBrickTask, NULL);
+
+	numwords = lightgrid.numbricks;
+	for (i = 0; i < numfilled; i++)
+	{
+		stride = 1 + lightgrid.numstyles[i];
+		lightgrid.data[lightgrid.filled[i]] = (uint32_t) (numwords - lightgrid.numbricks) << 3 | lightgrid.numstyles[i];
+		Vec_Grow ((void **) &lightgrid.data, sizeof (lightgrid.data[0]), LIGHTGRID_BRICKPROBES * stride);
+		src = lightgrid.baked + i * LIGHTGRID_BRICKPROBES * LIGHTGRID_PROBEWORDS;
+		dst = lightgrid.data + numwords;
+		for (j = 0; j < LIGHTGRID_BRICKPROBES; j++, src += LIGHTGRID_PROBEWORDS, dst += stride)
+			memcpy (dst, src, stride * sizeof (dst[0]));
+		numwords += LIGHTGRID_BRICKPROBES * stride;
+		VEC_HEADER (lightgrid.data).size = numwords;
+	}
+	VEC_FREE (lightgrid.baked);
+	VEC_FREE (lightgrid.numstyles);
+
+	GL_DeleteBuffer (lightgrid.buffer);
+	lightgrid.buffersize = sizeof (*header) + numwords * sizeof (lightgrid.data[0]);
+	lightgrid.buffer = GL_CreateBuffer (GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW, "light grid", lightgrid.buffersize, NULL);
+	GL_BufferSubDataFunc (GL_SHADER_STORAGE_BUFFER, 0, sizeof (*header), header);
+	GL_BufferSubDataFunc (GL_SHADER_STORAGE_BUFFER, sizeof (*header), numwords * sizeof (lightgrid.data[0]), lightgrid.data);
+
+	Con_DPrintf ("Light grid: %d/%d bricks, %.0f unit spacing, %d KB, %.1f ms\n",
+		numfilled, lightgrid.numbricks, lightgrid.spacing, (int) (lightgrid.buffersize >> 10), (Sys_DoubleTime () - time) * 1000.0);
+}
+
+/*
+=============
+R_LightGridActive
+=============
+*/
+qboolean R_LightGridActive (void)
+{
+	return r_lightgrid.value && VEC_SIZE (lightgrid.data);
+}
+
+/*
+=============
+R_BindLightGrid
+=============
+*/
+void R_BindLightGrid (void)
+{
+	if (lightgrid.buffer)
+		GL_BindBufferRange (GL_SHADER_STORAGE_BUFFER, 5, lightgrid.buffer, 0, lightgrid.buffersize);
+}
+
+/*
+=============
+R_LightGridProbe
+
+Returns false for probes in solid space or in empty bricks
+=============
+*/
+static qboolean R_LightGridProbe (int x, int y, int z, vec3_t color)
+{
+	const int		*bricks = lightgrid.header.bricks;
+	const uint32_t	*probe;
+	uint32_t		brick, numstyles;
+	float			scale;
+	int				i, style;
+
+	brick = lightgrid.data[((z / LIGHTGRID_BRICK) * bricks[1] + y / LIGHTGRID_BRICK) * bricks[0] + x / LIGHTGRID_BRICK];
+	if (!brick)
+		return false;
+
+	x %= LIGHTGRID_BRICK;
+	y %= LIGHTGRID_BRICK;
+	z %= LIGHTGRID_BRICK;
+	numstyles = brick & 7;
+	probe = lightgrid.data + lightgrid.numbricks + (brick >> 3);
+	probe += ((z * LIGHTGRID_BRICK + y) * LIGHTGRID_BRICK + x) * (1 + numstyles);
+	if (!(probe[1] & LIGHTGRID_VALID))
+		return false;
+
+	color[0] = color[1] = color[2] = 0.f;
+	for (i = 0; i < (int) numstyles; i++)
+	{
+		style = (probe[0] >> (i * 8)) & 255;
+		if (style == 255)
+			break;
+		scale = d_lightstylevalue[style] * (1.f / 256.f);
+		color[0] += ((probe[1 + i] >>  0) & 255) * scale;
+		color[1] += ((probe[1 + i] >>  8) & 255) * scale;
+		color[2] += ((probe[1 + i] >> 16) & 255) * scale;
+	}
+
+	return true;
+}
+
+/*
+=============
+R_LightGridPoint
+
+Trilinear lookup, returns the average light level like R_LightPoint
+=============
+*/
+int R_LightGridPoint (vec3_t p, vec3_t lightcolor)
+{
+	float	coord[3], frac[3], weight, total;
+	int		base[3], i, size;
+	vec3_t	color;
+
+	for (i = 0; i < 3; i++)
+	{
+		size = lightgrid.header.bricks[i] * LIGHTGRID_BRICK;
+		coord[i] = CLAMP (0.f, (p[i] - lightgrid.header.origin[i]) * lightgrid.header.scale, (float) (size - 1));
+		base[i] = q_min ((int) coord[i], size - 2);
+		frac[i] = coord[i] - base[i];
+	}
+
+	lightcolor[0] = lightcolor[1] = lightcolor[2] = 0.f;
+	for (i = 0, total = 0.f; i < 8; i++)
+	{
+		weight =
+			((i & 1) ? frac[0] : 1.f - frac[0]) *
+			((i & 2) ? frac[1] : 1.f - frac[1]) *
+			((i & 4) ? frac[2] : 1.f - frac[2]);
+		if (weight <= 0.f || !R_LightGridProbe (base[0] + (i & 1), base[1] + ((i >> 1) & 1), base[2] + (i >> 2), color))
+			continue;
+		VectorMA (lightcolor, weight, color, lightcolor);
+		total += weight;
+	}
+
+	if (total > 0.f)
+		VectorScale (lightcolor, 1.f / total, lightcolor);
+
+	return ((lightcolor[0] + lightcolor[1] + lightcolor[2]) * (1.0f / 3.0f));
+}
@@ -40,6 +40,9 @@ float		r_matviewproj[16];
 //johnfitz -- rendering statistics
 int rs_brushpolys, rs_aliaspolys, rs_skypolys;
 int rs_dynamiclightmaps, rs_brushpasses, rs_aliaspasses, rs_skypasses;
+int rs_dlights, rs_culleddlights, rs_hiddendlights;
+int rs_occlusiontested, rs_occludedentities, rs_occludedsurfs;
+int rs_aliasinstances, rs_aliasuploads;
 
 //
 // view origin
@@ -77,6 +80,8 @@ cvar_t	r_wateralpha = {"r_wateralpha","1",CVAR_ARCHIVE};
 cvar_t	r_litwater = {"r_litwater","1",CVAR_NONE};
 cvar_t	r_dynamic = {"r_dynamic","1",CVAR_ARCHIVE};
 cvar_t	r_novis = {"r_novis","0",CVAR_ARCHIVE};
+cvar_t	r_occlusion = {"r_occlusion","1",CVAR_ARCHIVE}; // 0=off; 1=entities; 2=entities+world surfaces
+cvar_t	r_showocclusion = {"r_showocclusion","0",CVAR_NONE};
 #if defined(USE_SIMD)
 cvar_t	r_simd = {"r_simd","1",CVAR_ARCHIVE};
 #endif
@@ -94,6 +99,7 @@ cvar_t	gl_nocolors = {"gl_nocolors","0",CVAR_NONE};
 cvar_t	r_clearcolor = {"r_clearcolor","2",CVAR_ARCHIVE};
 cvar_t	r_flatlightstyles = {"r_flatlightstyles", "0", CVAR_NONE};
 cvar_t	r_lerplightstyles = {"r_lerplightstyles", "1", CVAR_ARCHIVE}; // 0=off; 1=skip abrupt transitions; 2=always lerp
+cvar_t	r_lightgrid = {"r_lightgrid", "1", CVAR_ARCHIVE}; // 0=trace model lighting; 1=sample the baked light grid
 cvar_t	gl_fullbrights = {"gl_fullbrights", "1", CVAR_ARCHIVE};
 cvar_t	gl_farclip = {"gl_farclip", "65536", CVAR_ARCHIVE};
 cvar_t	gl_overbright_models = {"gl_overbright_models", "1", CVAR_ARCHIVE};
@@ -627,6 +633,65 @@ typedef struct framesetup_s
 
 static framesetup_t framesetup;
 
+typedef struct sortkeyjob_s {
+	byte		*keep;
+	alphamode_t	alphamode;
+} sortkeyjob_t;
+
+/*
+=============
+R_SortKeyTask
+
+Culls one visible entity and computes its sort key, runs on the worker pool
+=============
+*/
+static void R_SortKeyTask (int i, void *param)
+{
+	sortkeyjob_t	*job = (sortkeyjob_t *) param;
+	byte			*keep = job->keep;
+	entity_t		*ent = cl_visedicts[i];
+	alphamode_t		alphamode = job->alphamode;
+	qboolean		translucent;
+	int				j;
+
+	// remove entities with no or invisible models
+	keep[i] = false;
+	if (!ent->model || ent->alpha == ENTALPHA_ZERO)
+		return;
+	if (ent->model->type == mod_brush && R_CullModelForEntity (ent))
+		return;
+	keep[i] = true;
+
+	translucent = !ENTALPHA_OPAQUE (ent->alpha);
+	if (translucent && alphamode == ALPHAMODE_SORTED)
+	{
+		float dist, delta;
+		vec3_t mins, maxs;
+
+		R_GetEntityBounds (ent, mins, maxs);
+		for (j = 0, dist = 0.f; j < 3; j++)
+		{
+			delta = CLAMP (mins[j], r_refdef.vieworg[j], maxs[j]) - r_refdef.vieworg[j];
+			dist += delta * delta;
+		}
+		dist = sqrt (dist);
+		visedict_keys[i] = ~CLAMP (0, (int)dist, MODSORT_MASK);
+	}
+	else if (translucent && alphamode != ALPHAMODE_OIT)
+	{
+		// Note: -1 (0xfffff) for non-static entities (firstleaf=0),
+		// so they are sorted after static ones
+		visedict_keys[i] = ent->firstleaf - 1;
+	}
+	else
+	{
+		if (ent->model->type == mod_alias)
+			visedict_keys[i] = ent->model->sortkey | (ent->skinnum & MODSORT_FRAMEMASK);
+		else
+			visedict_keys[i] = ent->model->sortkey | (ent->frame & MODSORT_FRAMEMASK);
+	}
+}
+
 /*
 =============
 R_SortEntities
@@ -637,20 +702,24 @@ static void R_SortEntities (void)
 	int i, j, pass;
 	int bins[1 << (MODSORT_BITS/2)];
 	int typebins[mod_numtypes*2];
-	alphamode_t alphamode = R_GetEffectiveAlphaMode ();
+	sortkeyjob_t job;
 
 	if (!r_drawentities.value)
 		cl_numvisedicts = 0;
 
-	// remove entities with no or invisible models
+	// cull entities and fill the sort key array in parallel
+	job.keep = (byte *) Frame_Alloc (q_max (cl_numvisedicts, 1));
+	job.alphamode = R_GetEffectiveAlphaMode ();
+	Tasks_ParallelFor (cl_numvisedicts, R_SortKeyTask, &job);
+
+	// compact the remaining entities, keeping their order
 	for (i = 0, j = 0; i < cl_numvisedicts; i++)
 	{
-		entity_t *ent = cl_visedicts[i];
-		if (!ent->model || ent->alpha == ENTALPHA_ZERO)
+		if (!job.keep[i])
 			continue;
-		if (ent->model->type == mod_brush && R_CullModelForEntity (ent))
-			continue;
-		cl_visedicts[j++] = ent;
+		cl_visedicts[j] = cl_visedicts[i];
+		visedict_keys[j] = visedict_keys[i];
+		j++;
 	}
 	cl_numvisedicts = j;
 
@@ -658,40 +727,12 @@ static void R_SortEntities (void)
 	if (r_drawworld.value)
 		typebins[mod_brush * 2 + 0]++; // count worldspawn
 
-	// fill entity sort key array, initial order, and per-type counts
+	// fill initial order and per-type counts
 	for (i = 0; i < cl_numvisedicts; i++)
 	{
 		entity_t *ent = cl_visedicts[i];
 		qboolean translucent = !ENTALPHA_OPAQUE (ent->alpha);
 
-		if (translucent && alphamode == ALPHAMODE_SORTED)
-		{
-			float dist, delta;
-			vec3_t mins, maxs;
-
-			R_GetEntityBounds (ent, mins, maxs);
-			for (j = 0, dist = 0.f; j < 3; j++)
-			{
-				delta = CLAMP (mins[j], r_refdef.vieworg[j], maxs[j]) - r_refdef.vieworg[j];
-				dist += delta * delta;
-			}
-			dist = sqrt (dist);
-			visedict_keys[i] = ~CLAMP (0, (int)dist, MODSORT_MASK);
-		}
-		else if (translucent && alphamode != ALPHAMODE_OIT)
-		{
-			// Note: -1 (0xfffff) for non-static entities (firstleaf=0),
-			// so they are sorted after static ones
-			visedict_keys[i] = ent->firstleaf - 1;
-		}
-		else
-		{
-			if (ent->model->type == mod_alias)
-				visedict_keys[i] = ent->model->sortkey | (ent->skinnum & MODSORT_FRAMEMASK);
-			else
-				visedict_keys[i] = ent->model->sortkey | (ent->frame & MODSORT_FRAMEMASK);
-		}
-
 		if ((unsigned)ent->model->type >= (unsigned)mod_numtypes)
 			Sys_Error ("Model '%s' has invalid type %d", ent->model->name, ent->model->type);
 		typebins[ent->model->type * 2 + translucent]++;
@@ -937,6 +978,10 @@ void R_SetupScene (void)
 	R_SetupGL ();
 }
 
+static GLuint		r_lightbuffer_buf;
+static GLintptr		r_lightbuffer_ofs;
+static GLsizeiptr	r_lightbuffer_size;
+
 /*
 ===============
 R_UploadFrameData
@@ -950,12 +995,352 @@ void R_UploadFrameData (void)
 
 	size = sizeof(r_lightbuffer.lightstyles) + sizeof(r_lightbuffer.lights[0]) * q_max (r_framedata.numlights, 1); // avoid zero-length array
 	GL_Upload (GL_SHADER_STORAGE_BUFFER, &r_lightbuffer, size, &buf, &ofs);
-	GL_BindBufferRange (GL_SHADER_STORAGE_BUFFER, 0, buf, (GLintptr)ofs, size);
+	r_lightbuffer_buf = buf;
+	r_lightbuffer_ofs = (GLintptr)ofs;
+	r_lightbuffer_size = size;
+	R_BindLightBuffer ();
 
 	GL_Upload (GL_UNIFORM_BUFFER, &r_framedata, sizeof (r_framedata), &buf, &ofs);
 	GL_BindBufferRange (GL_UNIFORM_BUFFER, 0, buf, (GLintptr)ofs, sizeof (r_framedata));
 }
 
+/*
+===============
+R_BindLightBuffer
+
+Restores the light buffer binding of the current frame, for passes that
+share its binding point with other buffers
+===============
+*/
+void R_BindLightBuffer (void)
+{
+	GL_BindBufferRange (GL_SHADER_STORAGE_BUFFER, 0, r_lightbuffer_buf, r_lightbuffer_ofs, r_lightbuffer_size);
+}
+
+//==============================================================================
+//
+// OCCLUSION CULLING
+//
+//==============================================================================
+
+#define OCCLUSION_NUMSTATS		3		// entities tested, entities occluded, world surfaces occluded
+#define OCCLUSION_MAX_MOVE		64.f	// larger eye movements invalidate the pyramid
+#define OCCLUSION_NUMSLOTS		(MAX_VISEDICTS + 2)	// +1 for worldspawn, +1 for the untested slot 0
+
+typedef struct gpuocclusion_s {
+	float		viewproj[16];
+	float		size[2];
+	GLint		maxlevel;
+	GLint		padding;
+} gpuocclusion_t;
+
+typedef struct occlusionstate_s {
+	GLuint			pyramid;		// R32F, farthest normalized depth of each 2x2 block of the level above
+	int				pyramidwidth;
+	int				pyramidheight;
+	GLuint			visbuffer;		// one uint per visibility slot
+	GLuint			statsbuffer;
+
+	qboolean		valid;			// the pyramid holds the depth of the last frame
+	qmodel_t		*worldmodel;	// world the pyramid was built for
+	vec3_t			vieworg;		// eye position the pyramid was built from
+	gpuocclusion_t	params;
+
+	qboolean		active;			// occlusion tests are done this frame
+	GLuint			parambuf;
+	GLbyte			*paramofs;
+	int				numbounds;
+	vec4_t			bounds[(MAX_VISEDICTS + 1) * 2];	// mins/maxs of each sorted entity, mins[3]=1 if tested
+} occlusionstate_t;
+
+static occlusionstate_t r_occlusionstate;
+
+/*
+=============
+GLOcclusion_CreateResources
+=============
+*/
+void GLOcclusion_CreateResources (void)
+{
+	static const GLuint zero[OCCLUSION_NUMSTATS];
+
+	r_occlusionstate.visbuffer = GL_CreateBuffer (GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY, "occlusion visibility", sizeof (GLuint) * OCCLUSION_NUMSLOTS, NULL);
+	r_occlusionstate.statsbuffer = GL_CreateBuffer (GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_READ, "occlusion stats", sizeof (zero), zero);
+}
+
+/*
+=============
+GLOcclusion_DeleteResources
+=============
+*/
+void GLOcclusion_DeleteResources (void)
+{
+	GL_DeleteBuffer (r_occlusionstate.visbuffer);
+	GL_DeleteBuffer (r_occlusionstate.statsbuffer);
+	GL_DeleteNativeTexture (r_occlusionstate.pyramid);
+
+	r_occlusionstate.visbuffer = 0;
+	r_occlusionstate.statsbuffer = 0;
+	r_occlusionstate.pyramid = 0;
+	r_occlusionstate.pyramidwidth = 0;
+	r_occlusionstate.pyramidheight = 0;
+	r_occlusionstate.valid = false;
+	r_occlusionstate.active = false;
+}
+
+/*
+=============
+R_SetupOcclusion
+
+Decides whether last frame's depth pyramid can be used for this view
+=============
+*/
+static void R_SetupOcclusion (void)
+{
+	occlusionstate_t	*occ = &r_occlusionstate;
+	vec3_t				delta;
+
+	VectorSubtract (r_refdef.vieworg, occ->vieworg, delta);
+
+	occ->numbounds = 0;
+	occ->active =
+		r_occlusion.value > 0.f &&
+		occ->valid &&
+		occ->worldmodel == cl.worldmodel &&
+		DotProduct (delta, delta) < OCCLUSION_MAX_MOVE * OCCLUSION_MAX_MOVE
+	;
+
+	if (occ->active)
+		GL_Upload (GL_UNIFORM_BUFFER, &occ->params, sizeof (occ->params), &occ->parambuf, &occ->paramofs);
+}
+
+/*
+=============
+R_BindOcclusionPyramid
+
+Binds the resources used by IsBoxOccluded in compute shaders.
+Returns 0 if occlusion culling is off for this frame,
+1 if it's on, or 2 if the shaders should also update the stats.
+=============
+*/
+int R_BindOcclusionPyramid (void)
+{
+	occlusionstate_t *occ = &r_occlusionstate;
+
+	if (!occ->active)
+		return 0;
+
+	GL_BindBufferRange (GL_UNIFORM_BUFFER, 2, occ->parambuf, (GLintptr)occ->paramofs, sizeof (occ->params));
+	GL_BindBufferRange (GL_SHADER_STORAGE_BUFFER, 6, occ->statsbuffer, 0, sizeof (GLuint) * OCCLUSION_NUMSTATS);
+	GL_BindNative (GL_TEXTURE0, GL_TEXTURE_2D, occ->pyramid);
+
+	return r_speeds.value == 2.f ? 2 : 1;
+}
+
+/*
+=============
+R_BindOcclusionVisibility
+
+Binds the per-entity visibility read by the alias and brush vertex shaders
+=============
+*/
+void R_BindOcclusionVisibility (void)
+{
+	GL_BindBufferRange (GL_SHADER_STORAGE_BUFFER, 3, r_occlusionstate.visbuffer, 0, sizeof (GLuint) * OCCLUSION_NUMSLOTS);
+}
+
+/*
+=============
+R_GetOcclusionSlot
+
+Returns the visibility slot of an entity in the sorted list, or 0 (always visible)
+for entities drawn from anywhere else, like the view model
+=============
+*/
+int R_GetOcclusionSlot (entity_t **pent)
+{
+	if (!r_occlusionstate.active || !PTR_IN_RANGE (pent, cl_sorted_visedicts, cl_sorted_visedicts + countof (cl_sorted_visedicts)))
+		return 0;
+	return (int)(pent - cl_sorted_visedicts) + 1;
+}
+
+/*
+=============
+R_CullOccludedEntities
+
+Tests the bounds of all the sorted entities against the depth pyramid on the gpu.
+Occluded instances are discarded in the vertex shaders, no readback needed.
+=============
+*/
+static void R_CullOccludedEntities (void)
+{
+	occlusionstate_t	*occ = &r_occlusionstate;
+	int					i, count, stats;
+	GLuint				buf;
+	GLbyte				*ofs;
+
+	count = cl_modtype_ofs[mod_numtypes*2];
+	if (!occ->active || !count)
+		return;
+
+	GL_BeginGroup ("Occlusion culling");
+
+	for (i = 0; i < count; i++)
+	{
+		entity_t *ent = cl_sorted_visedicts[i];
+		float *mins = occ->bounds[i*2 + 0];
+		float *maxs = occ->bounds[i*2 + 1];
+
+		// the world and sprites are never tested
+		mins[3] = maxs[3] = 0.f;
+		if (ent == &cl_entities[0] || ent->model->type == mod_sprite)
+			continue;
+
+		R_GetEntityBounds (ent, mins, maxs);
+		mins[3] = 1.f;
+	}
+	occ->numbounds = count;
+
+	GL_UseProgram (glprogs.occlusion_cull);
+	stats = R_BindOcclusionPyramid ();
+	GL_Uniform1iFunc (0, stats > 1);
+	GL_Upload (GL_SHADER_STORAGE_BUFFER, occ->bounds, sizeof (occ->bounds[0]) * 2 * count, &buf, &ofs);
+	GL_BindBufferRange (GL_SHADER_STORAGE_BUFFER, 1, buf, (GLintptr)ofs, sizeof (occ->bounds[0]) * 2 * count);
+	GL_BindBufferRange (GL_SHADER_STORAGE_BUFFER, 2, occ->visbuffer, 0, sizeof (GLuint) * (count + 1));
+	GL_DispatchComputeFunc ((count + 63) / 64, 1, 1);
+	GL_MemoryBarrierFunc (GL_SHADER_STORAGE_BARRIER_BIT);
+
+	GL_EndGroup ();
+}
+
+/*
+=============
+R_BuildOcclusionPyramid
+
+Reduces the depth buffer of the scene into a max-depth mip chain,
+used to cull the entities and world surfaces of the next frame
+=============
+*/
+static void R_BuildOcclusionPyramid (void)
+{
+	occlusionstate_t	*occ = &r_occlusionstate;
+	GLuint				depthtex;
+	int					x, y, w, h, samples, level;
+
+	occ->valid = false;
+	if (!r_occlusion.value)
+		return;
+
+	if (GL_NeedsSceneEffects ())
+	{
+		depthtex = framebufs.scene.depth_stencil_tex;
+		samples = framebufs.scene.samples;
+		x = y = 0;
+		w = r_refdef.vrect.width / r_refdef.scale;
+		h = r_refdef.vrect.height / r_refdef.scale;
+	}
+	else if (GL_NeedsPostprocess ())
+	{
+		depthtex = framebufs.composite.depth_stencil_tex;
+		samples = 1;
+		x = glx + r_refdef.vrect.x;
+		y = gly + glheight - r_refdef.vrect.y - r_refdef.vrect.height;
+		w = r_refdef.vrect.width;
+		h = r_refdef.vrect.height;
+	}
+	else
+	{
+		// drawing straight to the default framebuffer, there's no depth texture to read
+		return;
+	}
+
+	if (w <= 0 || h <= 0)
+		return;
+
+	// power-of-two level 0 size, so each level can hold the rounded up halves of the previous one
+	if (occ->pyramidwidth != Q_nextPow2 ((vid.width + 1) >> 1) || occ->pyramidheight != Q_nextPow2 ((vid.height + 1) >> 1))
+	{
+		int levels;
+
+		GL_DeleteNativeTexture (occ->pyramid);
+		occ->pyramidwidth = Q_nextPow2 ((vid.width + 1) >> 1);
+		occ->pyramidheight = Q_nextPow2 ((vid.height + 1) >> 1);
+		for (levels = 1; (q_max (occ->pyramidwidth, occ->pyramidheight) >> levels) > 0; levels++)
+			;
+
+		glGenTextures (1, &occ->pyramid);
+		GL_BindNative (GL_TEXTURE0, GL_TEXTURE_2D, occ->pyramid);
+		GL_ObjectLabelFunc (GL_TEXTURE, occ->pyramid, -1, "occlusion pyramid");
+		GL_TexStorage2DFunc (GL_TEXTURE_2D, levels, GL_R32F, occ->pyramidwidth, occ->pyramidheight);
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	}
+
+	GL_BeginGroup ("Occlusion pyramid");
+
+	memcpy (occ->params.viewproj, r_matviewproj, sizeof (r_matviewproj));
+	occ->params.size[0] = w;
+	occ->params.size[1] = h;
+
+	// level 0 is read from the depth buffer, the others from the level above
+	GL_UseProgram (glprogs.occlusion_pyramid[samples > 1]);
+	GL_BindNative (GL_TEXTURE0, samples > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, depthtex);
+	GL_Uniform4iFunc (0, x, y, w, h);
+	GL_Uniform1iFunc (1, samples);
+
+	for (level = 0; ; level++)
+	{
+		int dstw = (w + 1) >> 1;
+		int dsth = (h + 1) >> 1;
+
+		GL_BindImageTextureFunc (2, occ->pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		GL_DispatchComputeFunc ((dstw + 7) / 8, (dsth + 7) / 8, 1);
+		GL_MemoryBarrierFunc (GL_TEXTURE_FETCH_BARRIER_BIT);
+
+		if (dstw == 1 && dsth == 1)
+			break;
+
+		if (level == 0)
+		{
+			GL_UseProgram (glprogs.occlusion_pyramid[2]);
+			GL_BindNative (GL_TEXTURE0, GL_TEXTURE_2D, occ->pyramid);
+		}
+		w = dstw;
+		h = dsth;
+		GL_Uniform4iFunc (0, 0, 0, w, h);
+		GL_Uniform1iFunc (1, level);
+	}
+
+	GL_EndGroup ();
+
+	occ->params.maxlevel = level;
+	occ->worldmodel = cl.worldmodel;
+	VectorCopy (r_refdef.vieworg, occ->vieworg);
+	occ->valid = true;
+}
+
+/*
+=============
+R_ReadOcclusionStats
+
+Synchronous readback, only used for r_speeds
+=============
+*/
+static void R_ReadOcclusionStats (void)
+{
+	static const GLuint zero[OCCLUSION_NUMSTATS];
+	GLuint stats[OCCLUSION_NUMSTATS];
+
+	GL_MemoryBarrierFunc (GL_BUFFER_UPDATE_BARRIER_BIT);
+	GL_BindBuffer (GL_SHADER_STORAGE_BUFFER, r_occlusionstate.statsbuffer);
+	GL_GetBufferSubDataFunc (GL_SHADER_STORAGE_BUFFER, 0, sizeof (stats), stats);
+	GL_BufferSubDataFunc (GL_SHADER_STORAGE_BUFFER, 0, sizeof (zero), zero);
+
+	rs_occlusiontested = stats[0];
+	rs_occludedentities = stats[1];
+	rs_occludedsurfs = stats[2];
+}
+
 /*
 ===============
 R_SetupView -- johnfitz -- this is the stuff that needs to be done once per frame, even in stereo mode
@@ -1034,10 +1419,14 @@ void R_SetupView (void)
 
 	R_SetFrustum ();
 
+	R_SetupOcclusion ();
+
 	R_MarkSurfaces (); //johnfitz -- create texture chains from PVS
 
 	R_SortEntities ();
 
+	R_CullOccludedEntities ();
+
 	R_PushDlights ();
 
 	//johnfitz -- cheat-protect some draw modes
@@ -1691,6 +2080,43 @@ static void R_ShowBoundingBoxes (void)
 	GL_EndGroup ();
 }
 
+/*
+================
+R_ShowOcclusion
+
+Draws the bounds of the entities tested against the depth pyramid,
+green if they passed, red if they were occluded
+================
+*/
+static void R_ShowOcclusion (void)
+{
+	occlusionstate_t	*occ = &r_occlusionstate;
+	GLuint				*visible;
+	int					i;
+
+	if (!r_showocclusion.value || !occ->active || !occ->numbounds)
+		return;
+
+	GL_BeginGroup ("Show occlusion");
+
+	visible = (GLuint *) Frame_Alloc (sizeof (GLuint) * (occ->numbounds + 1));
+	GL_MemoryBarrierFunc (GL_BUFFER_UPDATE_BARRIER_BIT);
+	GL_BindBuffer (GL_SHADER_STORAGE_BUFFER, occ->visbuffer);
+	GL_GetBufferSubDataFunc (GL_SHADER_STORAGE_BUFFER, 0, sizeof (GLuint) * (occ->numbounds + 1), visible);
+
+	R_SetDebugGeometryZTest (false);
+	for (i = 0; i < occ->numbounds; i++)
+	{
+		const float *mins = occ->bounds[i*2 + 0];
+		const float *maxs = occ->bounds[i*2 + 1];
+		if (mins[3])
+			R_EmitWireBox (mins, maxs, visible[i + 1] ? 0x7f00ff00 : 0x7f0000ff);
+	}
+	R_FlushDebugGeometry ();
+
+	GL_EndGroup ();
+}
+
 /*
 ===============
 R_ShowPointFile
@@ -1900,6 +2326,8 @@ void R_RenderScene (void)
 
 	R_DrawEntitiesOnList (false); //johnfitz -- false means this is the pass for nonalpha entities
 
+	R_UpdateParticles ();
+
 	R_DrawParticles (false);
 
 	Sky_DrawSky (); //johnfitz
@@ -1916,10 +2344,14 @@ void R_RenderScene (void)
 
 	R_EndTranslucency ();
 
+	R_BuildOcclusionPyramid ();
+
 	R_ShowTris (); //johnfitz
 
 	R_ShowBoundingBoxes (); //johnfitz
 
+	R_ShowOcclusion ();
+
 	R_ShowPointFile ();
 }
 
@@ -2025,6 +2457,7 @@ void R_RenderView (void)
 		//johnfitz -- rendering statistics
 		rs_brushpolys = rs_aliaspolys = rs_skypolys =
 		rs_dynamiclightmaps = rs_aliaspasses = rs_skypasses = rs_brushpasses = 0;
+		rs_aliasinstances = rs_aliasuploads = 0;
 	}
 	else if (gl_finish.value)
 		glFinish ();
@@ -2044,6 +2477,7 @@ void R_RenderView (void)
 					(int)cl.viewangles[YAW],
 					(int)cl.viewangles[ROLL]);
 	else if (r_speeds.value == 2)
+	{
 		Con_Printf ("%3i ms  %4i/%4i wpoly %4i/%4i epoly %3i lmap %4i/%4i sky %1.1f mtex\n",
 					(int)((time2-time1)*1000),
 					rs_brushpolys,
@@ -2054,6 +2488,20 @@ void R_RenderView (void)
 					rs_skypolys,
 					rs_skypasses,
 					TexMgr_FrameUsage ());
+		Con_Printf ("%4i dlights %4i frustum culled %4i outside pvs %4i clustered\n",
+					rs_dlights,
+					rs_culleddlights,
+					rs_hiddendlights,
+					r_framedata.numlights);
+		R_ReadOcclusionStats ();
+		Con_Printf ("%4i/%4i entities occluded %5i world surfs occluded\n",
+					rs_occludedentities,
+					rs_occlusiontested,
+					rs_occludedsurfs);
+		Con_Printf ("%4i/%4i alias instances uploaded\n",
+					rs_aliasuploads,
+					rs_aliasinstances);
+	}
 	else if (r_speeds.value)
 		Con_Printf ("%3i ms  %4i wpoly %4i epoly %3i lmap\n",
 					(int)((time2-time1)*1000),
@@ -36,6 +36,7 @@ extern cvar_t r_oldskyleaf;
 extern cvar_t r_drawworld;
 extern cvar_t r_showtris;
 extern cvar_t r_showbboxes;
+extern cvar_t r_showocclusion;
 extern cvar_t r_showbboxes_think;
 extern cvar_t r_showbboxes_health;
 extern cvar_t r_showbboxes_links;
@@ -304,6 +305,8 @@ void R_Init (void)
 	Cvar_RegisterVariable (&r_litwater);
 	Cvar_RegisterVariable (&r_dynamic);
 	Cvar_RegisterVariable (&r_novis);
+	Cvar_RegisterVariable (&r_occlusion);
+	Cvar_RegisterVariable (&r_showocclusion);
 #if defined(USE_SIMD)
 	Cvar_RegisterVariable (&r_simd);
 	Cvar_SetCallback (&r_simd, R_SIMD_f);
@@ -327,6 +330,7 @@ void R_Init (void)
 	Cvar_RegisterVariable (&r_waterwarp);
 	Cvar_RegisterVariable (&r_flatlightstyles);
 	Cvar_RegisterVariable (&r_lerplightstyles);
+	Cvar_RegisterVariable (&r_lightgrid);
 	Cvar_RegisterVariable (&r_oldskyleaf);
 	Cvar_RegisterVariable (&r_drawworld);
 	Cvar_RegisterVariable (&r_showtris);
@@ -519,6 +523,7 @@ void R_NewMap (void)
 	GL_BuildLightmaps ();
 	GL_BuildBModelVertexBuffer ();
 	GL_BuildBModelMarkBuffers ();
+	R_BuildLightGrid ();
 	//ericw -- no longer load alias models into a VBO here, it's done in Mod_LoadAliasModel
 
 	r_framecount = 0; //johnfitz -- paranoid?
@@ -572,6 +577,23 @@ static GLuint current_element_array_buffer;
 static GLuint current_shader_storage_buffer;
 static GLuint current_draw_indirect_buffer;
 
+static size_t *gl_buffer_sizes;	// by buffer name, for the memory stats
+
+/*
+====================
+GL_SetBufferSize
+
+Records the size of the storage allocated for a buffer
+====================
+*/
+static void GL_SetBufferSize (GLuint buffer, size_t size)
+{
+	while (VEC_SIZE (gl_buffer_sizes) <= buffer)
+		VEC_PUSH (gl_buffer_sizes, 0);
+	MemStats_Add (MEM_GPUBUFFERS, (ptrdiff_t) size - (ptrdiff_t) gl_buffer_sizes[buffer]);
+	gl_buffer_sizes[buffer] = size;
+}
+
 /*
 ====================
 GL_CreateBuffer
@@ -585,6 +607,7 @@ GLuint GL_CreateBuffer (GLenum target, GLenum usage, const char *name, size_t si
 	if (name)
 		GL_ObjectLabelFunc (GL_BUFFER, buffer, -1, name);
 	GL_BufferDataFunc (target, size, data, usage);
+	GL_SetBufferSize (buffer, size);
 	return buffer;
 }
 
@@ -715,6 +738,9 @@ void GL_DeleteBuffer (GLuint buffer)
 		if (ssbo_ranges[i].buffer == buffer)
 			ssbo_ranges[i].buffer = 0;
 
+	if (buffer)
+		GL_SetBufferSize (buffer, 0);
+
 	GL_DeleteBuffersFunc (1, &buffer);
 }
 
@@ -828,6 +854,7 @@ static void GL_AllocFrameResources (frameres_bits_t bits)
 			{
 				GL_BufferDataFunc (GL_ARRAY_BUFFER, frameres_host_buffer_size, NULL, GL_STREAM_DRAW);
 			}
+			GL_SetBufferSize (frame->host_buffer, frameres_host_buffer_size);
 		}
 
 		if (bits & FRAMERES_DEVICE_BUFFER_BIT)
@@ -840,6 +867,7 @@ static void GL_AllocFrameResources (frameres_bits_t bits)
 			q_snprintf (name, sizeof (name), "dynamic device buffer %d", i);
 			GL_ObjectLabelFunc (GL_BUFFER, frame->device_buffer, -1, name);
 			GL_BufferDataFunc (GL_SHADER_STORAGE_BUFFER, frameres_device_buffer_size, NULL, GL_STREAM_DRAW);
+			GL_SetBufferSize (frame->device_buffer, frameres_device_buffer_size);
 		}
 	}
 
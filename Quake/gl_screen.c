@@ -109,6 +109,7 @@ cvar_t		scr_zoomspeed = {"zoom_speed","8",CVAR_ARCHIVE};
 cvar_t		scr_conspeed = {"scr_conspeed","2000",CVAR_ARCHIVE};
 cvar_t		scr_centertime = {"scr_centertime","2",CVAR_NONE};
 cvar_t		scr_showturtle = {"showturtle","0",CVAR_NONE};
+cvar_t		scr_memstats = {"scr_memstats","0",CVAR_NONE};
 cvar_t		scr_showpause = {"showpause","1",CVAR_NONE};
 cvar_t		scr_printspeed = {"scr_printspeed","8",CVAR_NONE};
 cvar_t		gl_triplebuffer = {"gl_triplebuffer", "1", CVAR_ARCHIVE};
@@ -656,6 +657,7 @@ void SCR_Init (void)
 	Cvar_RegisterVariable (&scr_viewsize);
 	Cvar_RegisterVariable (&scr_conspeed);
 	Cvar_RegisterVariable (&scr_showturtle);
+	Cvar_RegisterVariable (&scr_memstats);
 	Cvar_RegisterVariable (&scr_showpause);
 	Cvar_RegisterVariable (&scr_centertime);
 	Cvar_RegisterVariable (&scr_printspeed);
@@ -893,9 +895,8 @@ void SCR_DrawDemoControls (void)
 	}
 
 	// Approximate the fraction of the demo that's already been played back
-	// based on the current file offset and total demo size
-	// Note: we need to take into account the starting offset for pak files
-	frac = (Sys_ftell (cls.demofile) - cls.demofilestart) / (double)cls.demofilesize;
+	// based on the current offset and total (uncompressed) demo size
+	frac = CL_DemoTell () / (double)cls.demofilesize;
 	frac = CLAMP (0.f, frac, 1.f);
 
 	if (cl.intermission)
@@ -1020,6 +1021,98 @@ void SCR_DrawDevStats (void)
 	Draw_String (x, (y++)*8-x, str);
 }
 
+/*
+==============
+SCR_DrawMemStats
+
+Stacked on top of devstats when both are shown
+==============
+*/
+void SCR_DrawMemStats (void)
+{
+	char	str[40];
+	int		lines = NUM_MEMCATS + 3;
+	int		y = (devstats.value ? 25-10 : 25) - lines;
+	int		x = 0; //margin
+	int		i;
+
+	if (!scr_memstats.value)
+		return;
+
+	GL_SetCanvas (CANVAS_BOTTOMLEFT);
+
+	Draw_Fill (x, y*8, 24*8, lines*8, 0, 0.5); //dark rectangle
+
+	sprintf (str, "memstats  |  Curr   Peak");
+	Draw_String (x, (y++)*8-x, str);
+
+	for (i = 0; i < NUM_MEMCATS; i++)
+	{
+		if (i == 0 || i == MEM_BSP)
+		{
+			sprintf (str, "----------+-------------");
+			Draw_String (x, (y++)*8-x, str);
+		}
+		sprintf (str, "%-10s|%6.1f %6.1f", MemStats_Name ((memcat_t) i),
+			MemStats_Get ((memcat_t) i) / (1024.0 * 1024.0), MemStats_Peak ((memcat_t) i) / (1024.0 * 1024.0));
+		Draw_String (x, (y++)*8-x, str);
+	}
+}
+
+/*
+==============
+SCR_DrawGPUTimes
+
+Per-group gpu times next to the cpu submit and frame times,
+to tell which side a slow frame is waiting on
+==============
+*/
+void SCR_DrawGPUTimes (void)
+{
+	char			str[40];
+	const gputime_t	*times;
+	float			cpums, framems;
+	int				numtimes, lines, y, i;
+	int				x = 320 - 26*8;
+
+	if (!r_gputimes.value)
+		return;
+
+	numtimes = GL_GetGPUTimes (&times, &cpums, &framems);
+	if (!numtimes)
+		return;
+	numtimes = q_min (numtimes, 23 - 6); // leave room for fps/clock below
+	lines = numtimes + 6;
+	y = 23 - lines;
+
+	GL_SetCanvas (CANVAS_BOTTOMRIGHT);
+
+	Draw_Fill (x, y*8, 26*8, lines*8, 0, 0.5); //dark rectangle
+
+	sprintf (str, "gputimes          |    ms");
+	Draw_String (x, (y++)*8, str);
+	sprintf (str, "------------------+-------");
+	Draw_String (x, (y++)*8, str);
+
+	sprintf (str, "%-18s|%7.2f", "gpu total", times[0].ms);
+	Draw_String (x, (y++)*8, str);
+	sprintf (str, "%-18s|%7.2f", "cpu submit", cpums);
+	Draw_String (x, (y++)*8, str);
+	sprintf (str, "%-18s|%7.2f", "frame time", framems);
+	Draw_String (x, (y++)*8, str);
+	sprintf (str, "------------------+-------");
+	Draw_String (x, (y++)*8, str);
+
+	for (i = 0; i < numtimes; i++)
+	{
+		char name[19];
+		int indent = q_min (times[i].depth, 8);
+		q_snprintf (name, sizeof (name), "%*s%s", indent, "", times[i].name);
+		sprintf (str, "%-18s|%7.2f", name, times[i].ms);
+		Draw_String (x, (y++)*8, str);
+	}
+}
+
 /*
 ==============
 SCR_DrawTurtle
@@ -2153,6 +2246,8 @@ void SCR_UpdateScreen (void)
 		SCR_CheckDrawCenterString ();
 		Sbar_Draw ();
 		SCR_DrawDevStats (); //johnfitz
+		SCR_DrawMemStats ();
+		SCR_DrawGPUTimes ();
 		SCR_DrawClock (); //johnfitz
 		SCR_DrawDemoControls ();
 		SCR_DrawSpeed ();
@@ -308,7 +308,7 @@ NOISE_FUNCTIONS
 "#define LIGHT_TILES_X " QS_STRINGIFY (LIGHT_TILES_X) "\n"\
 "#define LIGHT_TILES_Y " QS_STRINGIFY (LIGHT_TILES_Y) "\n"\
 "#define LIGHT_TILES_Z " QS_STRINGIFY (LIGHT_TILES_Z) "\n"\
-"#define MAX_LIGHTS    " QS_STRINGIFY (MAX_DLIGHTS)   "\n"\
+"#define MAX_CLUSTER_LIGHTS " QS_STRINGIFY (MAX_CLUSTER_LIGHTS) "\n"\
 "\n"\
 "struct Light\n"\
 "{\n"\
@@ -338,7 +338,8 @@ NOISE_FUNCTIONS
 ////////////////////////////////////////////////////////////////
 
 #define LIGHT_CLUSTER_IMAGE(mode) \
-"layout(rg32ui, binding=0) uniform " mode " uimage3D LightClusters;\n"\
+"layout(r32ui, binding=0) uniform " mode " uimage3D LightClusters;\n"\
+"layout(r16ui, binding=1) uniform " mode " uimage3D LightIndices;\n"\
 
 ////////////////////////////////////////////////////////////////
 
@@ -401,6 +402,7 @@ DRAW_ELEMENTS_INDIRECT_COMMAND \
 "{\n"\
 "	vec4	mat[3];\n"\
 "	float	alpha;\n"\
+"	uint	occlusion;\n"\
 "};\n"\
 "\n"\
 "layout(std430, binding=2) restrict readonly buffer InstanceBuffer\n"\
@@ -417,6 +419,24 @@ DRAW_ELEMENTS_INDIRECT_COMMAND \
 
 ////////////////////////////////////////////////////////////////
 
+#define OCCLUSION_BUFFER \
+"layout(std430, binding=3) restrict readonly buffer OcclusionBuffer\n"\
+"{\n"\
+"	uint occlusion_visible[];\n"\
+"};\n"\
+"\n"\
+"// slot 0 is used by instances that were not tested\n"\
+"bool IsOccluded(uint slot)\n"\
+"{\n"\
+"	return slot != 0u && occlusion_visible[slot] == 0u;\n"\
+"}\n"\
+"\n"\
+"// outside the clip volume, so all the triangles of an occluded instance get clipped\n"\
+"const vec4 OCCLUDED_POSITION = vec4(2.0, 2.0, 2.0, 1.0);\n"\
+"\n"\
+
+////////////////////////////////////////////////////////////////
+
 #define WORLD_VERTEX_BUFFER \
 "layout(location=0) in vec3 in_pos;\n"\
 "layout(location=1) in vec4 in_uv;\n"\
@@ -490,6 +510,7 @@ LIGHT_BUFFER
 WORLD_CALLDATA_BUFFER
 WORLD_INSTANCEDATA_BUFFER
 WORLD_VERTEX_BUFFER
+OCCLUSION_BUFFER
 "\n"
 "layout(location=0) flat out uint out_flags;\n"
 "layout(location=1) flat out float out_alpha;\n"
@@ -513,6 +534,11 @@ WORLD_VERTEX_BUFFER
 "	Call call = call_data[DRAW_ID];\n"
 "	int instance_id = GET_INSTANCE_ID(call);\n"
 "	Instance instance = instance_data[instance_id];\n"
+"	if (IsOccluded(instance.occlusion))\n"
+"	{\n"
+"		gl_Position = OCCLUDED_POSITION;\n"
+"		return;\n"
+"	}\n"
 "	out_pos = Transform(in_pos, instance);\n"
 "	gl_Position = ViewProj * vec4(out_pos, 1.0);\n"
 "#if REVERSED_Z\n"
@@ -660,13 +686,13 @@ OIT_OUTPUT (out_fragcolor)
 "\n"
 "	if (NumLights > 0u)\n"
 "	{\n"
-"		uint i, ofs;\n"
+"		uint i;\n"
 "		ivec3 cluster_coord;\n"
 "		cluster_coord.x = int(floor(in_coord.x));\n"
 "		cluster_coord.y = int(floor(in_coord.y));\n"
 "		cluster_coord.z = int(floor(log2(in_depth) * ZLogScale + ZLogBias));\n"
-"		uvec2 clusterdata = imageLoad(LightClusters, cluster_coord).xy;\n"
-"		if ((clusterdata.x | clusterdata.y) != 0u)\n"
+"		uint numclusterlights = imageLoad(LightClusters, cluster_coord).x;\n"
+"		if (numclusterlights != 0u)\n"
 "		{\n"
 "#if " QS_STRINGIFY (SHOW_ACTIVE_LIGHT_CLUSTERS) "\n"
 "			int cluster_idx = cluster_coord.x + cluster_coord.y * LIGHT_TILES_X + cluster_coord.z * LIGHT_TILES_X * LIGHT_TILES_Y;\n"
@@ -676,26 +702,21 @@ OIT_OUTPUT (out_fragcolor)
 "			vec4 plane;\n"
 "			plane.xyz = normalize(cross(dFdx(in_pos), dFdy(in_pos)));\n"
 "			plane.w = dot(in_pos, plane.xyz);\n"
-"			for (i = 0u, ofs = 0u; i < 2u; i++, ofs += 32u)\n"
+"			ivec3 index_coord = ivec3(cluster_coord.x * MAX_CLUSTER_LIGHTS, cluster_coord.yz);\n"
+"			for (i = 0u; i < numclusterlights; i++, index_coord.x++)\n"
 "			{\n"
-"				uint mask = clusterdata[i];\n"
-"				while (mask != 0u)\n"
-"				{\n"
-"					int j = findLSB(mask);\n"
-"					mask ^= 1u << j;\n"
-"					Light l = Lights[ofs + j];\n"
-"					// mimics R_AddDynamicLights, up to a point\n"
-"					float rad = l.radius;\n"
-"					float dist = dot(l.origin, plane.xyz) - plane.w;\n"
-"					rad -= abs(dist);\n"
-"					float minlight = l.minlight;\n"
-"					if (rad < minlight)\n"
-"						continue;\n"
-"					vec3 local_pos = l.origin - plane.xyz * dist;\n"
-"					minlight = rad - minlight;\n"
-"					dist = length(in_pos - local_pos);\n"
-"					dynamic_light += clamp((minlight - dist) / 16.0, 0.0, 1.0) * max(0., rad - dist) / 256. * l.color;\n"
-"				}\n"
+"				Light l = Lights[imageLoad(LightIndices, index_coord).x];\n"
+"				// mimics R_AddDynamicLights, up to a point\n"
+"				float rad = l.radius;\n"
+"				float dist = dot(l.origin, plane.xyz) - plane.w;\n"
+"				rad -= abs(dist);\n"
+"				float minlight = l.minlight;\n"
+"				if (rad < minlight)\n"
+"					continue;\n"
+"				vec3 local_pos = l.origin - plane.xyz * dist;\n"
+"				minlight = rad - minlight;\n"
+"				dist = length(in_pos - local_pos);\n"
+"				dynamic_light += clamp((minlight - dist) / 16.0, 0.0, 1.0) * max(0., rad - dist) / 256. * l.color;\n"
 "			}\n"
 "			total_light += max(min(dynamic_light, 1. - total_light), 0.);\n"
 "		}\n"
@@ -1031,18 +1052,16 @@ NOISE_FUNCTIONS
 #define ALIAS_INSTANCE_BUFFER \
 "struct InstanceData\n"\
 "{\n"\
-"	vec4	WorldMatrix[3];\n"\
-"	vec4	LightColor; // xyz=LightColor w=Alpha\n"\
-"	int		Pose1;\n"\
-"	int		Pose2;\n"\
-"	float	Blend;\n"\
-"	int		Padding;\n"\
+"	vec3	DynamicLight;\n"\
+"	uint	Slot; // in AliasStateBuffer\n"\
+"	uint	Occlusion;\n"\
 "};\n"\
 "\n"\
 "layout(std430, binding=1) restrict readonly buffer InstanceBuffer\n"\
 "{\n"\
 "	mat4	ViewProj;\n"\
 "	vec3	EyePos;\n"\
+"	float	Time;\n"\
 "	vec4	Fog;\n"\
 "	float	ScreenDither;\n"\
 "	InstanceData instances[];\n"\
@@ -1050,8 +1069,83 @@ NOISE_FUNCTIONS
 
 ////////////////////////////////////////////////////////////////
 
+#define LIGHT_GRID_BUFFER \
+"layout(std430, binding=5) restrict readonly buffer LightGridBuffer\n"\
+"{\n"\
+"	vec3	LightGridOrigin;\n"\
+"	float	LightGridScale;\n"\
+"	ivec3	LightGridBricks;\n"\
+"	uint	LightGridData[]; // brick entries (0 = empty, else probe offset << 3 | styles), followed by the probes\n"\
+"};\n"\
+"\n"\
+"bool GetLightGridProbe(ivec3 pos, out vec3 color)\n"\
+"{\n"\
+"	ivec3 brickpos = pos >> 2;\n"\
+"	uint brick = LightGridData[(brickpos.z * LightGridBricks.y + brickpos.y) * LightGridBricks.x + brickpos.x];\n"\
+"	color = vec3(0.0);\n"\
+"	if (brick == 0u)\n"\
+"		return false;\n"\
+"	pos &= 3;\n"\
+"	uint numstyles = brick & 7u;\n"\
+"	uint probe = uint(LightGridBricks.x * LightGridBricks.y * LightGridBricks.z) + (brick >> 3);\n"\
+"	probe += uint((pos.z * 4 + pos.y) * 4 + pos.x) * (numstyles + 1u);\n"\
+"	uint styles = LightGridData[probe];\n"\
+"	if ((LightGridData[probe + 1u] & 0x1000000u) == 0u)\n"\
+"		return false; // in solid space\n"\
+"	for (uint i = 0u; i < numstyles; i++)\n"\
+"	{\n"\
+"		uint style = (styles >> (i * 8u)) & 255u;\n"\
+"		if (style == 255u)\n"\
+"			break;\n"\
+"		color += unpackUnorm4x8(LightGridData[probe + 1u + i]).rgb * (255.0 * GetLightStyle(int(style)));\n"\
+"	}\n"\
+"	return true;\n"\
+"}\n"\
+"\n"\
+"vec3 SampleLightGrid(vec3 p)\n"\
+"{\n"\
+"	ivec3 size = LightGridBricks * 4;\n"\
+"	vec3 coord = clamp((p - LightGridOrigin) * LightGridScale, vec3(0.0), vec3(size - 1));\n"\
+"	ivec3 base = min(ivec3(coord), size - 2);\n"\
+"	vec3 frac = coord - vec3(base);\n"\
+"	vec4 total = vec4(0.0);\n"\
+"	for (int i = 0; i < 8; i++)\n"\
+"	{\n"\
+"		ivec3 corner = ivec3(i & 1, (i >> 1) & 1, i >> 2);\n"\
+"		vec3 w3 = mix(1.0 - frac, frac, vec3(corner));\n"\
+"		float weight = w3.x * w3.y * w3.z;\n"\
+"		vec3 color;\n"\
+"		if (weight > 0.0 && GetLightGridProbe(base + corner, color))\n"\
+"			total += vec4(color, 1.0) * weight;\n"\
+"	}\n"\
+"	return total.w > 0.0 ? total.rgb / total.w : vec3(0.0);\n"\
+"}\n"\
+
+////////////////////////////////////////////////////////////////
+
 static const char alias_vertex_shader[] =
 ALIAS_INSTANCE_BUFFER
+OCCLUSION_BUFFER
+LIGHT_BUFFER
+LIGHT_GRID_BUFFER
+"\n"
+"struct AliasState\n"
+"{\n"
+"	vec4	WorldMatrix[3];\n"
+"	vec4	LightColor; // xyz=LightColor w=Alpha\n"
+"	vec4	LightProbe; // xyz=light grid sample position, w=1 to use the light grid\n"
+"	int		Pose1;\n"
+"	int		Pose2;\n"
+"	float	LerpStart;\n"
+"	float	LerpRate;\n"
+"	float	MinLight;\n"
+"	float	MaxLight;\n"
+"};\n"
+"\n"
+"layout(std430, binding=4) restrict readonly buffer AliasStateBuffer\n"
+"{\n"
+"	AliasState states[];\n"
+"};\n"
 "\n"
 "struct PoseVertex\n"
 "{\n"
@@ -1121,11 +1215,18 @@ ALIAS_INSTANCE_BUFFER
 "void main()\n"
 "{\n"
 "	InstanceData inst = instances[gl_InstanceID];\n"
+"	if (IsOccluded(inst.Occlusion))\n"
+"	{\n"
+"		gl_Position = OCCLUDED_POSITION;\n"
+"		return;\n"
+"	}\n"
+"	AliasState state = states[inst.Slot];\n"
+"	float blend = clamp((Time - state.LerpStart) * state.LerpRate, 0.0, 1.0);\n"
 "	out_texcoord = in_uv;\n"
-"	PoseVertex pose1 = GetPoseVertex(inst.Pose1);\n"
-"	PoseVertex pose2 = GetPoseVertex(inst.Pose2);\n"
-"	mat4x3 worldmatrix = transpose(mat3x4(inst.WorldMatrix[0], inst.WorldMatrix[1], inst.WorldMatrix[2]));\n"\
-"	vec3 lerpedVert = (worldmatrix * vec4(mix(pose1.pos, pose2.pos, inst.Blend), 1.0)).xyz;\n"
+"	PoseVertex pose1 = GetPoseVertex(state.Pose1);\n"
+"	PoseVertex pose2 = GetPoseVertex(state.Pose2);\n"
+"	mat4x3 worldmatrix = transpose(mat3x4(state.WorldMatrix[0], state.WorldMatrix[1], state.WorldMatrix[2]));\n"\
+"	vec3 lerpedVert = (worldmatrix * vec4(mix(pose1.pos, pose2.pos, blend), 1.0)).xyz;\n"
 "	gl_Position = ViewProj * vec4(lerpedVert, 1.0);\n"
 "	out_pos = lerpedVert - EyePos;\n"
 "	// transform world X and Z axes to local space\n"
@@ -1134,7 +1235,14 @@ ALIAS_INSTANCE_BUFFER
 "	vec3 shadevector = (orientation[0] + orientation[2]) / sqrt(2.0);\n"
 "	float dot1 = r_avertexnormal_dot(pose1.nor, shadevector);\n"
 "	float dot2 = r_avertexnormal_dot(pose2.nor, shadevector);\n"
-"	out_color = clamp(inst.LightColor * vec4(vec3(mix(dot1, dot2, inst.Blend)), 1.0), 0.0, 1.0);\n"
+"	vec3 light = (state.LightProbe.w != 0.0 ? SampleLightGrid(state.LightProbe.xyz) : state.LightColor.rgb) + inst.DynamicLight;\n"
+"	float sum = light.r + light.g + light.b;\n"
+"	light += max(state.MinLight - sum, 0.0) * (1.0 / 3.0);\n"
+"	sum = max(sum, state.MinLight);\n"
+"	if (sum > state.MaxLight)\n"
+"		light *= state.MaxLight / sum;\n"
+"	vec4 lightcolor = vec4(light * (1.0 / 200.0), state.LightColor.a);\n"
+"	out_color = clamp(lightcolor * vec4(vec3(mix(dot1, dot2, blend)), 1.0), 0.0, 1.0);\n"
 "	uint overbright = floatBitsToUint(Fog.w) >> 31;\n"
 "	out_color.rgb = ldexp(out_color.rgb, ivec3(overbright));\n"
 "}\n";
@@ -1326,6 +1434,146 @@ OIT_OUTPUT (out_fragcolor)
 "#endif\n"
 "}\n";
 
+////////////////////////////////////////////////////////////////
+//
+// Particle simulation: same rules as CL_RunParticles, and
+// appends the live particles to an instanced draw
+//
+////////////////////////////////////////////////////////////////
+
+static const char particles_sim_compute_shader[] =
+"layout(local_size_x=64) in;\n"
+"\n"
+"struct Particle\n"
+"{\n"
+"	vec4	org_die;	// xyz = origin, w = time of death\n"
+"	vec4	vel_ramp;	// xyz = velocity, w = ramp\n"
+"	uint	color;\n"
+"	uint	type;\n"
+"	float	spawn;\n"
+"	uint	_pad;\n"
+"};\n"
+"\n"
+"layout(std430, binding=0) restrict readonly buffer PaletteBuffer\n"
+"{\n"
+"	uint palette[256];\n"
+"};\n"
+"\n"
+"layout(std430, binding=1) restrict buffer ParticleBuffer\n"
+"{\n"
+"	Particle particles[];\n"
+"};\n"
+"\n"
+"layout(std430, binding=2) restrict writeonly buffer VertexBuffer\n"
+"{\n"
+"	uvec4 vertices[]; // xyz = origin, w = color\n"
+"};\n"
+"\n"
+"// DrawArraysIndirectCommand, as uints for the same reason as in cull_mark\n"
+"layout(std430, binding=3) buffer DrawIndirectBuffer\n"
+"{\n"
+"	uint rawcmd[];\n"
+"};\n"
+"\n"
+"#define CMD_INSTANCE_COUNT	rawcmd[1]\n"
+"\n"
+"layout(std140, binding=1) uniform ParticleSimUBO\n"
+"{\n"
+"	float	Time;\n"
+"	float	PrevTime;\n"
+"	float	FrameTime;\n"
+"	float	Gravity;\n"
+"	uint	NumParticles;\n"
+"};\n"
+"\n"
+"// ptype_t\n"
+"#define PT_STATIC		0u\n"
+"#define PT_GRAV		1u\n"
+"#define PT_SLOWGRAV		2u\n"
+"#define PT_FIRE		3u\n"
+"#define PT_EXPLODE		4u\n"
+"#define PT_EXPLODE2		5u\n"
+"#define PT_BLOB		6u\n"
+"#define PT_BLOB2		7u\n"
+"\n"
+"const uint ramp1[8] = uint[8](0x6fu, 0x6du, 0x6bu, 0x69u, 0x67u, 0x65u, 0x63u, 0x61u);\n"
+"const uint ramp2[8] = uint[8](0x6fu, 0x6eu, 0x6du, 0x6cu, 0x6bu, 0x6au, 0x68u, 0x66u);\n"
+"const uint ramp3[8] = uint[8](0x6du, 0x6bu, 6u, 5u, 4u, 3u, 0u, 0u);\n"
+"\n"
+"void main()\n"
+"{\n"
+"	uint thread_id = gl_GlobalInvocationID.x;\n"
+"	if (thread_id >= NumParticles)\n"
+"		return;\n"
+"\n"
+"	Particle p = particles[thread_id];\n"
+"	if (p.org_die.w < Time || p.spawn > Time)\n"
+"		return;\n"
+"\n"
+"	// particles spawned since the last update are drawn where they start\n"
+"	if (p.spawn < PrevTime)\n"
+"	{\n"
+"		vec3 vel = p.vel_ramp.xyz;\n"
+"		float ramp = p.vel_ramp.w;\n"
+"		float grav = FrameTime * Gravity;\n"
+"		float dvel = 4.0 * FrameTime;\n"
+"\n"
+"		p.org_die.xyz += vel * FrameTime;\n"
+"\n"
+"		switch (p.type)\n"
+"		{\n"
+"		case PT_FIRE:\n"
+"			ramp += FrameTime * 5.0;\n"
+"			if (ramp >= 6.0)\n"
+"				p.org_die.w = -1.0;\n"
+"			else\n"
+"				p.color = ramp3[int(ramp)];\n"
+"			vel.z += grav;\n"
+"			break;\n"
+"		case PT_EXPLODE:\n"
+"			ramp += FrameTime * 10.0;\n"
+"			if (ramp >= 8.0)\n"
+"				p.org_die.w = -1.0;\n"
+"			else\n"
+"				p.color = ramp1[int(ramp)];\n"
+"			vel += vel * dvel;\n"
+"			vel.z -= grav;\n"
+"			break;\n"
+"		case PT_EXPLODE2:\n"
+"			ramp += FrameTime * 15.0;\n"
+"			if (ramp >= 8.0)\n"
+"				p.org_die.w = -1.0;\n"
+"			else\n"
+"				p.color = ramp2[int(ramp)];\n"
+"			vel -= vel * FrameTime;\n"
+"			vel.z -= grav;\n"
+"			break;\n"
+"		case PT_BLOB:\n"
+"			vel += vel * dvel;\n"
+"			vel.z -= grav;\n"
+"			break;\n"
+"		case PT_BLOB2:\n"
+"			vel.xy -= vel.xy * dvel;\n"
+"			vel.z -= grav;\n"
+"			break;\n"
+"		case PT_GRAV:\n"
+"		case PT_SLOWGRAV:\n"
+"			vel.z -= grav;\n"
+"			break;\n"
+"		default:\n"
+"			break;\n"
+"		}\n"
+"\n"
+"		p.vel_ramp = vec4(vel, ramp);\n"
+"		particles[thread_id] = p;\n"
+"		if (p.org_die.w < 0.0)\n"
+"			return;\n"
+"	}\n"
+"\n"
+"	uint index = atomicAdd(CMD_INSTANCE_COUNT, 1u);\n"
+"	vertices[index] = uvec4(floatBitsToUint(p.org_die.xyz), palette[p.color & 255u]);\n"
+"}\n";
+
 ////////////////////////////////////////////////////////////////
 //
 // Debug 3D
@@ -1425,6 +1673,69 @@ static const char oit_resove_fragment_shader[] =
 // COMPUTE SHADERS
 //
 ////////////////////////////////////////////////////////////////
+
+#define OCCLUSION_PYRAMID \
+"layout(std140, binding=2) uniform OcclusionUBO\n"\
+"{\n"\
+"	mat4	OcclusionViewProj;	// view-projection the pyramid was rendered with\n"\
+"	vec2	OcclusionSize;		// scene size in pixels, level 0 is half of it\n"\
+"	int		OcclusionMaxLevel;\n"\
+"};\n"\
+"\n"\
+"layout(binding=0) uniform sampler2D OcclusionPyramid;\n"\
+"\n"\
+"// Returns true if the box is behind the farthest depth the previous frame\n"\
+"// had in the screen area it covers. Boxes that cross the near plane or\n"\
+"// reach outside the previous view are never occluded.\n"\
+"bool IsBoxOccluded(vec3 mins, vec3 maxs)\n"\
+"{\n"\
+"	vec3 lo = vec3(1e30);\n"\
+"	vec3 hi = vec3(-1e30);\n"\
+"	for (int i = 0; i < 8; i++)\n"\
+"	{\n"\
+"		vec3 p = vec3((i & 1) != 0 ? maxs.x : mins.x, (i & 2) != 0 ? maxs.y : mins.y, (i & 4) != 0 ? maxs.z : mins.z);\n"\
+"		vec4 clip = OcclusionViewProj * vec4(p, 1.0);\n"\
+"		if (clip.w <= 0.0)\n"\
+"			return false;\n"\
+"		vec3 ndc = clip.xyz / clip.w;\n"\
+"		lo = min(lo, ndc);\n"\
+"		hi = max(hi, ndc);\n"\
+"	}\n"\
+"	if (any(lessThan(lo.xy, vec2(-1.0))) || any(greaterThan(hi.xy, vec2(1.0))))\n"\
+"		return false;\n"\
+"\n"\
+"	// the pyramid stores depth with 0=near and 1=far regardless of the depth convention\n"\
+"#if REVERSED_Z\n"\
+"	float nearest = 1.0 - hi.z;\n"\
+"#else\n"\
+"	float nearest = lo.z * 0.5 + 0.5;\n"\
+"#endif\n"\
+"\n"\
+"	// pick the first level where the box covers at most 2x2 texels\n"\
+"	ivec2 pixlo = ivec2((lo.xy * 0.5 + 0.5) * OcclusionSize);\n"\
+"	ivec2 pixhi = min(ivec2((hi.xy * 0.5 + 0.5) * OcclusionSize), ivec2(OcclusionSize) - 1);\n"\
+"	int level = 0;\n"\
+"	while (level < OcclusionMaxLevel && any(greaterThan((pixhi >> (level + 1)) - (pixlo >> (level + 1)), ivec2(1))))\n"\
+"		level++;\n"\
+"	ivec2 texlo = pixlo >> (level + 1);\n"\
+"	ivec2 texhi = pixhi >> (level + 1);\n"\
+"\n"\
+"	float farthest = max\n"\
+"	(\n"\
+"		max(texelFetch(OcclusionPyramid, texlo, level).r, texelFetch(OcclusionPyramid, ivec2(texhi.x, texlo.y), level).r),\n"\
+"		max(texelFetch(OcclusionPyramid, ivec2(texlo.x, texhi.y), level).r, texelFetch(OcclusionPyramid, texhi, level).r)\n"\
+"	);\n"\
+"\n"\
+"	return nearest > farthest;\n"\
+"}\n"\
+"\n"\
+
+#define OCCLUSION_STATS \
+"layout(std430, binding=6) restrict buffer OcclusionStatsBuffer\n"\
+"{\n"\
+"	uint occlusion_stats[]; // 0=entities tested; 1=entities occluded; 2=world surfaces occluded\n"\
+"};\n"\
+"\n"\
 //
 // Clear indirect draws
 //
@@ -1575,8 +1886,11 @@ DRAW_ELEMENTS_INDIRECT_COMMAND
 "	vec3	vieworg;\n"
 "	uint	oldskyleaf;\n"
 "	uint	framecount;\n"
+"	uint	occlusion; // 0=off; 1=on; 2=on, with stats\n"
 "};\n"
 "\n"
+OCCLUSION_PYRAMID
+OCCLUSION_STATS
 "void main()\n"
 "{\n"
 "	uint thread_id = gl_GlobalInvocationID.x;\n"
@@ -1619,6 +1933,13 @@ DRAW_ELEMENTS_INDIRECT_COMMAND
 "	// check if this is the first time this surface has passed culling this frame\n"
 "	if (atomicExchange(SURF_FRAMECOUNT(surfbase), framecount) == framecount)\n"
 "		return;\n"
+"\n""	// occlusion culling against the previous frame's depth pyramid\n"
+"	if (occlusion != 0u && IsBoxOccluded(mins, maxs))\n"
+"	{\n"
+"		if (occlusion > 1u)\n"
+"			atomicAdd(occlusion_stats[2], 1u);\n"
+"		return;\n"
+"	}\n"
 "\n"
 "	// surface is visible, append its triangles to the index buffer\n"
 "	// and update the draw command corresponding to its texture number\n"
@@ -1637,6 +1958,109 @@ DRAW_ELEMENTS_INDIRECT_COMMAND
 "	}\n"
 "}\n";
 
+////////////////////////////////////////////////////////////////
+//
+// Occlusion culling
+//
+////////////////////////////////////////////////////////////////
+
+static const char occlusion_pyramid_compute_shader[] =
+"layout(local_size_x=8, local_size_y=8) in;\n"
+"\n"
+"#if MODE == 1\n"
+"	layout(binding=0) uniform sampler2DMS Source;\n"
+"#else\n"
+"	layout(binding=0) uniform sampler2D Source;\n"
+"#endif\n"
+"layout(r32f, binding=0) uniform writeonly image2D Dest;\n"
+"\n"
+"layout(location=0) uniform ivec4 SourceRect; // xy=offset; zw=size\n"
+"layout(location=1) uniform int SourceParam; // MODE 1: sample count; MODE 2: level\n"
+"\n"
+"float LoadDepth(ivec2 pos)\n"
+"{\n"
+"	// clamping covers the extra row/column of odd-sized sources\n"
+"	pos = SourceRect.xy + min(pos, SourceRect.zw - 1);\n"
+"#if MODE == 2\n"
+"	return texelFetch(Source, pos, SourceParam).r;\n"
+"#else\n"
+"	#if MODE == 1\n"
+"		float depth = texelFetch(Source, pos, 0).r;\n"
+"		for (int i = 1; i < SourceParam; i++)\n"
+"		#if REVERSED_Z\n"
+"			depth = min(depth, texelFetch(Source, pos, i).r);\n"
+"		#else\n"
+"			depth = max(depth, texelFetch(Source, pos, i).r);\n"
+"		#endif\n"
+"	#else\n"
+"		float depth = texelFetch(Source, pos, 0).r;\n"
+"	#endif\n"
+"	#if REVERSED_Z\n"
+"		depth = 1.0 - depth;\n"
+"	#endif\n"
+"	return depth;\n"
+"#endif\n"
+"}\n"
+"\n"
+"void main()\n"
+"{\n"
+"	ivec2 dst = ivec2(gl_GlobalInvocationID.xy);\n"
+"	if (any(greaterThanEqual(dst, (SourceRect.zw + 1) >> 1)))\n"
+"		return;\n"
+"	ivec2 src = dst * 2;\n"
+"	float depth = max\n"
+"	(\n"
+"		max(LoadDepth(src), LoadDepth(src + ivec2(1, 0))),\n"
+"		max(LoadDepth(src + ivec2(0, 1)), LoadDepth(src + ivec2(1, 1)))\n"
+"	);\n"
+"	imageStore(Dest, dst, vec4(depth));\n"
+"}\n";
+
+////////////////////////////////////////////////////////////////
+
+static const char occlusion_cull_compute_shader[] =
+"layout(local_size_x=64) in;\n"
+"\n"
+OCCLUSION_PYRAMID
+OCCLUSION_STATS
+"struct Bounds\n"
+"{\n"
+"	vec4	mins; // w=1 if the entity should be tested\n"
+"	vec4	maxs;\n"
+"};\n"
+"\n"
+"layout(std430, binding=1) restrict readonly buffer BoundsBuffer\n"
+"{\n"
+"	Bounds bounds[];\n"
+"};\n"
+"\n"
+"layout(std430, binding=2) restrict writeonly buffer VisibilityBuffer\n"
+"{\n"
+"	uint visible[];\n"
+"};\n"
+"\n"
+"layout(location=0) uniform int CountStats;\n"
+"\n"
+"void main()\n"
+"{\n"
+"	uint thread_id = gl_GlobalInvocationID.x;\n"
+"	if (thread_id == 0u)\n"
+"		visible[0] = 1u;\n"
+"	if (thread_id >= bounds.length())\n"
+"		return;\n"
+"\n"
+"	Bounds b = bounds[thread_id];\n"
+"	bool occluded = b.mins.w != 0.0 && IsBoxOccluded(b.mins.xyz, b.maxs.xyz);\n"
+"	visible[thread_id + 1u] = occluded ? 0u : 1u;\n"
+"\n"
+"	if (CountStats != 0 && b.mins.w != 0.0)\n"
+"	{\n"
+"		atomicAdd(occlusion_stats[0], 1u);\n"
+"		if (occluded)\n"
+"			atomicAdd(occlusion_stats[1], 1u);\n"
+"	}\n"
+"}\n";
+
 ////////////////////////////////////////////////////////////////
 //
 // Light clustering
@@ -1657,7 +2081,9 @@ LIGHT_CLUSTER_IMAGE("writeonly")
 "	mat4	View;\n"
 "};\n"
 "\n"
-"shared vec4 local_lights[MAX_LIGHTS]; // xyz = view space pos; w = radius\n"
+"#define LIGHT_BATCH_SIZE 64u // = workgroup size\n"
+"\n"
+"shared vec4 local_lights[LIGHT_BATCH_SIZE]; // xyz = view space pos; w = radius\n"
 "\n"
 "vec4 cluster_planes[6]; // view space; facing outside\n"
 "vec3 cluster_center;\n"
@@ -1728,39 +2154,45 @@ LIGHT_CLUSTER_IMAGE("writeonly")
 "void main()\n"
 "{\n"
 "	uvec3 gid = gl_GlobalInvocationID;\n"
-"	if (any(greaterThanEqual(gid, uvec3(LIGHT_TILES_X, LIGHT_TILES_Y, LIGHT_TILES_Z))))\n"
-"		return;\n"
-"	uint numlights = NumLights;\n"
-"	if (numlights == 0u)\n"
+"	bool inside = all(lessThan(gid, uvec3(LIGHT_TILES_X, LIGHT_TILES_Y, LIGHT_TILES_Z)));\n"
+"	if (inside)\n"
 "	{\n"
-"		imageStore(LightClusters, ivec3(gid), uvec4(0u));\n"
-"		return;\n"
+"		ComputeClusterPlanes(gid);\n"
+"		ComputeClusterExtents();\n"
 "	}\n"
-"	uint groupsize = gl_WorkGroupSize.x * gl_WorkGroupSize.y * gl_WorkGroupSize.z;\n"
-"	uint numpasses = (numlights + (groupsize - 1u)) / groupsize;\n"
-"	uint i, j, ofs;\n"
-"	for (i = 0u, ofs = 0u; i < numpasses; i++, ofs += groupsize)\n"
+"\n"
+"	// lights are streamed through shared memory one batch at a time,\n"
+"	// each cluster keeps the first MAX_CLUSTER_LIGHTS ones touching it\n"
+"	uint numlights = NumLights;\n"
+"	uint count = 0u;\n"
+"	ivec3 index_coord = ivec3(gid.x * uint(MAX_CLUSTER_LIGHTS), gid.yz);\n"
+"	uint i, ofs;\n"
+"	for (ofs = 0u; ofs < numlights; ofs += LIGHT_BATCH_SIZE)\n"
 "	{\n"
 "		uint index = gl_LocalInvocationIndex + ofs;\n"
 "		if (index < numlights)\n"
 "		{\n"
 "			Light l = Lights[index];\n"
-"			local_lights[index] = vec4((View * vec4(l.origin, 1.0)).xyz, l.radius);\n"
+"			local_lights[gl_LocalInvocationIndex] = vec4((View * vec4(l.origin, 1.0)).xyz, l.radius);\n"
 "		}\n"
-"	}\n"
-"	memoryBarrierShared();\n"
-"	barrier();\n"
+"		memoryBarrierShared();\n"
+"		barrier();\n"
 "\n"
-"	ComputeClusterPlanes(gid);\n"
-"	ComputeClusterExtents();\n"
+"		uint batch = min(numlights - ofs, LIGHT_BATCH_SIZE);\n"
+"		for (i = 0u; inside && i < batch && count < uint(MAX_CLUSTER_LIGHTS); i++)\n"
+"		{\n"
+"			if (LightTouchesCluster(local_lights[i]))\n"
+"			{\n"
+"				imageStore(LightIndices, index_coord, uvec4(ofs + i));\n"
+"				index_coord.x++;\n"
+"				count++;\n"
+"			}\n"
+"		}\n"
+"		barrier();\n"
+"	}\n"
 "\n"
-"	uint clustermask[MAX_LIGHTS / 32];\n"
-"	for (i = 0u; i < clustermask.length(); i++)\n"
-"		clustermask[i] = 0u;\n"
-"	for (i = 0u; i < numlights; i++)\n"
-"		if (LightTouchesCluster(local_lights[i]))\n"
-"			clustermask[i >> 5u] |= 1u << (i & 31u);\n"
-"	imageStore(LightClusters, ivec3(gid), uvec4(clustermask[0], clustermask[1], 0u, 0u));\n"
+"	if (inside)\n"
+"		imageStore(LightClusters, ivec3(gid), uvec4(count));\n"
 "}\n";
 
 ////////////////////////////////////////////////////////////////
@@ -527,6 +527,28 @@ float TexMgr_FrameUsage (void)
 	return mb;
 }
 
+/*
+===============
+TexMgr_MemoryUsage -- bytes held by all loaded textures
+===============
+*/
+size_t TexMgr_MemoryUsage (void)
+{
+	size_t bytes = 0;
+	gltexture_t	*glt;
+
+	for (glt = active_gltextures; glt; glt = glt->next)
+	{
+		unsigned int layers = glt->flags & TEXPREF_CUBEMAP ? glt->depth * 6 : glt->depth;
+		size_t s = (size_t) glt->width * glt->height * layers;
+		if (glt->flags & TEXPREF_MIPMAP)
+			s = (s * 4 + 3) / 3;
+		bytes += s * 4 / glt->compression;
+	}
+
+	return bytes;
+}
+
 /*
 ===============
 TexMgr_CanCompress
@@ -895,16 +895,126 @@ static qboolean GL_FindExtension (const char *name)
 	return false;
 }
 
+/*
+===================================================================
+
+GPU TIMING
+
+Debug groups double as timing zones: while r_gputimes is set (or a trace
+is being captured) every GL_BeginGroup/GL_EndGroup pair also writes a
+timestamp query. Results are read back a few frames later, once the gpu
+has caught up, so measuring never stalls the pipeline.
+
+===================================================================
+*/
+
+#define GPU_TIMER_FRAMES	4		// frames in flight before the results are read back
+#define GPU_TIMER_MAXZONES	256
+#define GPU_TIMER_MAXDEPTH	16
+
+typedef struct gputimerzone_s
+{
+	char			name[32];
+	int				depth;
+} gputimerzone_t;
+
+typedef struct gputimerframe_s
+{
+	GLuint			queries[2*GPU_TIMER_MAXZONES];	// begin/end timestamp pairs
+	gputimerzone_t	zones[GPU_TIMER_MAXZONES];
+	int				numzones;
+	qboolean		pending;
+	double			cputime;	// seconds spent between GL_BeginRendering and the swap
+	double			frametime;	// seconds since the previous frame started
+} gputimerframe_t;
+
+typedef struct gputraceevent_s
+{
+	char			name[32];
+	int				depth;
+	double			start;		// microseconds since the first traced frame
+	double			duration;	// microseconds
+	double			cputime;	// milliseconds, root zone only
+} gputraceevent_t;
+
+static struct
+{
+	gputimerframe_t	frames[GPU_TIMER_FRAMES];
+	int				current;
+	qboolean		active;
+	int				stack[GPU_TIMER_MAXDEPTH];
+	int				depth;
+	double			framestart;
+
+	gputime_t		times[GPU_TIMER_MAXZONES];
+	int				numtimes;
+	float			cpums;
+	float			framems;
+
+	int				traceframes;	// frames left to capture
+	int				tracecaptured;
+	GLuint64		tracebase;
+	gputraceevent_t	*traceevents;
+	char			tracefile[MAX_OSPATH];
+} gputimer;
+
+cvar_t		r_gputimes = {"r_gputimes", "0", CVAR_NONE};
+static qboolean glmarkers = false;
+
+/*
+=============
+GL_BeginTimerZone
+=============
+*/
+static void GL_BeginTimerZone (const char *name)
+{
+	gputimerframe_t	*frame = &gputimer.frames[gputimer.current];
+	int				zone = -1;
+
+	if (gputimer.depth < GPU_TIMER_MAXDEPTH && frame->numzones < GPU_TIMER_MAXZONES)
+	{
+		zone = frame->numzones++;
+		q_strlcpy (frame->zones[zone].name, name, sizeof (frame->zones[zone].name));
+		frame->zones[zone].depth = gputimer.depth;
+		GL_QueryCounterFunc (frame->queries[zone*2], GL_TIMESTAMP);
+	}
+
+	if (gputimer.depth < GPU_TIMER_MAXDEPTH)
+		gputimer.stack[gputimer.depth] = zone;
+	gputimer.depth++;
+}
+
+/*
+=============
+GL_EndTimerZone
+=============
+*/
+static void GL_EndTimerZone (void)
+{
+	gputimerframe_t	*frame = &gputimer.frames[gputimer.current];
+	int				zone;
+
+	if (gputimer.depth <= 0)
+		return;
+	if (--gputimer.depth >= GPU_TIMER_MAXDEPTH)
+		return;
+
+	zone = gputimer.stack[gputimer.depth];
+	if (zone >= 0)
+		GL_QueryCounterFunc (frame->queries[zone*2+1], GL_TIMESTAMP);
+}
+
 /*
 =============
 GL_BeginGroup
 =============
 */
-static qboolean glmarkers = false;
 void GL_BeginGroup (const char *name)
 {
 	if (glmarkers)
 		GL_PushDebugGroupFunc (GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+	if (gputimer.active)
+		GL_BeginTimerZone (name);
 }
 
 /*
@@ -914,10 +1024,285 @@ GL_EndGroup
 */
 void GL_EndGroup (void)
 {
+	if (gputimer.active)
+		GL_EndTimerZone ();
 	if (glmarkers)
 		GL_PopDebugGroupFunc ();
 }
 
+/*
+=============
+GL_BeginGPUTimerFrame
+
+Called from GL_BeginRendering. If the slot we are about to reuse still
+hasn't been read back its results are dropped rather than waited for.
+=============
+*/
+static void GL_BeginGPUTimerFrame (void)
+{
+	gputimerframe_t	*frame;
+	double			now = Sys_DoubleTime ();
+	double			frametime = now - gputimer.framestart;
+
+	gputimer.framestart = now;
+	gputimer.active = r_gputimes.value || gputimer.traceframes > 0;
+	if (!gputimer.active)
+		return;
+
+	frame = &gputimer.frames[gputimer.current];
+	if (!frame->queries[0])
+		GL_GenQueriesFunc (countof (frame->queries), frame->queries);
+	frame->numzones = 0;
+	frame->pending = false;
+	frame->frametime = frametime;
+	gputimer.depth = 0;
+
+	GL_BeginTimerZone ("frame");
+}
+
+/*
+=============
+GL_EndGPUTimerFrame
+
+Called from GL_EndRendering right before the swap
+=============
+*/
+static void GL_EndGPUTimerFrame (void)
+{
+	gputimerframe_t *frame = &gputimer.frames[gputimer.current];
+
+	if (!gputimer.active)
+		return;
+
+	// close any zones left open so that every issued query gets written
+	while (gputimer.depth > 0)
+		GL_EndTimerZone ();
+
+	frame->cputime = Sys_DoubleTime () - gputimer.framestart;
+	frame->pending = true;
+	gputimer.active = false;
+	gputimer.current = (gputimer.current + 1) % GPU_TIMER_FRAMES;
+}
+
+/*
+=============
+GL_WriteGPUTrace
+
+Saves the captured frames in the Chrome trace event format,
+which can be opened in chrome://tracing or Perfetto
+=============
+*/
+static void GL_WriteGPUTrace (void)
+{
+	char	name[MAX_OSPATH];
+	FILE	*f;
+	size_t	i, count = VEC_SIZE (gputimer.traceevents);
+
+	q_snprintf (name, sizeof (name), "%s/%s", com_gamedir, gputimer.tracefile);
+	f = Sys_fopen (name, "w");
+	if (!f)
+	{
+		Con_Printf ("ERROR: couldn't open file %s.\n", gputimer.tracefile);
+		VEC_CLEAR (gputimer.traceevents);
+		return;
+	}
+
+	fprintf (f, "{\"traceEvents\":[\n");
+	for (i = 0; i < count; i++)
+	{
+		const gputraceevent_t *ev = &gputimer.traceevents[i];
+		fprintf (f, "{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f",
+			ev->name, ev->start, ev->duration);
+		if (ev->depth == 0)
+			fprintf (f, ",\"args\":{\"cpu_ms\":%.3f}", ev->cputime);
+		fprintf (f, "}%s\n", i + 1 < count ? "," : "");
+	}
+	fprintf (f, "],\"displayTimeUnit\":\"ms\"}\n");
+	fclose (f);
+
+	Con_SafePrintf ("Wrote %d gpu frames (%d zones) to ", gputimer.tracecaptured, (int) count);
+	Con_LinkPrintf (name, "%s", gputimer.tracefile);
+	Con_SafePrintf (".\n");
+
+	VEC_CLEAR (gputimer.traceevents);
+}
+
+/*
+=============
+GL_ResolveGPUTimerFrame
+=============
+*/
+static void GL_ResolveGPUTimerFrame (gputimerframe_t *frame)
+{
+	gputime_t	times[GPU_TIMER_MAXZONES];
+	GLuint64	begin, end;
+	int			i, j, numtimes = 0;
+	float		ms;
+
+	for (i = 0; i < frame->numzones; i++)
+	{
+		const gputimerzone_t *zone = &frame->zones[i];
+
+		GL_GetQueryObjectui64vFunc (frame->queries[i*2], GL_QUERY_RESULT, &begin);
+		GL_GetQueryObjectui64vFunc (frame->queries[i*2+1], GL_QUERY_RESULT, &end);
+		ms = end > begin ? (end - begin) / 1e6f : 0.f;
+
+		if (gputimer.traceframes > 0)
+		{
+			gputraceevent_t ev;
+			char *c;
+
+			if (i == 0 && !gputimer.tracecaptured)
+				gputimer.tracebase = begin;
+			memset (&ev, 0, sizeof (ev));
+			q_strlcpy (ev.name, zone->name, sizeof (ev.name));
+			for (c = ev.name; *c; c++)
+				if (*c == '"' || *c == '\\' || (unsigned char)*c < ' ')
+					*c = '_';
+			ev.depth = zone->depth;
+			ev.start = begin >= gputimer.tracebase ? (begin - gputimer.tracebase) / 1e3 : 0.0;
+			ev.duration = ms * 1e3;
+			ev.cputime = frame->cputime * 1e3;
+			VEC_PUSH (gputimer.traceevents, ev);
+		}
+
+		// zones that repeat within a frame (e.g. once per view) are merged
+		for (j = 0; j < numtimes; j++)
+			if (times[j].depth == zone->depth && !strcmp (times[j].name, zone->name))
+				break;
+		if (j == numtimes)
+		{
+			q_strlcpy (times[j].name, zone->name, sizeof (times[j].name));
+			times[j].depth = zone->depth;
+			times[j].count = 0;
+			times[j].ms = 0.f;
+			numtimes++;
+		}
+		times[j].count++;
+		times[j].ms += ms;
+	}
+
+	// smooth against the previous results so the overlay stays readable
+	for (i = 0; i < numtimes; i++)
+	{
+		for (j = 0; j < gputimer.numtimes; j++)
+		{
+			if (gputimer.times[j].depth == times[i].depth && !strcmp (gputimer.times[j].name, times[i].name))
+			{
+				times[i].ms = LERP (gputimer.times[j].ms, times[i].ms, 0.1f);
+				break;
+			}
+		}
+	}
+	memcpy (gputimer.times, times, numtimes * sizeof (times[0]));
+	gputimer.numtimes = numtimes;
+
+	if (gputimer.cpums || gputimer.framems)
+	{
+		gputimer.cpums = LERP (gputimer.cpums, frame->cputime * 1e3f, 0.1f);
+		gputimer.framems = LERP (gputimer.framems, frame->frametime * 1e3f, 0.1f);
+	}
+	else
+	{
+		gputimer.cpums = frame->cputime * 1e3f;
+		gputimer.framems = frame->frametime * 1e3f;
+	}
+
+	if (gputimer.traceframes > 0)
+	{
+		gputimer.tracecaptured++;
+		if (--gputimer.traceframes == 0)
+			GL_WriteGPUTrace ();
+	}
+}
+
+/*
+=============
+GL_CollectGPUTimes
+
+Reads back every frame whose queries have completed, oldest first
+=============
+*/
+static void GL_CollectGPUTimes (void)
+{
+	int		i;
+	GLint	available;
+
+	for (i = 0; i < GPU_TIMER_FRAMES; i++)
+	{
+		gputimerframe_t *frame = &gputimer.frames[(gputimer.current + i) % GPU_TIMER_FRAMES];
+		if (!frame->pending)
+			continue;
+
+		// the root zone ends last, and timestamps complete in order
+		GL_GetQueryObjectivFunc (frame->queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			break;
+
+		frame->pending = false;
+		GL_ResolveGPUTimerFrame (frame);
+	}
+}
+
+/*
+=============
+GL_GetGPUTimes
+
+Returns the number of zones measured in the most recent frame
+=============
+*/
+int GL_GetGPUTimes (const gputime_t **times, float *cpums, float *framems)
+{
+	*times = gputimer.times;
+	*cpums = gputimer.cpums;
+	*framems = gputimer.framems;
+	return gputimer.numtimes;
+}
+
+/*
+=============
+GL_GPUTimes_f -- called when r_gputimes changes
+=============
+*/
+static void GL_GPUTimes_f (cvar_t *var)
+{
+	if (!var->value)
+	{
+		gputimer.numtimes = 0;
+		gputimer.cpums = gputimer.framems = 0.f;
+	}
+}
+
+/*
+=============
+GL_GPUTrace_f
+
+r_gputrace [frames] [file]
+=============
+*/
+static void GL_GPUTrace_f (void)
+{
+	int frames = Cmd_Argc () >= 2 ? atoi (Cmd_Argv (1)) : 120;
+
+	if (gputimer.traceframes > 0)
+	{
+		Con_Printf ("gpu trace already in progress (%d frames left)\n", gputimer.traceframes);
+		return;
+	}
+	if (frames <= 0)
+	{
+		Con_Printf ("usage: %s [frames] [file]\n", Cmd_Argv (0));
+		return;
+	}
+
+	q_strlcpy (gputimer.tracefile, Cmd_Argc () >= 3 ? Cmd_Argv (2) : "gputrace.json", sizeof (gputimer.tracefile));
+	COM_AddExtension (gputimer.tracefile, ".json", sizeof (gputimer.tracefile));
+	VEC_CLEAR (gputimer.traceevents);
+	gputimer.tracecaptured = 0;
+	gputimer.traceframes = frames;
+	Con_Printf ("Capturing %d gpu frames...\n", frames);
+}
+
 /*
 ===============
 GL_DebugCallback
@@ -1320,6 +1705,7 @@ static void GL_Init (void)
 	GL_CreateShaders ();
 	GL_CreateFrameBuffers ();
 	GLLight_CreateResources ();
+	GLOcclusion_CreateResources ();
 	GLPalette_CreateResources ();
 
 	GL_ClearBufferBindings ();
@@ -1333,6 +1719,8 @@ GL_BeginRendering -- sets values of glx, gly, glwidth, glheight
 */
 void GL_BeginRendering (int *x, int *y, int *width, int *height)
 {
+	GL_BeginGPUTimerFrame ();
+
 	if (vid.resized)
 	{
 		vid.resized = false;
@@ -1376,12 +1764,15 @@ GL_EndRendering
 void GL_EndRendering (void)
 {
 	GL_PostProcess ();
+	GL_EndGPUTimerFrame ();
 	GL_ReleaseFrameResources ();
 
 	if (!scr_skipupdate)
 	{
 		SDL_GL_SwapWindow(draw_context);
 	}
+
+	GL_CollectGPUTimes ();
 }
 
 
@@ -1737,6 +2128,9 @@ void	VID_Init (void)
 	cmd = Cmd_AddCommand ("gl_info", GL_Info_f); //johnfitz
 	if (cmd)
 		cmd->completion = GL_Info_Completion_f;
+	Cmd_AddCommand ("r_gputrace", GL_GPUTrace_f);
+	Cvar_RegisterVariable (&r_gputimes);
+	Cvar_SetCallback (&r_gputimes, GL_GPUTimes_f);
 
 	//johnfitz -- removed code creating "glquake" subdirectory
 
@@ -103,6 +103,8 @@ extern	cvar_t	r_slimealpha;
 extern	cvar_t	r_litwater;
 extern	cvar_t	r_dynamic;
 extern	cvar_t	r_novis;
+extern	cvar_t	r_occlusion;
+extern	cvar_t	r_lightgrid;
 extern	cvar_t	r_scale;
 
 extern	cvar_t	r_oit;
@@ -133,12 +135,14 @@ extern	const char	*gl_version;
 	x(void,			VertexAttribDivisor, (GLuint index, GLuint divisor))\
 	x(void,			DrawElementsIndirect, (GLenum mode, GLenum type, const void *indirect))\
 	x(void,			MultiDrawElementsIndirect, (GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride))\
+	x(void,			DrawArraysIndirect, (GLenum mode, const void *indirect))\
 	x(void,			GenBuffers, (GLsizei n, GLuint *buffers))\
 	x(void,			DeleteBuffers, (GLsizei n, const GLuint *buffers))\
 	x(void,			BindBuffer, (GLenum target, GLuint buffer))\
 	x(void,			BindBufferRange, (GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size))\
 	x(void,			BufferData, (GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage))\
 	x(void,			BufferSubData, (GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data))\
+	x(void,			GetBufferSubData, (GLenum target, GLintptr offset, GLsizeiptr size, GLvoid *data))\
 	x(GLvoid*,		MapBuffer, (GLenum target, GLenum access))\
 	x(GLboolean,	UnmapBuffer, (GLenum target))\
 	x(void*,		MapBufferRange, (GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access))\
@@ -176,6 +180,7 @@ extern	const char	*gl_version;
 	x(void,			Uniform2f, (GLint location, GLfloat v0, GLfloat v1))\
 	x(void,			Uniform3f, (GLint location, GLfloat v0, GLfloat v1, GLfloat v2))\
 	x(void,			Uniform4f, (GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3))\
+	x(void,			Uniform4i, (GLint location, GLint v0, GLint v1, GLint v2, GLint v3))\
 	x(void,			Uniform3fv, (GLint location, GLsizei count, const GLfloat *value))\
 	x(void,			Uniform4fv, (GLint location, GLsizei count, const GLfloat *value))\
 	x(void,			UniformMatrix4fv, (GLint location, GLsizei count, GLboolean transpose, const GLfloat *value))\
@@ -254,6 +259,17 @@ QGL_ALL_FUNCTIONS(QGL_DECLARE_FUNC)
 void GL_BeginGroup (const char *name);
 void GL_EndGroup (void);
 
+typedef struct gputime_s
+{
+	char	name[32];
+	int		depth;		// nesting level, 0 is the whole frame
+	int		count;		// times the group was entered this frame
+	float	ms;			// smoothed gpu time, summed over all entries
+} gputime_t;
+
+extern cvar_t r_gputimes;
+int GL_GetGPUTimes (const gputime_t **times, float *cpums, float *framems);
+
 //==============================================================================
 
 // Note: in order to simplify state management we impose a few restrictions:
@@ -337,6 +353,9 @@ void R_SetAlphaMode (alphamode_t mode);
 //johnfitz -- rendering statistics
 extern int rs_brushpolys, rs_aliaspolys, rs_skypolys;
 extern int rs_dynamiclightmaps, rs_brushpasses, rs_aliaspasses, rs_skypasses;
+extern int rs_aliasinstances, rs_aliasuploads;
+extern int rs_dlights, rs_culleddlights, rs_hiddendlights;
+extern int rs_occlusiontested, rs_occludedentities, rs_occludedsurfs;
 
 //johnfitz -- track developer statistics that vary every frame
 extern cvar_t devstats;
@@ -386,6 +405,7 @@ extern const float	r_avertexnormals[NUMVERTEXNORMALS][3];
 
 //johnfitz -- fog functions called from outside gl_fog.c
 void Fog_ParseServerMessage (void);
+void Fog_Update (float density, float red, float green, float blue, float time);
 float *Fog_GetColor (void);
 float Fog_GetDensity (void);
 void Fog_EnableGFog (void);
@@ -403,6 +423,7 @@ void R_NewGame (void);
 #define LIGHT_TILES_X			32
 #define LIGHT_TILES_Y			16
 #define LIGHT_TILES_Z			32
+#define MAX_CLUSTER_LIGHTS		64
 
 typedef struct gpulight_s {
 	float	pos[3];
@@ -438,8 +459,14 @@ extern gpuframedata_t r_framedata;
 
 void R_AnimateLight (void);
 void R_MarkSurfaces (void);
+void R_CullDlights (const byte *vis);
+void R_AddDlightsAtPoint (const vec3_t p, vec3_t color);
+int R_BindOcclusionPyramid (void);
+void R_BindOcclusionVisibility (void);
+int R_GetOcclusionSlot (entity_t **pent);
 qboolean R_CullBox (vec3_t emins, vec3_t emaxs);
 qboolean R_CullModelForEntity (entity_t *e);
+void R_GetEntityBounds (const entity_t *e, vec3_t mins, vec3_t maxs);
 void R_EntityMatrix (float matrix[16], vec3_t origin, vec3_t angles, unsigned char scale);
 
 void R_InitParticles (void);
@@ -447,11 +474,13 @@ void R_DrawParticles (qboolean alpha);
 void R_DrawParticles_ShowTris (void);
 void CL_RunParticles (void);
 void R_ClearParticles (void);
+void R_UpdateParticles (void);
 
 void R_TranslatePlayerSkin (int playernum);
 void R_TranslateNewPlayerSkin (int playernum); //johnfitz -- this handles cases when the actual texture changes
 
 void R_UploadFrameData (void);
+void R_BindLightBuffer (void);
 
 void R_DrawBrushModels (entity_t **ents, int count);
 void R_DrawBrushModels_Water (entity_t **ents, int count, qboolean translucent);
@@ -505,7 +534,11 @@ void GLMesh_LoadVertexBuffer (qmodel_t *m, aliashdr_t *hdr);
 void GLMesh_LoadVertexBuffers (void);
 void GLMesh_DeleteVertexBuffers (void);
 
-int R_LightPoint (vec3_t p, float ofs, lightcache_t *cache);
+int R_LightPoint (vec3_t p, float ofs, lightcache_t *cache, vec3_t lightcolor);
+void R_BuildLightGrid (void);
+qboolean R_LightGridActive (void);
+void R_BindLightGrid (void);
+int R_LightGridPoint (vec3_t p, vec3_t lightcolor);
 
 #define WORLDSHADER_SOLID		0
 #define WORLDSHADER_ALPHATEST	1
@@ -540,6 +573,9 @@ typedef struct glprogs_s {
 	GLuint		gather_indirect;
 	GLuint		cull_mark;
 	GLuint		cluster_lights;
+	GLuint		particles_sim;
+	GLuint		occlusion_pyramid[3];	// [source:depth/multisampled depth/previous level]
+	GLuint		occlusion_cull;
 	GLuint		palette_init[3];	// [metric:naive/riemersma/oklab]
 	GLuint		palette_postprocess;
 } glprogs_t;
@@ -595,6 +631,9 @@ void GL_DeleteFrameBuffers (void);
 void GLLight_CreateResources (void);
 void GLLight_DeleteResources (void);
 
+void GLOcclusion_CreateResources (void);
+void GLOcclusion_DeleteResources (void);
+
 void GLPalette_CreateResources (void);
 void GLPalette_DeleteResources (void);
 void GLPalette_UpdateLookupTable (void);
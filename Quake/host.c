@@ -432,13 +432,16 @@ void SV_ClientPrintf (const char *fmt, ...)
 {
 	va_list		argptr;
 	char		string[1024];
+	int			oldsize;
 
 	va_start (argptr,fmt);
 	q_vsnprintf (string, sizeof(string), fmt,argptr);
 	va_end (argptr);
 
+	oldsize = host_client->message.cursize;
 	MSG_WriteByte (&host_client->message, svc_print);
 	MSG_WriteString (&host_client->message, string);
+	SV_NetStats_Add (host_client, NETSTAT_PRINT, oldsize);
 }
 
 /*
@@ -452,7 +455,7 @@ void SV_BroadcastPrintf (const char *fmt, ...)
 {
 	va_list		argptr;
 	char		string[1024];
-	int			i;
+	int			i, oldsize;
 
 	va_start (argptr,fmt);
 	q_vsnprintf (string, sizeof(string), fmt, argptr);
@@ -462,8 +465,10 @@ void SV_BroadcastPrintf (const char *fmt, ...)
 	{
 		if (svs.clients[i].active && svs.clients[i].spawned)
 		{
+			oldsize = svs.clients[i].message.cursize;
 			MSG_WriteByte (&svs.clients[i].message, svc_print);
 			MSG_WriteString (&svs.clients[i].message, string);
+			SV_NetStats_Add (&svs.clients[i], NETSTAT_PRINT, oldsize);
 		}
 	}
 }
@@ -479,13 +484,16 @@ void Host_ClientCommands (const char *fmt, ...)
 {
 	va_list		argptr;
 	char		string[1024];
+	int			oldsize;
 
 	va_start (argptr,fmt);
 	q_vsnprintf (string, sizeof(string), fmt, argptr);
 	va_end (argptr);
 
+	oldsize = host_client->message.cursize;
 	MSG_WriteByte (&host_client->message, svc_stufftext);
 	MSG_WriteString (&host_client->message, string);
+	SV_NetStats_Add (host_client, NETSTAT_STUFFTEXT, oldsize);
 }
 
 /*
@@ -651,6 +659,7 @@ void Host_ClearMemory (void)
 	}
 
 	Con_DPrintf ("Clearing memory\n");
+	MemStats_EndMap (sv.name[0] ? sv.name : cl.mapname);
 	Mod_ClearAll ();
 	Sky_ClearAll();
 	PR_ClearProgs(&sv.qcvm);
@@ -766,6 +775,159 @@ void Host_InvokeOnMainThread (void (*func) (void *param), void *param)
 	AsyncQueue_Push (&async_queue, func, param);
 }
 
+//==============================================================================
+//
+// Worker pool
+//
+// Tasks_ParallelFor splits a loop across the worker threads and the calling
+// thread, and returns once every index has been run. Workers are woken once
+// per loop and claim indices in chunks, so uneven items balance out.
+//
+//==============================================================================
+
+#define MAX_TASK_WORKERS	31
+
+typedef struct
+{
+	taskfunc_t			func;
+	void				*param;
+	int					count;
+	int					chunk;
+	SDL_atomic_t		next;		// first index not claimed yet
+} taskloop_t;
+
+static SDL_Thread		*task_workers[MAX_TASK_WORKERS];
+static int				task_numworkers;
+static SDL_sem			*task_wakeup;
+static SDL_sem			*task_finished;
+static SDL_atomic_t		task_quit;
+static SDL_threadID		task_owner;
+static qboolean			task_running;
+static taskloop_t		task_loop;
+
+static void Tasks_RunLoop (taskloop_t *loop)
+{
+	int first, last;
+
+	while ((first = SDL_AtomicAdd (&loop->next, loop->chunk)) < loop->count)
+	{
+		last = q_min (first + loop->chunk, loop->count);
+		for (; first < last; first++)
+			loop->func (first, loop->param);
+	}
+}
+
+static int SDLCALL Tasks_WorkerThread (void *unused)
+{
+	for (;;)
+	{
+		SDL_SemWait (task_wakeup);
+		if (SDL_AtomicGet (&task_quit))
+			break;
+		Tasks_RunLoop (&task_loop);
+		SDL_SemPost (task_finished);
+	}
+	return 0;
+}
+
+static void Tasks_Init (void)
+{
+	int i;
+
+	task_owner = SDL_ThreadID ();
+
+	i = COM_CheckParm ("-workers");
+	if (i && i < com_argc-1)
+		task_numworkers = Q_atoi (com_argv[i+1]);
+	else
+		task_numworkers = SDL_GetCPUCount () - 1;
+	task_numworkers = CLAMP (0, task_numworkers, MAX_TASK_WORKERS);
+	if (!task_numworkers)
+		return;
+
+	task_wakeup = SDL_CreateSemaphore (0);
+	task_finished = SDL_CreateSemaphore (0);
+	if (!task_wakeup || !task_finished)
+		Sys_Error ("Tasks_Init: could not create semaphores");
+
+	for (i = 0; i < task_numworkers; i++)
+	{
+		task_workers[i] = SDL_CreateThread (Tasks_WorkerThread, "Worker", NULL);
+		if (!task_workers[i])
+			break;
+	}
+	task_numworkers = i;
+	Sys_Printf ("%d worker threads\n", task_numworkers);
+}
+
+static void Tasks_Shutdown (void)
+{
+	int i;
+
+	SDL_AtomicSet (&task_quit, 1);
+	for (i = 0; i < task_numworkers; i++)
+		SDL_SemPost (task_wakeup);
+	for (i = 0; i < task_numworkers; i++)
+		SDL_WaitThread (task_workers[i], NULL);
+	task_numworkers = 0;
+
+	if (task_wakeup)
+		SDL_DestroySemaphore (task_wakeup);
+	if (task_finished)
+		SDL_DestroySemaphore (task_finished);
+	task_wakeup = task_finished = NULL;
+}
+
+/*
+==================
+Tasks_NumThreads
+
+Number of threads a parallel loop runs on, the calling one included
+==================
+*/
+int Tasks_NumThreads (void)
+{
+	return task_numworkers + 1;
+}
+
+/*
+==================
+Tasks_ParallelFor
+
+Calls func for every index in [0, count) from any of the threads. Loops
+started from another thread, or from inside a loop, just run serially.
+==================
+*/
+void Tasks_ParallelFor (int count, taskfunc_t func, void *param)
+{
+	int i, workers;
+
+	if (count <= 0)
+		return;
+
+	workers = q_min (task_numworkers, count - 1);
+	if (workers <= 0 || task_running || SDL_ThreadID () != task_owner)
+	{
+		for (i = 0; i < count; i++)
+			func (i, param);
+		return;
+	}
+
+	task_running = true;
+	task_loop.func = func;
+	task_loop.param = param;
+	task_loop.count = count;
+	task_loop.chunk = q_max (1, count / ((workers + 1) * 8));
+	SDL_AtomicSet (&task_loop.next, 0);
+
+	for (i = 0; i < workers; i++)
+		SDL_SemPost (task_wakeup);
+	Tasks_RunLoop (&task_loop);
+	for (i = 0; i < workers; i++)
+		SDL_SemWait (task_finished);
+	task_running = false;
+}
+
 //==============================================================================
 //
 // Host Frame
@@ -1189,6 +1351,49 @@ static void Host_PrintTimes (const double times[], const char *names[], int coun
 	Con_Printf ("%s\n", line);
 }
 
+/*
+==================
+Host_UpdateMemStats
+
+Samples the memory held by the subsystems that don't report it themselves
+==================
+*/
+static void Host_UpdateMemStats (void)
+{
+	qcvm_t	*vms[2] = {&sv.qcvm, &cl.qcvm};
+	size_t	edicts, strings, network;
+	int		i;
+
+	edicts = 0;
+	strings = 0;
+	for (i = 0; i < (int) countof (vms); i++)
+	{
+		edicts += (size_t) vms[i]->max_edicts * vms[i]->edict_size;
+		strings += vms[i]->stringssize + vms[i]->allocatedstrings + vms[i]->knownzonesize;
+		strings += vms[i]->maxknownstrings * sizeof (*vms[i]->knownstrings);
+	}
+	if (cl_entities)
+		edicts += cl_max_edicts * (sizeof (*cl_entities) + sizeof (*cl_entinterp));
+	MemStats_Set (MEM_EDICTS, edicts);
+	MemStats_Set (MEM_QCSTRINGS, strings);
+
+	network = net_message.maxsize + cls.message.maxsize;
+	network += svs.maxclientslimit * sizeof (svs.clients->msgbuf);
+	if (sv.active)
+	{
+		network += sv.datagram.maxsize + sv.reliable_datagram.maxsize;
+		for (i = 0; i < sv.num_signon_buffers; i++)
+			network += sv.signon_buffers[i]->maxsize;
+	}
+	MemStats_Set (MEM_NETWORK, network);
+
+	MemStats_Set (MEM_SOUNDS, S_SoundPoolSize ());
+	if (cls.state != ca_dedicated)
+		MemStats_Set (MEM_TEXTURES, TexMgr_MemoryUsage ());
+
+	MemStats_Update ();
+}
+
 /*
 ==================
 Host_Frame
@@ -1276,6 +1481,8 @@ void _Host_Frame (double time)
 	if (cls.state == ca_connected)
 		CL_ReadFromServer ();
 
+	Host_UpdateMemStats ();
+
 // update video
 	if (host_speeds.value)
 		time2 = Sys_DoubleTime ();
@@ -1336,6 +1543,9 @@ void _Host_Frame (double time)
 	}
 
 	host_framecount++;
+
+// throw away this frame's scratch memory
+	Frame_Reset ();
 }
 
 void Host_Frame (double time)
@@ -1393,6 +1603,7 @@ void Host_Init (void)
 
 	Memory_Init (host_parms->membase, host_parms->memsize);
 	AsyncQueue_Init (&async_queue, 1024);
+	Tasks_Init ();
 	Cbuf_Init ();
 	Cmd_Init ();
 	LOG_Init (host_parms);
@@ -1502,9 +1713,11 @@ void Host_Shutdown(void)
 	Steam_Shutdown ();
 
 	AsyncQueue_Destroy (&async_queue);
+	Tasks_Shutdown ();
 
 	Host_ShutdownSave ();
 	Host_WriteConfiguration ();
+	MemStats_EndMap (sv.name[0] ? sv.name : cl.mapname);
 
 // stop downloads before shutting down networking
 	Modlist_ShutDown ();
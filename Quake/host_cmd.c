@@ -3096,6 +3096,7 @@ static void Host_Spawn_f (void)
 
 // send all current names, colors, and frag counts
 	SZ_Clear (&host_client->message);
+	memset (host_client->netstats.pending, 0, sizeof (host_client->netstats.pending));
 
 // send time of update
 	MSG_WriteByte (&host_client->message, svc_time);
@@ -3160,6 +3161,7 @@ static void Host_Spawn_f (void)
 
 	MSG_WriteByte (&host_client->message, svc_signonnum);
 	MSG_WriteByte (&host_client->message, 3);
+	SV_NetStats_Add (host_client, NETSTAT_SIGNON, 0);
 	host_client->sendsignon = PRESPAWN_FLUSH;
 }
 
@@ -496,3 +496,30 @@ qboolean Image_WritePNG (const char *name, byte *data, int width, int height, in
 
 	return (error == 0);
 }
+
+/*
+============
+Image_Deflate
+
+Compresses data to a raw deflate stream (RFC 1951).
+Returns a malloc'ed buffer, or NULL on failure
+============
+*/
+byte *Image_Deflate (const byte *data, size_t size, size_t *outsize)
+{
+	LodePNGCompressSettings	settings;
+	unsigned char			*out = NULL;
+
+	lodepng_compress_settings_init (&settings);
+	settings.windowsize = 8192;
+
+	*outsize = 0;
+	if (lodepng_deflate (&out, outsize, data, size, &settings) != 0)
+	{
+		lodepng_free (out);
+		*outsize = 0;
+		return NULL;
+	}
+
+	return (byte *) out;
+}
@@ -35,5 +35,8 @@ qboolean Image_WriteTGA (const char *name, byte *data, int width, int height, in
 qboolean Image_WritePNG (const char *name, byte *data, int width, int height, int bpp, qboolean upsidedown);
 qboolean Image_WriteJPG (const char *name, byte *data, int width, int height, int bpp, int quality, qboolean upsidedown);
 
+//raw deflate, using the png encoder's compressor; free() the result
+byte *Image_Deflate (const byte *data, size_t size, size_t *outsize);
+
 #endif	/* GL_IMAGE_H */
 
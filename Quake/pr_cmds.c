@@ -27,13 +27,32 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	STRINGTEMP_BUFFERS		1024
 #define	STRINGTEMP_LENGTH		1024
 static	char	pr_string_temp[STRINGTEMP_BUFFERS][STRINGTEMP_LENGTH];
-static	byte	pr_string_tempindex = 0;
+static	unsigned int	pr_string_tempindex = 0;
+
+// sprintf results that don't fit in a temp slot, reused round-robin like the temp strings
+#define	STRINGTEMP_LONGBUFFERS	16
+static	char	*pr_string_longtemp[STRINGTEMP_LONGBUFFERS];
+static	size_t	pr_string_longtempsize[STRINGTEMP_LONGBUFFERS];
+static	unsigned int	pr_string_longtempindex = 0;
 
 static char *PR_GetTempString (void)
 {
 	return pr_string_temp[(STRINGTEMP_BUFFERS-1) & ++pr_string_tempindex];
 }
 
+static char *PR_GetLongTempString (size_t size)
+{
+	unsigned int i = (STRINGTEMP_LONGBUFFERS-1) & ++pr_string_longtempindex;
+	if (pr_string_longtempsize[i] < size)
+	{
+		pr_string_longtempsize[i] = Q_nextPow2 (size);
+		pr_string_longtemp[i] = (char *) realloc (pr_string_longtemp[i], pr_string_longtempsize[i]);
+		if (!pr_string_longtemp[i])
+			Sys_Error ("PR_GetLongTempString: failed to allocate %d bytes", (int) pr_string_longtempsize[i]);
+	}
+	return pr_string_longtemp[i];
+}
+
 int PR_MakeTempString (const char *val)
 {
 	char *tmp = PR_GetTempString();
@@ -68,47 +87,57 @@ static const char* PF_GetStringArg(int idx, void* userdata)
 static char *PF_VarString (int	first)
 {
 	int		i;
-	static char out[1024];
+	char	*out;
 	const char *format;
-	size_t s;
-
-	out[0] = 0;
-	s = 0;
+	size_t s, size;
 
 	if (first >= qcvm->argc)
-		return out;
+		return "";
 
+// the result lives in the frame arena, so there's no length limit
 	format = LOC_GetString(G_STRING((OFS_PARM0 + first * 3)));
+	for (i = first, size = 1; i < qcvm->argc; i++)
+		size += strlen (LOC_GetString(G_STRING(OFS_PARM0+i*3)));
+
 	if (LOC_HasPlaceholders(format))
 	{
-		int offset = first + 1;
-		s = LOC_Format(format, PF_GetStringArg, &offset, out, sizeof(out));
+		int offset;
+		while (1)
+		{
+			offset = first + 1;
+			out = (char *) Frame_Alloc (size);
+			s = LOC_Format(format, PF_GetStringArg, &offset, out, size);
+			if (s + 1 < size)
+				break;
+			Frame_Shrink (out, 0);	// may have been cut short, try with more room
+			size *= 2;
+		}
 	}
 	else
 	{
-		for (i = first; i < qcvm->argc; i++)
+		out = (char *) Frame_Alloc (size);
+		for (i = first, s = 0; i < qcvm->argc; i++)
 		{
-			s = q_strlcat(out, LOC_GetString(G_STRING(OFS_PARM0+i*3)), sizeof(out));
-			if (s >= sizeof(out))
-			{
-				Con_Warning("PF_VarString: overflow (string truncated)\n");
-				return out;
-			}
+			const char *arg = LOC_GetString(G_STRING(OFS_PARM0+i*3));
+			size_t len = strlen (arg);
+			memcpy (out + s, arg, len);
+			s += len;
 		}
+		out[s] = 0;
 	}
+	Frame_Shrink (out, s + 1);
+
 	if (s > 255)
 	{
 		if (!dev_overflows.varstring || dev_overflows.varstring + CONSOLE_RESPAM_TIME < realtime)
 		{
-			Con_DWarning("PF_VarString: %i characters exceeds standard limit of 255 (max = %d).\n",
-								(int) s, (int)(sizeof(out) - 1));
+			Con_DWarning("PF_VarString: %i characters exceeds standard limit of 255.\n", (int) s);
 			dev_overflows.varstring = realtime;
 		}
 	}
 	return out;
 }
 
-
 /*
 =================
 PF_error
@@ -2710,7 +2739,7 @@ static void PF_strconv (void)
 	G_INT(OFS_RETURN) = PR_SetEngineString((char*)resbuf);
 }
 
-static void PF_sprintf_internal (const char *s, int firstarg, char *outbuf, int outbuflen)
+static size_t PF_sprintf_internal (const char *s, int firstarg, char *outbuf, int outbuflen)
 {
 	const char *s0;
 	char *o = outbuf, *end = outbuf + outbuflen, *err;
@@ -3077,12 +3106,33 @@ verbatim:
 	}
 finished:
 	*o = 0;
+	return o - outbuf;
 }
 
 static void PF_sprintf(void)
 {
-	char *outbuf = PR_GetTempString();
-	PF_sprintf_internal(G_STRING(OFS_PARM0), 1, outbuf, STRINGTEMP_LENGTH);
+	char *buf, *outbuf;
+	size_t len, size = STRINGTEMP_LENGTH;
+
+// format into the frame arena, growing it until nothing gets cut short
+	for (;;)
+	{
+		buf = (char *) Frame_Alloc (size);
+		len = PF_sprintf_internal(G_STRING(OFS_PARM0), 1, buf, (int) size);
+		if (len + 1 < size || size >= (1u << 24))
+			break;
+		Frame_Shrink (buf, 0);
+		size *= 2;
+	}
+
+// the result may be kept by the mod, so it has to outlive the frame
+	if (len < STRINGTEMP_LENGTH)
+		outbuf = PR_GetTempString();
+	else
+		outbuf = PR_GetLongTempString(len + 1);
+	memcpy (outbuf, buf, len + 1);
+	Frame_Shrink (buf, 0);
+
 	G_INT(OFS_RETURN) = PR_SetEngineString(outbuf);
 }
 
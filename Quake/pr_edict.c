@@ -2175,6 +2175,7 @@ qboolean PR_LoadProgs (const char *filename, qboolean fatal)
 		Z_Free ((void *)qcvm->knownstrings);
 	qcvm->knownstrings = NULL;
 	qcvm->firstfreeknownstring = NULL;
+	qcvm->allocatedstrings = 0;
 	PR_SetEngineString("");
 
 	qcvm->globaldefs = (ddef_t *)((byte *)qcvm->progs + qcvm->progs->ofs_globaldefs);
@@ -2431,6 +2432,7 @@ int PR_AllocString (int size, char **ptr)
 		return 0;
 	i = PR_AllocStringSlot ();
 	qcvm->knownstrings[i] = (char *)Hunk_AllocName(size, "string");
+	qcvm->allocatedstrings += size;
 	if (ptr)
 		*ptr = (char *) qcvm->knownstrings[i];
 	return -1 - i;
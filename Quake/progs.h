@@ -239,6 +239,7 @@ typedef struct qcvm_s
 	int				maxknownstrings;
 	int				numknownstrings;
 	const char		**firstfreeknownstring; // free list (singly linked)
+	size_t			allocatedstrings; // bytes from PR_AllocString
 
 	unsigned char	*knownzone;
 	size_t			knownzonesize;
@@ -35,20 +35,24 @@ typedef struct
 typedef struct sfx_s
 {
 	char	name[MAX_QPATH];
-	cache_user_t	cache;
+	struct sfxcache_s	*cache;	/* in the sound pool, NULL until loaded	*/
 } sfx_t;
 
 /* !!! if this is changed, it must be changed in asm_i386.h too !!! */
-typedef struct
+typedef struct sfxcache_s
 {
 	int	length;
 	int	loopstart;
 	int	speed;
 	int	width;
 	int	stereo;
+	unsigned int	codec;	/* CODECTYPE_* the sound was loaded from	*/
+	qboolean	streamed;	/* decoded while playing, data is the file name	*/
 	byte	data[1];	/* variable sized	*/
 } sfxcache_t;
 
+typedef struct sfxstream_s sfxstream_t;
+
 typedef struct
 {
 	int	channels;
@@ -69,12 +73,14 @@ typedef struct
 	int	rightvol;		/* 0-255 volume					*/
 	int	end;			/* end time in global paintsamples		*/
 	int	pos;			/* sample position in sfx			*/
-	int	looping;		/* where to loop, -1 = no looping		*/
+	int	looping;		/* loop from the start even without a cue	*/
 	int	entnum;			/* to allow overriding a specific sound		*/
 	int	entchannel;
 	vec3_t	origin;			/* origin of sound effect			*/
 	vec_t	dist_mult;		/* distance multiplier (attenuation/clipK)	*/
 	int	master_vol;		/* 0-255 master volume				*/
+	qboolean	virtualized;	/* tracked but not mixed			*/
+	sfxstream_t	*stream;	/* decoder for a streamed sound			*/
 } channel_t;
 
 #define WAV_FORMAT_PCM	1
@@ -108,7 +114,8 @@ void S_TouchSound (const char *sample);
 void S_ClearPrecache (void);
 void S_BeginPrecaching (void);
 void S_EndPrecaching (void);
-void S_PaintChannels (int endtime);
+void S_PaintChannels (channel_t *channels, int numchannels, int endtime);
+void S_AdvanceChannels (channel_t *channels, int numchannels, int starttime, int endtime);
 void S_InitPaintChannels (void);
 float S_GetLoFreqLevel (void);
 float S_GetHiFreqLevel (void);
@@ -175,6 +182,7 @@ extern	cvar_t		snd_mixspeed;
 extern	cvar_t		snd_filterquality;
 extern	cvar_t		sfxvolume;
 extern	cvar_t		loadas8bit;
+extern	cvar_t		snd_streamlength;
 
 #define	MAX_RAW_SAMPLES	8192
 extern	portable_samplepair_t	s_rawsamples[MAX_RAW_SAMPLES];
@@ -183,6 +191,24 @@ extern	cvar_t		bgmvolume;
 
 void S_LocalSound (const char *name);
 sfxcache_t *S_LoadSound (sfx_t *s);
+sfxcache_t *S_CachedSound (sfx_t *s);
+void S_FlushSounds (void);
+void S_FreeSoundPool (void);
+size_t S_SoundPoolSize (void);
+
+/* streaming of long sounds: opened and closed on the main thread, read by the mixer */
+sfxstream_t *S_OpenSfxStream (sfx_t *sfx, qboolean loop, int skip);
+void S_CloseSfxStream (sfxstream_t *st);
+void S_StartSfxStream (sfxstream_t *st);
+sfxcache_t *S_ReadSfxStream (sfxstream_t *st, int count, int *offset, int *numsamples);
+void S_CollectSfxStreams (channel_t *voices, int numvoices);
+void S_UpdateSfxStreams (qboolean all);
+int S_SfxStreamCount (void);
+
+/* serializes the mixer thread against music stream changes */
+void S_LockMixer (void);
+void S_UnlockMixer (void);
+qboolean S_MixerThreaded (void);
 
 wavinfo_t GetWavinfo (const char *name, byte *wav, int wavlength);
 
@@ -446,6 +446,10 @@ extern int		minimum_memory;
 
 void Host_InvokeOnMainThread (void (*func) (void *param), void *param);
 
+typedef void (*taskfunc_t) (int index, void *param);
+int Tasks_NumThreads (void);
+void Tasks_ParallelFor (int count, taskfunc_t func, void *param);
+
 #endif /* RC_INVOKED */
 
 #endif	/* QUAKEDEFS_H */
@@ -35,15 +35,13 @@ const float	r_avertexnormals[NUMVERTEXNORMALS][3] = {
 #include "anorms.h"
 };
 
-extern vec3_t	lightcolor; //johnfitz -- replaces "float shadelight" for lit support
-
-static float	entalpha; //johnfitz
-
 //johnfitz -- struct for passing lerp information to drawing functions
 typedef struct {
 	short pose1;
 	short pose2;
 	float blend;
+	float lerpstart;	// the shader computes the blend factor from these
+	float lerprate;
 	vec3_t origin;
 	vec3_t angles;
 } lerpdata_t;
@@ -51,16 +49,46 @@ typedef struct {
 
 #define MAX_ALIAS_INSTANCES 256
 
+//
+// per-entity instance data is kept in a persistent gpu buffer, and only
+// rewritten when it changes; the per-draw data just references it
+//
 typedef struct aliasinstance_s {
 	float		worldmatrix[12];
-	vec3_t		lightcolor;
-	float		alpha;
+	vec3_t		lightcolor;	// static lighting, unscaled
+	float		alpha;		// never negative, used to mark new slots
+	vec3_t		lightprobe;	// where the shader samples the light grid
+	float		uselightgrid;	// 0 = use lightcolor instead
 	int32_t		pose1;
 	int32_t		pose2;
-	float		blend;
-	int32_t		padding;
+	float		lerpstart;
+	float		lerprate;
+	float		minlight;
+	float		maxlight;
+	float		_pad[2];
 } aliasinstance_t;
 
+typedef struct aliasdraw_s {
+	vec3_t		dlightcolor;
+	uint32_t	slot;		// in the persistent instance buffer
+	uint32_t	occlusion;	// visibility slot, 0 if not tested
+	uint32_t	_pad[3];
+} aliasdraw_t;
+
+typedef struct aliasslot_s {
+	entity_t	*ent;
+	int			lastframe;
+} aliasslot_t;
+
+static struct {
+	aliasslot_t		*slots;
+	aliasinstance_t	*instances;		// copy of the gpu buffer
+	int				*freeslots;
+	GLuint			buffer;
+	int				buffersize;		// in slots
+	int				lastrelease;	// r_framecount
+} r_aliasstate;
+
 struct ibuf_s {
 	int			count;
 	entity_t	*ent;
@@ -68,28 +96,50 @@ struct ibuf_s {
 	struct {
 		float	matviewproj[16];
 		vec3_t	eyepos;
-		float	_pad;
+		float	time;
 		vec4_t	fog;
 		float	dither;
 		float	_padding[3];
 	} global;
-	aliasinstance_t inst[MAX_ALIAS_INSTANCES];
+	aliasdraw_t draws[MAX_ALIAS_INSTANCES];
 } ibuf;
 
+//
+// per-entity setup is done on the worker pool, then the instances are
+// batched in the original order on the main thread
+//
+typedef struct aliasprep_s {
+	entity_t		*ent;
+	aliashdr_t		*hdr;
+	int				slot;
+	qboolean		visible;
+	qboolean		badframe;
+	qboolean		dirty;
+	aliasdraw_t		draw;
+} aliasprep_t;
+
+typedef struct aliasprepjob_s {
+	aliasprep_t		*preps;
+	qboolean		showtris;
+} aliasprepjob_t;
+
 /*
 =================
 R_SetupAliasFrame -- johnfitz -- rewritten to support lerping
+
+Returns false if the entity's frame was out of range
 =================
 */
-void R_SetupAliasFrame (entity_t *e, aliashdr_t *paliashdr, lerpdata_t *lerpdata)
+qboolean R_SetupAliasFrame (entity_t *e, aliashdr_t *paliashdr, lerpdata_t *lerpdata)
 {
 	int posenum, numposes;
 	int frame = e->frame;
+	qboolean valid = true;
 
 	if ((frame >= paliashdr->numframes) || (frame < 0))
 	{
-		Con_DPrintf ("R_AliasSetupFrame: no such frame %d for '%s'\n", frame, e->model->name);
 		frame = 0;
+		valid = false;
 	}
 
 	posenum = paliashdr->frames[frame].firstpose;
@@ -132,9 +182,11 @@ void R_SetupAliasFrame (entity_t *e, aliashdr_t *paliashdr, lerpdata_t *lerpdata
 	{
 		float s = (cls.demoplayback && cls.demospeed < 0.f) ? -1.f : 1.f;
 		if (e->lerpflags & LERP_FINISH && numposes == 1)
-			lerpdata->blend = CLAMP (0.0f, (float)(cl.time - e->lerpstart) / (e->lerpfinish - e->lerpstart), 1.0f);
+			lerpdata->lerprate = 1.0f / (e->lerpfinish - e->lerpstart);
 		else
-			lerpdata->blend = CLAMP (0.0f, (float)(cl.time - e->lerpstart) / e->lerptime * s, 1.0f);
+			lerpdata->lerprate = s / e->lerptime;
+		lerpdata->lerpstart = e->lerpstart;
+		lerpdata->blend = CLAMP (0.0f, (float)(cl.time - e->lerpstart) * lerpdata->lerprate, 1.0f);
 		if (lerpdata->blend == 1.0f)
 			e->previouspose = e->currentpose;
 		lerpdata->pose1 = e->previouspose;
@@ -143,9 +195,13 @@ void R_SetupAliasFrame (entity_t *e, aliashdr_t *paliashdr, lerpdata_t *lerpdata
 	else //don't lerp
 	{
 		lerpdata->blend = 1;
+		lerpdata->lerpstart = 0;
+		lerpdata->lerprate = 0;
 		lerpdata->pose1 = posenum;
 		lerpdata->pose2 = posenum;
 	}
+
+	return valid;
 }
 
 /*
@@ -218,72 +274,175 @@ void R_SetupEntityTransform (entity_t *e, lerpdata_t *lerpdata)
 /*
 =================
 R_SetupAliasLighting -- johnfitz -- broken out from R_DrawAliasModel and rewritten
+
+The static light is stored in the persistent instance and the dynamic lights
+are added per draw, the shader applies the minimum and maximum to the sum.
+With the light grid only the sample position is stored, so instances don't
+change when lightstyles animate.
 =================
 */
-void R_SetupAliasLighting (entity_t	*e)
+void R_SetupAliasLighting (entity_t	*e, aliasinstance_t *instance, vec3_t dlightcolor)
 {
-	vec3_t		dist;
-	float		add;
-	int			i;
-
 	// if the initial trace is completely black, try again from above
 	// this helps with models whose origin is slightly below ground level
 	// (e.g. some of the candles in the DOTM start map)
-	if (!R_LightPoint (e->origin, 0.f, &e->lightcache))
-		R_LightPoint (e->origin, e->model->maxs[2] * 0.5f, &e->lightcache);
-
-	//add dlights
-	for (i=0; i<r_framedata.numlights; i++)
+	if (R_LightGridActive ())
 	{
-		gpulight_t *l = &r_lightbuffer.lights[i];
-		VectorSubtract (e->origin, l->pos, dist);
-		add = DotProduct (dist, dist);
-		if (l->radius * l->radius > add)
-			VectorMA (lightcolor, l->radius - sqrtf (add), l->color, lightcolor);
+		VectorCopy (e->origin, instance->lightprobe);
+		if (!R_LightGridPoint (instance->lightprobe, instance->lightcolor))
+			instance->lightprobe[2] += e->model->maxs[2] * 0.5f;
+		instance->lightcolor[0] = instance->lightcolor[1] = instance->lightcolor[2] = 0.f;
+		instance->uselightgrid = 1.f;
 	}
+	else if (!R_LightPoint (e->origin, 0.f, &e->lightcache, instance->lightcolor))
+		R_LightPoint (e->origin, e->model->maxs[2] * 0.5f, &e->lightcache, instance->lightcolor);
+
+	//add dlights
+	dlightcolor[0] = dlightcolor[1] = dlightcolor[2] = 0.f;
+	R_AddDlightsAtPoint (e->origin, dlightcolor);
+
+	instance->minlight = 0.f;
+	instance->maxlight = FLT_MAX;
 
 	// minimum light value on gun (24)
 	if (e == &cl.viewent)
+		instance->minlight = 72.0f;
+
+	// minimum light value on players (8)
+	if (e > cl_entities && e <= cl_entities + cl.maxclients)
+		instance->minlight = 24.0f;
+
+	// clamp lighting so it doesn't overbright as much (96)
+	if (gl_overbright_models.value)
+		instance->maxlight = 288.0f;
+	//hack up the brightness when fullbrights but no overbrights (256)
+	else if (e->model->flags & MOD_FBRIGHTHACK && gl_fullbrights.value)
+	{
+		instance->lightcolor[0] = 256.0f;
+		instance->lightcolor[1] = 256.0f;
+		instance->lightcolor[2] = 256.0f;
+		instance->uselightgrid = 0.f;
+		dlightcolor[0] = dlightcolor[1] = dlightcolor[2] = 0.f;
+	}
+}
+
+/*
+=================
+R_GetAliasSlot
+
+Returns the persistent instance slot of an entity, allocating one if needed
+=================
+*/
+static int R_GetAliasSlot (entity_t *e)
+{
+	int index = e->aliasslot - 1;
+
+	if (index < 0 || index >= (int) VEC_SIZE (r_aliasstate.slots) || r_aliasstate.slots[index].ent != e)
 	{
-		add = 72.0f - (lightcolor[0] + lightcolor[1] + lightcolor[2]);
-		if (add > 0.0f)
+		if (VEC_SIZE (r_aliasstate.freeslots))
+		{
+			index = r_aliasstate.freeslots[VEC_SIZE (r_aliasstate.freeslots) - 1];
+			VEC_POP (r_aliasstate.freeslots);
+		}
+		else
 		{
-			add *= 1.0f / 3.0f;
-			lightcolor[0] += add;
-			lightcolor[1] += add;
-			lightcolor[2] += add;
+			index = VEC_SIZE (r_aliasstate.slots);
+			Vec_Grow ((void **) &r_aliasstate.slots, sizeof (r_aliasstate.slots[0]), 1);
+			Vec_Grow ((void **) &r_aliasstate.instances, sizeof (r_aliasstate.instances[0]), 1);
+			VEC_HEADER (r_aliasstate.slots).size++;
+			VEC_HEADER (r_aliasstate.instances).size++;
 		}
+
+		r_aliasstate.slots[index].ent = e;
+		memset (&r_aliasstate.instances[index], 0, sizeof (r_aliasstate.instances[index]));
+		r_aliasstate.instances[index].alpha = -1.f; // doesn't match any real instance
+		e->aliasslot = index + 1;
 	}
 
-	// minimum light value on players (8)
-	if (e > cl_entities && e <= cl_entities + cl.maxclients)
+	r_aliasstate.slots[index].lastframe = r_framecount;
+	return index;
+}
+
+/*
+=================
+R_ReleaseAliasSlots
+
+Frees the slots of the entities that weren't drawn in the last frame
+=================
+*/
+static void R_ReleaseAliasSlots (void)
+{
+	int i, count;
+
+	if (r_aliasstate.lastrelease == r_framecount)
+		return;
+	r_aliasstate.lastrelease = r_framecount;
+
+	for (i = 0, count = VEC_SIZE (r_aliasstate.slots); i < count; i++)
 	{
-		add = 24.0f - (lightcolor[0] + lightcolor[1] + lightcolor[2]);
-		if (add > 0.0f)
+		aliasslot_t *slot = &r_aliasstate.slots[i];
+		if (slot->ent && (unsigned)(r_framecount - slot->lastframe) > 1u)
 		{
-			add *= 1.0f / 3.0f;
-			lightcolor[0] += add;
-			lightcolor[1] += add;
-			lightcolor[2] += add;
+			slot->ent = NULL;
+			VEC_PUSH (r_aliasstate.freeslots, i);
 		}
 	}
+}
 
-	// clamp lighting so it doesn't overbright as much (96)
-	if (gl_overbright_models.value)
+/*
+=================
+R_CompareSlots
+=================
+*/
+static int R_CompareSlots (const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
+}
+
+/*
+=================
+R_UploadAliasInstances
+
+Sends the instances that changed to the gpu, merging adjacent slots
+=================
+*/
+static void R_UploadAliasInstances (const aliasprep_t *preps, int count)
+{
+	int		i, j, numdirty, numslots;
+	int		*dirty;
+
+	numslots = VEC_SIZE (r_aliasstate.slots);
+	if (numslots > r_aliasstate.buffersize)
 	{
-		add = lightcolor[0] + lightcolor[1] + lightcolor[2];
-		if (add > 288.0f)
-			VectorScale(lightcolor, 288.0f / add, lightcolor);
+		// grow the buffer and upload everything
+		r_aliasstate.buffersize = q_max (Q_nextPow2 (numslots), MAX_ALIAS_INSTANCES);
+		GL_DeleteBuffer (r_aliasstate.buffer);
+		r_aliasstate.buffer = GL_CreateBuffer (GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW, "alias instances", r_aliasstate.buffersize * sizeof (aliasinstance_t), NULL);
+		GL_BufferSubDataFunc (GL_SHADER_STORAGE_BUFFER, 0, numslots * sizeof (aliasinstance_t), r_aliasstate.instances);
+		rs_aliasuploads += numslots;
+		return;
 	}
-	//hack up the brightness when fullbrights but no overbrights (256)
-	else if (e->model->flags & MOD_FBRIGHTHACK && gl_fullbrights.value)
+
+	dirty = (int *) Frame_Alloc (count * sizeof (int));
+	for (i = numdirty = 0; i < count; i++)
+		if (preps[i].visible && preps[i].dirty)
+			dirty[numdirty++] = preps[i].slot;
+	if (!numdirty)
+		return;
+
+	qsort (dirty, numdirty, sizeof (dirty[0]), R_CompareSlots);
+
+	GL_BindBuffer (GL_SHADER_STORAGE_BUFFER, r_aliasstate.buffer);
+	for (i = 0; i < numdirty; i = j)
 	{
-		lightcolor[0] = 256.0f;
-		lightcolor[1] = 256.0f;
-		lightcolor[2] = 256.0f;
+		for (j = i + 1; j < numdirty && dirty[j] <= dirty[j - 1] + 1; j++)
+			;
+		GL_BufferSubDataFunc (GL_SHADER_STORAGE_BUFFER,
+			dirty[i] * sizeof (aliasinstance_t),
+			(dirty[j - 1] - dirty[i] + 1) * sizeof (aliasinstance_t),
+			&r_aliasstate.instances[dirty[i]]);
 	}
-
-	VectorScale (lightcolor, 1.0f / 200.0f, lightcolor);
+	rs_aliasuploads += numdirty;
 }
 
 /*
@@ -348,6 +507,7 @@ void R_FlushAliasInstances (qboolean showtris)
 
 	memcpy (ibuf.global.matviewproj, r_matviewproj, sizeof (r_matviewproj));
 	memcpy (ibuf.global.eyepos, r_refdef.vieworg, sizeof (r_refdef.vieworg));
+	ibuf.global.time = cl.time;
 	memcpy (ibuf.global.fog, r_framedata.fogdata, 3 * sizeof (float));
 	// use fog density sign bit as overbright flag
 	ibuf.global.fog[3] =
@@ -357,13 +517,17 @@ void R_FlushAliasInstances (qboolean showtris)
 	;
 	ibuf.global.dither = r_framedata.screendither;
 
-	ibuf_size = sizeof(ibuf.global) + sizeof(ibuf.inst[0]) * ibuf.count;
+	ibuf_size = sizeof(ibuf.global) + sizeof(ibuf.draws[0]) * ibuf.count;
 	GL_Upload (GL_SHADER_STORAGE_BUFFER, &ibuf.global, ibuf_size, &buf, &ofs);
 
 	buffers[0] = buf;
 	offsets[0] = (GLintptr) ofs;
 	sizes[0] = ibuf_size;
 
+	R_BindOcclusionVisibility ();
+	GL_BindBufferRange (GL_SHADER_STORAGE_BUFFER, 4, r_aliasstate.buffer, 0, r_aliasstate.buffersize * sizeof (aliasinstance_t));
+	R_BindLightBuffer ();
+	R_BindLightGrid ();
 	GL_BindBuffer (GL_ARRAY_BUFFER, model->meshvbo);
 	GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, model->meshindexesvbo);
 
@@ -451,7 +615,7 @@ static qboolean R_Alias_CanAddToBatch (const entity_t *e)
 		return true;
 
 	// full batch
-	if (ibuf.count == countof (ibuf.inst))
+	if (ibuf.count == countof (ibuf.draws))
 		return false;
 
 	// different models/skins
@@ -467,27 +631,38 @@ static qboolean R_Alias_CanAddToBatch (const entity_t *e)
 
 /*
 =================
-R_DrawAliasModel_Real
+R_PrepareAliasInstance
+
+Sets up the lerp state, transform and lighting of a single entity,
+only touching that entity and its slot so it can run on any thread
 =================
 */
-static void R_DrawAliasModel_Real (entity_t *e, qboolean showtris)
+static void R_PrepareAliasInstance (aliasprep_t *prep, qboolean showtris)
 {
-	aliashdr_t	*paliashdr;
+	entity_t	*e = prep->ent;
+	aliashdr_t	*paliashdr = prep->hdr;
 	lerpdata_t	lerpdata;
 	float		fovscale = 1.0f;
 	float		model_matrix[16];
-	aliasinstance_t	*instance;
+	float		entalpha; //johnfitz
+	aliasinstance_t	instance;
+	aliasinstance_t	*stored = &r_aliasstate.instances[prep->slot];
+
+	prep->visible = false;
+	prep->dirty = false;
 
 	//
 	// setup pose/lerp data -- do it first so we don't miss updates due to culling
 	//
-	paliashdr = (aliashdr_t *)Mod_Extradata (e->model);
-
-	R_SetupAliasFrame (e, paliashdr, &lerpdata);
+	prep->badframe = !R_SetupAliasFrame (e, paliashdr, &lerpdata);
 	R_SetupEntityTransform (e, &lerpdata);
 
 	if (lerpdata.pose1 == lerpdata.pose2)
+	{
 		lerpdata.blend = 0.f;
+		lerpdata.lerpstart = 0.f;
+		lerpdata.lerprate = 0.f;
+	}
 
 	//
 	// viewmodel adjustments (position, fov distortion correction)
@@ -532,47 +707,117 @@ static void R_DrawAliasModel_Real (entity_t *e, qboolean showtris)
 	//
 	// set up lighting
 	//
-	rs_aliaspolys += paliashdr->numtris;
-	R_SetupAliasLighting (e);
-
-	//
-	// draw it
-	//
+	memset (&instance, 0, sizeof (instance));
+	R_SetupAliasLighting (e, &instance, prep->draw.dlightcolor);
 
 	if (r_fullbright_cheatsafe || showtris)
-		lightcolor[0] = lightcolor[1] = lightcolor[2] = 0.5f;
+	{
+		// 0.5 after scaling
+		instance.lightcolor[0] = instance.lightcolor[1] = instance.lightcolor[2] = 100.f;
+		instance.uselightgrid = 0.f;
+		instance.minlight = 0.f;
+		instance.maxlight = FLT_MAX;
+		prep->draw.dlightcolor[0] = prep->draw.dlightcolor[1] = prep->draw.dlightcolor[2] = 0.f;
+	}
 
 	if (showtris)
 		entalpha = 1.f;
 
-	if (!R_Alias_CanAddToBatch (e))
-		R_FlushAliasInstances (showtris);
+	MatrixTranspose4x3 (model_matrix, instance.worldmatrix);
 
-	if (!ibuf.count)
-		ibuf.ent = e;
+	instance.alpha = entalpha;
+	instance.pose1 = lerpdata.pose1;
+	instance.pose2 = lerpdata.pose2;
+	instance.lerpstart = lerpdata.lerpstart;
+	instance.lerprate = lerpdata.lerprate;
 
-	instance = &ibuf.inst[ibuf.count++];
+	if (paliashdr->poseverttype == PV_QUAKE1)
+	{
+		instance.pose1 *= paliashdr->numverts_vbo;
+		instance.pose2 *= paliashdr->numverts_vbo;
+	}
+	else
+	{
+		instance.pose1 *= paliashdr->numbones;
+		instance.pose2 *= paliashdr->numbones;
+	}
 
-	MatrixTranspose4x3 (model_matrix, instance->worldmatrix);
+	prep->draw.slot = prep->slot;
+	prep->draw.occlusion = 0;
 
-	instance->lightcolor[0] = lightcolor[0];
-	instance->lightcolor[1] = lightcolor[1];
-	instance->lightcolor[2] = lightcolor[2];
-	instance->alpha = entalpha;
-	instance->pose1 = lerpdata.pose1;
-	instance->pose2 = lerpdata.pose2;
-	instance->blend = lerpdata.blend;
+	// only instances that changed are uploaded
+	if (memcmp (stored, &instance, sizeof (instance)) != 0)
+	{
+		*stored = instance;
+		prep->dirty = true;
+	}
 
-	if (paliashdr->poseverttype == PV_QUAKE1)
+	prep->visible = true;
+}
+
+/*
+=================
+R_PrepareAliasInstanceTask
+=================
+*/
+static void R_PrepareAliasInstanceTask (int index, void *param)
+{
+	aliasprepjob_t *job = (aliasprepjob_t *) param;
+	R_PrepareAliasInstance (&job->preps[index], job->showtris);
+}
+
+/*
+=================
+R_DrawAliasModels_Real
+=================
+*/
+static void R_DrawAliasModels_Real (entity_t **ents, int count, qboolean showtris)
+{
+	aliasprepjob_t	job;
+	aliasprep_t		*prep;
+	int				i;
+
+	if (count <= 0)
+		return;
+
+	R_ReleaseAliasSlots ();
+
+	// model data and slots are fetched up front, the cache is only safe to use from the main thread
+	job.preps = (aliasprep_t *) Frame_Alloc (count * sizeof (aliasprep_t));
+	job.showtris = showtris;
+	for (i = 0; i < count; i++)
 	{
-		instance->pose1 *= paliashdr->numverts_vbo;
-		instance->pose2 *= paliashdr->numverts_vbo;
+		job.preps[i].ent = ents[i];
+		job.preps[i].hdr = (aliashdr_t *) Mod_Extradata (ents[i]->model);
+		job.preps[i].slot = R_GetAliasSlot (ents[i]);
 	}
-	else
+
+	Tasks_ParallelFor (count, R_PrepareAliasInstanceTask, &job);
+
+	R_UploadAliasInstances (job.preps, count);
+
+	for (i = 0, prep = job.preps; i < count; i++, prep++)
 	{
-		instance->pose1 *= paliashdr->numbones;
-		instance->pose2 *= paliashdr->numbones;
+		if (prep->badframe)
+			Con_DPrintf ("R_AliasSetupFrame: no such frame %d for '%s'\n", prep->ent->frame, prep->ent->model->name);
+		if (!prep->visible)
+			continue;
+
+		rs_aliaspolys += prep->hdr->numtris;
+		rs_aliasinstances++;
+
+		if (!R_Alias_CanAddToBatch (prep->ent))
+			R_FlushAliasInstances (showtris);
+
+		if (!ibuf.count)
+			ibuf.ent = prep->ent;
+
+		ibuf.draws[ibuf.count] = prep->draw;
+		ibuf.draws[ibuf.count].occlusion = R_GetOcclusionSlot (&ents[i]);
+		ibuf.count++;
 	}
+
+	R_FlushAliasInstances (showtris);
 }
 
 /*
@@ -582,10 +827,7 @@ R_DrawAliasModels
 */
 void R_DrawAliasModels (entity_t **ents, int count)
 {
-	int i;
-	for (i = 0; i < count; i++)
-		R_DrawAliasModel_Real (ents[i], false);
-	R_FlushAliasInstances (false);
+	R_DrawAliasModels_Real (ents, count, false);
 }
 
 /*
@@ -595,8 +837,5 @@ R_DrawAliasModels_ShowTris
 */
 void R_DrawAliasModels_ShowTris (entity_t **ents, int count)
 {
-	int i;
-	for (i = 0; i < count; i++)
-		R_DrawAliasModel_Real (ents[i], true);
-	R_FlushAliasInstances (true);
+	R_DrawAliasModels_Real (ents, count, true);
 }
@@ -288,6 +288,19 @@ static void GL_FillSurfaceLightmap (msurface_t *surf)
 	}
 }
 
+/*
+==================
+GL_FillLightmapTask
+
+Surfaces own disjoint rectangles of the lightmap, so they can be filled in
+any order from any thread
+==================
+*/
+static void GL_FillLightmapTask (int index, void *unused)
+{
+	GL_FillSurfaceLightmap (lit_surfs[index]);
+}
+
 /*
 ==================
 GL_FreeLightmapData
@@ -314,6 +327,8 @@ static void GL_FreeLightmapData (void)
 	lightmap_width = 0;
 	lightmap_height = 0;
 	num_lightmap_samples = 0;
+
+	MemStats_Set (MEM_LIGHTMAPS, 0);
 }
 
 /*
@@ -440,8 +455,9 @@ with all the surfaces from all brush models
 */
 void GL_BuildLightmaps (void)
 {
-	int			i, j, xblocks, yblocks, lmsize;
+	int			i, xblocks, yblocks, lmsize;
 	lightmap_t	*lm;
+	double		packtime, filltime;
 
 	r_framecount = 1; // no dlightcache
 
@@ -463,7 +479,9 @@ void GL_BuildLightmaps (void)
 	}
 
 	// allocate lightmap blocks
+	packtime = Sys_DoubleTime ();
 	GL_PackLitSurfaces ();
+	packtime = Sys_DoubleTime () - packtime;
 
 	// determine combined texture size and allocate memory for it
 	xblocks = (int) ceil (sqrt (lightmap_count));
@@ -490,6 +508,7 @@ void GL_BuildLightmaps (void)
 	lightmap_data = (unsigned *) calloc (lmsize, sizeof (*lightmap_data));
 	if (!lightmap_data)
 		Sys_Error ("GL_BuildLightmaps: out of memory on %" SDL_PRIu64 " bytes", (uint64_t)(lmsize * sizeof (*lightmap_data)));
+	MemStats_Set (MEM_LIGHTMAPS, lmsize * sizeof (*lightmap_data) + lightmap_count * sizeof (*lightmaps));
 
 	// compute offsets for each lightmap block
 	for (i=0; i<lightmap_count; i++)
@@ -508,8 +527,12 @@ void GL_BuildLightmaps (void)
 			lightmap_data[i] = 0xff808080u;
 
 	// fill lightmap samples
-	for (i = 0, j = VEC_SIZE (lit_surfs); i < j; i++)
-		GL_FillSurfaceLightmap (lit_surfs[i]);
+	filltime = Sys_DoubleTime ();
+	Tasks_ParallelFor (VEC_SIZE (lit_surfs), GL_FillLightmapTask, NULL);
+	filltime = Sys_DoubleTime () - filltime;
+
+	Con_DPrintf ("Lightmap build:  %d surfaces, %.1f ms packing, %.1f ms filling (%d threads)\n",
+		(int) VEC_SIZE (lit_surfs), packtime * 1000.0, filltime * 1000.0, Tasks_NumThreads ());
 
 	lightmap_texture =
 		TexMgr_LoadImage (cl.worldmodel, "lightmap", lightmap_width, lightmap_height,
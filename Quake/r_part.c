@@ -27,6 +27,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 										//  time
 #define ABSOLUTE_MIN_PARTICLES	512		// no fewer than this no matter what's
 										//  on the command line
+#define MAX_GPU_PARTICLES		(256 * 1024)	// default max # of particles
+												//  simulated on the gpu
 
 static int	ramp1[8] = {0x6f, 0x6d, 0x6b, 0x69, 0x67, 0x65, 0x63, 0x61};
 static int	ramp2[8] = {0x6f, 0x6e, 0x6d, 0x6c, 0x6b, 0x6a, 0x68, 0x66};
@@ -39,6 +41,7 @@ static float uvscale;
 static float texturescalefactor; //johnfitz -- compensate for apparent size of different particle textures
 
 cvar_t	r_particles = {"r_particles","2", CVAR_ARCHIVE}; //johnfitz
+cvar_t	r_gpuparticles = {"r_gpuparticles","1", CVAR_ARCHIVE};
 
 typedef struct particlevert_t {
 	vec3_t		pos;
@@ -48,6 +51,71 @@ typedef struct particlevert_t {
 static particlevert_t partverts[MAX_PARTICLES];
 static int numpartverts = 0;
 
+/*
+Without r_gpuparticles, CL_RunParticles moves the particles spawned since
+the last update into one store per type, laid out as separate arrays per
+field, so that every type is updated by a few straight loops over its
+arrays instead of a switch per particle. Dead particles are swap-removed,
+so the order within a store is not stable.
+*/
+typedef struct particlestore_s
+{
+	float		*x, *y, *z;
+	float		*vx, *vy, *vz;
+	float		*ramp;
+	float		*die;
+	float		*spawn;
+	byte		*color;
+	int			count;
+	int			capacity;
+} particlestore_t;
+
+#define NUM_PARTICLE_TYPES	(pt_blob2 + 1)
+
+static particlestore_t	partstores[NUM_PARTICLE_TYPES];
+static int				r_numstoredparticles;
+
+/*
+With r_gpuparticles, the particles array only holds the ones spawned since
+the last frame was rendered. They are then copied into a ring buffer on the
+gpu, where a compute shader simulates them and appends the live ones to an
+instanced draw. Once the ring is full the oldest particles are recycled.
+CL_RunParticles keeps simulating on the cpu with r_gpuparticles 0.
+*/
+typedef struct gpuparticle_s
+{
+	vec3_t		org;
+	float		die;
+	vec3_t		vel;
+	float		ramp;
+	uint32_t	color;
+	uint32_t	type;
+	float		spawn;
+	uint32_t	pad;
+} gpuparticle_t;
+
+typedef struct gpuparticlesim_s
+{
+	float		time;
+	float		prevtime;
+	float		frametime;
+	float		gravity;
+	uint32_t	numparticles;
+	uint32_t	pad[3];
+} gpuparticlesim_t;
+
+static struct
+{
+	GLuint		state_buffer;	// gpuparticle_t[budget]
+	GLuint		vertex_buffer;	// particlevert_t[budget]
+	GLuint		cmd_buffer;		// DrawArraysIndirectCommand
+	int			budget;
+	int			head;			// next slot to spawn into
+	int			used;			// slots that have ever held a particle
+	double		time;			// of the last update
+	qboolean	reset;
+} gpuparticles;
+
 /*
 ===============
 R_SetParticleTexture_f -- johnfitz
@@ -68,6 +136,16 @@ static void R_SetParticleTexture_f (cvar_t *var)
 	}
 }
 
+/*
+===============
+R_GpuParticles_f
+===============
+*/
+static void R_GpuParticles_f (cvar_t *var)
+{
+	R_ClearParticles ();
+}
+
 /*
 ===============
 R_AllocParticle
@@ -75,7 +153,7 @@ R_AllocParticle
 */
 particle_t *R_AllocParticle (void)
 {
-	if (r_numactiveparticles < r_numparticles)
+	if (r_numactiveparticles + r_numstoredparticles < r_numparticles)
 	{
 		particle_t *p = &particles[r_numactiveparticles++];
 		p->spawn = cl.time - 0.001;
@@ -110,9 +188,17 @@ void R_InitParticles (void)
 			Hunk_AllocName (r_numparticles * sizeof(particle_t), "particles");
 	r_numactiveparticles = 0;
 
+	i = COM_CheckParm ("-gpuparticles");
+	if (i && i < com_argc - 1)
+		gpuparticles.budget = q_max (atoi (com_argv[i + 1]), ABSOLUTE_MIN_PARTICLES);
+	else
+		gpuparticles.budget = MAX_GPU_PARTICLES;
+
 	Cvar_RegisterVariable (&r_particles); //johnfitz
 	Cvar_SetCallback (&r_particles, R_SetParticleTexture_f);
 	R_SetParticleTexture_f (&r_particles); // set default
+	Cvar_RegisterVariable (&r_gpuparticles);
+	Cvar_SetCallback (&r_gpuparticles, R_GpuParticles_f);
 }
 
 /*
@@ -183,7 +269,15 @@ R_ClearParticles
 */
 void R_ClearParticles (void)
 {
+	int i;
+
 	r_numactiveparticles = 0;
+	r_numstoredparticles = 0;
+	for (i = 0; i < NUM_PARTICLE_TYPES; i++)
+		partstores[i].count = 0;
+	gpuparticles.head = 0;
+	gpuparticles.used = 0;
+	gpuparticles.reset = true;
 }
 
 /*
@@ -558,6 +652,198 @@ void R_RocketTrail (vec3_t start, vec3_t end, int type)
 	}
 }
 
+/*
+===============
+R_GrowParticleStore
+===============
+*/
+static void R_GrowParticleStore (particlestore_t *s, int count)
+{
+	int capacity = q_max (s->capacity, 256);
+
+	while (capacity < count)
+		capacity *= 2;
+	if (capacity == s->capacity)
+		return;
+
+	s->x		= (float *) realloc (s->x,		capacity * sizeof (float));
+	s->y		= (float *) realloc (s->y,		capacity * sizeof (float));
+	s->z		= (float *) realloc (s->z,		capacity * sizeof (float));
+	s->vx		= (float *) realloc (s->vx,		capacity * sizeof (float));
+	s->vy		= (float *) realloc (s->vy,		capacity * sizeof (float));
+	s->vz		= (float *) realloc (s->vz,		capacity * sizeof (float));
+	s->ramp		= (float *) realloc (s->ramp,	capacity * sizeof (float));
+	s->die		= (float *) realloc (s->die,	capacity * sizeof (float));
+	s->spawn	= (float *) realloc (s->spawn,	capacity * sizeof (float));
+	s->color	= (byte *) realloc (s->color,	capacity * sizeof (byte));
+	if (!s->x || !s->y || !s->z || !s->vx || !s->vy || !s->vz || !s->ramp || !s->die || !s->spawn || !s->color)
+		Sys_Error ("R_GrowParticleStore: realloc() failed on %d particles", capacity);
+	s->capacity = capacity;
+}
+
+/*
+===============
+R_StoreParticles
+
+Moves the particles spawned since the last update into their type's store
+===============
+*/
+static void R_StoreParticles (void)
+{
+	particle_t		*p;
+	particlestore_t	*s;
+	int				i, j, counts[NUM_PARTICLE_TYPES];
+
+	memset (counts, 0, sizeof (counts));
+	for (i = 0, p = particles; i < r_numactiveparticles; i++, p++)
+		counts[p->type]++;
+	for (i = 0; i < NUM_PARTICLE_TYPES; i++)
+		if (counts[i])
+			R_GrowParticleStore (&partstores[i], partstores[i].count + counts[i]);
+
+	for (i = 0, p = particles; i < r_numactiveparticles; i++, p++)
+	{
+		s = &partstores[p->type];
+		j = s->count++;
+		s->x[j] = p->org[0];
+		s->y[j] = p->org[1];
+		s->z[j] = p->org[2];
+		s->vx[j] = p->vel[0];
+		s->vy[j] = p->vel[1];
+		s->vz[j] = p->vel[2];
+		s->ramp[j] = p->ramp;
+		s->die[j] = p->die;
+		s->spawn[j] = p->spawn;
+		s->color[j] = p->color;
+	}
+
+	r_numactiveparticles = 0;
+}
+
+/*
+===============
+R_RemoveDeadParticles
+===============
+*/
+static void R_RemoveDeadParticles (particlestore_t *s)
+{
+	int i, last;
+
+	for (i = 0; i < s->count; )
+	{
+		if (s->die[i] >= cl.time && s->spawn[i] <= cl.time)
+		{
+			i++;
+			continue;
+		}
+
+		last = --s->count;
+		s->x[i] = s->x[last];
+		s->y[i] = s->y[last];
+		s->z[i] = s->z[last];
+		s->vx[i] = s->vx[last];
+		s->vy[i] = s->vy[last];
+		s->vz[i] = s->vz[last];
+		s->ramp[i] = s->ramp[last];
+		s->die[i] = s->die[last];
+		s->spawn[i] = s->spawn[last];
+		s->color[i] = s->color[last];
+	}
+}
+
+/*
+===============
+R_ParticleMulAdd
+
+dst[i] += src[i] * scale
+===============
+*/
+static void R_ParticleMulAdd (float *dst, const float *src, float scale, int count)
+{
+	int i = 0;
+
+#ifdef USE_SSE2
+	if (use_simd)
+	{
+		__m128 vscale = _mm_set1_ps (scale);
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_ps (dst + i, _mm_add_ps (_mm_loadu_ps (dst + i), _mm_mul_ps (_mm_loadu_ps (src + i), vscale)));
+	}
+#endif
+
+	for (; i < count; i++)
+		dst[i] += src[i] * scale;
+}
+
+/*
+===============
+R_ParticleAdd
+
+dst[i] += value
+===============
+*/
+static void R_ParticleAdd (float *dst, float value, int count)
+{
+	int i = 0;
+
+#ifdef USE_SSE2
+	if (use_simd)
+	{
+		__m128 vvalue = _mm_set1_ps (value);
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_ps (dst + i, _mm_add_ps (_mm_loadu_ps (dst + i), vvalue));
+	}
+#endif
+
+	for (; i < count; i++)
+		dst[i] += value;
+}
+
+/*
+===============
+R_ParticleRamp
+
+Advances the color ramp, marking the particles that ran past its end as dead
+===============
+*/
+static void R_ParticleRamp (particlestore_t *s, float step, float end, const int *ramp)
+{
+	int		i = 0;
+	float	r;
+
+#ifdef USE_SSE2
+	if (use_simd)
+	{
+		__m128 vstep = _mm_set1_ps (step);
+		__m128 vend = _mm_set1_ps (end);
+		__m128 vdead = _mm_set1_ps (-1.f);
+		for (; i + 4 <= s->count; i += 4)
+		{
+			__m128 vramp = _mm_add_ps (_mm_loadu_ps (s->ramp + i), vstep);
+			__m128 alive = _mm_cmplt_ps (vramp, vend);
+			__m128 vdie = _mm_loadu_ps (s->die + i);
+			vdie = _mm_or_ps (_mm_and_ps (alive, vdie), _mm_andnot_ps (alive, vdead));
+			_mm_storeu_ps (s->ramp + i, vramp);
+			_mm_storeu_ps (s->die + i, vdie);
+		}
+	}
+#endif
+
+	for (; i < s->count; i++)
+	{
+		r = s->ramp[i] + step;
+		s->ramp[i] = r;
+		s->die[i] = r < end ? s->die[i] : -1.f;
+	}
+
+	// the ramp tables have 8 entries, the index is masked so the lookup is always safe
+	for (i = 0; i < s->count; i++)
+	{
+		r = s->ramp[i];
+		s->color[i] = r < end ? ramp[(int)r & 7] : s->color[i];
+	}
+}
+
 /*
 ===============
 CL_RunParticles -- johnfitz -- all the particle behavior, separated from R_DrawParticles
@@ -565,11 +851,14 @@ CL_RunParticles -- johnfitz -- all the particle behavior, separated from R_DrawP
 */
 void CL_RunParticles (void)
 {
-	particle_t		*p;
-	int				i, cur, active;
+	particlestore_t	*s;
+	int				type;
 	float			time1, time2, time3, dvel, frametime, grav;
 	extern	cvar_t	sv_gravity;
 
+	if (r_gpuparticles.value)
+		return; // simulated in R_UpdateParticles
+
 	frametime = cl.time - cl.oldtime;
 	time3 = frametime * 15;
 	time2 = frametime * 10;
@@ -577,74 +866,178 @@ void CL_RunParticles (void)
 	grav = frametime * sv_gravity.value * 0.05;
 	dvel = 4*frametime;
 
-	for (cur = active = 0, p = particles; cur < r_numactiveparticles; cur++, p++)
+	if (r_numactiveparticles)
+		R_StoreParticles ();
+
+	r_numstoredparticles = 0;
+	for (type = 0; type < NUM_PARTICLE_TYPES; type++)
 	{
-		if (p->die < cl.time || p->spawn > cl.time)
+		s = &partstores[type];
+		R_RemoveDeadParticles (s);
+		if (!s->count)
 			continue;
+		r_numstoredparticles += s->count;
 
-		p->org[0] += p->vel[0]*frametime;
-		p->org[1] += p->vel[1]*frametime;
-		p->org[2] += p->vel[2]*frametime;
+		R_ParticleMulAdd (s->x, s->vx, frametime, s->count);
+		R_ParticleMulAdd (s->y, s->vy, frametime, s->count);
+		R_ParticleMulAdd (s->z, s->vz, frametime, s->count);
 
-		switch (p->type)
+		switch (type)
 		{
 		case pt_static:
 			break;
+
 		case pt_fire:
-			p->ramp += time1;
-			if (p->ramp >= 6)
-				p->die = -1;
-			else
-				p->color = ramp3[(int)p->ramp];
-			p->vel[2] += grav;
+			R_ParticleRamp (s, time1, 6, ramp3);
+			R_ParticleAdd (s->vz, grav, s->count);
 			break;
 
 		case pt_explode:
-			p->ramp += time2;
-			if (p->ramp >=8)
-				p->die = -1;
-			else
-				p->color = ramp1[(int)p->ramp];
-			for (i=0 ; i<3 ; i++)
-				p->vel[i] += p->vel[i]*dvel;
-			p->vel[2] -= grav;
+			R_ParticleRamp (s, time2, 8, ramp1);
+			R_ParticleMulAdd (s->vx, s->vx, dvel, s->count);
+			R_ParticleMulAdd (s->vy, s->vy, dvel, s->count);
+			R_ParticleMulAdd (s->vz, s->vz, dvel, s->count);
+			R_ParticleAdd (s->vz, -grav, s->count);
 			break;
 
 		case pt_explode2:
-			p->ramp += time3;
-			if (p->ramp >=8)
-				p->die = -1;
-			else
-				p->color = ramp2[(int)p->ramp];
-			for (i=0 ; i<3 ; i++)
-				p->vel[i] -= p->vel[i]*frametime;
-			p->vel[2] -= grav;
+			R_ParticleRamp (s, time3, 8, ramp2);
+			R_ParticleMulAdd (s->vx, s->vx, -frametime, s->count);
+			R_ParticleMulAdd (s->vy, s->vy, -frametime, s->count);
+			R_ParticleMulAdd (s->vz, s->vz, -frametime, s->count);
+			R_ParticleAdd (s->vz, -grav, s->count);
 			break;
 
 		case pt_blob:
-			for (i=0 ; i<3 ; i++)
-				p->vel[i] += p->vel[i]*dvel;
-			p->vel[2] -= grav;
+			R_ParticleMulAdd (s->vx, s->vx, dvel, s->count);
+			R_ParticleMulAdd (s->vy, s->vy, dvel, s->count);
+			R_ParticleMulAdd (s->vz, s->vz, dvel, s->count);
+			R_ParticleAdd (s->vz, -grav, s->count);
 			break;
 
 		case pt_blob2:
-			for (i=0 ; i<2 ; i++)
-				p->vel[i] -= p->vel[i]*dvel;
-			p->vel[2] -= grav;
+			R_ParticleMulAdd (s->vx, s->vx, -dvel, s->count);
+			R_ParticleMulAdd (s->vy, s->vy, -dvel, s->count);
+			R_ParticleAdd (s->vz, -grav, s->count);
 			break;
 
 		case pt_grav:
 		case pt_slowgrav:
-			p->vel[2] -= grav;
+			R_ParticleAdd (s->vz, -grav, s->count);
 			break;
 		}
+	}
+}
 
-		if (cur != active)
-			particles[active] = *p;
-		active++;
+/*
+===============
+R_SpawnGPUParticles
+
+Copies the particles spawned since the last update to the ring buffer
+===============
+*/
+static void R_SpawnGPUParticles (void)
+{
+	gpuparticle_t	*staged, *out;
+	particle_t		*p;
+	int				i, count, first;
+
+	count = q_min (r_numactiveparticles, gpuparticles.budget);
+	p = particles + r_numactiveparticles - count; // the newest ones win
+	staged = (gpuparticle_t *) Frame_Alloc (count * sizeof (*staged));
+	for (i = 0, out = staged; i < count; i++, p++, out++)
+	{
+		VectorCopy (p->org, out->org);
+		out->die = p->die;
+		VectorCopy (p->vel, out->vel);
+		out->ramp = p->ramp;
+		out->color = p->color;
+		out->type = p->type;
+		out->spawn = p->spawn;
+		out->pad = 0;
+	}
+	r_numactiveparticles = 0;
+
+	GL_BindBuffer (GL_SHADER_STORAGE_BUFFER, gpuparticles.state_buffer);
+	for (first = 0; first < count; )
+	{
+		i = q_min (count - first, gpuparticles.budget - gpuparticles.head);
+		GL_BufferSubDataFunc (GL_SHADER_STORAGE_BUFFER, gpuparticles.head * sizeof (*staged), i * sizeof (*staged), staged + first);
+		first += i;
+		gpuparticles.head = (gpuparticles.head + i) % gpuparticles.budget;
+	}
+	gpuparticles.used = q_min (gpuparticles.used + count, gpuparticles.budget);
+}
+
+/*
+===============
+R_UpdateParticles
+
+Runs the gpu simulation once per frame, before the particles are drawn
+===============
+*/
+void R_UpdateParticles (void)
+{
+	static const GLuint	cmd[4] = {4, 0, 0, 0}; // count, instanceCount, first, baseInstance
+	gpuparticlesim_t	sim;
+	GLuint				buf;
+	GLbyte				*ofs;
+	extern	cvar_t		sv_gravity;
+
+	if (!r_gpuparticles.value || !r_particles.value)
+		return;
+
+	if (!gpuparticles.state_buffer)
+	{
+		gpuparticles.state_buffer = GL_CreateBuffer (GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW, "particle state",
+			gpuparticles.budget * sizeof (gpuparticle_t), NULL);
+		gpuparticles.vertex_buffer = GL_CreateBuffer (GL_ARRAY_BUFFER, GL_DYNAMIC_DRAW, "particle vertices",
+			gpuparticles.budget * sizeof (particlevert_t), NULL);
+		gpuparticles.cmd_buffer = GL_CreateBuffer (GL_DRAW_INDIRECT_BUFFER, GL_DYNAMIC_DRAW, "particle draw cmd",
+			sizeof (cmd), cmd);
+	}
+
+	if (gpuparticles.reset || cl.time < gpuparticles.time)
+	{
+		gpuparticles.time = cl.time;
+		gpuparticles.reset = false;
 	}
 
-	r_numactiveparticles = active;
+	if (r_numactiveparticles)
+		R_SpawnGPUParticles ();
+
+	GL_BindBuffer (GL_DRAW_INDIRECT_BUFFER, gpuparticles.cmd_buffer);
+	GL_BufferSubDataFunc (GL_DRAW_INDIRECT_BUFFER, 0, sizeof (cmd), cmd);
+
+	if (!gpuparticles.used)
+		return;
+
+	GL_BeginGroup ("Particle simulation");
+
+	sim.time = cl.time;
+	sim.prevtime = gpuparticles.time;
+	sim.frametime = cl.time - gpuparticles.time;
+	sim.gravity = sv_gravity.value * 0.05;
+	sim.numparticles = gpuparticles.used;
+	sim.pad[0] = sim.pad[1] = sim.pad[2] = 0;
+	gpuparticles.time = cl.time;
+
+	GL_UseProgram (glprogs.particles_sim);
+	GL_Upload (GL_SHADER_STORAGE_BUFFER, d_8to24table, 256 * sizeof (d_8to24table[0]), &buf, &ofs);
+	GL_BindBufferRange (GL_SHADER_STORAGE_BUFFER, 0, buf, (GLintptr) ofs, 256 * sizeof (d_8to24table[0]));
+	GL_BindBufferRange (GL_SHADER_STORAGE_BUFFER, 1, gpuparticles.state_buffer, 0, gpuparticles.budget * sizeof (gpuparticle_t));
+	GL_BindBufferRange (GL_SHADER_STORAGE_BUFFER, 2, gpuparticles.vertex_buffer, 0, gpuparticles.budget * sizeof (particlevert_t));
+	GL_BindBufferRange (GL_SHADER_STORAGE_BUFFER, 3, gpuparticles.cmd_buffer, 0, sizeof (cmd));
+	GL_Upload (GL_UNIFORM_BUFFER, &sim, sizeof (sim), &buf, &ofs);
+	GL_BindBufferRange (GL_UNIFORM_BUFFER, 1, buf, (GLintptr) ofs, sizeof (sim));
+
+	GL_DispatchComputeFunc ((gpuparticles.used + 63) / 64, 1, 1);
+	// the draw reads the vertices and indirect command, the next frame's uploads
+	// and dispatch read and overwrite the state and command buffers again
+	GL_MemoryBarrierFunc (GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+		GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	GL_EndGroup ();
 }
 
 /*
@@ -678,18 +1071,19 @@ R_DrawParticles_Real -- johnfitz -- moved all non-drawing code to CL_RunParticle
 static void R_DrawParticles_Real (qboolean alpha, qboolean showtris)
 {
 	particle_t		*p;
+	particlestore_t	*s;
 	particlevert_t	*v;
 	GLubyte			color[4] = {255, 255, 255, 255}, *c; //johnfitz -- particle transparency
 	extern	cvar_t	r_particles; //johnfitz
 	//float			alpha; //johnfitz -- particle transparency
 	float			scalex, scaley;
 	qboolean		dither, oit;
-	int				i;
+	int				i, type;
 
 	if (!r_particles.value)
 		return;
 
-	if (!r_numactiveparticles)
+	if (r_gpuparticles.value ? !gpuparticles.used : !(r_numactiveparticles + r_numstoredparticles))
 		return;
 
 	// square particles are drawn opaque (avoiding alpha sorting issues)
@@ -716,6 +1110,17 @@ static void R_DrawParticles_Real (qboolean alpha, qboolean showtris)
 	else
 		GL_SetState (GLS_BLEND_OPAQUE | GLS_CULL_NONE | GLS_ATTRIBS (2) | GLS_INSTANCED_ATTRIBS (2));
 
+	if (r_gpuparticles.value)
+	{
+		GL_BindBuffer (GL_ARRAY_BUFFER, gpuparticles.vertex_buffer);
+		GL_VertexAttribPointerFunc (0, 3, GL_FLOAT, GL_FALSE, sizeof(partverts[0]), (void *) offsetof(particlevert_t, pos));
+		GL_VertexAttribPointerFunc (1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(partverts[0]), (void *) offsetof(particlevert_t, color));
+		GL_BindBuffer (GL_DRAW_INDIRECT_BUFFER, gpuparticles.cmd_buffer);
+		GL_DrawArraysIndirectFunc (GL_TRIANGLE_STRIP, 0);
+		GL_EndGroup ();
+		return;
+	}
+
 	numpartverts = 0;
 	for (i = 0, p = particles; i < r_numactiveparticles; i++, p++)
 	{
@@ -736,6 +1141,23 @@ static void R_DrawParticles_Real (qboolean alpha, qboolean showtris)
 		//johnfitz
 	}
 
+	for (type = 0; type < NUM_PARTICLE_TYPES; type++)
+	{
+		s = &partstores[type];
+		for (i = 0; i < s->count; i++)
+		{
+			if (numpartverts == countof(partverts))
+				R_FlushParticleBatch ();
+
+			v = &partverts[numpartverts++];
+			v->pos[0] = s->x[i];
+			v->pos[1] = s->y[i];
+			v->pos[2] = s->z[i];
+			c = showtris ? color : (GLubyte *) &d_8to24table[s->color[i]];
+			*(uint32_t*)&v->color = *(uint32_t*)c;
+		}
+	}
+
 	R_FlushParticleBatch ();
 
 	GL_EndGroup ();
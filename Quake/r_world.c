@@ -45,7 +45,8 @@ typedef struct gpumark_frame_s {
 	vec3_t		vieworg;
 	GLuint		oldskyleaf;
 	GLuint		framecount;
-	GLuint		padding[3];
+	GLuint		occlusion;
+	GLuint		padding[2];
 } gpumark_frame_t;
 
 byte *SV_FatPVS (vec3_t org, qmodel_t *worldmodel);
@@ -78,6 +79,7 @@ static void R_MarkVisSurfaces (byte* vis)
 	frame.vieworg[2] = r_refdef.vieworg[2];
 	frame.oldskyleaf = r_oldskyleaf.value != 0.f;
 	frame.framecount = r_framecount;
+	frame.occlusion = r_occlusion.value >= 2.f ? R_BindOcclusionPyramid () : 0;
 
 	COMPILE_TIME_ASSERT (vis_alignment_must_be_power_of_2, (VIS_ALIGN & (VIS_ALIGN - 1)) == 0);
 	COMPILE_TIME_ASSERT (vis_alignment_must_be_multiple_of_uint, (VIS_ALIGN & 3) == 0);
@@ -133,6 +135,7 @@ void R_MarkSurfaces (void)
 
 	R_MarkVisSurfaces (vis);
 	R_AddStaticModels (vis);
+	R_CullDlights (vis);
 }
 
 /*
@@ -155,7 +158,8 @@ float GL_WaterAlphaForEntityTextureType (entity_t *ent, textype_t type)
 typedef struct bmodel_gpu_instance_s {
 	float		world[12];	// world matrix (transposed mat4x3)
 	float		alpha;
-	float		padding[3];
+	GLuint		occlusion;	// visibility slot, 0 if not tested
+	float		padding[2];
 } bmodel_gpu_instance_t;
 
 typedef struct bmodel_bindless_gpu_call_s {
@@ -196,8 +200,9 @@ static GLuint						bmodel_batch_program;
 R_InitBModelInstance
 =============
 */
-static void R_InitBModelInstance (bmodel_gpu_instance_t *inst, entity_t *ent)
+static void R_InitBModelInstance (bmodel_gpu_instance_t *inst, entity_t **pent)
 {
+	entity_t *ent = *pent;
 	vec3_t angles;
 	float mat[16];
 
@@ -209,6 +214,7 @@ static void R_InitBModelInstance (bmodel_gpu_instance_t *inst, entity_t *ent)
 	MatrixTranspose4x3 (mat, inst->world);
 
 	inst->alpha = ent->alpha == ENTALPHA_DEFAULT ? -1.f : ENTALPHA_DECODE (ent->alpha);
+	inst->occlusion = R_GetOcclusionSlot (pent);
 	memset (&inst->padding, 0, sizeof(inst->padding));
 }
 
@@ -248,6 +254,7 @@ static void R_FlushBModelCalls (void)
 	GL_MemoryBarrierFunc (GL_COMMAND_BARRIER_BIT);
 
 	GL_UseProgram (bmodel_batch_program);
+	R_BindOcclusionVisibility ();
 	GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, gl_bmodel_ibo);
 	GL_BindBuffer (GL_ARRAY_BUFFER, gl_bmodel_vbo);
 	GL_BindBuffer (GL_DRAW_INDIRECT_BUFFER, cmdbuf);
@@ -446,7 +453,7 @@ static void R_DrawBrushModels_Real (entity_t **ents, int count, brushpass_t pass
 	// fill instance data
 	for (i = 0, totalinst = 0; i < count; i++)
 		if (ents[i]->model->texofs[texend] - ents[i]->model->texofs[texbegin] > 0)
-			R_InitBModelInstance (&bmodel_instances[totalinst++], ents[i]);
+			R_InitBModelInstance (&bmodel_instances[totalinst++], &ents[i]);
 
 	if (!totalinst)
 		return;
@@ -475,7 +482,7 @@ static void R_DrawBrushModels_Real (entity_t **ents, int count, brushpass_t pass
 		entity_t *e = ents[i++];
 		qmodel_t *model = e->model;
 		qboolean isworld = (e == &cl_entities[0]);
-		qboolean isstatic = PTR_IN_RANGE (e, cl_static_entities, cl_static_entities + MAX_STATIC_ENTITIES);
+		qboolean isstatic = PTR_IN_RANGE (e, cl_static_entities, cl_static_entities + cl.num_statics);
 		qboolean zfix = !isworld && !isstatic;
 		int frame = isworld ? 0 : e->frame;
 		int numtex = model->texofs[texend] - model->texofs[texbegin];
@@ -538,7 +545,7 @@ void R_DrawBrushModels_Water (entity_t **ents, int count, qboolean translucent)
 	// fill instance data
 	for (i = 0, totalinst = 0; i < count; i++)
 		if (R_EntHasWater (ents[i], translucent))
-			R_InitBModelInstance (&bmodel_instances[totalinst++], ents[i]);
+			R_InitBModelInstance (&bmodel_instances[totalinst++], &ents[i]);
 
 	if (!totalinst)
 		return;
@@ -87,6 +87,7 @@ typedef struct entity_s
 	vec3_t					currentangles;	//johnfitz -- transform lerping
 
 	lightcache_t			lightcache;		// alias light trace cache
+	int						aliasslot;		// persistent alias instance slot + 1
 
 	float					traildelay;		// time left until next particle trail update
 	vec3_t					trailorg;		// previous particle trail point
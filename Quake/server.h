@@ -25,6 +25,43 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 // server.h
 
+// per-client bandwidth accounting categories
+typedef enum
+{
+	NETSTAT_TIME,			// svc_time header
+	NETSTAT_CLIENTDATA,		// svc_clientdata, svc_damage, svc_setangle
+	NETSTAT_ENTITIES,		// entity updates
+	NETSTAT_SOUND,			// svc_sound, svc_localsound
+	NETSTAT_PARTICLE,		// svc_particle
+	NETSTAT_STATS,			// svc_updatestat and stat stuffcmds
+	NETSTAT_SCOREBOARD,		// svc_updatefrags
+	NETSTAT_STUFFTEXT,		// svc_stufftext
+	NETSTAT_PRINT,			// svc_print
+	NETSTAT_SIGNON,			// signon buffers
+	NETSTAT_BROADCAST,		// sv.reliable_datagram (names, colors, pause, MSG_ALL)
+	NETSTAT_OTHER,			// everything else (QC WriteByte, temp entities...)
+
+	NETSTAT_NUMCATEGORIES
+} netstatcat_t;
+
+#define NETSTAT_HISTOGRAM_BUCKETS	12	// power-of-two buckets of per-frame bytes: 0, <32, <64, ... >=16k
+
+typedef struct
+{
+	int			pending[NETSTAT_NUMCATEGORIES];		// reliable bytes queued in client->message, by category
+	double		unreliable[NETSTAT_NUMCATEGORIES];	// total bytes sent, by category
+	double		reliable[NETSTAT_NUMCATEGORIES];
+	int			unreliable_messages;
+	int			reliable_messages;
+	int			frame_unreliable[NETSTAT_NUMCATEGORIES];	// bytes sent this frame
+	int			frame_reliable[NETSTAT_NUMCATEGORIES];
+	int			frames;
+	int			peak_frame_bytes;
+	int			histogram[NETSTAT_HISTOGRAM_BUCKETS];
+} clientnetstats_t;
+
+//=============================================================================
+
 typedef struct
 {
 	int			maxclients;
@@ -64,6 +101,7 @@ typedef struct
 
 	sizebuf_t	datagram;
 	byte		datagram_buf[MAX_DATAGRAM];
+	int			datagram_netstats[NETSTAT_NUMCATEGORIES];	// bytes in sv.datagram, by category
 
 	sizebuf_t	reliable_datagram;	// copied to all clients at end of frame
 	byte		reliable_datagram_buf[MAX_DATAGRAM];
@@ -161,6 +199,8 @@ typedef struct client_s
 	int				oldstats_i[MAX_CL_STATS];		//previous values of stats. if these differ from the current values, reflag resendstats.
 	float			oldstats_f[MAX_CL_STATS];		//previous values of stats. if these differ from the current values, reflag resendstats.
 	char			*oldstats_s[MAX_CL_STATS];
+
+	clientnetstats_t	netstats;
 } client_t;
 
 
@@ -278,6 +318,7 @@ void SV_LocalSound (client_t *client, const char *sample); // for 2021 rerelease
 void SV_DropClient (qboolean crash);
 
 void SV_SendClientMessages (void);
+void SV_NetStats_Add (client_t *client, netstatcat_t cat, int oldsize);
 void SV_ClearDatagram (void);
 void SV_ReserveSignonSpace (int numbytes);
 
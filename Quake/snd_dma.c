@@ -91,6 +91,80 @@ static	cvar_t	ambient_fade = {"ambient_fade", "100", CVAR_NONE};
 static	cvar_t	snd_noextraupdate = {"snd_noextraupdate", "0", CVAR_NONE};
 static	cvar_t	snd_show = {"snd_show", "0", CVAR_NONE};
 static	cvar_t	_snd_mixahead = {"_snd_mixahead", "0.1", CVAR_ARCHIVE};
+static	cvar_t	snd_mixthread = {"snd_mixthread", "1", CVAR_ARCHIVE};
+static	cvar_t	snd_virtualvolume = {"snd_virtualvolume", "4", CVAR_ARCHIVE};
+static	cvar_t	snd_maxvoices = {"snd_maxvoices", "64", CVAR_ARCHIVE};
+cvar_t		snd_streamlength = {"snd_streamlength", "10", CVAR_ARCHIVE};
+
+// voice manager statistics for the last update
+static struct
+{
+	int		active;		// channels with a sound
+	int		mixed;		// channels actually painted
+	int		silent;		// out of range, or a static folded into another one
+	int		quiet;		// virtualized for being below snd_virtualvolume
+	int		capped;		// virtualized by snd_maxvoices
+	int		peak;		// most channels painted at once
+} snd_voices;
+
+/*
+===============================================================================
+
+MIXER THREAD
+
+When snd_mixthread is set, mixing and music decoding run on their own thread
+so a long host frame can't starve the DMA buffer. The main thread keeps
+running all the game-side logic on snd_channels (picking channels, ambients,
+spatialization) and forwards every change through a single-producer,
+single-consumer command ring to the mixer thread, which owns a private copy
+of the channels (the voices) and paintedtime.
+
+===============================================================================
+*/
+
+typedef enum
+{
+	SNDCMD_START,		// (re)start a voice from a full channel copy
+	SNDCMD_STOP,		// silence a voice
+	SNDCMD_UPDATE,		// new volumes for a playing voice
+	SNDCMD_STOPALL,		// silence everything and drop static voices
+} sndcmdtype_t;
+
+typedef struct
+{
+	sndcmdtype_t	type;
+	int				index;
+	channel_t		chan;
+} sndcmd_t;
+
+typedef struct
+{
+	sfx_t			*sfx;
+	int				leftvol;
+	int				rightvol;
+	qboolean		virtualized;
+} sndsent_t;
+
+#define SND_MAXCOMMANDS		4096	// must be a power of two
+#define SND_MIXINTERVAL		5		// milliseconds between mixer wakeups
+
+static struct
+{
+	qboolean		threaded;
+	SDL_Thread		*thread;
+	SDL_mutex		*lock;
+	SDL_atomic_t	quit;
+	SDL_atomic_t	head;			// only written by the main thread
+	SDL_atomic_t	tail;			// only written by the mixer thread
+	SDL_atomic_t	painted;		// mixer's paintedtime, published for the main thread
+	SDL_atomic_t	reset;			// mixer dropped all voices (paintedtime wrapped)
+	int				overflows;
+	int				chantime;		// main thread's view of paintedtime
+	sndcmd_t		commands[SND_MAXCOMMANDS];
+	channel_t		voices[MAX_CHANNELS];
+	int				numvoices;
+	sndsent_t		sent[MAX_CHANNELS];	// last state forwarded for each channel
+} snd_mixer;
 
 
 static void S_SoundInfo_f (void)
@@ -108,6 +182,16 @@ static void S_SoundInfo_f (void)
 	Con_Printf("%5d submission_chunk\n", shm->submission_chunk);
 	Con_Printf("%5d total_channels\n", total_channels);
 	Con_Printf("%p dma buffer\n", shm->buffer);
+	Con_Printf("%5d active voices\n", snd_voices.active);
+	Con_Printf("%5d mixed voices (peak %d, max %d)\n", snd_voices.mixed, snd_voices.peak, (int)snd_maxvoices.value);
+	Con_Printf("%5d sound streams\n", S_SfxStreamCount ());
+	Con_Printf("%5d virtual voices (%d silent, %d quiet, %d over limit)\n",
+		snd_voices.silent + snd_voices.quiet + snd_voices.capped,
+		snd_voices.silent, snd_voices.quiet, snd_voices.capped);
+	if (snd_mixer.threaded)
+		Con_Printf("mixer thread, %d dropped commands\n", snd_mixer.overflows);
+	else
+		Con_Printf("mixing on main thread\n");
 }
 
 
@@ -127,9 +211,314 @@ static void SND_Callback_snd_filterquality (cvar_t *var)
 
 /*
 ================
-S_Startup
+S_LockMixer
+================
+*/
+void S_LockMixer (void)
+{
+	if (snd_mixer.lock)
+		SDL_LockMutex (snd_mixer.lock);
+}
+
+/*
+================
+S_UnlockMixer
+================
+*/
+void S_UnlockMixer (void)
+{
+	if (snd_mixer.lock)
+		SDL_UnlockMutex (snd_mixer.lock);
+}
+
+/*
+================
+S_MixerThreaded
+================
+*/
+qboolean S_MixerThreaded (void)
+{
+	return snd_mixer.threaded;
+}
+
+/*
+================
+S_ChannelTime
+
+paintedtime as seen by the code that manages snd_channels
+================
+*/
+static int S_ChannelTime (void)
+{
+	return snd_mixer.threaded ? snd_mixer.chantime : paintedtime;
+}
+
+/*
+================
+S_CachedSound
+
+Returns the samples for a playing channel. The mixer thread must never
+hit the disk, so when it is running only already loaded data is used.
+================
+*/
+sfxcache_t *S_CachedSound (sfx_t *sfx)
+{
+	if (snd_mixer.threaded)
+		return sfx->cache;
+	return S_LoadSound (sfx);
+}
+
+/*
+================
+S_PushCommand
+
+Main thread only. Returns false if the ring is full.
+================
+*/
+static qboolean S_PushCommand (sndcmdtype_t type, int index, const channel_t *chan)
+{
+	int			head;
+	sndcmd_t	*cmd;
+
+	head = SDL_AtomicGet (&snd_mixer.head);
+	if (head - SDL_AtomicGet (&snd_mixer.tail) >= SND_MAXCOMMANDS)
+	{
+		snd_mixer.overflows++;
+		return false;
+	}
+
+	cmd = &snd_mixer.commands[head & (SND_MAXCOMMANDS - 1)];
+	cmd->type = type;
+	cmd->index = index;
+	if (chan)
+		cmd->chan = *chan;
+
+	SDL_MemoryBarrierRelease ();
+	SDL_AtomicSet (&snd_mixer.head, head + 1);
+
+	return true;
+}
+
+/*
+================
+S_SendChannel
+
+Forwards a freshly (re)started or killed channel to the mixer thread
+================
+*/
+static qboolean S_SendChannel (channel_t *ch)
+{
+	int			index;
+	sndsent_t	*sent;
+
+	if (!snd_mixer.threaded)
+		return true;
+
+	index = ch - snd_channels;
+	if (!S_PushCommand (ch->sfx ? SNDCMD_START : SNDCMD_STOP, index, ch))
+		return false;
+
+	sent = &snd_mixer.sent[index];
+	sent->sfx = ch->sfx;
+	sent->leftvol = ch->leftvol;
+	sent->rightvol = ch->rightvol;
+	sent->virtualized = ch->virtualized;
+
+	return true;
+}
+
+/*
+================
+S_SendVolumes
+
+Forwards the spatialization done this frame to the mixer thread
+================
+*/
+static void S_SendVolumes (void)
+{
+	int			i;
+	channel_t	*ch;
+	sndsent_t	*sent;
+
+	for (i = 0, ch = snd_channels, sent = snd_mixer.sent; i < total_channels; i++, ch++, sent++)
+	{
+	// dynamic channels that ended here are left to finish on their own
+		if (!ch->sfx && i >= NUM_AMBIENTS)
+			continue;
+		if (sent->sfx == ch->sfx && sent->leftvol == ch->leftvol && sent->rightvol == ch->rightvol &&
+			sent->virtualized == ch->virtualized)
+			continue;
+		if (!S_PushCommand (SNDCMD_UPDATE, i, ch))
+			break;
+		sent->sfx = ch->sfx;
+		sent->leftvol = ch->leftvol;
+		sent->rightvol = ch->rightvol;
+		sent->virtualized = ch->virtualized;
+	}
+}
+
+/*
+================
+S_ExecuteCommands
+
+Mixer thread only
+================
+*/
+static void S_ExecuteCommands (void)
+{
+	int			head, tail;
+	sndcmd_t	*cmd;
+	channel_t	*voice;
+	sfxcache_t	*sc;
+
+	tail = SDL_AtomicGet (&snd_mixer.tail);
+	head = SDL_AtomicGet (&snd_mixer.head);
+	SDL_MemoryBarrierAcquire ();
+
+	for (; tail != head; tail++)
+	{
+		cmd = &snd_mixer.commands[tail & (SND_MAXCOMMANDS - 1)];
+		voice = &snd_mixer.voices[cmd->index];
+
+		switch (cmd->type)
+		{
+		case SNDCMD_START:
+			*voice = cmd->chan;
+			sc = voice->sfx->cache;
+			if (!sc)
+			{
+				voice->sfx = NULL;
+				break;
+			}
+			voice->end = paintedtime + sc->length - voice->pos;
+			if (voice->stream)
+				S_StartSfxStream (voice->stream);
+			snd_mixer.numvoices = q_max (snd_mixer.numvoices, cmd->index + 1);
+			break;
+
+		case SNDCMD_STOP:
+			voice->sfx = NULL;
+			voice->end = 0;
+			break;
+
+		case SNDCMD_UPDATE:
+			if (cmd->index < NUM_AMBIENTS)
+				voice->sfx = cmd->chan.sfx;
+			if (voice->sfx == cmd->chan.sfx)
+			{
+				voice->leftvol = cmd->chan.leftvol;
+				voice->rightvol = cmd->chan.rightvol;
+				voice->virtualized = cmd->chan.virtualized;
+			}
+			break;
+
+		case SNDCMD_STOPALL:
+			memset (snd_mixer.voices, 0, sizeof (snd_mixer.voices));
+			snd_mixer.numvoices = MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS;
+			break;
+		}
+	}
+
+	SDL_MemoryBarrierRelease ();
+	SDL_AtomicSet (&snd_mixer.tail, tail);
+}
+
+/*
+================
+S_MixerThread
+================
+*/
+static int SDLCALL S_MixerThread (void *unused)
+{
+	while (!SDL_AtomicGet (&snd_mixer.quit))
+	{
+		S_LockMixer ();
+
+		BGM_UpdateStream ();
+
+		S_ExecuteCommands ();
+		S_Update_ ();
+
+		SDL_AtomicSet (&snd_mixer.painted, paintedtime);
+
+		S_UnlockMixer ();
+
+		SDL_Delay (SND_MIXINTERVAL);
+	}
+
+	return 0;
+}
+
+/*
+================
+S_StartMixerThread
+================
+*/
+static void S_StartMixerThread (void)
+{
+	int i;
+
+	if (snd_mixer.threaded || !sound_started || !snd_mixer.lock)
+		return;
+
+	memcpy (snd_mixer.voices, snd_channels, sizeof (snd_mixer.voices));
+	snd_mixer.numvoices = total_channels;
+	for (i = 0; i < MAX_CHANNELS; i++)
+	{
+		snd_mixer.sent[i].sfx = snd_channels[i].sfx;
+		snd_mixer.sent[i].leftvol = snd_channels[i].leftvol;
+		snd_mixer.sent[i].rightvol = snd_channels[i].rightvol;
+		snd_mixer.sent[i].virtualized = snd_channels[i].virtualized;
+	}
+
+	SDL_AtomicSet (&snd_mixer.quit, 0);
+	SDL_AtomicSet (&snd_mixer.head, 0);
+	SDL_AtomicSet (&snd_mixer.tail, 0);
+	SDL_AtomicSet (&snd_mixer.painted, paintedtime);
+	SDL_AtomicSet (&snd_mixer.reset, 0);
+	snd_mixer.chantime = paintedtime;
+	snd_mixer.overflows = 0;
+
+	snd_mixer.threaded = true;
+	snd_mixer.thread = SDL_CreateThread (S_MixerThread, "Mixer", NULL);
+	if (!snd_mixer.thread)
+	{
+		snd_mixer.threaded = false;
+		Con_Warning ("Couldn't create mixer thread: %s\n", SDL_GetError ());
+	}
+}
+
+/*
+================
+S_StopMixerThread
+
+Hands the voices back to the main thread
 ================
 */
+static void S_StopMixerThread (void)
+{
+	if (!snd_mixer.threaded)
+		return;
+
+	SDL_AtomicSet (&snd_mixer.quit, 1);
+	SDL_WaitThread (snd_mixer.thread, NULL);
+	snd_mixer.thread = NULL;
+
+	S_ExecuteCommands ();
+	snd_mixer.threaded = false;
+
+	memcpy (snd_channels, snd_mixer.voices, sizeof (snd_channels));
+	total_channels = q_max (total_channels, snd_mixer.numvoices);
+}
+
+static void SND_Callback_snd_mixthread (cvar_t *var)
+{
+	if (var->value)
+		S_StartMixerThread ();
+	else
+		S_StopMixerThread ();
+}
+
 void S_Startup (void)
 {
 	if (!snd_initialized)
@@ -174,6 +563,10 @@ void S_Init (void)
 	Cvar_RegisterVariable(&snd_noextraupdate);
 	Cvar_RegisterVariable(&snd_show);
 	Cvar_RegisterVariable(&_snd_mixahead);
+	Cvar_RegisterVariable(&snd_mixthread);
+	Cvar_RegisterVariable(&snd_virtualvolume);
+	Cvar_RegisterVariable(&snd_maxvoices);
+	Cvar_RegisterVariable(&snd_streamlength);
 	Cvar_RegisterVariable(&sndspeed);
 	Cvar_RegisterVariable(&snd_mixspeed);
 	Cvar_RegisterVariable(&snd_filterquality);
@@ -210,6 +603,7 @@ void S_Init (void)
 
 	Cvar_SetCallback(&sfxvolume, SND_Callback_sfxvolume);
 	Cvar_SetCallback(&snd_filterquality, &SND_Callback_snd_filterquality);
+	Cvar_SetCallback(&snd_mixthread, SND_Callback_snd_mixthread);
 
 	SND_InitScaletable ();
 
@@ -226,12 +620,17 @@ void S_Init (void)
 //	if (shm->buffer)
 //		shm->buffer[4] = shm->buffer[5] = 0x7f;	// force a pop for debugging
 
+// the codecs are needed for loading compressed sounds
+	S_CodecInit ();
+
 	ambient_sfx[AMBIENT_WATER] = S_PrecacheSound ("ambience/water1.wav");
 	ambient_sfx[AMBIENT_SKY] = S_PrecacheSound ("ambience/wind2.wav");
 
-	S_CodecInit ();
-
 	S_StopAllSounds (true);
+
+	snd_mixer.lock = SDL_CreateMutex ();
+	if (snd_mixer.lock && snd_mixthread.value)
+		S_StartMixerThread ();
 }
 
 
@@ -243,6 +642,9 @@ void S_Shutdown (void)
 	if (!sound_started)
 		return;
 
+	S_StopMixerThread ();
+	S_UpdateSfxStreams (true);
+
 	sound_started = 0;
 	snd_blocked = 0;
 
@@ -295,6 +697,38 @@ static sfx_t *S_FindName (const char *name)
 }
 
 
+/*
+==================
+S_FlushSounds
+
+Throws away every loaded sound, e.g. when the game directory changes
+==================
+*/
+void S_FlushSounds (void)
+{
+	int		i;
+
+	if (!sound_started)
+		return;
+
+	S_StopAllSounds (true);
+
+	S_LockMixer ();
+// the mixer thread is parked on the lock, drain the ring on its behalf so
+// no voice is left pointing into the pool
+	if (snd_mixer.threaded)
+		S_ExecuteCommands ();
+	for (i = 0; i < num_sfx; i++)
+		known_sfx[i].cache = NULL;
+	S_FreeSoundPool ();
+	S_UpdateSfxStreams (true);
+	S_UnlockMixer ();
+
+	for (i = 0; i < NUM_AMBIENTS; i++)
+		if (ambient_sfx[i])
+			S_LoadSound (ambient_sfx[i]);
+}
+
 /*
 ==================
 S_TouchSound
@@ -303,13 +737,10 @@ S_TouchSound
 */
 void S_TouchSound (const char *name)
 {
-	sfx_t	*sfx;
-
 	if (!sound_started)
 		return;
 
-	sfx = S_FindName (name);
-	Cache_Check (&sfx->cache);
+	S_FindName (name);
 }
 
 /*
@@ -367,9 +798,9 @@ channel_t *SND_PickChannel (int entnum, int entchannel)
 		if (snd_channels[ch_idx].entnum == cl.viewentity && entnum != cl.viewentity && snd_channels[ch_idx].sfx)
 			continue;
 
-		if (snd_channels[ch_idx].end - paintedtime < life_left)
+		if (snd_channels[ch_idx].end - S_ChannelTime () < life_left)
 		{
-			life_left = snd_channels[ch_idx].end - paintedtime;
+			life_left = snd_channels[ch_idx].end - S_ChannelTime ();
 			first_to_die = ch_idx;
 		}
 	}
@@ -404,6 +835,15 @@ void SND_Spatialize (channel_t *ch)
 
 // calculate stereo seperation and distance attenuation
 	VectorSubtract(ch->origin, listener_origin, source_vec);
+
+// beyond the clip distance nothing can be heard, skip the normalize
+	dist = DotProduct(source_vec, source_vec) * ch->dist_mult * ch->dist_mult;
+	if (dist >= 1.0)
+	{
+		ch->leftvol = ch->rightvol = 0;
+		return;
+	}
+
 	dist = VectorNormalize(source_vec) * ch->dist_mult;
 	dot = DotProduct(listener_right, source_vec);
 
@@ -449,7 +889,7 @@ void S_StartSound (int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float
 	if (!sound_started)
 		return;
 
-	if (!sfx)
+	if (!sfx || cls.demoseeking || cls.timedemo_nodraw)
 		return;
 
 	if (nosound.value)
@@ -483,13 +923,17 @@ void S_StartSound (int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float
 	SND_Spatialize(target_chan);
 
 	if (!target_chan->leftvol && !target_chan->rightvol)
+	{
+		S_SendChannel (target_chan);
 		return;		// not audible at all
+	}
 
 // new channel
 	sc = S_LoadSound (sfx);
 	if (!sc)
 	{
 		target_chan->sfx = NULL;
+		S_SendChannel (target_chan);
 		return;		// couldn't load the sound's data
 	}
 
@@ -500,7 +944,7 @@ void S_StartSound (int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float
 
 	target_chan->sfx = sfx;
 	target_chan->pos = 0.0;
-	target_chan->end = paintedtime + sc->length;
+	target_chan->end = S_ChannelTime () + sc->length;
 
 // if an identical sound has also been started this frame, offset the pos
 // a bit to keep it from just making the first one louder
@@ -527,6 +971,24 @@ void S_StartSound (int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float
 			break;
 		}
 	}
+
+// long sounds are decoded while they play
+	if (sc->streamed)
+	{
+		target_chan->stream = S_OpenSfxStream (sfx, sc->loopstart >= 0, target_chan->pos);
+		if (!target_chan->stream)
+		{
+			target_chan->sfx = NULL;
+			S_SendChannel (target_chan);
+			return;
+		}
+	}
+
+	if (!S_SendChannel (target_chan) && target_chan->stream)
+	{
+		S_CloseSfxStream (target_chan->stream);
+		target_chan->stream = NULL;
+	}
 }
 
 void S_StopSound (int entnum, int entchannel)
@@ -540,6 +1002,7 @@ void S_StopSound (int entnum, int entchannel)
 		{
 			snd_channels[i].end = 0;
 			snd_channels[i].sfx = NULL;
+			S_SendChannel (&snd_channels[i]);
 			return;
 		}
 	}
@@ -562,6 +1025,12 @@ void S_StopAllSounds (qboolean clear)
 
 	memset(snd_channels, 0, MAX_CHANNELS * sizeof(channel_t));
 
+	if (snd_mixer.threaded)
+	{
+		memset (snd_mixer.sent, 0, sizeof (snd_mixer.sent));
+		S_PushCommand (SNDCMD_STOPALL, 0, NULL);
+	}
+
 	if (clear)
 		S_ClearBuffer ();
 }
@@ -578,9 +1047,13 @@ void S_ClearBuffer (void)
 	if (!sound_started || !shm)
 		return;
 
+	S_LockMixer ();
 	SNDDMA_LockBuffer ();
 	if (! shm->buffer)
+	{
+		S_UnlockMixer ();
 		return;
+	}
 
 	s_rawend = 0;
 
@@ -593,6 +1066,7 @@ void S_ClearBuffer (void)
 	memset (s_rawsamples, 0, sizeof (s_rawsamples));
 
 	SNDDMA_Submit ();
+	S_UnlockMixer ();
 }
 
 
@@ -624,17 +1098,37 @@ void S_StaticSound (sfx_t *sfx, vec3_t origin, float vol, float attenuation)
 
 	if (sc->loopstart == -1)
 	{
-		Con_Printf ("Sound %s not looped\n", sfx->name);
-		return;
+	// compressed formats have no loop markers, loop them from the start
+		if (sc->codec == CODECTYPE_WAV)
+		{
+			Con_Printf ("Sound %s not looped\n", sfx->name);
+			return;
+		}
+		ss->looping = 1;
 	}
 
 	ss->sfx = sfx;
 	VectorCopy (origin, ss->origin);
 	ss->master_vol = (int)vol;
 	ss->dist_mult = (attenuation / 64) / sound_nominal_clip_dist;
-	ss->end = paintedtime + sc->length;
+	ss->end = S_ChannelTime () + sc->length;
+
+	if (sc->streamed)
+	{
+		ss->stream = S_OpenSfxStream (sfx, true, 0);
+		if (!ss->stream)
+		{
+			ss->sfx = NULL;
+			return;
+		}
+	}
 
 	SND_Spatialize (ss);
+	if (!S_SendChannel (ss) && ss->stream)
+	{
+		S_CloseSfxStream (ss->stream);
+		ss->stream = NULL;
+	}
 }
 
 
@@ -811,6 +1305,95 @@ void S_RawSamples (int samples, int rate, int width, int channels, byte *data, f
 	}
 }
 
+/*
+============
+S_UpdateVoices
+
+Voice manager: channels too quiet to matter are virtualized, i.e. their
+position keeps advancing but they aren't mixed, then the loudest remaining
+ones are kept up to snd_maxvoices. Ambients and the player's own sounds
+always win. Uses a histogram over the 0-255 volume range instead of a sort.
+============
+*/
+#define VOICE_PRIORITIES	257		// 0-255 volume, 256 = always mixed
+
+static int S_VoicePriority (const channel_t *ch, int index)
+{
+	if (index < NUM_AMBIENTS || ch->entnum == cl.viewentity)
+		return VOICE_PRIORITIES - 1;
+	return q_min (q_max (ch->leftvol, ch->rightvol), VOICE_PRIORITIES - 2);
+}
+
+static void S_UpdateVoices (void)
+{
+	static int	histogram[VOICE_PRIORITIES];
+	int			i, threshold, cutoff, maxvoices, count, atcutoff, peak;
+	channel_t	*ch;
+
+	peak = snd_voices.peak;
+	memset (&snd_voices, 0, sizeof (snd_voices));
+	snd_voices.peak = peak;
+	memset (histogram, 0, sizeof (histogram));
+
+	threshold = q_max ((int)snd_virtualvolume.value, 1);
+
+	for (i = 0, ch = snd_channels; i < total_channels; i++, ch++)
+	{
+		if (!ch->sfx)
+			continue;
+		snd_voices.active++;
+
+		ch->virtualized = q_max (ch->leftvol, ch->rightvol) < threshold;
+		if (ch->virtualized)
+		{
+			if (!ch->leftvol && !ch->rightvol)
+				snd_voices.silent++;
+			else
+				snd_voices.quiet++;
+			continue;
+		}
+
+		histogram[S_VoicePriority (ch, i)]++;
+		snd_voices.mixed++;
+	}
+
+// find the lowest priority that still fits
+	maxvoices = (int)snd_maxvoices.value;
+	if (maxvoices > 0 && snd_voices.mixed > maxvoices)
+	{
+		count = 0;
+		for (cutoff = VOICE_PRIORITIES - 1; cutoff > 0; cutoff--)
+		{
+			if (count + histogram[cutoff] > maxvoices)
+				break;
+			count += histogram[cutoff];
+		}
+
+	// everything below the cutoff goes, ties at the cutoff fill the remaining slots
+		atcutoff = maxvoices - count;
+		for (i = 0, ch = snd_channels; i < total_channels; i++, ch++)
+		{
+			int priority;
+
+			if (!ch->sfx || ch->virtualized)
+				continue;
+			priority = S_VoicePriority (ch, i);
+			if (priority > cutoff)
+				continue;
+			if (priority == cutoff && atcutoff > 0)
+			{
+				atcutoff--;
+				continue;
+			}
+			ch->virtualized = true;
+			snd_voices.capped++;
+			snd_voices.mixed--;
+		}
+	}
+
+	snd_voices.peak = q_max (snd_voices.peak, snd_voices.mixed);
+}
+
 /*
 ============
 S_Update
@@ -828,6 +1411,22 @@ void S_Update (vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
 	if (!sound_started || (snd_blocked > 0))
 		return;
 
+// catch up with the voices on the mixer thread
+	if (snd_mixer.threaded)
+	{
+		int painted;
+
+		if (SDL_AtomicSet (&snd_mixer.reset, 0))
+			S_StopAllSounds (false);
+
+		painted = SDL_AtomicGet (&snd_mixer.painted);
+		S_AdvanceChannels (snd_channels, total_channels, snd_mixer.chantime, painted);
+		snd_mixer.chantime = painted;
+	}
+
+// close the sound streams that finished playing
+	S_UpdateSfxStreams (false);
+
 	VectorCopy(origin, listener_origin);
 	VectorCopy(forward, listener_forward);
 	VectorCopy(right, listener_right);
@@ -886,6 +1485,8 @@ void S_Update (vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
 		}
 	}
 
+	S_UpdateVoices ();
+
 //
 // debugging output
 //
@@ -895,9 +1496,9 @@ void S_Update (vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
 		ch = snd_channels;
 		for (i = 0; i < total_channels; i++, ch++)
 		{
-			if (ch->sfx && (ch->leftvol || ch->rightvol) )
+			if (ch->sfx && !ch->virtualized)
 			{
-				sfxcache_t *sc = (sfxcache_t *) Cache_Check (&ch->sfx->cache);
+				sfxcache_t *sc = ch->sfx->cache;
 				if (snd_show.value >= 2.f)
 					Con_SafePrintf ("L:%3i R:%3i | ENT:%5i CH:%3i | %s%s\n",
 						ch->leftvol, ch->rightvol, ch->entnum, ch->entchannel, ch->sfx->name, sc && sc->loopstart >= 0 ? " [L]" : "");
@@ -911,8 +1512,11 @@ void S_Update (vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
 // add raw data from streamed samples
 //	BGM_Update();	// moved to the main loop just before S_Update ()
 
-// mix some sound
-	S_Update_();
+// hand the new volumes to the mixer thread, or mix some sound
+	if (snd_mixer.threaded)
+		S_SendVolumes ();
+	else
+		S_Update_();
 }
 
 static void GetSoundtime (void)
@@ -936,7 +1540,14 @@ static void GetSoundtime (void)
 		{	// time to chop things off to avoid 32 bit limits
 			buffers = 0;
 			paintedtime = fullsamples;
-			S_StopAllSounds (true);
+			if (snd_mixer.threaded)
+			{	// the main thread owns snd_channels, let it catch up
+				memset (snd_mixer.voices, 0, sizeof (snd_mixer.voices));
+				SDL_AtomicSet (&snd_mixer.reset, 1);
+				S_ClearBuffer ();
+			}
+			else
+				S_StopAllSounds (true);
 		}
 	}
 	oldsamplepos = samplepos;
@@ -946,7 +1557,7 @@ static void GetSoundtime (void)
 
 void S_ExtraUpdate (void)
 {
-	if (snd_noextraupdate.value)
+	if (snd_noextraupdate.value || snd_mixer.threaded)
 		return;		// don't pollute timings
 	S_Update_();
 }
@@ -978,7 +1589,16 @@ static void S_Update_ (void)
 	samps = shm->samples >> (shm->channels - 1);
 	endtime = q_min(endtime, (unsigned int)(soundtime + samps));
 
-	S_PaintChannels (endtime);
+	if (snd_mixer.threaded)
+	{
+		S_PaintChannels (snd_mixer.voices, snd_mixer.numvoices, endtime);
+		S_CollectSfxStreams (snd_mixer.voices, snd_mixer.numvoices);
+	}
+	else
+	{
+		S_PaintChannels (snd_channels, total_channels, endtime);
+		S_CollectSfxStreams (snd_channels, total_channels);
+	}
 
 	SNDDMA_Submit ();
 }
@@ -1071,18 +1691,21 @@ static void S_SoundList (void)
 	total = 0;
 	for (sfx = known_sfx, i = 0; i < num_sfx; i++, sfx++)
 	{
-		sc = (sfxcache_t *) Cache_Check (&sfx->cache);
+		sc = sfx->cache;
 		if (!sc)
 			continue;
-		size = sc->length*sc->width*(sc->stereo + 1);
+		size = sc->streamed ? 0 : sc->length*sc->width*(sc->stereo + 1);
 		total += size;
-		if (sc->loopstart >= 0)
+		if (sc->streamed)
+			Con_SafePrintf ("S");
+		else if (sc->loopstart >= 0)
 			Con_SafePrintf ("L"); //johnfitz -- was Con_Printf
 		else
 			Con_SafePrintf (" "); //johnfitz -- was Con_Printf
 		Con_SafePrintf("(%2db) %6i : %s\n", sc->width*8, size, sfx->name); //johnfitz -- was Con_Printf
 	}
 	Con_Printf ("%i sounds, %i bytes\n", num_sfx, total); //johnfitz -- added count
+	Con_Printf ("%.1f MB sound pool\n", S_SoundPoolSize () / (1024.0 * 1024.0));
 }
 
 
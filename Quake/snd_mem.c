@@ -22,27 +22,283 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // snd_mem.c: sound caching
 
 #include "quakedef.h"
+#include "snd_codec.h"
+
+/*
+===============================================================================
+
+SOUND POOL
+
+Loaded sounds live in their own pool instead of the hunk cache, so each one
+is decoded and resampled once per game directory and never evicted. The pool
+only grows; S_FreeSoundPool releases all of it at once.
+
+===============================================================================
+*/
+
+#define SND_POOLBLOCKSIZE	(4 * 1024 * 1024)
+
+typedef struct sndpoolblock_s
+{
+	struct sndpoolblock_s	*next;
+	size_t					size;
+	size_t					used;
+	size_t					pad;		// keep the data 16-byte aligned
+} sndpoolblock_t;
+
+static sndpoolblock_t	*snd_pool;
+static size_t			snd_poolbytes;
+
+/*
+================
+S_PoolAlloc
+================
+*/
+static void *S_PoolAlloc (size_t size)
+{
+	sndpoolblock_t	*block;
+	size_t			blocksize;
+	byte			*ptr;
+
+	size = (size + 15) & ~(size_t)15;
+
+	block = snd_pool;
+	if (!block || block->used + size > block->size)
+	{
+		blocksize = q_max (size, (size_t) SND_POOLBLOCKSIZE);
+		block = (sndpoolblock_t *) malloc (sizeof (sndpoolblock_t) + blocksize);
+		if (!block)
+			Sys_Error ("S_PoolAlloc: failed on %" SDL_PRIu64 " bytes", (uint64_t) blocksize);
+		block->size = blocksize;
+		block->used = 0;
+
+	// oversized sounds get a block of their own, keep filling the current one
+		if (snd_pool && blocksize > SND_POOLBLOCKSIZE)
+		{
+			block->next = snd_pool->next;
+			snd_pool->next = block;
+		}
+		else
+		{
+			block->next = snd_pool;
+			snd_pool = block;
+		}
+	}
+
+	ptr = (byte *) (block + 1) + block->used;
+	block->used += size;
+	snd_poolbytes += size;
+
+	return ptr;
+}
+
+/*
+================
+S_FreeSoundPool
+
+The caller is responsible for making sure nothing references the sounds
+================
+*/
+void S_FreeSoundPool (void)
+{
+	sndpoolblock_t *block;
+
+	while (snd_pool)
+	{
+		block = snd_pool;
+		snd_pool = block->next;
+		free (block);
+	}
+	snd_poolbytes = 0;
+}
+
+/*
+================
+S_SoundPoolSize
+================
+*/
+size_t S_SoundPoolSize (void)
+{
+	return snd_poolbytes;
+}
+
+/*
+===============================================================================
+
+RESAMPLING
+
+Polyphase windowed-sinc interpolation. The filter bank holds RESAMPLE_PHASES
+fractional offsets of a Kaiser-windowed sinc; each output sample is the dot
+product of the input around its position with the nearest phase. When
+decimating, the cutoff drops to the output Nyquist rate and the filter widens
+to match. The bank is kept around for the next sound with the same rates.
+
+===============================================================================
+*/
+
+#define RESAMPLE_PHASES		256
+#define RESAMPLE_TAPS		32		// filter length when upsampling, multiple of 4
+#define RESAMPLE_MAXTAPS	128
+#define RESAMPLE_BETA		8.0		// Kaiser window shape
+
+static struct
+{
+	int		inrate;
+	int		outrate;
+	int		taps;
+	float	*coeffs;		// [RESAMPLE_PHASES + 1][taps]
+} resampler;
+
+/*
+================
+S_BesselI0
+================
+*/
+static double S_BesselI0 (double x)
+{
+	double	sum, term;
+	int		k;
+
+	sum = term = 1.0;
+	for (k = 1; k < 32; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+
+	return sum;
+}
+
+/*
+================
+S_BuildResampler
+
+Returns a malloc'ed filter bank for the given rates
+================
+*/
+static float *S_BuildResampler (int inrate, int outrate, int *outtaps)
+{
+	double	cutoff, half, d, x, w, sum;
+	float	*coeffs, *row;
+	int		taps, phase, k;
+
+	cutoff = q_min (1.0, (double) outrate / inrate);
+	taps = (int) ceil (RESAMPLE_TAPS / cutoff);
+	taps = (taps + 3) & ~3;
+	taps = CLAMP (4, taps, RESAMPLE_MAXTAPS);
+	half = taps / 2;
+
+	coeffs = (float *) malloc ((RESAMPLE_PHASES + 1) * taps * sizeof (float));
+	if (!coeffs)
+		Sys_Error ("S_BuildResampler: out of memory");
+
+	for (phase = 0; phase <= RESAMPLE_PHASES; phase++)
+	{
+		row = coeffs + phase * taps;
+		sum = 0.0;
+		for (k = 0; k < taps; k++)
+		{
+			// distance from the output position to input sample k
+			d = (k - half + 1) - (double) phase / RESAMPLE_PHASES;
+			x = d / half;
+			if (x <= -1.0 || x >= 1.0)
+				w = 0.0;
+			else
+			{
+				w = S_BesselI0 (RESAMPLE_BETA * sqrt (1.0 - x * x)) / S_BesselI0 (RESAMPLE_BETA);
+				x = M_PI * cutoff * d;
+				w *= cutoff * (fabs (x) < 1e-9 ? 1.0 : sin (x) / x);
+			}
+			row[k] = (float) w;
+			sum += w;
+		}
+
+	// unity gain at DC for every phase
+		for (k = 0; k < taps; k++)
+			row[k] = (float) (row[k] / sum);
+	}
+
+	*outtaps = taps;
+	return coeffs;
+}
+
+/*
+================
+S_InitResampler
+================
+*/
+static void S_InitResampler (int inrate, int outrate)
+{
+	if (resampler.coeffs && resampler.inrate == inrate && resampler.outrate == outrate)
+		return;
+
+	free (resampler.coeffs);
+	resampler.coeffs = S_BuildResampler (inrate, outrate, &resampler.taps);
+	resampler.inrate = inrate;
+	resampler.outrate = outrate;
+}
+
+/*
+================
+S_ResampleDot
+================
+*/
+static float S_ResampleDot (const float *in, const float *coeffs, int taps)
+{
+	float	sum;
+	int		k;
+
+	sum = 0.f;
+	for (k = 0; k < taps; k++)
+		sum += in[k] * coeffs[k];
+
+	return sum;
+}
+
+#ifdef USE_SSE2
+static float S_ResampleDot_SSE2 (const float *in, const float *coeffs, int taps)
+{
+	__m128	acc0, acc1;
+	int		k;
+
+	acc0 = _mm_setzero_ps ();
+	acc1 = _mm_setzero_ps ();
+	for (k = 0; k + 8 <= taps; k += 8)
+	{
+		acc0 = _mm_add_ps (acc0, _mm_mul_ps (_mm_loadu_ps (in + k), _mm_loadu_ps (coeffs + k)));
+		acc1 = _mm_add_ps (acc1, _mm_mul_ps (_mm_loadu_ps (in + k + 4), _mm_loadu_ps (coeffs + k + 4)));
+	}
+	if (k < taps)
+		acc0 = _mm_add_ps (acc0, _mm_mul_ps (_mm_loadu_ps (in + k), _mm_loadu_ps (coeffs + k)));
+
+	acc0 = _mm_add_ps (acc0, acc1);
+	acc0 = _mm_add_ps (acc0, _mm_movehl_ps (acc0, acc0));
+	acc0 = _mm_add_ss (acc0, _mm_shuffle_ps (acc0, acc0, 1));
+
+	return _mm_cvtss_f32 (acc0);
+}
+#endif
 
 /*
 ================
 ResampleSfx
 ================
 */
-static void ResampleSfx (sfx_t *sfx, int inrate, int inwidth, byte *data)
+static void ResampleSfx (sfxcache_t *sc, int inrate, int inwidth, byte *data)
 {
-	int		outcount;
+	int		outcount, incount;
 	int		srcsample;
 	float	stepscale;
-	int		i;
+	int		i, taps, half;
 	int		sample, samplefrac, fracstep;
-	sfxcache_t	*sc;
-
-	sc = (sfxcache_t *) Cache_Check (&sfx->cache);
-	if (!sc)
-		return;
+	float	*in, *padded;
+	uint64_t	pos, step;
 
 	stepscale = (float)inrate / shm->speed;	// this is usually 0.5, 1, or 2
 
+	incount = sc->length;
 	outcount = sc->length / stepscale;
 	sc->length = outcount;
 	if (sc->loopstart != -1)
@@ -55,17 +311,41 @@ static void ResampleSfx (sfx_t *sfx, int inrate, int inwidth, byte *data)
 		sc->width = inwidth;
 	sc->stereo = 0;
 
-// resample / decimate to the current source rate
-
 	if (stepscale == 1 && inwidth == 1 && sc->width == 1)
 	{
 // fast special case
 		for (i = 0; i < outcount; i++)
 			((signed char *)sc->data)[i] = (int)( (unsigned char)(data[i]) - 128);
+		return;
 	}
-	else
+
+	if (stepscale == 1)
+	{
+// straight conversion
+		for (i = 0; i < outcount; i++)
+		{
+			if (inwidth == 2)
+				sample = LittleShort ( ((short *)data)[i] );
+			else
+				sample = (int)( (unsigned char)(data[i]) - 128) << 8;
+			if (sc->width == 2)
+				((short *)sc->data)[i] = sample;
+			else
+				((signed char *)sc->data)[i] = sample >> 8;
+		}
+		return;
+	}
+
+	S_InitResampler (inrate, shm->speed);
+	taps = resampler.taps;
+	half = taps / 2;
+
+// widen the input to float, with room for the filter on both sides; looping
+// sounds continue into their loop so the seam gets filtered too
+	padded = (float *) calloc (incount + taps + 1, sizeof (float));
+	if (!padded)
 	{
-// general case
+// out of memory: nearest-neighbour fallback
 		srcsample = samplefrac = 0;
 		fracstep = stepscale*256;
 		for (i = 0; i < outcount; i++)
@@ -82,43 +362,275 @@ static void ResampleSfx (sfx_t *sfx, int inrate, int inwidth, byte *data)
 			srcsample += samplefrac >> 8;
 			samplefrac &= 255;
 		}
+		return;
+	}
+
+	in = padded + half;
+	for (i = 0; i < incount; i++)
+	{
+		if (inwidth == 2)
+			in[i] = LittleShort ( ((short *)data)[i] );
+		else
+			in[i] = (int)( (unsigned char)(data[i]) - 128) << 8;
 	}
+	if (sc->loopstart != -1)
+	{
+		srcsample = (int) (sc->loopstart * stepscale);
+		for (i = 0; i <= half && srcsample + i < incount; i++)
+			in[incount + i] = in[srcsample + i];
+	}
+
+	pos = 0;
+	step = (uint64_t) ((double) inrate / shm->speed * 4294967296.0);
+	for (i = 0; i < outcount; i++, pos += step)
+	{
+		const float	*window, *coeffs;
+		float		out;
+		int			phase;
+
+		srcsample = (int) (pos >> 32);
+		phase = (int) (((pos & 0xffffffffu) * RESAMPLE_PHASES + 0x80000000u) >> 32);
+		window = in + srcsample - half + 1;
+		coeffs = resampler.coeffs + phase * taps;
+
+#ifdef USE_SSE2
+		if (use_simd)
+			out = S_ResampleDot_SSE2 (window, coeffs, taps);
+		else
+#endif
+			out = S_ResampleDot (window, coeffs, taps);
+
+		sample = (int) floor (out + 0.5f);
+		sample = CLAMP (-32768, sample, 32767);
+		if (sc->width == 2)
+			((short *)sc->data)[i] = sample;
+		else
+			((signed char *)sc->data)[i] = sample >> 8;
+	}
+
+	free (padded);
 }
 
 //=============================================================================
 
 /*
 ==============
-S_LoadSound
+S_FindSoundFile
+
+Picks the file a sound is loaded from: the WAV itself, or a compressed
+replacement with the same base name. The one from the highest search path
+wins, the WAV on ties. Returns the codec type, CODECTYPE_NONE if nothing
+was found.
 ==============
 */
-sfxcache_t *S_LoadSound (sfx_t *s)
+static const struct
+{
+	unsigned int	type;
+	const char		*ext;
+} sfx_formats[] =
+{
+	{ CODECTYPE_VORBIS,	"ogg" },
+	{ CODECTYPE_OPUS,	"opus" },
+	{ CODECTYPE_FLAC,	"flac" },
+};
+
+static unsigned int S_FindSoundFile (sfx_t *s, char *path, size_t pathsize)
+{
+	char			base[MAX_QPATH + 8];
+	char			tmp[MAX_QPATH + 8];
+	unsigned int	type, path_id, best_id;
+	int				i;
+
+	q_snprintf (path, pathsize, "sound/%s", s->name);
+	if (COM_FileExists (path, &best_id))
+		type = CODECTYPE_WAV;
+	else
+		type = CODECTYPE_NONE;
+
+	COM_StripExtension (path, base, sizeof (base));
+	for (i = 0; i < (int) countof (sfx_formats); i++)
+	{
+		if (S_CodecIsAvailable (sfx_formats[i].type) != 1)
+			continue;
+		q_snprintf (tmp, sizeof (tmp), "%s.%s", base, sfx_formats[i].ext);
+		if (!COM_FileExists (tmp, &path_id))
+			continue;
+		if (type == CODECTYPE_NONE || path_id > best_id)
+		{
+			best_id = path_id;
+			type = sfx_formats[i].type;
+			q_strlcpy (path, tmp, pathsize);
+		}
+	}
+
+	return type;
+}
+
+/*
+==============
+S_StreamedSound
+
+Sounds longer than snd_streamlength seconds aren't kept in memory: all that
+is stored is a header with the file to stream from
+==============
+*/
+static qboolean S_ShouldStream (int samples, int rate)
+{
+	return snd_streamlength.value > 0 && samples > snd_streamlength.value * rate;
+}
+
+static sfxcache_t *S_StreamedSound (const char *path, unsigned int type, int samples, int rate, int loopstart)
 {
-	char	namebuffer[256];
-	byte	*data;
-	wavinfo_t	info;
-	int		len;
-	float	stepscale;
 	sfxcache_t	*sc;
+	float		stepscale;
 
-// see if still in memory
-	sc = (sfxcache_t *) Cache_Check (&s->cache);
-	if (sc)
-		return sc;
+	sc = (sfxcache_t *) S_PoolAlloc (sizeof (sfxcache_t) + strlen (path));
+	stepscale = (float)rate / shm->speed;
+	sc->length = samples / stepscale;
+	sc->loopstart = loopstart == -1 ? -1 : (int) (loopstart / stepscale);
+	sc->speed = shm->speed;
+	sc->width = 2;
+	sc->stereo = 0;
+	sc->codec = type;
+	sc->streamed = true;
+	strcpy ((char *) sc->data, path);
 
-//	Con_Printf ("S_LoadSound: %x\n", (int)stackbuf);
+	return sc;
+}
 
-// load it in
-	q_strlcpy(namebuffer, "sound/", sizeof(namebuffer));
-	q_strlcat(namebuffer, s->name, sizeof(namebuffer));
+/*
+==============
+S_LoadCompressedSound
+
+Decodes a compressed sound effect, downmixing it to mono. Long ones are only
+measured and then streamed.
+==============
+*/
+static sfxcache_t *S_LoadCompressedSound (sfx_t *s, const char *path, unsigned int type)
+{
+	snd_stream_t	*stream;
+	byte			raw[8192];
+	short			*samples, *grow;
+	int				count, maxcount, capacity;
+	int				i, res, frames, channels, width, rate;
+	qboolean		streamed;
+	float			stepscale;
+	int				len;
+	sfxcache_t		*sc;
+
+	stream = S_CodecOpenStreamType (path, type, false);
+	if (!stream)
+		return NULL;
+
+	rate = stream->info.rate;
+	width = stream->info.width;
+	channels = stream->info.channels;
+	if (rate <= 0 || (width != 1 && width != 2) || channels < 1)
+	{
+		S_CodecCloseStream (stream);
+		Con_Printf ("%s has an unsupported format\n", path);
+		return NULL;
+	}
+
+	maxcount = snd_streamlength.value > 0 ? (int) (snd_streamlength.value * rate) : INT_MAX;
+	samples = NULL;
+	capacity = count = 0;
+	streamed = false;
+
+	while ((res = S_CodecReadStream (stream, sizeof (raw) - sizeof (raw) % (width * channels), raw)) > 0)
+	{
+		frames = res / (width * channels);
+		if (!streamed && count + frames > maxcount)
+		{	// too long to keep around, just measure the rest
+			streamed = true;
+			free (samples);
+			samples = NULL;
+		}
+		if (!streamed)
+		{
+			if (count + frames > capacity)
+			{
+				capacity = q_max (capacity * 2, count + frames);
+				grow = (short *) realloc (samples, capacity * sizeof (short));
+				if (!grow)
+				{
+					free (samples);
+					S_CodecCloseStream (stream);
+					Con_Printf ("%s: out of memory\n", path);
+					return NULL;
+				}
+				samples = grow;
+			}
+			for (i = 0; i < frames; i++)
+			{
+				int c, sum = 0;
+				for (c = 0; c < channels; c++)
+				{
+					if (width == 2)
+						sum += ((short *) raw)[i * channels + c];
+					else
+						sum += (raw[i * channels + c] - 128) << 8;
+				}
+				samples[count + i] = LittleShort ((short) (sum / channels));
+			}
+		}
+		count += frames;
+	}
+	S_CodecCloseStream (stream);
+
+	if (res < 0 || count == 0)
+	{
+		free (samples);
+		Con_Printf ("%s has zero samples\n", path);
+		return NULL;
+	}
+
+	if (streamed)
+		return S_StreamedSound (path, type, count, rate, -1);
+
+	stepscale = (float)rate / shm->speed;
+	len = count / stepscale;
+	len = len * (loadas8bit.value ? 1 : 2);
+	if (len == 0)
+	{
+		free (samples);
+		Con_Printf ("%s has zero samples\n", path);
+		return NULL;
+	}
+
+	sc = (sfxcache_t *) S_PoolAlloc (len + sizeof(sfxcache_t));
+	sc->length = count;
+	sc->loopstart = -1;
+	sc->speed = rate;
+	sc->width = 2;
+	sc->stereo = 0;
+	sc->codec = type;
+	sc->streamed = false;
 
-//	Con_Printf ("loading %s\n",namebuffer);
+	ResampleSfx (sc, rate, 2, (byte *) samples);
+	free (samples);
+
+	return sc;
+}
+
+/*
+==============
+S_LoadWavSound
+==============
+*/
+static sfxcache_t *S_LoadWavSound (sfx_t *s, const char *path)
+{
+	byte	*data;
+	wavinfo_t	info;
+	int		len;
+	float	stepscale;
+	sfxcache_t	*sc;
 
-	data = COM_LoadMallocFile (namebuffer, NULL);
+	data = COM_LoadMallocFile (path, NULL);
 
 	if (!data)
 	{
-		Con_Printf ("Couldn't load %s\n", namebuffer);
+		Con_Printf ("Couldn't load %s\n", path);
 		return NULL;
 	}
 
@@ -140,7 +652,7 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 	stepscale = (float)info.rate / shm->speed;
 	len = info.samples / stepscale;
 
-	len = len * info.width * info.channels;
+	len = len * (loadas8bit.value ? 1 : info.width) * info.channels;
 
 	if (info.samples == 0 || len == 0)
 	{
@@ -149,26 +661,428 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 		return NULL;
 	}
 
-	sc = (sfxcache_t *) Cache_Alloc ( &s->cache, len + sizeof(sfxcache_t), s->name);
-	if (!sc)
+	if (S_ShouldStream (info.samples, info.rate) && S_CodecIsAvailable (CODECTYPE_WAV) == 1)
 	{
 		free (data);
-		return NULL;
+		return S_StreamedSound (path, CODECTYPE_WAV, info.samples, info.rate, info.loopstart);
 	}
 
+	sc = (sfxcache_t *) S_PoolAlloc (len + sizeof(sfxcache_t));
+
 	sc->length = info.samples;
 	sc->loopstart = info.loopstart;
 	sc->speed = info.rate;
 	sc->width = info.width;
 	sc->stereo = info.channels;
+	sc->codec = CODECTYPE_WAV;
+	sc->streamed = false;
 
-	ResampleSfx (s, sc->speed, sc->width, data + info.dataofs);
+	ResampleSfx (sc, sc->speed, sc->width, data + info.dataofs);
 
 	free (data);
 
 	return sc;
 }
 
+/*
+==============
+S_LoadSound
+==============
+*/
+sfxcache_t *S_LoadSound (sfx_t *s)
+{
+	char	namebuffer[MAX_QPATH + 8];
+	unsigned int	type;
+	sfxcache_t	*sc;
+
+// see if already loaded
+	if (s->cache)
+		return s->cache;
+
+// load it in
+	type = S_FindSoundFile (s, namebuffer, sizeof (namebuffer));
+	if (type == CODECTYPE_NONE)
+	{
+		Con_Printf ("Couldn't load %s\n", namebuffer);
+		return NULL;
+	}
+
+	if (type == CODECTYPE_WAV)
+		sc = S_LoadWavSound (s, namebuffer);
+	else
+		sc = S_LoadCompressedSound (s, namebuffer, type);
+	if (!sc)
+		return NULL;
+
+// only publish the sound once it's complete, the mixer thread may look at it
+	SDL_MemoryBarrierRelease ();
+	s->cache = sc;
+
+	return sc;
+}
+
+/*
+===============================================================================
+
+SOUND STREAMS
+
+Each channel playing a streamed sound gets one of a few stream slots. The
+slot decodes and resamples into a ring buffer just ahead of the mixer, on
+whichever thread mixes. Slots are opened and closed on the main thread only,
+since that touches the file system and the zone:
+
+	FREE -> PENDING		main thread opens it for a new channel
+	PENDING -> PLAYING	mixer picks up the channel
+	PLAYING -> DONE		mixer no longer has a voice using it
+	DONE -> FREE		main thread closes it
+
+===============================================================================
+*/
+
+#define SFXSTREAM_RINGSIZE	8192	// resampled samples, power of two >= PAINTBUFFER_SIZE
+#define SFXSTREAM_INSIZE	4096	// decoded samples buffered for the resampler
+#define MAX_SFXSTREAMS		16
+
+enum
+{
+	SFXSTREAM_FREE,
+	SFXSTREAM_PENDING,
+	SFXSTREAM_PLAYING,
+	SFXSTREAM_DONE
+};
+
+struct sfxstream_s
+{
+	SDL_atomic_t	state;
+	snd_stream_t	*codec;
+	qboolean		loop;
+	int				loopskip;		// input samples to drop after rewinding
+	qboolean		eof;
+
+	float			*coeffs;		// NULL when no resampling is needed
+	int				taps;
+	uint64_t		pos;			// 32.32 position of the next output in 'in'
+	uint64_t		step;
+	int				incount;
+	float			in[SFXSTREAM_INSIZE + RESAMPLE_MAXTAPS];
+
+	int				skip;			// outputs to drop before the first read
+	int				readpos;		// ring positions, only ever increase
+	int				writepos;
+	sfxcache_t		*ring;
+};
+
+static sfxstream_t	sfx_streams[MAX_SFXSTREAMS];
+
+/*
+==============
+S_DecodeSfxStream
+
+Appends decoded mono samples to the resampler input. Returns false once
+the stream has ended for good.
+==============
+*/
+static qboolean S_DecodeSfxStream (sfxstream_t *st)
+{
+	byte	raw[4096];
+	int		frame, frames, room, res, i, c, sum;
+	snd_info_t	*info = &st->codec->info;
+	qboolean	rewound = false;
+
+	frame = info->width * info->channels;
+	room = SFXSTREAM_INSIZE + RESAMPLE_MAXTAPS - st->incount;
+	frames = q_min (room, (int) sizeof (raw) / frame);
+	if (frames <= 0)
+		return true;
+
+	while (1)
+	{
+		res = S_CodecReadStream (st->codec, frames * frame, raw);
+		if (res > 0)
+			break;
+		if (res < 0 || !st->loop || rewound || S_CodecRewindStream (st->codec) != 0)
+			return false;
+		rewound = true;
+
+	// skip ahead to the loop point
+		for (i = st->loopskip; i > 0; i -= res / frame)
+		{
+			res = S_CodecReadStream (st->codec, q_min (i, frames) * frame, raw);
+			if (res <= 0)
+				return false;
+		}
+	}
+
+	frames = res / frame;
+	for (i = 0; i < frames; i++)
+	{
+		for (c = 0, sum = 0; c < info->channels; c++)
+		{
+			if (info->width == 2)
+				sum += ((short *) raw)[i * info->channels + c];
+			else
+				sum += (raw[i * info->channels + c] - 128) << 8;
+		}
+		st->in[st->incount++] = (float) sum / info->channels;
+	}
+
+	return true;
+}
+
+/*
+==============
+S_FillSfxStream
+
+Produces resampled output until the ring holds 'count' unread samples
+==============
+*/
+static void S_FillSfxStream (sfxstream_t *st, int count)
+{
+	int		half, center, drop, sample, phase;
+	float	out;
+	short	*ring = (short *) st->ring->data;
+
+	half = st->coeffs ? st->taps / 2 : 1;
+
+	while (st->writepos - st->readpos < count)
+	{
+		center = (int) (st->pos >> 32);
+
+	// need more input for this output?
+		if (center + half >= st->incount)
+		{
+		// slide the consumed input out, keeping the filter's history
+			drop = center - (half - 1);
+			if (drop > 0)
+			{
+				memmove (st->in, st->in + drop, (st->incount - drop) * sizeof (float));
+				st->incount -= drop;
+				st->pos -= (uint64_t) drop << 32;
+				center -= drop;
+			}
+
+			if (st->eof || !S_DecodeSfxStream (st))
+			{
+			// flush the filter with silence, then keep outputting it
+				st->eof = true;
+				while (center + half >= st->incount && st->incount < SFXSTREAM_INSIZE + RESAMPLE_MAXTAPS)
+					st->in[st->incount++] = 0.f;
+			}
+			continue;
+		}
+
+		if (!st->coeffs)
+			out = st->in[center];
+		else
+		{
+			phase = (int) (((st->pos & 0xffffffffu) * RESAMPLE_PHASES + 0x80000000u) >> 32);
+#ifdef USE_SSE2
+			if (use_simd)
+				out = S_ResampleDot_SSE2 (st->in + center - half + 1, st->coeffs + phase * st->taps, st->taps);
+			else
+#endif
+				out = S_ResampleDot (st->in + center - half + 1, st->coeffs + phase * st->taps, st->taps);
+		}
+		st->pos += st->step;
+
+		if (st->skip > 0)
+		{
+			st->skip--;
+			continue;
+		}
+
+		sample = (int) floor (out + 0.5f);
+		ring[st->writepos & (SFXSTREAM_RINGSIZE - 1)] = CLAMP (-32768, sample, 32767);
+		st->writepos++;
+	}
+}
+
+/*
+==============
+S_ReadSfxStream
+
+Mixer side: returns the ring and the offset of the next contiguous run of
+at most 'count' samples, which is consumed
+==============
+*/
+sfxcache_t *S_ReadSfxStream (sfxstream_t *st, int count, int *offset, int *numsamples)
+{
+	int ofs;
+
+	count = q_min (count, SFXSTREAM_RINGSIZE / 2);
+	S_FillSfxStream (st, count);
+
+	ofs = st->readpos & (SFXSTREAM_RINGSIZE - 1);
+	count = q_min (count, SFXSTREAM_RINGSIZE - ofs);
+	st->readpos += count;
+
+	*offset = ofs;
+	*numsamples = count;
+	return st->ring;
+}
+
+/*
+==============
+S_OpenSfxStream
+
+Main thread: starts streaming a sound for a new channel, which begins
+'skip' samples in
+==============
+*/
+sfxstream_t *S_OpenSfxStream (sfx_t *sfx, qboolean loop, int skip)
+{
+	sfxcache_t	*sc = sfx->cache;
+	sfxstream_t	*st;
+	int			i, rate;
+
+	for (i = 0, st = sfx_streams; i < MAX_SFXSTREAMS; i++, st++)
+		if (SDL_AtomicGet (&st->state) == SFXSTREAM_FREE)
+			break;
+	if (i == MAX_SFXSTREAMS)
+	{
+		Con_DPrintf ("S_OpenSfxStream: no free streams for %s\n", sfx->name);
+		return NULL;
+	}
+
+	st->codec = S_CodecOpenStreamType ((const char *) sc->data, sc->codec, false);
+	if (!st->codec)
+		return NULL;
+
+	if (!st->ring)
+	{
+		st->ring = (sfxcache_t *) malloc (sizeof (sfxcache_t) + SFXSTREAM_RINGSIZE * sizeof (short));
+		if (!st->ring)
+			Sys_Error ("S_OpenSfxStream: out of memory");
+		memset (st->ring, 0, sizeof (sfxcache_t));
+		st->ring->width = 2;
+		st->ring->speed = shm->speed;
+		st->ring->loopstart = -1;
+		st->ring->length = SFXSTREAM_RINGSIZE;
+	}
+
+	rate = st->codec->info.rate;
+	st->loop = loop;
+	st->loopskip = sc->loopstart > 0 ? (int) (sc->loopstart * (double) rate / shm->speed) : 0;
+	st->eof = false;
+	st->coeffs = NULL;
+	st->taps = 0;
+	if (rate != shm->speed)
+		st->coeffs = S_BuildResampler (rate, shm->speed, &st->taps);
+	st->step = (uint64_t) ((double) rate / shm->speed * 4294967296.0);
+
+// start with the filter's history all silent
+	st->incount = st->coeffs ? st->taps / 2 - 1 : 0;
+	memset (st->in, 0, st->incount * sizeof (float));
+	st->pos = (uint64_t) st->incount << 32;
+
+	st->skip = skip;
+	st->readpos = st->writepos = 0;
+
+	SDL_AtomicSet (&st->state, S_MixerThreaded () ? SFXSTREAM_PENDING : SFXSTREAM_PLAYING);
+
+	return st;
+}
+
+/*
+==============
+S_CloseSfxStream
+==============
+*/
+void S_CloseSfxStream (sfxstream_t *st)
+{
+	S_CodecCloseStream (st->codec);
+	st->codec = NULL;
+	free (st->coeffs);
+	st->coeffs = NULL;
+	SDL_AtomicSet (&st->state, SFXSTREAM_FREE);
+}
+
+/*
+==============
+S_StartSfxStream
+
+Mixer side: a voice has taken over the stream
+==============
+*/
+void S_StartSfxStream (sfxstream_t *st)
+{
+	SDL_AtomicCAS (&st->state, SFXSTREAM_PENDING, SFXSTREAM_PLAYING);
+}
+
+/*
+==============
+S_CollectSfxStreams
+
+Mixer side: retires the streams no voice refers to anymore
+==============
+*/
+void S_CollectSfxStreams (channel_t *voices, int numvoices)
+{
+	qboolean	used[MAX_SFXSTREAMS];
+	int			i, playing;
+	channel_t	*ch;
+
+	for (i = 0, playing = 0; i < MAX_SFXSTREAMS; i++)
+		if (SDL_AtomicGet (&sfx_streams[i].state) == SFXSTREAM_PLAYING)
+			playing++;
+	if (!playing)
+		return;
+
+	memset (used, 0, sizeof (used));
+	for (i = 0, ch = voices; i < numvoices; i++, ch++)
+	{
+		if (!ch->stream)
+			continue;
+		if (!ch->sfx)
+		{
+			ch->stream = NULL;
+			continue;
+		}
+		used[ch->stream - sfx_streams] = true;
+	}
+
+	for (i = 0; i < MAX_SFXSTREAMS; i++)
+		if (!used[i])
+			SDL_AtomicCAS (&sfx_streams[i].state, SFXSTREAM_PLAYING, SFXSTREAM_DONE);
+}
+
+/*
+==============
+S_UpdateSfxStreams
+
+Main thread: closes the streams the mixer is done with. With 'all' set,
+every stream is closed; the mixer must not be running.
+==============
+*/
+void S_UpdateSfxStreams (qboolean all)
+{
+	int			i, state;
+	sfxstream_t	*st;
+
+	for (i = 0, st = sfx_streams; i < MAX_SFXSTREAMS; i++, st++)
+	{
+		state = SDL_AtomicGet (&st->state);
+		if (state == SFXSTREAM_DONE || (all && state != SFXSTREAM_FREE))
+			S_CloseSfxStream (st);
+	}
+}
+
+/*
+==============
+S_SfxStreamCount
+==============
+*/
+int S_SfxStreamCount (void)
+{
+	int i, count;
+
+	for (i = 0, count = 0; i < MAX_SFXSTREAMS; i++)
+		if (SDL_AtomicGet (&sfx_streams[i].state) != SFXSTREAM_FREE)
+			count++;
+
+	return count;
+}
+
 
 
 /*
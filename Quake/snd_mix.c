@@ -153,6 +153,82 @@ static void S_TransferPaintBuffer (int endtime)
 	}
 }
 
+#ifdef USE_SSE2
+/*
+==============
+S_WriteStereo16_SSE2
+
+Adds the music (if any) at -6dB and converts a span of the paint buffer
+to 16-bit output. Divisions round towards zero and packing saturates,
+matching the scalar code.
+==============
+*/
+static void S_WriteStereo16_SSE2 (const int *in, const int *music, short *out, int count)
+{
+	const __m128i	mask = _mm_set1_epi32 (255);
+	__m128i			a, b, m;
+	int				i, val;
+
+	count *= 2;
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		a = _mm_loadu_si128 ((const __m128i *) (in + i));
+		b = _mm_loadu_si128 ((const __m128i *) (in + i + 4));
+		if (music)
+		{
+			m = _mm_loadu_si128 ((const __m128i *) (music + i));
+			a = _mm_add_epi32 (a, _mm_srai_epi32 (_mm_add_epi32 (m, _mm_srli_epi32 (m, 31)), 1));
+			m = _mm_loadu_si128 ((const __m128i *) (music + i + 4));
+			b = _mm_add_epi32 (b, _mm_srai_epi32 (_mm_add_epi32 (m, _mm_srli_epi32 (m, 31)), 1));
+		}
+		a = _mm_srai_epi32 (_mm_add_epi32 (a, _mm_and_si128 (_mm_srai_epi32 (a, 31), mask)), 8);
+		b = _mm_srai_epi32 (_mm_add_epi32 (b, _mm_and_si128 (_mm_srai_epi32 (b, 31), mask)), 8);
+		_mm_storeu_si128 ((__m128i *) (out + i), _mm_packs_epi32 (a, b));
+	}
+
+	for ( ; i < count; i++)
+	{
+		val = in[i];
+		if (music)
+			val += music[i] / 2;
+		val /= 256;
+		out[i] = CLAMP ((short)0x8000, val, 0x7fff);
+	}
+}
+
+/*
+==============
+S_TransferStereo16_SSE2
+
+Music is read from s_rawsamples for sample times below musicend
+==============
+*/
+static void S_TransferStereo16_SSE2 (int endtime, int musicend)
+{
+	int		pos, lpos, count, rawpos;
+	short	*out;
+	int		*music;
+
+	for (pos = paintedtime; pos < endtime; pos += count)
+	{
+	// handle recirculating buffer issues
+		lpos = pos & ((shm->samples >> 1) - 1);
+		out = (short *)shm->buffer + (lpos << 1);
+		count = q_min (endtime - pos, (shm->samples >> 1) - lpos);
+
+		music = NULL;
+		if (pos < musicend)
+		{
+			rawpos = pos & (MAX_RAW_SAMPLES - 1);
+			music = (int *) &s_rawsamples[rawpos];
+			count = q_min (count, q_min (musicend - pos, MAX_RAW_SAMPLES - rawpos));
+		}
+
+		S_WriteStereo16_SSE2 ((int *) &paintbuffer[pos - paintedtime], music, out, count);
+	}
+}
+#endif
+
 /*
 ==============
 S_MakeBlackmanWindowKernel
@@ -332,6 +408,43 @@ static void S_LowpassFilter(int *data, int stride, int count,
 	S_ApplyFilter(memory, data, stride, count);
 }
 
+/*
+==============
+S_ClipPaintBuffer
+
+Clips each sample to 0dB, then reduces by 6dB
+==============
+*/
+static void S_ClipPaintBuffer (int count)
+{
+	int		*p = (int *) paintbuffer;
+	int		i;
+
+	count *= 2;
+	i = 0;
+#ifdef USE_SSE2
+	if (use_simd)
+	{
+		const __m128i	hi = _mm_set1_epi32 (32767 * 256);
+		const __m128i	lo = _mm_set1_epi32 (-32768 * 256);
+		__m128i			x, m;
+
+		for ( ; i + 4 <= count; i += 4)
+		{
+			x = _mm_loadu_si128 ((const __m128i *) (p + i));
+			m = _mm_cmpgt_epi32 (x, hi);
+			x = _mm_or_si128 (_mm_and_si128 (m, hi), _mm_andnot_si128 (m, x));
+			m = _mm_cmplt_epi32 (x, lo);
+			x = _mm_or_si128 (_mm_and_si128 (m, lo), _mm_andnot_si128 (m, x));
+			x = _mm_srai_epi32 (_mm_add_epi32 (x, _mm_srli_epi32 (x, 31)), 1);
+			_mm_storeu_si128 ((__m128i *) (p + i), x);
+		}
+	}
+#endif
+	for ( ; i < count; i++)
+		p[i] = CLAMP(-32768 * 256, p[i], 32767 * 256) / 2;
+}
+
 /*
 ===============================================================================
 
@@ -425,8 +538,10 @@ CHANNEL MIXING
 
 static void SND_PaintChannelFrom8 (channel_t *ch, sfxcache_t *sc, int endtime, int paintbufferstart);
 static void SND_PaintChannelFrom16 (channel_t *ch, sfxcache_t *sc, int endtime, int paintbufferstart);
+static void SND_AdvanceChannel (channel_t *ch, sfxcache_t *sc, int ltime, int endtime);
+static void SND_PaintStream (channel_t *ch, int count, int paintbufferstart, qboolean mix);
 
-void S_PaintChannels (int endtime)
+void S_PaintChannels (channel_t *channels, int numchannels, int endtime)
 {
 	int		i;
 	int		end, ltime, count;
@@ -446,17 +561,23 @@ void S_PaintChannels (int endtime)
 		memset(paintbuffer, 0, (end - paintedtime) * sizeof(portable_samplepair_t));
 
 	// paint in the channels.
-		ch = snd_channels;
-		for (i = 0; i < total_channels; i++, ch++)
+		ch = channels;
+		for (i = 0; i < numchannels; i++, ch++)
 		{
 			if (!ch->sfx)
 				continue;
-			if (!ch->leftvol && !ch->rightvol)
-				continue;
-			sc = S_LoadSound (ch->sfx);
+			sc = S_CachedSound (ch->sfx);
 			if (!sc)
 				continue;
 
+		// virtual voices keep their place in the sound without being mixed,
+		// streams still have to be decoded to stay in step
+			if (!ch->stream && (sc->streamed || ch->virtualized || (!ch->leftvol && !ch->rightvol)))
+			{
+				SND_AdvanceChannel (ch, sc, paintedtime, end);
+				continue;
+			}
+
 			ltime = paintedtime;
 
 			while (ltime < end)
@@ -470,7 +591,9 @@ void S_PaintChannels (int endtime)
 				{
 					// the last param to SND_PaintChannelFrom is the index
 					// to start painting to in the paintbuffer, usually 0.
-					if (sc->width == 1)
+					if (ch->stream)
+						SND_PaintStream(ch, count, ltime - paintedtime, !ch->virtualized && (ch->leftvol || ch->rightvol));
+					else if (sc->width == 1)
 						SND_PaintChannelFrom8(ch, sc, count, ltime - paintedtime);
 					else
 						SND_PaintChannelFrom16(ch, sc, count, ltime - paintedtime);
@@ -481,9 +604,9 @@ void S_PaintChannels (int endtime)
 			// if at end of loop, restart
 				if (ltime >= ch->end)
 				{
-					if (sc->loopstart >= 0)
+					if (sc->loopstart >= 0 || ch->looping)
 					{
-						ch->pos = sc->loopstart;
+						ch->pos = q_max (sc->loopstart, 0);
 						ch->end = ltime + sc->length - ch->pos;
 					}
 					else
@@ -498,11 +621,7 @@ void S_PaintChannels (int endtime)
 	// clip each sample to 0dB, then reduce by 6dB (to leave some headroom for
 	// the lowpass filter and the music). the lowpass will smooth out the
 	// clipping
-		for (i=0; i<end-paintedtime; i++)
-		{
-			paintbuffer[i].left = CLAMP(-32768 * 256, paintbuffer[i].left, 32767 * 256) / 2;
-			paintbuffer[i].right = CLAMP(-32768 * 256, paintbuffer[i].right, 32767 * 256) / 2;
-		}
+		S_ClipPaintBuffer (end - paintedtime);
 
 	// apply a lowpass filter
 		if (sndspeed.value == 11025 && shm->speed == 44100)
@@ -515,6 +634,16 @@ void S_PaintChannels (int endtime)
 		S_UnderwaterFilter (end - paintedtime);
 		S_UpdateLevels (end - paintedtime);
 
+#ifdef USE_SSE2
+	// paint in the music while writing the output
+		if (use_simd && shm->samplebits == 16 && shm->channels == 2)
+		{
+			S_TransferStereo16_SSE2 (end, s_rawend >= paintedtime ? q_min (end, s_rawend) : paintedtime);
+			paintedtime = end;
+			continue;
+		}
+#endif
+
 	// paint in the music
 		if (s_rawend >= paintedtime)
 		{	// copy from the streaming sound source
@@ -542,6 +671,98 @@ void S_PaintChannels (int endtime)
 	}
 }
 
+/*
+================
+SND_AdvanceChannel
+
+Moves a channel forward in time exactly like painting it would
+================
+*/
+static void SND_AdvanceChannel (channel_t *ch, sfxcache_t *sc, int ltime, int endtime)
+{
+	int		count;
+
+	while (ltime < endtime)
+	{
+		count = q_min (ch->end, endtime) - ltime;
+		if (count > 0)
+		{
+			ch->pos += count;
+			ltime += count;
+		}
+
+		if (ltime >= ch->end)
+		{
+			if (sc->loopstart >= 0 || ch->looping)
+			{
+				ch->pos = q_max (sc->loopstart, 0);
+				ch->end = ltime + sc->length - ch->pos;
+			}
+			else
+			{
+				ch->sfx = NULL;
+				break;
+			}
+		}
+	}
+}
+
+/*
+================
+SND_PaintStream
+
+Paints a streamed channel from its stream's ring buffer. The ring is
+consumed even when nothing is mixed, so the stream keeps its place.
+================
+*/
+static void SND_PaintStream (channel_t *ch, int count, int paintbufferstart, qboolean mix)
+{
+	sfxcache_t	*ring;
+	int			pos, ofs, n;
+
+	pos = ch->pos + count;
+	while (count > 0)
+	{
+		ring = S_ReadSfxStream (ch->stream, count, &ofs, &n);
+		if (mix)
+		{
+			ch->pos = ofs;
+			SND_PaintChannelFrom16 (ch, ring, n, paintbufferstart);
+		}
+		paintbufferstart += n;
+		count -= n;
+	}
+	ch->pos = pos;
+}
+
+/*
+================
+S_AdvanceChannels
+
+Moves channels forward in time without painting anything. Used by the main
+thread to keep its channel list in step with the mixer thread's voices.
+================
+*/
+void S_AdvanceChannels (channel_t *channels, int numchannels, int starttime, int endtime)
+{
+	int		i;
+	channel_t	*ch;
+	sfxcache_t	*sc;
+
+	if (starttime >= endtime)
+		return;
+
+	ch = channels;
+	for (i = 0; i < numchannels; i++, ch++)
+	{
+		if (!ch->sfx)
+			continue;
+		sc = S_CachedSound (ch->sfx);
+		if (sc)
+			SND_AdvanceChannel (ch, sc, starttime, endtime);
+	}
+}
+
 void SND_InitScaletable (void)
 {
 	int		i, j;
@@ -565,6 +786,98 @@ void SND_InitScaletable (void)
 }
 
 
+#ifdef USE_SSE2
+/*
+==============
+SND_MulStereo_SSE2
+
+Multiplies 8 16-bit samples by the (left, right) 16-bit volumes in vol,
+giving 32-bit products laid out like the stereo pairs of the paint buffer
+==============
+*/
+static inline void SND_MulStereo_SSE2 (__m128i samples, __m128i vol, __m128i products[4])
+{
+	__m128i		dup, lo, hi;
+
+	dup = _mm_unpacklo_epi16 (samples, samples);
+	lo = _mm_mullo_epi16 (dup, vol);
+	hi = _mm_mulhi_epi16 (dup, vol);
+	products[0] = _mm_unpacklo_epi16 (lo, hi);
+	products[1] = _mm_unpackhi_epi16 (lo, hi);
+
+	dup = _mm_unpackhi_epi16 (samples, samples);
+	lo = _mm_mullo_epi16 (dup, vol);
+	hi = _mm_mulhi_epi16 (dup, vol);
+	products[2] = _mm_unpacklo_epi16 (lo, hi);
+	products[3] = _mm_unpackhi_epi16 (lo, hi);
+}
+
+/*
+==============
+SND_PaintFrom8_SSE2
+
+Each scale is split into 8-bit halves so that the 16-bit multiplies
+give the same results as snd_scaletable. Returns the number of samples
+painted, a multiple of 8.
+==============
+*/
+static int SND_PaintFrom8_SSE2 (const signed char *sfx, int lscale, int rscale, int *out, int count)
+{
+	const __m128i	vollo = _mm_set_epi16 (rscale & 255, lscale & 255, rscale & 255, lscale & 255, rscale & 255, lscale & 255, rscale & 255, lscale & 255);
+	const __m128i	volhi = _mm_set_epi16 (rscale >> 8, lscale >> 8, rscale >> 8, lscale >> 8, rscale >> 8, lscale >> 8, rscale >> 8, lscale >> 8);
+	__m128i			samples, plo[4], phi[4], *dst;
+	int				i, j;
+
+	if (lscale < 0 || rscale < 0 || (lscale >> 8) > 0x7fff || (rscale >> 8) > 0x7fff)
+		return 0;
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		samples = _mm_loadl_epi64 ((const __m128i *) (sfx + i));
+		samples = _mm_srai_epi16 (_mm_unpacklo_epi8 (samples, samples), 8);
+		SND_MulStereo_SSE2 (samples, vollo, plo);
+		SND_MulStereo_SSE2 (samples, volhi, phi);
+
+		dst = (__m128i *) (out + i * 2);
+		for (j = 0; j < 4; j++)
+		{
+			__m128i sum = _mm_add_epi32 (plo[j], _mm_slli_epi32 (phi[j], 8));
+			_mm_storeu_si128 (dst + j, _mm_add_epi32 (_mm_loadu_si128 (dst + j), sum));
+		}
+	}
+
+	return i;
+}
+
+/*
+==============
+SND_PaintFrom16_SSE2
+
+Returns the number of samples painted, a multiple of 8
+==============
+*/
+static int SND_PaintFrom16_SSE2 (const short *sfx, int leftvol, int rightvol, int *out, int count)
+{
+	const __m128i	vol = _mm_set_epi16 (rightvol, leftvol, rightvol, leftvol, rightvol, leftvol, rightvol, leftvol);
+	__m128i			products[4], *dst;
+	int				i, j;
+
+	if (leftvol < -0x8000 || leftvol > 0x7fff || rightvol < -0x8000 || rightvol > 0x7fff)
+		return 0;
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		SND_MulStereo_SSE2 (_mm_loadu_si128 ((const __m128i *) (sfx + i)), vol, products);
+
+		dst = (__m128i *) (out + i * 2);
+		for (j = 0; j < 4; j++)
+			_mm_storeu_si128 (dst + j, _mm_add_epi32 (_mm_loadu_si128 (dst + j), products[j]));
+	}
+
+	return i;
+}
+#endif
+
 static void SND_PaintChannelFrom8 (channel_t *ch, sfxcache_t *sc, int count, int paintbufferstart)
 {
 	int	data;
@@ -581,7 +894,12 @@ static void SND_PaintChannelFrom8 (channel_t *ch, sfxcache_t *sc, int count, int
 	rscale = snd_scaletable[ch->rightvol >> 3];
 	sfx = (unsigned char *)sc->data + ch->pos;
 
-	for (i = 0; i < count; i++)
+	i = 0;
+#ifdef USE_SSE2
+	if (use_simd)
+		i = SND_PaintFrom8_SSE2 ((const signed char *) sfx, lscale[1], rscale[1], (int *) &paintbuffer[paintbufferstart], count);
+#endif
+	for ( ; i < count; i++)
 	{
 		data = sfx[i];
 		paintbuffer[paintbufferstart + i].left += lscale[data];
@@ -605,7 +923,12 @@ static void SND_PaintChannelFrom16 (channel_t *ch, sfxcache_t *sc, int count, in
 	rightvol /= 256;
 	sfx = (signed short *)sc->data + ch->pos;
 
-	for (i = 0; i < count; i++)
+	i = 0;
+#ifdef USE_SSE2
+	if (use_simd)
+		i = SND_PaintFrom16_SSE2 (sfx, leftvol, rightvol, (int *) &paintbuffer[paintbufferstart], count);
+#endif
+	for ( ; i < count; i++)
 	{
 		data = sfx[i];
 	// this was causing integer overflow as observed in quakespasm
@@ -34,6 +34,10 @@ int		sv_protocol = PROTOCOL_RMQ; //johnfitz
 extern cvar_t nomonsters;
 
 static cvar_t sv_netsort = {"sv_netsort", "1", CVAR_NONE};
+static cvar_t sv_netstats_log = {"sv_netstats_log", "0", CVAR_NONE};
+
+static void SV_NetStats_f (void);
+static void SV_NetStats_LogChanged (cvar_t *var);
 
 //============================================================================
 
@@ -178,7 +182,11 @@ void SV_Init (void)
 	Cvar_RegisterVariable (&sv_autosave);
 	Cvar_RegisterVariable (&sv_autosave_interval);
 
+	Cvar_RegisterVariable (&sv_netstats_log);
+	Cvar_SetCallback (&sv_netstats_log, SV_NetStats_LogChanged);
+
 	Cmd_AddCommand ("sv_protocol", &SV_Protocol_f); //johnfitz
+	Cmd_AddCommand ("sv_netstats", &SV_NetStats_f);
 
 	for (i=0 ; i<MAX_MODELS ; i++)
 		sprintf (localmodels[i], "*%i", i);
@@ -222,10 +230,11 @@ Make sure the event gets sent to all clients
 */
 void SV_StartParticle (vec3_t org, vec3_t dir, int color, int count)
 {
-	int		i, v;
+	int		i, v, oldsize;
 
 	if (sv.datagram.cursize > MAX_DATAGRAM-18)
 		return;
+	oldsize = sv.datagram.cursize;
 	MSG_WriteByte (&sv.datagram, svc_particle);
 	MSG_WriteCoord (&sv.datagram, org[0], sv.protocolflags);
 	MSG_WriteCoord (&sv.datagram, org[1], sv.protocolflags);
@@ -241,6 +250,7 @@ void SV_StartParticle (vec3_t org, vec3_t dir, int color, int count)
 	}
 	MSG_WriteByte (&sv.datagram, count);
 	MSG_WriteByte (&sv.datagram, color);
+	sv.datagram_netstats[NETSTAT_PARTICLE] += sv.datagram.cursize - oldsize;
 }
 
 /*
@@ -261,7 +271,7 @@ Larger attenuations will drop off.  (max 4 attenuation)
 void SV_StartSound (edict_t *entity, int channel, const char *sample, int volume, float attenuation)
 {
 	int			sound_num, ent;
-	int			i, field_mask;
+	int			i, field_mask, oldsize;
 
 	if (volume < 0 || volume > 255)
 		Host_Error ("SV_StartSound: volume = %i", volume);
@@ -315,6 +325,7 @@ void SV_StartSound (edict_t *entity, int channel, const char *sample, int volume
 		return;
 
 // directed messages go only to the entity the are targeted on
+	oldsize = sv.datagram.cursize;
 	MSG_WriteByte (&sv.datagram, svc_sound);
 	MSG_WriteByte (&sv.datagram, field_mask);
 	if (field_mask & SND_VOLUME)
@@ -338,6 +349,7 @@ void SV_StartSound (edict_t *entity, int channel, const char *sample, int volume
 
 	for (i = 0; i < 3; i++)
 		MSG_WriteCoord (&sv.datagram, entity->v.origin[i]+0.5*(entity->v.mins[i]+entity->v.maxs[i]), sv.protocolflags);
+	sv.datagram_netstats[NETSTAT_SOUND] += sv.datagram.cursize - oldsize;
 }
 
 /*
@@ -347,7 +359,7 @@ SV_LocalSound - for 2021 rerelease
 */
 void SV_LocalSound (client_t *client, const char *sample)
 {
-	int	sound_num, field_mask;
+	int	sound_num, field_mask, oldsize;
 
 	for (sound_num = 1; sound_num < MAX_SOUNDS && sv.sound_precache[sound_num]; sound_num++)
 	{
@@ -371,12 +383,14 @@ void SV_LocalSound (client_t *client, const char *sample)
 	if (client->message.cursize > client->message.maxsize-4)
 		return;
 
+	oldsize = client->message.cursize;
 	MSG_WriteByte (&client->message, svc_localsound);
 	MSG_WriteByte (&client->message, field_mask);
 	if (field_mask & SND_LARGESOUND)
 		MSG_WriteShort (&client->message, sound_num);
 	else
 		MSG_WriteByte (&client->message, sound_num);
+	SV_NetStats_Add (client, NETSTAT_SOUND, oldsize);
 }
 
 /*
@@ -565,6 +579,7 @@ SV_ClearDatagram
 void SV_ClearDatagram (void)
 {
 	SZ_Clear (&sv.datagram);
+	memset (sv.datagram_netstats, 0, sizeof (sv.datagram_netstats));
 }
 
 /*
@@ -1173,6 +1188,298 @@ void SV_WriteClientdataToMessage (edict_t *ent, sizebuf_t *msg)
 	}
 }
 
+/*
+=============================================================================
+
+BANDWIDTH ACCOUNTING
+
+Every byte sent to a client is attributed to a netstatcat_t category.
+Unreliable bytes are measured while the datagram is built, reliable bytes
+are tagged when they are queued in client->message and committed when the
+message is actually sent.  Anything that wasn't tagged counts as "other".
+
+=============================================================================
+*/
+
+static FILE *sv_netstats_logfile;
+
+static const char *const netstat_names[NETSTAT_NUMCATEGORIES] =
+{
+	"time",
+	"clientdata",
+	"entities",
+	"sound",
+	"particle",
+	"stats",
+	"scoreboard",
+	"stufftext",
+	"print",
+	"signon",
+	"broadcast",
+	"other",
+};
+
+/*
+=======================
+SV_NetStats_Add
+
+Tags the bytes written to client->message since oldsize
+=======================
+*/
+void SV_NetStats_Add (client_t *client, netstatcat_t cat, int oldsize)
+{
+	int bytes = client->message.cursize - oldsize;
+	if (bytes > 0) // negative if the buffer overflowed in the meantime
+		client->netstats.pending[cat] += bytes;
+}
+
+/*
+=======================
+SV_NetStats_FlushReliable
+
+Commits the tagged bytes of a reliable message that has just been sent
+=======================
+*/
+static void SV_NetStats_FlushReliable (client_t *client)
+{
+	clientnetstats_t	*ns = &client->netstats;
+	int					i, bytes, remaining;
+
+	remaining = client->message.cursize;
+	for (i = 0; i < NETSTAT_NUMCATEGORIES; i++)
+	{
+		bytes = q_min (ns->pending[i], remaining);
+		ns->frame_reliable[i] += bytes;
+		remaining -= bytes;
+	}
+	ns->frame_reliable[NETSTAT_OTHER] += remaining;
+	ns->reliable_messages++;
+
+	memset (ns->pending, 0, sizeof (ns->pending));
+}
+
+/*
+=======================
+SV_NetStats_Bucket
+
+Maps a per-frame byte count to a histogram bucket:
+0, <32, <64, <128, ... , <16k, >=16k
+=======================
+*/
+static int SV_NetStats_Bucket (int bytes)
+{
+	int bucket, limit;
+
+	if (bytes <= 0)
+		return 0;
+	for (bucket = 1, limit = 32; bucket < NETSTAT_HISTOGRAM_BUCKETS - 1 && bytes >= limit; bucket++)
+		limit <<= 1;
+
+	return bucket;
+}
+
+/*
+=======================
+SV_NetStats_LogChanged
+=======================
+*/
+static void SV_NetStats_LogChanged (cvar_t *var)
+{
+	if (!var->value && sv_netstats_logfile)
+	{
+		fclose (sv_netstats_logfile);
+		sv_netstats_logfile = NULL;
+	}
+}
+
+/*
+=======================
+SV_NetStats_OpenLog
+=======================
+*/
+static FILE *SV_NetStats_OpenLog (void)
+{
+	char	name[MAX_OSPATH];
+	int		i;
+
+	if (sv_netstats_logfile)
+		return sv_netstats_logfile;
+
+	q_snprintf (name, sizeof (name), "%s/netstats.csv", com_gamedir);
+	sv_netstats_logfile = Sys_fopen (name, "w");
+	if (!sv_netstats_logfile)
+	{
+		Con_Printf ("ERROR: couldn't open file %s.\n", name);
+		Cvar_SetQuick (&sv_netstats_log, "0");
+		return NULL;
+	}
+
+	fprintf (sv_netstats_logfile, "time,map,client");
+	for (i = 0; i < NETSTAT_NUMCATEGORIES; i++)
+		fprintf (sv_netstats_logfile, ",u_%s", netstat_names[i]);
+	for (i = 0; i < NETSTAT_NUMCATEGORIES; i++)
+		fprintf (sv_netstats_logfile, ",r_%s", netstat_names[i]);
+	fprintf (sv_netstats_logfile, "\n");
+
+	Con_SafePrintf ("Logging network statistics to ");
+	Con_LinkPrintf (name, "netstats.csv");
+	Con_SafePrintf ("\n");
+
+	return sv_netstats_logfile;
+}
+
+/*
+=======================
+SV_NetStats_EndFrame
+
+Accumulates the bytes sent to each client this frame
+=======================
+*/
+static void SV_NetStats_EndFrame (void)
+{
+	int					i, j, total;
+	client_t			*client;
+	clientnetstats_t	*ns;
+	FILE				*log;
+
+	log = sv_netstats_log.value ? SV_NetStats_OpenLog () : NULL;
+
+	for (i = 0, client = svs.clients; i < svs.maxclients; i++, client++)
+	{
+		if (!client->active)
+			continue;
+
+		ns = &client->netstats;
+		for (j = 0, total = 0; j < NETSTAT_NUMCATEGORIES; j++)
+		{
+			ns->unreliable[j] += ns->frame_unreliable[j];
+			ns->reliable[j] += ns->frame_reliable[j];
+			total += ns->frame_unreliable[j] + ns->frame_reliable[j];
+		}
+
+		ns->frames++;
+		ns->histogram[SV_NetStats_Bucket (total)]++;
+		ns->peak_frame_bytes = q_max (ns->peak_frame_bytes, total);
+
+		if (log && total)
+		{
+			fprintf (log, "%.3f,%s,%d", realtime, sv.name, i);
+			for (j = 0; j < NETSTAT_NUMCATEGORIES; j++)
+				fprintf (log, ",%d", ns->frame_unreliable[j]);
+			for (j = 0; j < NETSTAT_NUMCATEGORIES; j++)
+				fprintf (log, ",%d", ns->frame_reliable[j]);
+			fprintf (log, "\n");
+		}
+
+		memset (ns->frame_unreliable, 0, sizeof (ns->frame_unreliable));
+		memset (ns->frame_reliable, 0, sizeof (ns->frame_reliable));
+	}
+}
+
+/*
+=======================
+SV_NetStats_Print
+=======================
+*/
+static void SV_NetStats_Print (int clientnum)
+{
+	client_t			*client = &svs.clients[clientnum];
+	clientnetstats_t	*ns = &client->netstats;
+	double				utotal, rtotal, total;
+	int					i, maxcount, len;
+
+	for (i = 0, utotal = rtotal = 0.0; i < NETSTAT_NUMCATEGORIES; i++)
+	{
+		utotal += ns->unreliable[i];
+		rtotal += ns->reliable[i];
+	}
+	total = q_max (utotal + rtotal, 1.0);
+
+	Con_Printf ("\nclient %d \"%s\" (%s)\n", clientnum, client->name, NET_QSocketGetAddressString (client->netconnection));
+	Con_Printf ("%d frames, %d datagrams, %d reliable messages\n", ns->frames, ns->unreliable_messages, ns->reliable_messages);
+	Con_Printf ("avg %.0f bytes/frame, peak %d bytes/frame\n", (utotal + rtotal) / q_max (ns->frames, 1), ns->peak_frame_bytes);
+	Con_Printf ("category    unreliable   reliable     %%\n");
+	for (i = 0; i < NETSTAT_NUMCATEGORIES; i++)
+	{
+		if (!ns->unreliable[i] && !ns->reliable[i])
+			continue;
+		Con_Printf ("%-10s %11.0f %10.0f %5.1f\n", netstat_names[i], ns->unreliable[i], ns->reliable[i],
+			100.0 * (ns->unreliable[i] + ns->reliable[i]) / total);
+	}
+	Con_Printf ("%-10s %11.0f %10.0f\n", "total", utotal, rtotal);
+
+	for (i = 0, maxcount = 1; i < NETSTAT_HISTOGRAM_BUCKETS; i++)
+		maxcount = q_max (maxcount, ns->histogram[i]);
+
+	Con_Printf ("bytes/frame histogram:\n");
+	for (i = 0; i < NETSTAT_HISTOGRAM_BUCKETS; i++)
+	{
+		char bar[21];
+		if (!ns->histogram[i])
+			continue;
+		len = (ns->histogram[i] * (sizeof (bar) - 1) + maxcount - 1) / maxcount;
+		memset (bar, '#', len);
+		bar[len] = '\0';
+		if (i == 0)
+			Con_Printf ("%8s %8d %s\n", "0", ns->histogram[i], bar);
+		else if (i == NETSTAT_HISTOGRAM_BUCKETS - 1)
+			Con_Printf (">=%6d %8d %s\n", 16 << (i - 1), ns->histogram[i], bar);
+		else
+			Con_Printf (" <%6d %8d %s\n", 16 << i, ns->histogram[i], bar);
+	}
+}
+
+/*
+=======================
+SV_NetStats_f
+
+sv_netstats [reset | <client number>]
+=======================
+*/
+static void SV_NetStats_f (void)
+{
+	int			i, first, last;
+	client_t	*client;
+
+	if (!sv.active)
+	{
+		Con_Printf ("Server not active\n");
+		return;
+	}
+
+	first = 0;
+	last = svs.maxclients - 1;
+
+	if (Cmd_Argc () >= 2)
+	{
+		if (!q_strcasecmp (Cmd_Argv (1), "reset"))
+		{
+			for (i = 0, client = svs.clients; i < svs.maxclients; i++, client++)
+			{
+				int pending[NETSTAT_NUMCATEGORIES];
+				memcpy (pending, client->netstats.pending, sizeof (pending));
+				memset (&client->netstats, 0, sizeof (client->netstats));
+				memcpy (client->netstats.pending, pending, sizeof (pending));
+			}
+			Con_Printf ("Network statistics reset\n");
+			return;
+		}
+
+		first = last = atoi (Cmd_Argv (1));
+		if (first < 0 || first >= svs.maxclients || !svs.clients[first].active)
+		{
+			Con_Printf ("No active client %s\n", Cmd_Argv (1));
+			return;
+		}
+	}
+	else
+		Con_Printf ("usage: sv_netstats [reset | <client number>]\n");
+
+	for (i = first; i <= last; i++)
+		if (svs.clients[i].active)
+			SV_NetStats_Print (i);
+}
+
 /*
 =======================
 SV_SendClientDatagram
@@ -1182,6 +1489,7 @@ qboolean SV_SendClientDatagram (client_t *client)
 {
 	byte		buf[MAX_DATAGRAM];
 	sizebuf_t	msg;
+	int			i, *frame, oldsize;
 
 	msg.data = buf;
 	msg.maxsize = sizeof(buf);
@@ -1192,17 +1500,35 @@ qboolean SV_SendClientDatagram (client_t *client)
 		msg.maxsize = DATAGRAM_MTU;
 	//johnfitz
 
+	frame = client->netstats.frame_unreliable;
+
 	MSG_WriteByte (&msg, svc_time);
 	MSG_WriteFloat (&msg, qcvm->time);
+	frame[NETSTAT_TIME] += msg.cursize;
 
 // add the client specific data to the datagram
+	oldsize = msg.cursize;
 	SV_WriteClientdataToMessage (client->edict, &msg);
+	frame[NETSTAT_CLIENTDATA] += msg.cursize - oldsize;
 
+	oldsize = msg.cursize;
 	SV_WriteEntitiesToClient (client->edict, &msg);
+	frame[NETSTAT_ENTITIES] += msg.cursize - oldsize;
 
 // copy the server datagram if there is space
 	if (msg.cursize + sv.datagram.cursize < msg.maxsize)
+	{
 		SZ_Write (&msg, sv.datagram.data, sv.datagram.cursize);
+		oldsize = sv.datagram.cursize;
+		for (i = 0; i < NETSTAT_NUMCATEGORIES; i++)
+		{
+			frame[i] += sv.datagram_netstats[i];
+			oldsize -= sv.datagram_netstats[i];
+		}
+		frame[NETSTAT_OTHER] += oldsize;
+	}
+
+	client->netstats.unreliable_messages++;
 
 // send the datagram
 	if (NET_SendUnreliableMessage (client->netconnection, &msg) == -1)
@@ -1226,8 +1552,9 @@ void SV_WriteStats (client_t *client)
 	int			statsi[MAX_CL_STATS];
 	float		statsf[MAX_CL_STATS];
 	const char	*statss[MAX_CL_STATS];
-	int			i;
+	int			i, oldsize;
 
+	oldsize = client->message.cursize;
 	SV_CalcStats (client, statsi, statsf, statss);
 
 	for (i = 0; i < MAX_CL_STATS; i++)
@@ -1280,6 +1607,8 @@ void SV_WriteStats (client_t *client)
 			}
 		}
 	}
+
+	SV_NetStats_Add (client, NETSTAT_STATS, oldsize);
 }
 
 /*
@@ -1289,11 +1618,15 @@ SV_WriteUnderwaterOverride
 */
 void SV_WriteUnderwaterOverride (client_t *client)
 {
+	int oldsize;
+
 	if (!client->edict->sendforcewater)
 		return;
 	client->edict->sendforcewater = false;
+	oldsize = client->message.cursize;
 	MSG_WriteByte (&client->message, svc_stufftext);
 	MSG_WriteString (&client->message, va ("//v_water %i\n", client->edict->forcewater));
+	SV_NetStats_Add (client, NETSTAT_STUFFTEXT, oldsize);
 }
 
 
@@ -1304,7 +1637,7 @@ SV_UpdateToReliableMessages
 */
 void SV_UpdateToReliableMessages (void)
 {
-	int			i, j;
+	int			i, j, oldsize;
 	client_t *client;
 
 // check for changes to be sent over the reliable streams
@@ -1316,9 +1649,11 @@ void SV_UpdateToReliableMessages (void)
 			{
 				if (!client->active)
 					continue;
+				oldsize = client->message.cursize;
 				MSG_WriteByte (&client->message, svc_updatefrags);
 				MSG_WriteByte (&client->message, i);
 				MSG_WriteShort (&client->message, host_client->edict->v.frags);
+				SV_NetStats_Add (client, NETSTAT_SCOREBOARD, oldsize);
 			}
 
 			host_client->old_frags = host_client->edict->v.frags;
@@ -1331,7 +1666,9 @@ void SV_UpdateToReliableMessages (void)
 			continue;
 		SV_WriteStats (client);
 		SV_WriteUnderwaterOverride (client);
+		oldsize = client->message.cursize;
 		SZ_Write (&client->message, sv.reliable_datagram.data, sv.reliable_datagram.cursize);
+		SV_NetStats_Add (client, NETSTAT_BROADCAST, oldsize);
 	}
 
 	SZ_Clear (&sv.reliable_datagram);
@@ -1407,6 +1744,7 @@ void SV_SendClientMessages (void)
 					if (host_client->message.cursize + signon->cursize > host_client->message.maxsize)
 						break;
 					SZ_Write (&host_client->message, signon->data, signon->cursize);
+					host_client->netstats.pending[NETSTAT_SIGNON] += signon->cursize;
 					host_client->signonidx++;
 					// only send multiple buffers at once when playing locally,
 					// otherwise we send one signon at a time to avoid overflowing
@@ -1423,6 +1761,7 @@ void SV_SendClientMessages (void)
 				{
 					MSG_WriteByte (&host_client->message, svc_signonnum);
 					MSG_WriteByte (&host_client->message, 2);
+					host_client->netstats.pending[NETSTAT_SIGNON] += 2;
 					host_client->sendsignon = PRESPAWN_FLUSH;
 				}
 			}
@@ -1453,6 +1792,7 @@ void SV_SendClientMessages (void)
 				if (NET_SendMessage (host_client->netconnection
 				, &host_client->message) == -1)
 					SV_DropClient (true);	// if the message couldn't send, kick off
+				SV_NetStats_FlushReliable (host_client);
 				SZ_Clear (&host_client->message);
 				host_client->last_message = realtime;
 				if (host_client->sendsignon == PRESPAWN_FLUSH)
@@ -1461,6 +1801,7 @@ void SV_SendClientMessages (void)
 		}
 	}
 
+	SV_NetStats_EndFrame ();
 
 // clear muzzle flashes
 	SV_CleanupEnts ();
@@ -26,27 +26,29 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	DYNAMIC_SIZE	(4 * 1024 * 1024) // ericw -- was 512KB (64-bit) / 384KB (32-bit)
 
 #define	ZONEID	0x1d4a11
+#define	SLABID	0x51ab1d
+#define	SLABFREEID	0x51abf3
 #define MINFRAGMENT	64
 
+#define	ZTAG_SLAB	2	// a block carved up by the slab allocator
+
 typedef struct memblock_s
 {
+	struct	memblock_s	*next, *prev;
 	int	size;		// including the header and possibly tiny fragments
 	int	tag;		// a tag of 0 is a free block
-	int	id;		// should be ZONEID
 	int	pad;		// pad to 64 bit boundary
-	struct	memblock_s	*next, *prev;
+	int	id;		// should be ZONEID, kept right before the data
 } memblock_t;
 
 typedef struct
 {
 	int		size;		// total bytes malloced, including header
+	int		used;		// bytes in allocated blocks, headers and slabs included
 	memblock_t	blocklist;	// start / end cap for linked list
 	memblock_t	*rover;
 } memzone_t;
 
-void Cache_FreeLow (int new_low_hunk);
-
-
 /*
 ==============================================================================
 
@@ -59,11 +61,204 @@ The rover can be left pointing at a non-empty block
 
 The zone calls are pretty much only used for small strings and structures,
 all big things are allocated on the hunk.
+
+Small requests don't walk the block list: they are served from slabs, zone
+blocks of ZSLAB_SIZE bytes cut into objects of a single size class. Each
+class keeps the slabs that still have free objects on a list, so both
+allocating and freeing are constant time. Only requests larger than the
+biggest class, and the slabs themselves, go through the rover.
 ==============================================================================
 */
 
 static memzone_t	*mainzone;
 
+#define	ZSLAB_SIZE		(16 * 1024)
+#define	ZSLAB_CLASSES	12
+#define	ZSLAB_MAXOBJ	1024	// biggest class, header included
+
+typedef struct
+{
+	int	ofs;		// from the start of its slab
+	int	id;		// SLABID, or SLABFREEID on the free list; right before the data
+} slabobj_t;
+
+// free objects keep the next free one where their data would be
+#define SLABOBJ_NEXT(obj)	(*(slabobj_t **) ((obj) + 1))
+
+typedef struct zslab_s
+{
+	struct zslab_s	*next, *prev;	// among its class's slabs with free objects
+	slabobj_t	*free;
+	int		sizeclass;
+	int		used;		// objects handed out
+	int		count;		// objects in the slab
+} zslab_t;
+
+#define ZSLAB_FIRSTOBJ	((int) ((sizeof (zslab_t) + 7) & ~7))
+
+typedef struct
+{
+	zslab_t	partial;	// start / end cap for the slabs with free objects
+	int		objsize;	// including the object header
+	int		slabs;
+	int		used;		// objects handed out
+	int		peak;
+} zslabclass_t;
+
+static const int	zslab_sizes[ZSLAB_CLASSES] =
+{
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, ZSLAB_MAXOBJ
+};
+
+static zslabclass_t	zslab_classes[ZSLAB_CLASSES];
+static byte			zslab_classfor[ZSLAB_MAXOBJ / 8 + 1];	// by size in 8 byte units
+
+static void *Z_TagMalloc (int size, int tag);
+
+
+/*
+========================
+Z_SlabInit
+========================
+*/
+static void Z_SlabInit (void)
+{
+	int		i, c;
+	zslabclass_t	*cls;
+
+	for (i = 0, cls = zslab_classes; i < ZSLAB_CLASSES; i++, cls++)
+	{
+		memset (cls, 0, sizeof (*cls));
+		cls->partial.next = cls->partial.prev = &cls->partial;
+		cls->objsize = zslab_sizes[i];
+	}
+
+	for (i = 0, c = 0; i <= ZSLAB_MAXOBJ / 8; i++)
+	{
+		while (zslab_sizes[c] < i * 8)
+			c++;
+		zslab_classfor[i] = c;
+	}
+}
+
+/*
+========================
+Z_NewSlab
+
+Carves a fresh slab out of the zone and puts it on its class's list
+========================
+*/
+static zslab_t *Z_NewSlab (zslabclass_t *cls)
+{
+	zslab_t		*slab;
+	slabobj_t	*obj, **link;
+	int			i, ofs;
+
+	slab = (zslab_t *) Z_TagMalloc (ZSLAB_SIZE, ZTAG_SLAB);
+	if (!slab)
+		return NULL;
+
+	slab->sizeclass = cls - zslab_classes;
+	slab->used = 0;
+	slab->count = (ZSLAB_SIZE - ZSLAB_FIRSTOBJ) / cls->objsize;
+
+	link = &slab->free;
+	for (i = 0, ofs = ZSLAB_FIRSTOBJ; i < slab->count; i++, ofs += cls->objsize)
+	{
+		obj = (slabobj_t *) ((byte *) slab + ofs);
+		obj->ofs = ofs;
+		obj->id = SLABFREEID;
+		*link = obj;
+		link = &SLABOBJ_NEXT (obj);
+	}
+	*link = NULL;
+
+	slab->next = cls->partial.next;
+	slab->prev = &cls->partial;
+	slab->next->prev = slab;
+	cls->partial.next = slab;
+	cls->slabs++;
+
+	return slab;
+}
+
+/*
+========================
+Z_SlabMalloc
+========================
+*/
+static void *Z_SlabMalloc (int size)
+{
+	zslabclass_t	*cls;
+	zslab_t		*slab;
+	slabobj_t	*obj;
+
+	size += sizeof (slabobj_t);
+	cls = &zslab_classes[zslab_classfor[(size + 7) >> 3]];
+
+	slab = cls->partial.next;
+	if (slab == &cls->partial)
+	{
+		slab = Z_NewSlab (cls);
+		if (!slab)
+			return NULL;
+	}
+
+	obj = slab->free;
+	slab->free = SLABOBJ_NEXT (obj);
+	obj->id = SLABID;
+	memset (obj + 1, 0, cls->objsize - sizeof (slabobj_t));	// a realloc may grow into the rest
+	slab->used++;
+
+	if (!slab->free)
+	{	// full, take it off the list
+		slab->prev->next = slab->next;
+		slab->next->prev = slab->prev;
+		slab->next = slab->prev = slab;
+	}
+
+	cls->used++;
+	cls->peak = q_max (cls->peak, cls->used);
+
+	return (void *) (obj + 1);
+}
+
+/*
+========================
+Z_SlabFree
+========================
+*/
+static void Z_SlabFree (slabobj_t *obj)
+{
+	zslab_t		*slab;
+	zslabclass_t	*cls;
+
+	slab = (zslab_t *) ((byte *) obj - obj->ofs);
+	cls = &zslab_classes[slab->sizeclass];
+
+	obj->id = SLABFREEID;
+	SLABOBJ_NEXT (obj) = slab->free;
+	if (!slab->free)
+	{	// was full, make it available again
+		slab->next = cls->partial.next;
+		slab->prev = &cls->partial;
+		slab->next->prev = slab;
+		cls->partial.next = slab;
+	}
+	slab->free = obj;
+	slab->used--;
+	cls->used--;
+
+// give empty slabs back to the zone, but keep one around so a class that
+// keeps allocating and freeing a single object doesn't churn
+	if (!slab->used && (cls->partial.next != slab || slab->next != &cls->partial))
+	{
+		slab->prev->next = slab->next;
+		slab->next->prev = slab->prev;
+		cls->slabs--;
+		Z_Free (slab);
+	}
+}
 
 /*
 ========================
@@ -73,10 +268,20 @@ Z_Free
 void Z_Free (void *ptr)
 {
 	memblock_t	*block, *other;
+	slabobj_t	*obj;
 
 	if (!ptr)
 		Sys_Error ("Z_Free: NULL pointer");
 
+	obj = (slabobj_t *) ptr - 1;
+	if (obj->id == SLABID)
+	{
+		Z_SlabFree (obj);
+		return;
+	}
+	if (obj->id == SLABFREEID)
+		Sys_Error ("Z_Free: freed a freed pointer");
+
 	block = (memblock_t *) ( (byte *)ptr - sizeof(memblock_t));
 	if (block->id != ZONEID)
 		Sys_Error ("Z_Free: freed a pointer without ZONEID");
@@ -84,6 +289,7 @@ void Z_Free (void *ptr)
 		Sys_Error ("Z_Free: freed a freed pointer");
 
 	block->tag = 0;		// mark as free
+	mainzone->used -= block->size;
 
 	other = block->prev;
 	if (!other->tag)
@@ -155,6 +361,7 @@ static void *Z_TagMalloc (int size, int tag)
 	}
 
 	base->tag = tag;				// no longer a free block
+	mainzone->used += base->size;
 
 	mainzone->rover = base->next;	// next allocation will start looking here
 
@@ -166,6 +373,30 @@ static void *Z_TagMalloc (int size, int tag)
 	return (void *) ((byte *)base + sizeof(memblock_t));
 }
 
+#ifndef NDEBUG
+/*
+========================
+Z_CheckSlab
+========================
+*/
+static void Z_CheckSlab (zslab_t *slab)
+{
+	slabobj_t	*obj;
+	int			numfree;
+
+	if (slab->sizeclass < 0 || slab->sizeclass >= ZSLAB_CLASSES)
+		Sys_Error ("Z_CheckHeap: slab with a bad size class");
+	for (obj = slab->free, numfree = 0; obj; obj = SLABOBJ_NEXT (obj), numfree++)
+	{
+		if (obj->id != SLABFREEID || (byte *) obj - obj->ofs != (byte *) slab)
+			Sys_Error ("Z_CheckHeap: trashed object on a slab free list");
+		if (numfree >= slab->count)
+			Sys_Error ("Z_CheckHeap: slab free list is circular");
+	}
+	if (numfree + slab->used != slab->count)
+		Sys_Error ("Z_CheckHeap: slab object count mismatch");
+}
+
 /*
 ========================
 Z_CheckHeap
@@ -177,6 +408,10 @@ static void Z_CheckHeap (void)
 
 	for (block = mainzone->blocklist.next ; ; block = block->next)
 	{
+		if (block->tag == ZTAG_SLAB)
+			Z_CheckSlab ((zslab_t *) (block + 1));
+		if (block->tag && *(int *)((byte *)block + block->size - 4) != ZONEID)
+			Sys_Error ("Z_CheckHeap: block trashed past its end");
 		if (block->next == &mainzone->blocklist)
 			break;			// all blocks have been hit
 		if ( (byte *)block + block->size != (byte *)block->next)
@@ -187,6 +422,7 @@ static void Z_CheckHeap (void)
 			Sys_Error ("Z_CheckHeap: two consecutive free blocks");
 	}
 }
+#endif
 
 
 /*
@@ -198,11 +434,15 @@ void *Z_Malloc (int size)
 {
 	void	*buf;
 
-	Z_CheckHeap ();	// DEBUG
-	buf = Z_TagMalloc (size, 1);
+#ifndef NDEBUG
+	Z_CheckHeap ();
+#endif
+	if (size + (int) sizeof (slabobj_t) <= ZSLAB_MAXOBJ)
+		buf = Z_SlabMalloc (size);	// comes zeroed
+	else if ((buf = Z_TagMalloc (size, 1)) != NULL)
+		Q_memset (buf, 0, size);
 	if (!buf)
 		Sys_Error ("Z_Malloc: failed on allocation of %i bytes",size);
-	Q_memset (buf, 0, size);
 
 	return buf;
 }
@@ -217,10 +457,49 @@ void *Z_Realloc(void *ptr, int size)
 	int old_size;
 	void *old_ptr;
 	memblock_t *block;
+	slabobj_t *obj;
+	zslab_t *slab;
 
 	if (!ptr)
 		return Z_Malloc (size);
 
+	obj = (slabobj_t *) ptr - 1;
+	if (obj->id == SLABID || size + (int) sizeof (slabobj_t) <= ZSLAB_MAXOBJ)
+	{
+		if (obj->id == SLABID)
+		{
+			slab = (zslab_t *) ((byte *) obj - obj->ofs);
+			old_size = zslab_sizes[slab->sizeclass] - sizeof (slabobj_t);
+
+		// still the right class, just keep the unused tail zeroed
+			if (size + (int) sizeof (slabobj_t) <= ZSLAB_MAXOBJ &&
+				zslab_classfor[(size + sizeof (slabobj_t) + 7) >> 3] == slab->sizeclass)
+			{
+				memset ((byte *)ptr + size, 0, old_size - size);
+				return ptr;
+			}
+		}
+		else if (obj->id == SLABFREEID)
+			Sys_Error ("Z_Realloc: realloced a freed pointer");
+		else
+		{
+			block = (memblock_t *) ((byte *) ptr - sizeof (memblock_t));
+			if (block->id != ZONEID)
+				Sys_Error ("Z_Realloc: realloced a pointer without ZONEID");
+			if (block->tag == 0)
+				Sys_Error ("Z_Realloc: realloced a freed pointer");
+			old_size = block->size - (4 + (int)sizeof(memblock_t));
+		}
+
+	// moving between a slab and the zone, both copies are needed at once
+		old_ptr = ptr;
+		ptr = Z_Malloc (size);
+		memcpy (ptr, old_ptr, q_min(old_size, size));
+		Z_Free (old_ptr);
+
+		return ptr;
+	}
+
 	block = (memblock_t *) ((byte *) ptr - sizeof (memblock_t));
 	if (block->id != ZONEID)
 		Sys_Error ("Z_Realloc: realloced a pointer without ZONEID");
@@ -261,13 +540,23 @@ Z_Print
 void Z_Print (memzone_t *zone)
 {
 	memblock_t	*block;
+	zslab_t		*slab;
+	zslabclass_t	*cls;
+	int			i;
 
-	Con_Printf ("zone size: %i  location: %p\n",mainzone->size,mainzone);
+	Con_Printf ("zone size: %i  used: %i  location: %p\n",mainzone->size,mainzone->used,mainzone);
 
 	for (block = zone->blocklist.next ; ; block = block->next)
 	{
-		Con_Printf ("block:%p    size:%7i    tag:%3i\n",
-			block, block->size, block->tag);
+		if (block->tag == ZTAG_SLAB)
+		{
+			slab = (zslab_t *) (block + 1);
+			Con_Printf ("block:%p    size:%7i    slab:%4i x %3i/%3i\n",
+				block, block->size, zslab_sizes[slab->sizeclass], slab->used, slab->count);
+		}
+		else
+			Con_Printf ("block:%p    size:%7i    tag:%3i\n",
+				block, block->size, block->tag);
 
 		if (block->next == &zone->blocklist)
 			break;			// all blocks have been hit
@@ -278,6 +567,24 @@ void Z_Print (memzone_t *zone)
 		if (!block->tag && !block->next->tag)
 			Con_Printf ("ERROR: two consecutive free blocks\n");
 	}
+
+	for (i = 0, cls = zslab_classes; i < ZSLAB_CLASSES; i++, cls++)
+	{
+		if (!cls->slabs && !cls->peak)
+			continue;
+		Con_Printf ("class %4i: %3i slabs  %5i used  %5i peak\n",
+			cls->objsize, cls->slabs, cls->used, cls->peak);
+	}
+}
+
+/*
+========================
+Z_Print_f
+========================
+*/
+static void Z_Print_f (void)
+{
+	Z_Print (mainzone);
 }
 
 
@@ -503,30 +810,6 @@ static int Hunk_SegForOfs (int ofs)
 	return -1;
 }
 
-/*
-===================
-Hunk_SegForPtr
-===================
-*/
-static int Hunk_SegForPtr (const void *ptr)
-{
-	int i;
-
-	for (i = hunk_numsegments - 1; i >= 0; i--)
-	{
-		const hunkseg_t *seg = hunk_segments[i];
-		const byte *begin = SEG_MEM (seg);
-		const byte *end = begin + seg->size;
-		if (PTR_IN_RANGE (ptr, begin, end))
-			return i;
-	}
-
-	Sys_Error ("Hunk_SegForPtr: bad pointer");
-
-	return -1;
-}
-
-
 /*
 ===================
 Hunk_AllocInternal
@@ -567,8 +850,6 @@ static void *Hunk_AllocInternal (int size, const char *name, hunkflags_t flags)
 		if (hunk_numsegments == MAX_SEGMENTS)
 			Sys_Error ("Hunk_Alloc: segment overflow");
 
-		Cache_Flush ();
-
 		newbase = LASTSEG->base + LASTSEG->size;
 		newsize = LASTSEG->size * 2;
 		newsize = q_max (newsize, size);
@@ -595,8 +876,6 @@ static void *Hunk_AllocInternal (int size, const char *name, hunkflags_t flags)
 	hunk_low_used += size;
 	seg->used = hunk_low_used - seg->base;
 
-	Cache_FreeLow (hunk_low_used);
-
 	if (flags & HF_CLEAR)
 		memset (h, 0, size);
 
@@ -678,183 +957,372 @@ char *Hunk_Strdup (const char *s, const char *name)
 /*
 ===============================================================================
 
-CACHE MEMORY
+ARENA MEMORY
+
+Bump allocators for scratch memory that is thrown away all at once. Each
+arena grows by chaining blocks; a reset folds them back into a single block
+big enough for what was used, so an arena in steady use stops calling
+malloc altogether.
+
+The frame arena belongs to the main thread and is reset at the end of every
+host frame. Other threads create arenas of their own.
 
 ===============================================================================
 */
 
-#define CACHENAME_LEN	32
-typedef struct cache_system_s
+#define ARENA_BLOCKSIZE		(64 * 1024)
+#define ARENA_MAXKEEP		(4 * 1024 * 1024)	// biggest block kept across resets
+
+typedef struct arenablock_s
 {
-	int			size;		// including this header
-	cache_user_t		*user;
-	char			name[CACHENAME_LEN];
-	struct cache_system_s	*prev, *next;
-	struct cache_system_s	*lru_prev, *lru_next;	// for LRU flushing
-} cache_system_t;
+	struct arenablock_s	*next;
+	size_t			size;		// usable bytes after this header
+	size_t			used;
+	size_t			pad;		// keeps the data 16 byte aligned
+} arenablock_t;
 
-cache_system_t *Cache_TryAlloc (int size, qboolean nobottom);
+static memarena_t	frame_arena;
+static SDL_threadID	frame_thread;
 
-cache_system_t	cache_head;
+/*
+============
+Arena_NewBlock
+============
+*/
+static arenablock_t *Arena_NewBlock (memarena_t *arena, size_t size)
+{
+	arenablock_t	*block;
+
+	block = (arenablock_t *) malloc (sizeof (arenablock_t) + size);
+	if (!block)
+		Sys_Error ("Arena_Alloc: failed on %" SDL_PRIu64 " bytes", (uint64_t) size);
+	block->size = size;
+	block->used = 0;
+	block->next = arena->blocks;
+	arena->blocks = block;
+
+	return block;
+}
 
 /*
-===========
-Cache_Move
-===========
+============
+Arena_Alloc
+
+Returns uninitialized, 16 byte aligned memory
+============
 */
-void Cache_Move ( cache_system_t *c)
+void *Arena_Alloc (memarena_t *arena, size_t size)
 {
-	cache_system_t		*new_cs;
+	arenablock_t	*block;
+	void			*ptr;
 
-// we are clearing up space at the bottom, so only allocate it late
-	new_cs = Cache_TryAlloc (c->size, true);
-	if (new_cs)
-	{
-//		Con_Printf ("cache_move ok\n");
+	size = (size + 15) & ~(size_t)15;
+	block = arena->blocks;
+	if (!block || block->size - block->used < size)
+		block = Arena_NewBlock (arena, q_max (size, (size_t) ARENA_BLOCKSIZE));
 
-		Q_memcpy ( new_cs+1, c+1, c->size - sizeof(cache_system_t) );
-		new_cs->user = c->user;
-		Q_memcpy (new_cs->name, c->name, sizeof(new_cs->name));
-		Cache_Free (c->user, false); //johnfitz -- added second argument
-		new_cs->user->data = (void *)(new_cs+1);
-	}
-	else
-	{
-//		Con_Printf ("cache_move failed\n");
+	ptr = (byte *) (block + 1) + block->used;
+	block->used += size;
+	arena->used += size;
+	arena->peak = q_max (arena->peak, arena->used);
 
-		Cache_Free (c->user, true); // tough luck... //johnfitz -- added second argument
-	}
+	return ptr;
 }
 
 /*
 ============
-Cache_FreeLow
+Arena_Shrink
 
-Throw things out until the hunk can be expanded to the given point
+Gives back the end of the most recent allocation
 ============
 */
-void Cache_FreeLow (int new_low_hunk)
+void Arena_Shrink (memarena_t *arena, void *ptr, size_t size)
 {
-	cache_system_t	*c;
-	hunkseg_t		*seg;
-	int				ofs;
+	arenablock_t	*block = arena->blocks;
+	size_t			ofs, end;
 
-	// can only allocate space in the last segment
-	new_low_hunk = q_max (new_low_hunk, LASTSEG->base);
+	if (!block)
+		return;
+	ofs = (byte *) ptr - (byte *) (block + 1);
+	if (ofs >= block->used)
+		return;		// not in the current block
 
-	while (1)
+	end = ofs + ((size + 15) & ~(size_t)15);
+	if (end < block->used)
 	{
-		c = cache_head.next;
-		if (c == &cache_head)
-			return;		// nothing in cache at all
-		seg = hunk_segments[Hunk_SegForPtr (c)];
-		ofs = (byte *) (c) - SEG_MEM (seg);
-		if (ofs + seg->base >= new_low_hunk)
-			return;		// there is space to grow the hunk
-		Cache_Move ( c );	// reclaim the space
+		arena->used -= block->used - end;
+		block->used = end;
 	}
 }
 
-void Cache_UnlinkLRU (cache_system_t *cs)
+/*
+============
+Arena_Strdup
+============
+*/
+char *Arena_Strdup (memarena_t *arena, const char *s)
 {
-	if (!cs->lru_next || !cs->lru_prev)
-		Sys_Error ("Cache_UnlinkLRU: NULL link");
+	size_t sz = strlen(s) + 1;
+	char *ptr = (char *) Arena_Alloc (arena, sz);
+	memcpy (ptr, s, sz);
+	return ptr;
+}
 
-	cs->lru_next->lru_prev = cs->lru_prev;
-	cs->lru_prev->lru_next = cs->lru_next;
+/*
+============
+Arena_Reset
 
-	cs->lru_prev = cs->lru_next = NULL;
+Frees everything allocated from the arena
+============
+*/
+void Arena_Reset (memarena_t *arena)
+{
+	arenablock_t	*block, *next;
+	size_t			total;
+
+	block = arena->blocks;
+	if (block && block->next)
+	{
+	// grew past one block: replace them all by one that would have sufficed
+		for (total = 0; block; block = next)
+		{
+			next = block->next;
+			total += block->size;
+			free (block);
+		}
+		arena->blocks = NULL;
+		Arena_NewBlock (arena, q_min (total, (size_t) ARENA_MAXKEEP));
+	}
+	else if (block && block->size > ARENA_MAXKEEP)
+	{
+		free (block);
+		arena->blocks = NULL;
+	}
+	else if (block)
+		block->used = 0;
+
+	arena->used = 0;
 }
 
-void Cache_MakeLRU (cache_system_t *cs)
+/*
+============
+Arena_Free
+============
+*/
+void Arena_Free (memarena_t *arena)
 {
-	if (cs->lru_next || cs->lru_prev)
-		Sys_Error ("Cache_MakeLRU: active link");
+	arenablock_t	*block, *next;
 
-	cache_head.lru_next->lru_prev = cs;
-	cs->lru_next = cache_head.lru_next;
-	cs->lru_prev = &cache_head;
-	cache_head.lru_next = cs;
+	for (block = arena->blocks; block; block = next)
+	{
+		next = block->next;
+		free (block);
+	}
+	arena->blocks = NULL;
+	arena->used = 0;
 }
 
 /*
 ============
-Cache_TryAlloc
+Frame_Alloc
 
-Looks for a free block of memory between the high and low hunk marks
-Size should already include the header and padding
+Scratch memory that stays valid until the end of the current host frame.
+Main thread only.
 ============
 */
-cache_system_t *Cache_TryAlloc (int size, qboolean nobottom)
+void *Frame_Alloc (size_t size)
 {
-	cache_system_t	*cs, *new_cs;
-	int ofs = q_max (hunk_low_used, LASTSEG->base);
+	if (!Frame_Available ())
+		Sys_Error ("Frame_Alloc: called from another thread");
+	return Arena_Alloc (&frame_arena, size);
+}
 
-// is the cache completely empty?
-	if (!nobottom && cache_head.prev == &cache_head)
-	{
-		if ((ofs - LASTSEG->base) + size > LASTSEG->size)
-			Sys_Error ("Cache_TryAlloc: %i is greater then free hunk", size);
+void Frame_Shrink (void *ptr, size_t size)
+{
+	Arena_Shrink (&frame_arena, ptr, size);
+}
 
-		new_cs = (cache_system_t *) (SEG_MEM (LASTSEG) + ofs - LASTSEG->base);
-		memset (new_cs, 0, sizeof(*new_cs));
-		new_cs->size = size;
+char *Frame_Strdup (const char *s)
+{
+	if (!Frame_Available ())
+		Sys_Error ("Frame_Strdup: called from another thread");
+	return Arena_Strdup (&frame_arena, s);
+}
 
-		cache_head.prev = cache_head.next = new_cs;
-		new_cs->prev = new_cs->next = &cache_head;
+/*
+============
+Frame_Available
 
-		Cache_MakeLRU (new_cs);
-		return new_cs;
-	}
+True on the thread that owns the frame arena
+============
+*/
+qboolean Frame_Available (void)
+{
+	return frame_thread == SDL_ThreadID ();
+}
 
-// search from the bottom up for space
+/*
+============
+Frame_Reset
 
-	new_cs = (cache_system_t *) (SEG_MEM (LASTSEG) + ofs - LASTSEG->base);
-	cs = cache_head.next;
+Called at the end of every host frame
+============
+*/
+void Frame_Reset (void)
+{
+	MemStats_Set (MEM_FRAME, frame_arena.used);
+	Arena_Reset (&frame_arena);
+}
 
-	do
-	{
-		if (!nobottom || cs != cache_head.next)
-		{
-			if ( (byte *)cs - (byte *)new_cs >= size)
-			{	// found space
-				memset (new_cs, 0, sizeof(*new_cs));
-				new_cs->size = size;
+/*
+===============================================================================
 
-				new_cs->next = cs;
-				new_cs->prev = cs->prev;
-				cs->prev->next = new_cs;
-				cs->prev = new_cs;
+CACHE MEMORY
 
-				Cache_MakeLRU (new_cs);
+Cached assets live in their own allocations outside the hunk, so growing the
+hunk never throws them out. Each asset class has a memory budget; once a
+class goes over it, its least recently used entries are evicted. Entries
+used during the current frame are never evicted, since callers may still
+hold pointers into them; the class then temporarily stays over budget.
 
-				return new_cs;
-			}
-		}
+===============================================================================
+*/
 
-	// continue looking
-		new_cs = (cache_system_t *)((byte *)cs + cs->size);
-		cs = cs->next;
+#define CACHENAME_LEN	32
+typedef struct cache_system_s
+{
+	size_t			size;		// including this header
+	cache_user_t		*user;
+	char			name[CACHENAME_LEN];
+	cacheclass_t		cacheclass;
+	int			lastframe;	// host_framecount when last used
+	struct cache_system_s	*lru_prev, *lru_next;	// for LRU flushing
+} cache_system_t;
 
-	} while (cs != &cache_head);
+// keeps the data 16 byte aligned, like hunk memory
+#define CACHE_HEADER_SIZE	((sizeof (cache_system_t) + 15) & ~15)
+#define CACHE_DATA(cs)		((void *) ((byte *) (cs) + CACHE_HEADER_SIZE))
+#define CACHE_SYSTEM(data)	((cache_system_t *) ((byte *) (data) - CACHE_HEADER_SIZE))
 
-// try to allocate one at the very end
-	if ((byte *)new_cs - SEG_MEM (LASTSEG) + size <= LASTSEG->size)
-	{
-		memset (new_cs, 0, sizeof(*new_cs));
-		new_cs->size = size;
+typedef struct
+{
+	const char		*name;
+	cvar_t			*budget;	// in MB, 0 means unlimited
+	cache_system_t	lru;		// head is the most recently used
+	size_t			used;
+	size_t			peak;
+	int				entries;
+	int				hits;
+	int				misses;
+	int				evictions;
+} cachepool_t;
+
+static cvar_t	cache_budget_alias = {"cache_budget_alias", "128", CVAR_ARCHIVE};
+static cvar_t	cache_budget_md5 = {"cache_budget_md5", "128", CVAR_ARCHIVE};
+
+static cachepool_t	cache_pools[NUM_CACHE_CLASSES] =
+{
+	{ "alias",	&cache_budget_alias },
+	{ "md5",	&cache_budget_md5 },
+};
 
-		new_cs->next = &cache_head;
-		new_cs->prev = cache_head.prev;
-		cache_head.prev->next = new_cs;
-		cache_head.prev = new_cs;
+static SDL_mutex	*cache_mutex;
 
-		Cache_MakeLRU (new_cs);
+/*
+============
+Cache_Lock
+============
+*/
+void Cache_Lock (void)
+{
+	if (cache_mutex)
+		SDL_LockMutex (cache_mutex);
+}
+
+/*
+============
+Cache_Unlock
+============
+*/
+void Cache_Unlock (void)
+{
+	if (cache_mutex)
+		SDL_UnlockMutex (cache_mutex);
+}
 
-		return new_cs;
+static void Cache_UnlinkLRU (cache_system_t *cs)
+{
+	if (!cs->lru_next || !cs->lru_prev)
+		Sys_Error ("Cache_UnlinkLRU: NULL link");
+
+	cs->lru_next->lru_prev = cs->lru_prev;
+	cs->lru_prev->lru_next = cs->lru_next;
+
+	cs->lru_prev = cs->lru_next = NULL;
+}
+
+static void Cache_MakeLRU (cache_system_t *cs)
+{
+	cache_system_t	*head = &cache_pools[cs->cacheclass].lru;
+
+	if (cs->lru_next || cs->lru_prev)
+		Sys_Error ("Cache_MakeLRU: active link");
+
+	head->lru_next->lru_prev = cs;
+	cs->lru_next = head->lru_next;
+	cs->lru_prev = head;
+	head->lru_next = cs;
+}
+
+/*
+============
+Cache_Budget
+============
+*/
+static size_t Cache_Budget (cachepool_t *pool)
+{
+	if (pool->budget->value <= 0.f)
+		return (size_t) -1;
+	return (size_t) (pool->budget->value * 1024.f * 1024.f);
+}
+
+/*
+============
+Cache_Evict
+
+Throws out the least recently used entries of a class until 'extra' more
+bytes fit into its budget, or only entries still in use this frame are left
+============
+*/
+static void Cache_Evict (cachepool_t *pool, size_t extra)
+{
+	cache_system_t	*cs;
+	size_t			budget = Cache_Budget (pool);
+
+	Cache_Lock ();
+	while (pool->used + extra > budget)
+	{
+		cs = pool->lru.lru_prev;
+		if (cs == &pool->lru || cs->lastframe == host_framecount)
+			break;
+		pool->evictions++;
+		Cache_Free (cs->user, true);
 	}
+	Cache_Unlock ();
+}
 
-	return NULL;		// couldn't allocate
+/*
+============
+Cache_Callback_Budget
+============
+*/
+static void Cache_Callback_Budget (cvar_t *var)
+{
+	int	i;
+
+	for (i = 0; i < NUM_CACHE_CLASSES; i++)
+		if (cache_pools[i].budget == var)
+			Cache_Evict (&cache_pools[i], 0);
 }
 
 /*
@@ -866,8 +1334,13 @@ Throw everything out, so new data will be demand cached
 */
 void Cache_Flush (void)
 {
-	while (cache_head.next != &cache_head)
-		Cache_Free ( cache_head.next->user, true); // reclaim the space //johnfitz -- added second argument
+	int	i;
+
+	Cache_Lock ();
+	for (i = 0; i < NUM_CACHE_CLASSES; i++)
+		while (cache_pools[i].lru.lru_next != &cache_pools[i].lru)
+			Cache_Free (cache_pools[i].lru.lru_next->user, true); // reclaim the space //johnfitz -- added second argument
+	Cache_Unlock ();
 }
 
 /*
@@ -876,14 +1349,31 @@ Cache_Print
 
 ============
 */
-void Cache_Print (void)
+static void Cache_Print (void)
 {
 	cache_system_t	*cd;
+	cachepool_t		*pool;
+	int				i;
+
+	Cache_Lock ();
+	for (i = 0, pool = cache_pools; i < NUM_CACHE_CLASSES; i++, pool++)
+	{
+		for (cd = pool->lru.lru_next ; cd != &pool->lru ; cd = cd->lru_next)
+			Con_SafePrintf ("%8i : %s\n", (int) cd->size, cd->name);
+	}
 
-	for (cd = cache_head.next ; cd != &cache_head ; cd = cd->next)
+	Con_SafePrintf ("class    entries      used      peak    budget     hits   misses  evicted\n");
+	for (i = 0, pool = cache_pools; i < NUM_CACHE_CLASSES; i++, pool++)
 	{
-		Con_Printf ("%8i : %s\n", cd->size, cd->name);
+		Con_SafePrintf ("%-8s %7i %8.1fM %8.1fM ", pool->name, pool->entries,
+			pool->used / (1024.0 * 1024.0), pool->peak / (1024.0 * 1024.0));
+		if (pool->budget->value > 0.f)
+			Con_SafePrintf ("%8.1fM ", pool->budget->value);
+		else
+			Con_SafePrintf ("%9s ", "none");
+		Con_SafePrintf ("%8i %8i %8i\n", pool->hits, pool->misses, pool->evictions);
 	}
+	Cache_Unlock ();
 }
 
 /*
@@ -894,7 +1384,12 @@ Cache_Report
 */
 void Cache_Report (void)
 {
-	Con_DPrintf ("%4.1f megabyte data cache\n", (Hunk_Size () - hunk_low_used) / (float)(1024*1024) );
+	size_t	total;
+	int		i;
+
+	for (i = 0, total = 0; i < NUM_CACHE_CLASSES; i++)
+		total += cache_pools[i].used;
+	Con_DPrintf ("%4.1f megabyte data cache\n", total / (float)(1024*1024) );
 }
 
 /*
@@ -905,10 +1400,21 @@ Cache_Init
 */
 void Cache_Init (void)
 {
-	cache_head.next = cache_head.prev = &cache_head;
-	cache_head.lru_next = cache_head.lru_prev = &cache_head;
+	int	i;
+
+	for (i = 0; i < NUM_CACHE_CLASSES; i++)
+	{
+		cache_pools[i].lru.lru_next = cache_pools[i].lru.lru_prev = &cache_pools[i].lru;
+		Cvar_RegisterVariable (cache_pools[i].budget);
+		Cvar_SetCallback (cache_pools[i].budget, Cache_Callback_Budget);
+	}
+
+	cache_mutex = SDL_CreateMutex ();
+	if (!cache_mutex)
+		Sys_Error ("Cache_Init: could not create mutex");
 
 	Cmd_AddCommand ("flush", Cache_Flush);
+	Cmd_AddCommand ("cache_print", Cache_Print);
 }
 
 /*
@@ -921,19 +1427,24 @@ Frees the memory and removes it from the LRU list
 void Cache_Free (cache_user_t *c, qboolean freetextures) //johnfitz -- added second argument
 {
 	cache_system_t	*cs;
+	cachepool_t		*pool;
 
 	if (!c->data)
 		Sys_Error ("Cache_Free: not allocated");
 
-	cs = ((cache_system_t *)c->data) - 1;
+	Cache_Lock ();
 
-	cs->prev->next = cs->next;
-	cs->next->prev = cs->prev;
-	cs->next = cs->prev = NULL;
+	cs = CACHE_SYSTEM (c->data);
+	pool = &cache_pools[cs->cacheclass];
+	pool->used -= cs->size;
+	pool->entries--;
 
 	c->data = NULL;
 
 	Cache_UnlinkLRU (cs);
+	free (cs);
+
+	Cache_Unlock ();
 
 	//johnfitz -- if a model becomes uncached, free the gltextures.  This only works
 	//becuase the cache_user_t is the last component of the qmodel_t struct.  Should
@@ -952,17 +1463,25 @@ Cache_Check
 void *Cache_Check (cache_user_t *c)
 {
 	cache_system_t	*cs;
+	void			*data;
 
-	if (!c->data)
-		return NULL;
+	Cache_Lock ();
 
-	cs = ((cache_system_t *)c->data) - 1;
+	data = c->data;
+	if (data)
+	{
+		cs = CACHE_SYSTEM (data);
+		cs->lastframe = host_framecount;
+		cache_pools[cs->cacheclass].hits++;
 
-// move to head of LRU
-	Cache_UnlinkLRU (cs);
-	Cache_MakeLRU (cs);
+	// move to head of LRU
+		Cache_UnlinkLRU (cs);
+		Cache_MakeLRU (cs);
+	}
 
-	return c->data;
+	Cache_Unlock ();
+
+	return data;
 }
 
 
@@ -971,9 +1490,11 @@ void *Cache_Check (cache_user_t *c)
 Cache_Alloc
 ==============
 */
-void *Cache_Alloc (cache_user_t *c, int size, const char *name)
+void *Cache_Alloc (cache_user_t *c, cacheclass_t cacheclass, int size, const char *name)
 {
 	cache_system_t	*cs;
+	cachepool_t		*pool;
+	size_t			total;
 
 	if (c->data)
 		Sys_Error ("Cache_Alloc: already allocated");
@@ -981,28 +1502,214 @@ void *Cache_Alloc (cache_user_t *c, int size, const char *name)
 	if (size <= 0)
 		Sys_Error ("Cache_Alloc: size %i", size);
 
-	size = (size + sizeof(cache_system_t) + 15) & ~15;
+	if ((unsigned) cacheclass >= NUM_CACHE_CLASSES)
+		Sys_Error ("Cache_Alloc: bad class %i", (int) cacheclass);
 
-// find memory for it
-	while (1)
-	{
-		cs = Cache_TryAlloc (size, false);
-		if (cs)
-		{
-			q_strlcpy (cs->name, name, CACHENAME_LEN);
-			c->data = (void *)(cs+1);
-			cs->user = c;
-			break;
-		}
+	pool = &cache_pools[cacheclass];
+	total = CACHE_HEADER_SIZE + ((size + 15) & ~15);
+
+	Cache_Lock ();
+
+// make room in the class's budget
+	Cache_Evict (pool, total);
+
+	cs = (cache_system_t *) malloc (total);
+	if (!cs)
+		Sys_Error ("Cache_Alloc: failed on %i bytes for %s", size, name);
+
+	memset (cs, 0, sizeof (*cs));
+	cs->size = total;
+	cs->cacheclass = cacheclass;
+	q_strlcpy (cs->name, name, CACHENAME_LEN);
+	cs->user = c;
+	cs->lastframe = host_framecount;
+	c->data = CACHE_DATA (cs);
+	Cache_MakeLRU (cs);
+
+	pool->used += total;
+	pool->peak = q_max (pool->peak, pool->used);
+	pool->entries++;
+	pool->misses++;
+
+	Cache_Unlock ();
+
+	return c->data;
+}
+
+/*
+===============================================================================
+
+MEMORY STATISTICS
+
+Current sizes and high water marks since the current map started. The
+allocators are sampled once a frame; subsystems report what they hold with
+MemStats_Set or MemStats_Add, either when it changes or once a frame when
+that is cheaper. With memstats_log set, the marks of every map are appended
+to memstats.csv in the game directory when the map ends, so that runs of
+different builds can be compared. Main thread only.
+
+===============================================================================
+*/
+
+typedef struct
+{
+	const char	*name;		// also the csv column
+	size_t		bytes;
+	size_t		peak;		// since the map started
+} memstat_t;
+
+static memstat_t	memstats[] =
+{
+	{ "hunk" },
+	{ "zone" },
+	{ "frame" },
+	{ "bsp" },
+	{ "lightmaps" },
+	{ "alias" },
+	{ "textures" },
+	{ "gpubuffers" },
+	{ "sounds" },
+	{ "edicts" },
+	{ "qcstrings" },
+	{ "network" },
+};
+COMPILE_TIME_ASSERT (memstats, countof (memstats) == NUM_MEMCATS);
+
+static double	memstats_mapstart;
+static cvar_t	memstats_log = {"memstats_log", "0", CVAR_ARCHIVE};
+
+void MemStats_Set (memcat_t cat, size_t bytes)
+{
+	memstats[cat].bytes = bytes;
+	if (memstats[cat].peak < bytes)
+		memstats[cat].peak = bytes;
+}
+
+void MemStats_Add (memcat_t cat, ptrdiff_t bytes)
+{
+	if (bytes < 0 && (size_t) -bytes > memstats[cat].bytes)
+		MemStats_Set (cat, 0);
+	else
+		MemStats_Set (cat, memstats[cat].bytes + bytes);
+}
+
+size_t MemStats_Get (memcat_t cat)
+{
+	return memstats[cat].bytes;
+}
+
+size_t MemStats_Peak (memcat_t cat)
+{
+	return memstats[cat].peak;
+}
+
+const char *MemStats_Name (memcat_t cat)
+{
+	return memstats[cat].name;
+}
 
-	// free the least recently used cahedat
-		if (cache_head.lru_prev == &cache_head)
-			Sys_Error ("Cache_Alloc: out of memory"); // not enough memory at all
+/*
+============
+MemStats_Update
 
-		Cache_Free (cache_head.lru_prev->user, true); //johnfitz -- added second argument
+Samples the allocators, and raises the marks of categories that have not
+changed since they were reset
+============
+*/
+void MemStats_Update (void)
+{
+	size_t	cached;
+	int		i;
+
+	MemStats_Set (MEM_HUNK, hunk_low_used);
+	MemStats_Set (MEM_ZONE, mainzone->used);
+
+	Cache_Lock ();
+	for (i = 0, cached = 0; i < NUM_CACHE_CLASSES; i++)
+		cached += cache_pools[i].used;
+	Cache_Unlock ();
+	MemStats_Set (MEM_ALIAS, cached);
+
+	for (i = 0; i < NUM_MEMCATS; i++)
+		if (memstats[i].peak < memstats[i].bytes)
+			memstats[i].peak = memstats[i].bytes;
+}
+
+/*
+============
+MemStats_WriteLog
+============
+*/
+static void MemStats_WriteLog (const char *mapname)
+{
+	char	path[MAX_OSPATH];
+	FILE	*f;
+	int		i;
+
+	q_snprintf (path, sizeof (path), "%s/memstats.csv", com_gamedir);
+	f = Sys_fopen (path, "a");
+	if (!f)
+	{
+		Con_Printf ("Couldn't write %s\n", path);
+		return;
 	}
 
-	return Cache_Check (c);
+	fseek (f, 0, SEEK_END);
+	if (ftell (f) == 0)
+	{
+		fprintf (f, "version,map,seconds");
+		for (i = 0; i < NUM_MEMCATS; i++)
+			fprintf (f, ",%s", memstats[i].name);
+		fprintf (f, "\n");
+	}
+
+	fprintf (f, "%s,%s,%.0f", IRONWAIL_VER_STRING, mapname, realtime - memstats_mapstart);
+	for (i = 0; i < NUM_MEMCATS; i++)
+		fprintf (f, ",%" SDL_PRIu64, (uint64_t) memstats[i].peak);
+	fprintf (f, "\n");
+
+	fclose (f);
+}
+
+/*
+============
+MemStats_EndMap
+
+The memory of the old map is still held when this is called, so the new
+marks start from zero rather than from the current sizes
+============
+*/
+void MemStats_EndMap (const char *mapname)
+{
+	int i;
+
+	if (mapname && *mapname && memstats_log.value)
+		MemStats_WriteLog (mapname);
+
+	for (i = 0; i < NUM_MEMCATS; i++)
+		memstats[i].peak = 0;
+	memstats_mapstart = realtime;
+}
+
+/*
+============
+MemStats_Print_f
+============
+*/
+static void MemStats_Print_f (void)
+{
+	int i;
+
+	MemStats_Update ();
+
+	Con_SafePrintf ("category        current       peak\n");
+	for (i = 0; i < NUM_MEMCATS; i++)
+	{
+		if (i == MEM_BSP)
+			Con_SafePrintf ("----------\n");
+		Con_SafePrintf ("%-10s %10.1fM %10.1fM\n", memstats[i].name,
+			memstats[i].bytes / (1024.0 * 1024.0), memstats[i].peak / (1024.0 * 1024.0));
+	}
 }
 
 //============================================================================
@@ -1020,6 +1727,8 @@ static void Memory_InitZone (memzone_t *zone, int size)
 	zone->blocklist.id = 0;
 	zone->blocklist.size = 0;
 	zone->rover = block;
+	zone->size = size;
+	zone->used = 0;
 
 	block->prev = block->next = &zone->blocklist;
 	block->tag = 0;			// free block
@@ -1043,7 +1752,8 @@ void Memory_Init (void *buf, int size)
 	hunk_numsegments = 1;
 	hunk_low_used = 0;
 
-	Cache_Init ();
+	frame_thread = SDL_ThreadID ();
+
 	p = COM_CheckParm ("-zone");
 	if (p)
 	{
@@ -1054,7 +1764,13 @@ void Memory_Init (void *buf, int size)
 	}
 	mainzone = (memzone_t *) Hunk_AllocName (zonesize, "zone" );
 	Memory_InitZone (mainzone, zonesize);
+	Z_SlabInit ();
+	Cache_Init ();
 
 	Cmd_AddCommand ("hunk_print", Hunk_Print_f); //johnfitz
+	Cmd_AddCommand ("zone_print", Z_Print_f);
+
+	Cvar_RegisterVariable (&memstats_log);
+	Cmd_AddCommand ("memstats", MemStats_Print_f);
 }
 
@@ -47,13 +47,20 @@ the very bottom of the hunk.
 Cache_??? Cache memory is for objects that can be dynamically loaded and
 can usefully stay persistant between levels.  The size of the cache
 fluctuates from level to level.
-Cache memory is always allocated from the top hunk segment.
+Cache memory is allocated outside the hunk, with a separate memory budget
+for each class of asset.
 
+Arena_??? Arenas hand out scratch memory that is all released at once.
+Frame_??? allocations come from the main thread's arena, which is reset at
+the end of every host frame.
+
+MemStats_??? Memory statistics. Keeps the current size and the per-map high
+water mark of each allocator, and of the memory held by each subsystem no
+matter which allocator it comes from, so the two groups overlap.
 
 
------- Top of Memory -------
 
-cachable memory
+------ Top of Memory -------
 
 <--- low hunk used
 
@@ -95,11 +102,37 @@ void Hunk_FreeToLowMark (int mark);
 
 void Hunk_Check (void);
 
+typedef struct memarena_s
+{
+	struct arenablock_s	*blocks;	// the one being allocated from first
+	size_t			used;		// since the last reset
+	size_t			peak;
+} memarena_t;
+
+void *Arena_Alloc (memarena_t *arena, size_t size); // returns uninitialized memory
+void Arena_Shrink (memarena_t *arena, void *ptr, size_t size); // only for the last allocation
+char *Arena_Strdup (memarena_t *arena, const char *s);
+void Arena_Reset (memarena_t *arena);
+void Arena_Free (memarena_t *arena);
+
+void *Frame_Alloc (size_t size); // main thread, valid until the end of the host frame
+void Frame_Shrink (void *ptr, size_t size);
+char *Frame_Strdup (const char *s);
+qboolean Frame_Available (void);
+void Frame_Reset (void);
+
 typedef struct cache_user_s
 {
 	void	*data;
 } cache_user_t;
 
+typedef enum
+{
+	CACHE_ALIAS,		// mdl models
+	CACHE_MD5,			// md5 models
+	NUM_CACHE_CLASSES
+} cacheclass_t;
+
 void Cache_Flush (void);
 
 void *Cache_Check (cache_user_t *c);
@@ -108,11 +141,45 @@ void *Cache_Check (cache_user_t *c);
 
 void Cache_Free (cache_user_t *c, qboolean freetextures); //johnfitz -- added second argument
 
-void *Cache_Alloc (cache_user_t *c, int size, const char *name);
-// Returns NULL if all purgable data was tossed and there still
-// wasn't enough room.
+void *Cache_Alloc (cache_user_t *c, cacheclass_t cacheclass, int size, const char *name);
+// Evicts the least recently used data of the class if it would go over
+// its budget, then returns the new data
 
 void Cache_Report (void);
 
+void Cache_Lock (void);
+void Cache_Unlock (void);
+// held internally by every call that can free cached data
+
+typedef enum
+{
+// allocators, sampled by MemStats_Update
+	MEM_HUNK,
+	MEM_ZONE,
+	MEM_FRAME,		// frame arena, at the end of the last frame
+// subsystems, reported by their owners
+	MEM_BSP,		// brush models on the hunk
+	MEM_LIGHTMAPS,	// cpu side lightmap data
+	MEM_ALIAS,		// alias and md5 models in the cache
+	MEM_TEXTURES,
+	MEM_GPUBUFFERS,
+	MEM_SOUNDS,
+	MEM_EDICTS,
+	MEM_QCSTRINGS,
+	MEM_NETWORK,
+	NUM_MEMCATS
+} memcat_t;
+
+void MemStats_Set (memcat_t cat, size_t bytes);
+void MemStats_Add (memcat_t cat, ptrdiff_t bytes);
+size_t MemStats_Get (memcat_t cat);
+size_t MemStats_Peak (memcat_t cat);
+const char *MemStats_Name (memcat_t cat);
+void MemStats_Update (void);
+// samples the allocators and updates all the high water marks, once a frame
+void MemStats_EndMap (const char *mapname);
+// appends the high water marks of the map to the csv log if enabled,
+// then starts new ones
+
 #endif	/* __ZZONE_H */
 